@@ -0,0 +1,776 @@
+// End-to-end HTTP load generator for the bank server.
+//
+// Opens keep-alive connections, each with one request in flight, and drives a
+// weighted mix of endpoints against accounts picked uniformly or with Zipfian
+// skew (a few hot accounts get most of the traffic). Closed loop (the
+// default) sends the next request as soon as the previous answer arrives.
+// Open loop (--rate) schedules requests at a fixed total rate and measures
+// latency from the scheduled send time, so a server that stalls shows up as
+// queueing delay instead of quietly lowering the offered load (coordinated
+// omission). Latencies are kept in HdrHistogram-layout histograms with three
+// significant digits.
+//
+// The server can use either storage backend, so the same run compares
+// Postgres with BANK_STORAGE=memory.
+//
+// --hot-payee sends every transfer to one account, like a merchant's
+// settlement account. Run it before and after flagging that account hot
+// (BANK_HOT_ACCOUNTS, or SELECT set_account_stripes(id, n)) to see what
+// striping its credits buys.
+//
+//   ./build/bankbench [--host=127.0.0.1] [--port=8080] [--connections=64]
+//                     [--threads=4] [--duration=10] [--warmup=2] [--rate=0]
+//                     [--accounts=1000] [--zipf=0.99] [--setup=1]
+//                     [--mix=balance:50,deposit:10,withdraw:10,transfer:20,transactions:5,login:5]
+//                     [--hgrm=latency.hgrm] [--hot-payee=0]
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "json_codec.hpp"
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+enum Route
+{
+    balance,
+    deposit,
+    withdraw,
+    transfer,
+    transactions,
+    login,
+    routeCount
+};
+
+const char *const routeNames[routeCount] = {"balance", "deposit", "withdraw", "transfer", "transactions", "login"};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    unsigned connections = 64;
+    unsigned threads = 4;
+    double duration = 10;     // seconds measured
+    double warmup = 2;        // seconds run before measuring
+    double rate = 0;          // total requests/s; 0 = closed loop
+    unsigned accounts = 1000;
+    double zipf = 0.99;       // 0 = uniform
+    bool setup = true;        // register the accounts first
+    std::string mix = "balance:50,deposit:10,withdraw:10,transfer:20,transactions:5,login:5";
+    std::string hgrm;         // write the overall percentile distribution here
+    int hotPayee = 0;         // user id receiving every transfer; 0 = picked like senders
+};
+
+// Log-linear histogram of microseconds, bucketed like HdrHistogram with three
+// significant digits: values below 2048 are exact, and each power of two
+// above that is split into 1024 equal buckets.
+class Histogram
+{
+public:
+    static constexpr int subBits = 11;
+    static constexpr std::uint64_t subCount = 1u << subBits;
+    static constexpr std::uint64_t half = subCount / 2;
+    static constexpr int maxBits = 36; // about 19 hours
+    static constexpr std::size_t bucketCount = subCount + (maxBits - subBits) * half;
+
+    Histogram() : counts(bucketCount) {}
+
+    void record(std::uint64_t value)
+    {
+        value = std::min(value, (std::uint64_t(1) << maxBits) - 1);
+        ++counts[index(value)];
+        ++total;
+        sum += value;
+        max = std::max(max, value);
+    }
+
+    void merge(const Histogram &other)
+    {
+        for (std::size_t i = 0; i < bucketCount; ++i)
+            counts[i] += other.counts[i];
+        total += other.total;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    // Smallest recorded value such that `percentile` percent are at or below it
+    std::uint64_t percentile(double percentile) const
+    {
+        if (total == 0)
+            return 0;
+        const auto target = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * total)));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i)
+        {
+            seen += counts[i];
+            if (seen >= target)
+                return std::min(highest(i), max);
+        }
+        return max;
+    }
+
+    std::uint64_t count() const { return total; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+    std::uint64_t maximum() const { return max; }
+
+    // HdrHistogram's percentile distribution text (.hgrm), values in
+    // milliseconds, for the usual plotting tools
+    void writeDistribution(std::FILE *out) const
+    {
+        std::fprintf(out, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+        const int ticksPerHalfDistance = 5;
+        double p = 0;
+        while (total > 0)
+        {
+            const std::uint64_t v = percentile(p);
+            std::uint64_t below = 0;
+            for (std::size_t i = 0; i <= index(v); ++i)
+                below += counts[i];
+            const double q = p / 100.0;
+            if (q < 1.0)
+                std::fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", v / 1000.0, q, static_cast<unsigned long long>(below), 1.0 / (1.0 - q));
+            if (below >= total || 1.0 / (1.0 - q) > total)
+                break;
+            const double halfDistance = std::pow(2.0, std::floor(std::log2(100.0 / (100.0 - p))) + 1);
+            p += 100.0 / (ticksPerHalfDistance * halfDistance);
+        }
+        std::fprintf(out, "%12.3f %14.12f %10llu %14s\n", max / 1000.0, 1.0, static_cast<unsigned long long>(total), "inf");
+
+        double variance = 0;
+        const double m = mean();
+        for (std::size_t i = 0; i < bucketCount; ++i)
+        {
+            if (counts[i])
+                variance += counts[i] * std::pow(highest(i) - m, 2);
+        }
+        const double stddev = total ? std::sqrt(variance / total) : 0.0;
+        std::fprintf(out, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", m / 1000.0, stddev / 1000.0);
+        std::fprintf(out, "#[Max     = %12.3f, Total count    = %12llu]\n", max / 1000.0, static_cast<unsigned long long>(total));
+        std::fprintf(out, "#[Buckets = %12d, SubBuckets     = %12llu]\n", maxBits - subBits + 1, static_cast<unsigned long long>(subCount));
+    }
+
+private:
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < subCount)
+            return static_cast<std::size_t>(value);
+        const int msb = 63 - __builtin_clzll(value);
+        const int shift = msb - (subBits - 1); // value >> shift is in [half, subCount)
+        return static_cast<std::size_t>(subCount + (shift - 1) * half + ((value >> shift) - half));
+    }
+
+    // Largest value that lands in bucket i
+    static std::uint64_t highest(std::size_t i)
+    {
+        if (i < subCount)
+            return i;
+        const std::size_t shift = (i - subCount) / half + 1;
+        const std::uint64_t sub = (i - subCount) % half + half;
+        return ((sub + 1) << shift) - 1;
+    }
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total = 0;
+    std::uint64_t sum = 0;
+    std::uint64_t max = 0;
+};
+
+// Zipf-distributed ranks in [0, n), rank 0 the most popular (Gray et al.,
+// "Quickly generating billion-record synthetic databases", as used by YCSB).
+// theta in (0, 1); 0 gives a uniform distribution.
+class Zipf
+{
+public:
+    Zipf(std::uint64_t n, double theta) : n(n), theta(theta)
+    {
+        if (theta <= 0)
+            return;
+        for (std::uint64_t i = 1; i <= n; ++i)
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        const double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    std::uint64_t operator()(std::mt19937_64 &rng) const
+    {
+        const double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+        if (theta <= 0)
+            return std::min<std::uint64_t>(n - 1, static_cast<std::uint64_t>(u * n));
+        const double uz = u * zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + std::pow(0.5, theta))
+            return std::min<std::uint64_t>(1, n - 1);
+        return std::min<std::uint64_t>(n - 1, static_cast<std::uint64_t>(n * std::pow(eta * u - eta + 1.0, alpha)));
+    }
+
+private:
+    std::uint64_t n;
+    double theta;
+    double zetan = 0;
+    double alpha = 0;
+    double eta = 0;
+};
+
+struct RouteStats
+{
+    Histogram latency;        // every response, whatever its status
+    std::uint64_t failed = 0; // non-2xx (e.g. insufficient funds)
+    std::uint64_t errors = 0; // connection errors and timeouts
+};
+
+using ThreadStats = std::array<RouteStats, routeCount>;
+
+// Set on each I/O thread so completion handlers record without locking
+thread_local ThreadStats *localStats = nullptr;
+
+struct Run
+{
+    Options opt;
+    std::vector<int> ids;            // account index -> user id
+    std::vector<Route> mixTable;     // 100 slots filled by weight
+    Zipf accounts{1, 0};
+    tcp::resolver::results_type endpoints;
+    Clock::time_point measureFrom;
+    Clock::time_point measureUntil;
+    std::atomic<bool> stopping{false};
+    std::atomic<int> active{0};
+};
+
+std::string accountName(std::size_t index)
+{
+    return "bench-" + std::to_string(index);
+}
+
+// Fill `req` with one request for `route`
+void buildRequest(http::request<http::string_body> &req, Route route, Run &run, std::mt19937_64 &rng)
+{
+    const std::size_t a = run.accounts(rng);
+    const int userId = run.ids[a];
+    req = {};
+    req.version(11);
+    req.set(http::field::host, run.opt.host);
+    req.keep_alive(true);
+
+    std::string body;
+    codec::Writer w(body);
+    switch (route)
+    {
+    case balance:
+        req.method(http::verb::get);
+        req.target("/balance?userId=" + std::to_string(userId));
+        break;
+    case deposit:
+        req.method(http::verb::post);
+        req.target("/deposit");
+        w.beginObject().key("userId").value(userId).key("amount").value(10.0).endObject();
+        break;
+    case withdraw:
+        req.method(http::verb::post);
+        req.target("/withdraw");
+        w.beginObject().key("userId").value(userId).key("amount").value(1.0).endObject();
+        break;
+    case transfer:
+    {
+        std::size_t b = run.accounts(rng);
+        for (int tries = 0; b == a && tries < 8; ++tries)
+            b = run.accounts(rng);
+        if (b == a)
+            b = (a + 1) % run.ids.size();
+        int senderId = userId;
+        int receiverId = run.ids[b];
+        if (run.opt.hotPayee > 0)
+        {
+            receiverId = run.opt.hotPayee;
+            if (senderId == receiverId)
+                senderId = run.ids[b];
+        }
+        req.method(http::verb::post);
+        req.target("/transfer");
+        w.beginObject().key("senderId").value(senderId).key("receiverId").value(receiverId).key("amount").value(1.0).endObject();
+        break;
+    }
+    case transactions:
+        req.method(http::verb::get);
+        req.target("/transactions?userId=" + std::to_string(userId) + "&limit=20");
+        break;
+    case login:
+        req.method(http::verb::post);
+        req.target("/login");
+        w.beginObject().key("name").value(accountName(a)).key("password").value("bench").endObject();
+        break;
+    default:
+        break;
+    }
+    if (!body.empty())
+    {
+        req.set(http::field::content_type, "application/json");
+        req.body() = std::move(body);
+    }
+    req.prepare_payload();
+}
+
+// One keep-alive connection with a single request in flight
+class Connection : public std::enable_shared_from_this<Connection>
+{
+public:
+    Connection(net::io_context &ioc, Run &run, Clock::duration interval, Clock::time_point first, std::uint64_t seed)
+        : stream_(net::make_strand(ioc)), timer_(stream_.get_executor()), run_(run), interval_(interval),
+          next_(first), rng_(seed)
+    {
+    }
+
+    void start()
+    {
+        ++run_.active;
+        connect();
+    }
+
+private:
+    void connect()
+    {
+        stream_.expires_after(std::chrono::seconds(5));
+        stream_.async_connect(run_.endpoints, beast::bind_front_handler(&Connection::onConnect, shared_from_this()));
+    }
+
+    void onConnect(beast::error_code ec, const tcp::endpoint &)
+    {
+        if (ec)
+            return fail();
+        schedule();
+    }
+
+    void schedule()
+    {
+        if (run_.stopping.load(std::memory_order_relaxed))
+            return finish();
+
+        if (interval_.count() > 0)
+        {
+            // Open loop: each request has a fixed slot, whether or not the
+            // previous one has come back yet
+            intended_ = next_;
+            next_ += interval_;
+            if (intended_ > Clock::now())
+            {
+                timer_.expires_at(intended_);
+                timer_.async_wait(beast::bind_front_handler(&Connection::onTimer, shared_from_this()));
+                return;
+            }
+        }
+        else
+        {
+            intended_ = Clock::now();
+        }
+        send();
+    }
+
+    void onTimer(beast::error_code ec)
+    {
+        if (ec)
+            return finish();
+        send();
+    }
+
+    void send()
+    {
+        route_ = run_.mixTable[std::uniform_int_distribution<std::size_t>(0, run_.mixTable.size() - 1)(rng_)];
+        buildRequest(req_, route_, run_, rng_);
+        stream_.expires_after(std::chrono::seconds(30));
+        http::async_write(stream_, req_, beast::bind_front_handler(&Connection::onWrite, shared_from_this()));
+    }
+
+    void onWrite(beast::error_code ec, std::size_t)
+    {
+        if (ec)
+            return fail();
+        res_ = {};
+        http::async_read(stream_, buffer_, res_, beast::bind_front_handler(&Connection::onRead, shared_from_this()));
+    }
+
+    void onRead(beast::error_code ec, std::size_t)
+    {
+        if (ec)
+            return fail();
+
+        if (measuring())
+        {
+            RouteStats &stats = (*localStats)[route_];
+            const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - intended_).count();
+            stats.latency.record(static_cast<std::uint64_t>(std::max<std::int64_t>(0, micros)));
+            if (res_.result_int() / 100 != 2)
+                ++stats.failed;
+        }
+
+        if (!res_.keep_alive())
+        {
+            close();
+            buffer_.clear();
+            return connect();
+        }
+        schedule();
+    }
+
+    bool measuring() const
+    {
+        return intended_ >= run_.measureFrom && intended_ < run_.measureUntil;
+    }
+
+    // Count the error, then reconnect after a short pause
+    void fail()
+    {
+        if (measuring())
+            ++(*localStats)[route_].errors;
+        close();
+        if (run_.stopping.load(std::memory_order_relaxed))
+            return finish();
+        buffer_.clear();
+        timer_.expires_after(std::chrono::milliseconds(100));
+        timer_.async_wait([self = shared_from_this()](beast::error_code ec)
+                          {
+                              if (ec)
+                                  return self->finish();
+                              self->connect();
+                          });
+    }
+
+    void close()
+    {
+        beast::error_code ec;
+        stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream_.close();
+    }
+
+    void finish()
+    {
+        close();
+        --run_.active;
+    }
+
+    beast::tcp_stream stream_;
+    net::steady_timer timer_;
+    beast::flat_buffer buffer_;
+    http::request<http::string_body> req_;
+    http::response<http::string_body> res_;
+    Run &run_;
+    Clock::duration interval_;
+    Clock::time_point next_;
+    Clock::time_point intended_;
+    Route route_ = balance;
+    std::mt19937_64 rng_;
+};
+
+Options parseOptions(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::invalid_argument("expected --name=value, got " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+
+        if (name == "host")
+            opt.host = value;
+        else if (name == "port")
+            opt.port = value;
+        else if (name == "connections")
+            opt.connections = static_cast<unsigned>(std::stoul(value));
+        else if (name == "threads")
+            opt.threads = static_cast<unsigned>(std::stoul(value));
+        else if (name == "duration")
+            opt.duration = std::stod(value);
+        else if (name == "warmup")
+            opt.warmup = std::stod(value);
+        else if (name == "rate")
+            opt.rate = std::stod(value);
+        else if (name == "accounts")
+            opt.accounts = static_cast<unsigned>(std::stoul(value));
+        else if (name == "zipf")
+            opt.zipf = std::stod(value);
+        else if (name == "setup")
+            opt.setup = value != "0";
+        else if (name == "mix")
+            opt.mix = value;
+        else if (name == "hgrm")
+            opt.hgrm = value;
+        else if (name == "hot-payee")
+            opt.hotPayee = std::stoi(value);
+        else
+            throw std::invalid_argument("unknown option --" + name);
+    }
+    if (opt.connections == 0 || opt.threads == 0 || opt.accounts < 2 || opt.duration <= 0)
+        throw std::invalid_argument("connections, threads and duration must be positive, accounts at least 2");
+    if (opt.zipf < 0 || opt.zipf >= 1)
+        throw std::invalid_argument("--zipf must be in [0, 1)");
+    return opt;
+}
+
+// "balance:50,deposit:10" -> a 100-slot table to draw routes from
+std::vector<Route> parseMix(const std::string &mix)
+{
+    std::vector<std::pair<Route, double>> weights;
+    double total = 0;
+    std::size_t pos = 0;
+    while (pos < mix.size())
+    {
+        std::size_t end = mix.find(',', pos);
+        if (end == std::string::npos)
+            end = mix.size();
+        const std::string item = mix.substr(pos, end - pos);
+        const auto colon = item.find(':');
+        const std::string name = item.substr(0, colon);
+        const double weight = colon == std::string::npos ? 1.0 : std::stod(item.substr(colon + 1));
+        const auto *found = std::find_if(std::begin(routeNames), std::end(routeNames),
+                                         [&](const char *n)
+                                         { return name == n; });
+        if (found == std::end(routeNames) || weight < 0)
+            throw std::invalid_argument("bad --mix entry '" + item + "'");
+        weights.emplace_back(static_cast<Route>(found - std::begin(routeNames)), weight);
+        total += weight;
+        pos = end + 1;
+    }
+    if (total <= 0)
+        throw std::invalid_argument("--mix has no positive weights");
+
+    std::vector<Route> table;
+    for (const auto &[route, weight] : weights)
+        table.insert(table.end(), static_cast<std::size_t>(std::lround(weight / total * 100)), route);
+    if (table.empty())
+        table.push_back(weights.front().first);
+    return table;
+}
+
+// Register `bench-<i>` accounts and learn their ids through /login. Done with
+// blocking clients before the measured run starts.
+std::vector<int> setupAccounts(const Run &run)
+{
+    std::vector<int> ids(run.opt.accounts, 0);
+    std::atomic<std::size_t> nextIndex{0};
+    std::atomic<bool> failed{false};
+    std::string error;
+    std::mutex errorMutex;
+
+    auto worker = [&]
+    {
+        try
+        {
+            net::io_context ioc;
+            beast::tcp_stream stream(ioc);
+            stream.connect(run.endpoints);
+            beast::flat_buffer buffer;
+
+            auto post = [&](const char *target, const std::string &body)
+            {
+                http::request<http::string_body> req{http::verb::post, target, 11};
+                req.set(http::field::host, run.opt.host);
+                req.set(http::field::content_type, "application/json");
+                req.body() = body;
+                req.prepare_payload();
+                http::write(stream, req);
+                http::response<http::string_body> res;
+                http::read(stream, buffer, res);
+                return res;
+            };
+
+            for (std::size_t i; (i = nextIndex++) < ids.size() && !failed;)
+            {
+                std::string body;
+                codec::Writer(body).beginObject().key("name").value(accountName(i)).key("password").value("bench").key("initialBalance").value(1000000.0).endObject();
+                auto res = post("/register", body);
+                if (res.result_int() / 100 != 2)
+                    throw std::runtime_error("/register returned " + std::to_string(res.result_int()));
+
+                body.clear();
+                codec::Writer(body).beginObject().key("name").value(accountName(i)).key("password").value("bench").endObject();
+                res = post("/login", body);
+                if (res.result_int() / 100 != 2)
+                    throw std::runtime_error("/login returned " + std::to_string(res.result_int()));
+                int userId = 0;
+                codec::parseObject(res.body(), {{"userId", userId}});
+                ids[i] = userId;
+            }
+        }
+        catch (const std::exception &e)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            failed = true;
+            error = e.what();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < std::min(16u, run.opt.connections); ++t)
+        workers.emplace_back(worker);
+    for (auto &t : workers)
+        t.join();
+    if (failed)
+        throw std::runtime_error("account setup failed: " + error);
+    return ids;
+}
+
+void printRow(const char *name, const Histogram &h, std::uint64_t failed, std::uint64_t errors, double seconds)
+{
+    std::printf("%-13s %9llu %10.1f %8llu %7llu %9llu %9llu %9llu %9llu %9llu\n", name,
+                static_cast<unsigned long long>(h.count()), h.count() / seconds,
+                static_cast<unsigned long long>(failed), static_cast<unsigned long long>(errors),
+                static_cast<unsigned long long>(h.percentile(50)), static_cast<unsigned long long>(h.percentile(90)),
+                static_cast<unsigned long long>(h.percentile(99)), static_cast<unsigned long long>(h.percentile(99.9)),
+                static_cast<unsigned long long>(h.maximum()));
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Run run;
+    try
+    {
+        run.opt = parseOptions(argc, argv);
+        run.mixTable = parseMix(run.opt.mix);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "bankbench: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    const Options &opt = run.opt;
+
+    try
+    {
+        net::io_context resolverContext;
+        run.endpoints = tcp::resolver(resolverContext).resolve(opt.host, opt.port);
+
+        if (opt.setup)
+        {
+            const auto started = Clock::now();
+            run.ids = setupAccounts(run);
+            std::printf("setup: %u accounts in %.1f s\n", opt.accounts,
+                        std::chrono::duration<double>(Clock::now() - started).count());
+        }
+        else
+        {
+            for (unsigned i = 0; i < opt.accounts; ++i)
+                run.ids.push_back(static_cast<int>(i + 1));
+        }
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "bankbench: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    run.accounts = Zipf(opt.accounts, opt.zipf);
+
+    std::printf("bankbench %s:%s  %s  %u connections  %u threads  %.0f s (+%.0f s warmup)\n", opt.host.c_str(),
+                opt.port.c_str(), opt.rate > 0 ? "open loop" : "closed loop", opt.connections, opt.threads,
+                opt.duration, opt.warmup);
+    if (opt.rate > 0)
+        std::printf("rate %.0f req/s  ", opt.rate);
+    std::printf("accounts %u  zipf %.2f  mix %s", opt.accounts, opt.zipf, opt.mix.c_str());
+    if (opt.hotPayee > 0)
+        std::printf("  hot payee %d", opt.hotPayee);
+    std::printf("\n\n");
+
+    net::io_context ioc{static_cast<int>(opt.threads)};
+    const auto start = Clock::now() + std::chrono::milliseconds(100);
+    const auto toDuration = [](double seconds)
+    { return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)); };
+    run.measureFrom = start + toDuration(opt.warmup);
+    run.measureUntil = run.measureFrom + toDuration(opt.duration);
+
+    // Open loop: each connection carries rate/connections, offset so sends
+    // are spread evenly instead of arriving in bursts
+    const Clock::duration interval = opt.rate > 0 ? toDuration(opt.connections / opt.rate) : Clock::duration::zero();
+    for (unsigned i = 0; i < opt.connections; ++i)
+    {
+        const auto first = start + (opt.rate > 0 ? toDuration(i / opt.rate) : Clock::duration::zero());
+        std::make_shared<Connection>(ioc, run, interval, first, 0x9E3779B97F4A7C15ull * (i + 1))->start();
+    }
+
+    std::vector<std::unique_ptr<ThreadStats>> stats;
+    for (unsigned t = 0; t < opt.threads; ++t)
+        stats.push_back(std::make_unique<ThreadStats>());
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < opt.threads; ++t)
+    {
+        threads.emplace_back([&ioc, s = stats[t].get()]
+                             {
+                                 localStats = s;
+                                 ioc.run();
+                             });
+    }
+
+    std::this_thread::sleep_until(run.measureUntil);
+    run.stopping = true;
+    // Let in-flight requests finish, but don't wait on a stuck server forever
+    const auto grace = Clock::now() + std::chrono::seconds(5);
+    while (run.active.load() > 0 && Clock::now() < grace)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ioc.stop();
+    for (auto &t : threads)
+        t.join();
+
+    std::printf("%-13s %9s %10s %8s %7s %9s %9s %9s %9s %9s\n", "route", "count", "req/s", "failed", "errors",
+                "p50(us)", "p90", "p99", "p99.9", "max");
+    Histogram all;
+    std::uint64_t failed = 0, errors = 0;
+    for (int r = 0; r < routeCount; ++r)
+    {
+        RouteStats merged;
+        for (const auto &s : stats)
+        {
+            const RouteStats &part = (*s)[r];
+            merged.latency.merge(part.latency);
+            merged.failed += part.failed;
+            merged.errors += part.errors;
+        }
+        if (merged.latency.count() == 0 && merged.errors == 0)
+            continue;
+        printRow(routeNames[r], merged.latency, merged.failed, merged.errors, opt.duration);
+        all.merge(merged.latency);
+        failed += merged.failed;
+        errors += merged.errors;
+    }
+    printRow("all", all, failed, errors, opt.duration);
+
+    if (!opt.hgrm.empty())
+    {
+        if (std::FILE *out = std::fopen(opt.hgrm.c_str(), "w"))
+        {
+            all.writeDistribution(out);
+            std::fclose(out);
+        }
+        else
+        {
+            std::fprintf(stderr, "bankbench: cannot write %s\n", opt.hgrm.c_str());
+        }
+    }
+    return errors > 0 && all.count() == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
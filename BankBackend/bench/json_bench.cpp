@@ -0,0 +1,125 @@
+// Microbenchmark: nlohmann::json DOM vs the codec:: pull parser / writer on
+// the payloads the API actually handles.
+//
+//   ./build/json_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <nlohmann/json.hpp>
+#include "json_codec.hpp"
+
+using json = nlohmann::json;
+
+namespace
+{
+
+volatile double sink = 0;
+
+template <typename Fn>
+double nsPerOp(std::size_t iterations, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        fn();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+void report(const char *name, double dom, double codec)
+{
+    std::printf("%-28s nlohmann %9.1f ns   codec %9.1f ns   (%.1fx)\n", name, dom, codec, dom / codec);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+    const std::string depositBody = R"({"userId": 42, "amount": 100.5})";
+    const std::string transferBody = R"({"senderId": 42, "receiverId": 7, "amount": 250})";
+    const std::string registerBody = R"({"name": "TestUser", "password": "abc123", "initialBalance": 1000})";
+
+    std::vector<Transaction> history;
+    for (int i = 0; i < 100; ++i)
+        history.emplace_back(i + 1, 42, 10.25 * i, i % 2 ? "deposit" : "withdrawal", "2025-04-01 12:34:56.789012");
+
+    // Request parsing
+    report("parse /deposit",
+           nsPerOp(iterations, [&]
+                   {
+                       json body = json::parse(depositBody);
+                       sink = sink + body.at("userId").get<int>() + body.at("amount").get<double>(); }),
+           nsPerOp(iterations, [&]
+                   {
+                       int userId;
+                       double amount;
+                       codec::parseObject(depositBody, {{"userId", userId}, {"amount", amount}});
+                       sink = sink + userId + amount; }));
+
+    report("parse /transfer",
+           nsPerOp(iterations, [&]
+                   {
+                       json body = json::parse(transferBody);
+                       sink = sink + body.at("senderId").get<int>() + body.at("receiverId").get<int>() +
+                              body.at("amount").get<double>(); }),
+           nsPerOp(iterations, [&]
+                   {
+                       int senderId, receiverId;
+                       double amount;
+                       codec::parseObject(transferBody,
+                                          {{"senderId", senderId}, {"receiverId", receiverId}, {"amount", amount}});
+                       sink = sink + senderId + receiverId + amount; }));
+
+    report("parse /register",
+           nsPerOp(iterations, [&]
+                   {
+                       json body = json::parse(registerBody);
+                       std::string name = body.at("name").get<std::string>();
+                       std::string password = body.at("password").get<std::string>();
+                       sink = sink + name.size() + password.size() + body.value("initialBalance", 0.0); }),
+           nsPerOp(iterations, [&]
+                   {
+                       std::string name, password;
+                       double balance = 0.0;
+                       codec::parseObject(registerBody,
+                                          {{"name", name}, {"password", password}, {"initialBalance", balance, false}});
+                       sink = sink + name.size() + password.size() + balance; }));
+
+    // Response building
+    report("status response",
+           nsPerOp(iterations, [&]
+                   {
+                       json resBody;
+                       resBody["status"] = "success";
+                       resBody["message"] = "Deposit successful";
+                       sink = sink + resBody.dump().size(); }),
+           nsPerOp(iterations, [&]
+                   { sink = sink + codec::statusBody(true, "Deposit successful").size(); }));
+
+    const std::size_t arrayIterations = iterations / 100 + 1;
+    report("100 transactions",
+           nsPerOp(arrayIterations, [&]
+                   {
+                       json jsonArray = json::array();
+                       for (const auto &tx : history)
+                           jsonArray.push_back({{"id", tx.id},
+                                                {"userId", tx.user_id},
+                                                {"amount", tx.amount},
+                                                {"type", tx.type},
+                                                {"timestamp", tx.timestamp}});
+                       sink = sink + jsonArray.dump().size(); }),
+           nsPerOp(arrayIterations, [&]
+                   {
+                       std::string out;
+                       codec::Writer w(out);
+                       w.beginArray();
+                       for (const auto &tx : history)
+                           codec::writeTransaction(w, tx);
+                       w.endArray();
+                       sink = sink + out.size(); }));
+    return 0;
+}
@@ -0,0 +1,114 @@
+// Microbenchmark: cost of choosing an endpoint for a request.
+//
+// Compares the old substring-scan chain used by handle_request with Router
+// (perfect-hash lookup + zero-copy query parsing). Both sides pull userId out
+// of the query string so the numbers reflect a full dispatch.
+//
+//   ./build/router_bench [iterations]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "routes/router.hpp"
+
+namespace
+{
+
+volatile int sink = 0;
+
+void noop(RequestContext &ctx, Response &, ChunkSource &)
+{
+    int userId = 0;
+    ctx.query.getInt("userId", userId);
+    sink = sink + userId;
+}
+
+// The pre-router lookup: a chain of substring scans plus a copying query parse
+std::string legacyQueryParam(const std::string &query, const std::string &key)
+{
+    std::size_t keyPos = query.find(key + "=");
+    if (keyPos == std::string::npos)
+        return "";
+    std::size_t valueStart = keyPos + key.length() + 1;
+    std::size_t valueEnd = query.find("&", valueStart);
+    if (valueEnd == std::string::npos)
+        valueEnd = query.length();
+    return query.substr(valueStart, valueEnd - valueStart);
+}
+
+int legacyDispatch(const Request &req)
+{
+    std::string target(req.target());
+    const char *names[] = {"/balance", "/deposit", "/withdraw", "/transfer",
+                           "/transactions", "/register", "/login", "/createUser"};
+    for (int i = 0; i < 8; ++i)
+    {
+        if (target.find(names[i]) != std::string::npos)
+        {
+            std::size_t q = target.find("?");
+            if (q != std::string::npos)
+                sink = sink + std::atoi(legacyQueryParam(target.substr(q + 1), "userId").c_str());
+            return i;
+        }
+    }
+    return -1;
+}
+
+template <typename Fn>
+double nsPerOp(std::size_t iterations, Fn &&fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < iterations; ++i)
+        fn(i);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    std::size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000000;
+
+    Router router;
+    router.add(http::verb::get, "/balance", noop);
+    router.add(http::verb::post, "/deposit", noop);
+    router.add(http::verb::post, "/withdraw", noop);
+    router.add(http::verb::post, "/transfer", noop);
+    router.add(http::verb::get, "/transactions", noop);
+    router.add(http::verb::post, "/register", noop);
+    router.add(http::verb::post, "/login", noop);
+    router.add(http::verb::post, "/createUser", noop);
+    router.seal();
+
+    // Typical mix: mostly balance checks, some history and money movement
+    std::vector<Request> requests;
+    auto add = [&](http::verb method, const char *target)
+    {
+        Request req{method, target, 11};
+        requests.push_back(std::move(req));
+    };
+    add(http::verb::get, "/balance?userId=42");
+    add(http::verb::get, "/balance?userId=7");
+    add(http::verb::get, "/transactions?userId=42&limit=50&after=1000");
+    add(http::verb::post, "/deposit");
+    add(http::verb::post, "/transfer");
+    add(http::verb::post, "/login");
+    add(http::verb::get, "/balance?userId=1001");
+    add(http::verb::post, "/createUser");
+
+    Response res;
+    ChunkSource stream;
+
+    double legacy = nsPerOp(iterations, [&](std::size_t i)
+                            { sink = sink + legacyDispatch(requests[i % requests.size()]); });
+    double routed = nsPerOp(iterations, [&](std::size_t i)
+                            { router.dispatch(requests[i % requests.size()], res, stream); });
+
+    std::printf("iterations:        %zu\n", iterations);
+    std::printf("substring chain:   %.1f ns/request\n", legacy);
+    std::printf("router dispatch:   %.1f ns/request\n", routed);
+    return 0;
+}
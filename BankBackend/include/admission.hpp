@@ -0,0 +1,156 @@
+#ifndef ADMISSION_HPP
+#define ADMISSION_HPP
+
+#include <boost/beast/http.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "config.hpp"
+#include "routes/handlers.hpp"
+
+// Admission control, applied to every request before it reaches a handler.
+// Under overload the server refuses work it can't finish in time, cheaply
+// and early, so the requests it does take keep their latency:
+//   - token buckets per client address and per account answer 429
+//   - at most AdmissionConfig::maxInFlight requests are in the handlers at
+//     once (by default one per pooled DB connection); the rest wait in a
+//     bounded FIFO and get 503 if no slot frees up within the queue deadline
+//   - a streamed response counts against AdmissionConfig::maxStreams until
+//     its last chunk is sent, and one that only serializes gives its slot
+//     back when the handler returns, so slow readers of long bodies can't
+//     hold every slot; one still reading the database keeps its slot until
+//     its last chunk is produced; a stream over the limit gets 503 straight
+//     away
+// Rejections carry Retry-After.
+namespace admission {
+
+using Clock = std::chrono::steady_clock;
+
+// Token buckets for many keys in a fixed table, one 64-bit word per bucket
+// (refill time and tokens) updated with compare-and-swap: no locks and no
+// allocation per key. Keys hash onto the table, so two keys can share a
+// bucket; the table is large enough that this is rare, and a shared bucket
+// only ever limits harder, never lets more through.
+class TokenBuckets {
+public:
+    // `rate` tokens per second, up to `burst` saved up
+    TokenBuckets(unsigned rate, unsigned burst, std::size_t slots = 1 << 16);
+
+    // Take a token for `key`. When there is none, `retryAfter` is how long
+    // until there will be.
+    bool take(std::uint64_t key, std::chrono::milliseconds &retryAfter);
+
+private:
+    std::uint64_t rate;     // millitokens per millisecond (= tokens per second)
+    std::uint64_t capacity; // millitokens
+    std::unique_ptr<std::atomic<std::uint64_t>[]> buckets;
+    std::size_t mask;
+    Clock::time_point epoch;
+};
+
+enum class Outcome {
+    bypass,       // not subject to admission (/metrics); no slot taken
+    admitted,     // run it now; call Controller::leave() once its response is ready
+    wait,         // no free slot: call Controller::wait()
+    queued,       // the callback passed to wait() decides later
+    overloaded,   // 503: no slot and the wait queue is full
+    rateLimited,  // 429: the client or the account is over its rate
+};
+
+struct Stats {
+    std::size_t inFlight;
+    std::size_t queued;
+    std::size_t streams;         // streamed responses being sent
+    std::uint64_t admitted;
+    std::uint64_t shedOverload;  // queue full
+    std::uint64_t shedDeadline;  // waited past the queue deadline
+    std::uint64_t shedStreams;   // streams refused at the stream limit
+    std::uint64_t limitedClient;
+    std::uint64_t limitedAccount;
+};
+
+class Controller {
+public:
+    // Called once a queued request's fate is known: true to run it (it then
+    // holds a slot), false if it missed the deadline. Runs on whichever
+    // thread decided, so it should only hand off to the request's own.
+    using Callback = std::function<void(bool admitted)>;
+
+    static Controller &instance();
+
+    // cfg.maxInFlight of 0 means no concurrency limit
+    void start(const AdmissionConfig &cfg);
+    void stop();
+
+    // Rate limits, then a free slot if there is one: bypass, admitted,
+    // rateLimited or wait. `client` identifies the peer (see clientKey); the
+    // account is taken from the request's token, query or body. On a
+    // rejection `retryAfter` says when to come back. Takes no lock and
+    // allocates nothing.
+    Outcome enter(std::uint64_t client, const Request &req,
+                  std::chrono::seconds &retryAfter);
+
+    // After enter() said wait: admitted, queued (`onDecision` runs later)
+    // or overloaded
+    Outcome wait(Callback onDecision, std::chrono::seconds &retryAfter);
+
+    // Give back the slot of an admitted request
+    void leave();
+
+    // Take a stream slot for an admitted request whose handler returned a
+    // streamed body, before it gives its request slot back (or, for one
+    // still reading the database, keeps it): false at the stream limit. leaveStream() once the last chunk is sent.
+    bool enterStream();
+    void leaveStream();
+
+    Stats stats() const;
+
+private:
+    struct Waiter {
+        Clock::time_point deadline;
+        Callback decide;
+    };
+
+    Controller() = default;
+    ~Controller();
+
+    bool tryAcquire(); // a slot, ignoring the queue
+    void expire(std::vector<Callback> &shed); // pop waiters past their deadline; needs `mutex`
+    void sweep();
+
+    AdmissionConfig cfg;
+    std::size_t streamLimit = 0; // 0 = none
+    std::unique_ptr<TokenBuckets> clientBuckets;
+    std::unique_ptr<TokenBuckets> accountBuckets;
+
+    std::atomic<std::size_t> inFlight{0};
+    std::atomic<std::size_t> waiting{0}; // waiters.size(), readable without the lock
+    std::atomic<std::size_t> streams{0};
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<Waiter> waiters;
+    bool running = false;
+    std::thread sweeper; // sheds waiters whose deadline passes while no slot frees up
+
+    std::atomic<std::uint64_t> admittedCount{0};
+    std::atomic<std::uint64_t> shedOverloadCount{0};
+    std::atomic<std::uint64_t> shedDeadlineCount{0};
+    std::atomic<std::uint64_t> shedStreamsCount{0};
+    std::atomic<std::uint64_t> limitedClientCount{0};
+    std::atomic<std::uint64_t> limitedAccountCount{0};
+};
+
+// Rate-limit key for a peer address (raw IPv4 or IPv6 bytes)
+std::uint64_t clientKey(const unsigned char *address, std::size_t size);
+
+} // namespace admission
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+
+// Per-connection request memory, and the allocation counts that show how
+// much of a request still goes to the heap.
+//
+// Each Session owns an Arena. The parsed request and the response being
+// built (headers and bodies both, see Request/Response in handlers.hpp) come
+// out of it by bumping an offset, and nothing is freed one by one: the arena
+// is rewound whenever the connection has no response queued. A request that doesn't
+// fit spills into separate heap blocks, and the next rewind grows the
+// arena's own block to cover it (up to ServerConfig::arenaRetain), so a
+// connection repeating similar requests stops touching the heap for them.
+namespace arena {
+
+// Heap allocations (operator new) made by the calling thread so far. The
+// server replaces the global operator new to keep this count.
+std::uint64_t heapAllocations();
+
+// Adds the heap allocations the calling thread makes while it is alive to
+// `total`; a request is charged for each section of work done on its behalf
+class Tally {
+public:
+    explicit Tally(std::uint64_t &total) : total(total), start(heapAllocations()) {}
+    ~Tally() { total += heapAllocations() - start; }
+    Tally(const Tally &) = delete;
+    Tally &operator=(const Tally &) = delete;
+
+private:
+    std::uint64_t &total;
+    std::uint64_t start;
+};
+
+// Not thread-safe: used from its session's strand only
+class Arena : public std::pmr::memory_resource {
+public:
+    // `initial` bytes up front; a rewind grows the block to at most `retain`
+    Arena(std::size_t initial, std::size_t retain);
+    ~Arena() override;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // Forget everything allocated since the last rewind. Only once nothing
+    // allocated from the arena is still in use.
+    void rewind();
+
+    std::size_t capacity() const { return size; }
+
+private:
+    struct Spill {
+        Spill *next;
+        std::size_t bytes;     // including this header
+        std::size_t alignment;
+    };
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void *, std::size_t, std::size_t) override {} // all at once, by rewind()
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+
+    void releaseSpills();
+
+    std::size_t retain;
+    std::size_t size;
+    std::unique_ptr<std::byte[]> block;
+    std::size_t offset = 0;
+    Spill *spills = nullptr;
+    std::size_t spilled = 0; // bytes asked of spill blocks since the last rewind
+};
+
+} // namespace arena
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef ASYNC_DB_HPP
+#define ASYNC_DB_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <libpq-fe.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+#include "../src/models/transaction.hpp"
+#include "config.hpp"
+#include "storage.hpp"
+#include "trace.hpp"
+
+// Non-blocking counterpart of DB for the request hot path. A few libpq
+// connections are put in nonblocking mode and their sockets are watched by
+// the server's io_context, so a request waiting on Postgres holds no thread:
+// the I/O threads keep serving other connections and the completion runs
+// when the result arrives. Queries queue (FIFO) while every connection is
+// busy. Semantics match DB: the same prepared statements, balance cache,
+// group commit and retries on serialization failures and deadlocks.
+//
+// With DbConfig::replicas set, each replica gets its own set of connections
+// too, and balance and history reads go wherever ReplicaRouter sends them
+// (see replicas.hpp), falling back to the primary as DB does.
+class AsyncDB {
+public:
+    using BalanceCallback = std::function<void(double balance)>;  // -1 for an unknown user
+    using DoneCallback = std::function<void(WriteResult result)>;
+    using TransactionsCallback = std::function<void(std::optional<std::vector<Transaction>>)>;  // nullopt if the read failed
+
+    static AsyncDB &instance();
+
+    // Start opening cfg.asyncConnections connections on `ioc` (that many per
+    // endpoint). Queries submitted before they are up wait for the first one.
+    void start(boost::asio::io_context &ioc, const DbConfig &cfg);
+
+    // Close every connection. Call once `ioc` has stopped running; queries
+    // still in flight are dropped without their callback.
+    void stop();
+
+    bool running() const { return started.load(std::memory_order_acquire); }
+
+    // Callbacks run on an I/O thread (or the group-commit thread), possibly
+    // before the call returns, and must not block
+    void getBalance(int userId, BalanceCallback done);
+    void deposit(int userId, double amount, DoneCallback done);
+    void withdraw(int userId, double amount, DoneCallback done);
+    void transfer(int senderId, int receiverId, double amount, DoneCallback done);
+    void getTransactions(int userId, const HistoryCursor &after, int limit, TransactionsCallback done);
+
+    // The balance as the primary has it now, past the cache and replicas,
+    // for a change this instance only heard about: -1 for an unknown user,
+    // nullopt if the query failed
+    void readBalance(int userId, std::function<void(std::optional<double> balance)> done);
+
+    struct Stats {
+        std::size_t connections; // open and prepared, replicas included
+        std::size_t queued;      // waiting for a connection
+    };
+    Stats stats();
+
+private:
+    // The query's result, or nullptr if it failed. The result is freed when
+    // the callback returns.
+    using ResultCallback = std::function<void(const PGresult *)>;
+
+    struct Query {
+        const char *statement = nullptr;
+        std::vector<std::string> params; // text format
+        ResultCallback done;
+        std::size_t route = 0;           // metrics route of the request that asked
+        int attempt = 1;
+        trace::Context trace = trace::current(); // the asking request, if traced
+        trace::Clock::time_point submitted{};    // set for traced queries only
+    };
+
+    // Called with a replica's result; false has the primary answer instead
+    using ReplicaCallback = std::function<bool(const PGresult *)>;
+
+    struct Endpoint;
+
+    struct Connection {
+        Connection(boost::asio::io_context &ioc, Endpoint &endpoint);
+
+        Endpoint &endpoint;
+        boost::asio::strand<boost::asio::io_context::executor_type> strand; // every step for this connection
+        boost::asio::posix::stream_descriptor socket; // PQsocket(), owned by libpq
+        boost::asio::steady_timer timer;  // retry backoff and reconnect delay
+        PGconn *pg = nullptr;
+        std::size_t prepared = 0;         // statements prepared so far while connecting
+        bool ready = false;
+        bool watching = false;            // idle, with watch() reading
+        std::unique_ptr<Query> query;     // in flight
+        std::function<void(PGresult *)> onResult; // step to run when the current command's result is in
+        PGresult *result = nullptr;
+    };
+
+    // The primary or one replica, with its own connections and queue
+    struct Endpoint {
+        std::string connectionString;
+        std::vector<std::unique_ptr<Connection>> connections;
+
+        std::mutex mutex;
+        std::vector<Connection *> idle;
+        std::deque<Query> backlog;
+        std::size_t readyCount = 0;
+    };
+
+    AsyncDB() = default;
+
+    void open(boost::asio::io_context &ioc, Endpoint &endpoint);
+    void close(Endpoint &endpoint);
+    void submit(Endpoint &endpoint, Query query);
+    void read(int userId, Query query, ReplicaCallback onReplica); // on a replica when ReplicaRouter allows
+    void send(Connection &c);
+    void finish(Connection &c, const PGresult *result);
+    void release(Connection &c); // take the next queued query, or go idle
+    void watch(Connection &c);  // notice a dropped idle connection
+
+    // libpq plumbing; all of it runs on the connection's strand
+    void connect(Connection &c);
+    void pollConnect(Connection &c, PostgresPollingStatusType status);
+    void prepareNext(Connection &c);
+    void exchange(Connection &c, std::function<void(PGresult *)> onResult); // flush a PQsend*, then collect its result
+    void flush(Connection &c);
+    void receive(Connection &c);
+    void waitFor(Connection &c, bool write, std::function<void()> then);
+    void broken(Connection &c, const char *what); // drop the connection and open a new one
+    void connectFailed(Connection &c);            // try again after a delay
+    void disconnect(Connection &c);
+
+    DbConfig cfg;
+    std::atomic<bool> started{false};
+    Endpoint primary;
+    std::vector<std::unique_ptr<Endpoint>> replicas; // in DbConfig::replicas order, as ReplicaRouter numbers them
+};
+
+#endif
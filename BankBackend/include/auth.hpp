@@ -0,0 +1,120 @@
+#ifndef AUTH_HPP
+#define AUTH_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "config.hpp"
+
+// Logins and who is calling. POST /login checks the password once and hands
+// out a session token; later requests send it as "Authorization: Bearer
+// <token>" and are identified from memory, without touching the database.
+namespace auth {
+
+// Live sessions, split over shards so concurrent lookups rarely share a lock.
+// A token is base64url(session id | user id | expiry) "." base64url(HMAC of
+// that), so forged or tampered tokens are turned away before any lock is
+// taken; the store is what makes a token revocable (POST /logout).
+class SessionStore {
+public:
+    static SessionStore &instance();
+
+    // Set the signing key (random when cfg.sessionKey is empty) and lifetime
+    void configure(const AuthConfig &cfg);
+
+    // New session for `userId`; returns its token
+    std::string issue(int userId);
+
+    // The session's user for a valid, unexpired, unrevoked token
+    bool resolve(std::string_view token, int &userId) const;
+
+    // End a session; false if the token wasn't live
+    bool revoke(std::string_view token);
+
+    std::chrono::seconds ttl() const { return lifetime; }
+    std::size_t size() const;
+
+private:
+    static constexpr std::size_t shardCount = 64;
+    static constexpr std::size_t idBytes = 16;
+
+    struct Session {
+        int userId;
+        std::int64_t expires; // unix seconds
+    };
+
+    // Own cache line each, so shards don't contend through false sharing
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::string, Session> sessions; // keyed by the raw session id
+        std::int64_t nextSweep = 0;
+    };
+
+    SessionStore() = default;
+
+    // Check the signature and split a token; `id` gets the raw session id
+    bool decode(std::string_view token, std::string &id, int &userId, std::int64_t &expires) const;
+    Shard &shardFor(const std::string &id) const;
+
+    std::string key;
+    std::chrono::seconds lifetime{3600};
+    mutable std::array<Shard, shardCount> shards;
+};
+
+// Fixed pool of threads for password hashing. Hashes are deliberately slow,
+// so running them on the I/O threads would let a burst of logins stall every
+// other request; here they queue instead, and once the queue is full new
+// work is refused (the caller answers 503) rather than piling up.
+class PasswordWorkers {
+public:
+    using Task = std::function<void()>;
+
+    struct Stats {
+        std::size_t queued;
+        std::uint64_t completed;
+        std::uint64_t rejected;
+    };
+
+    static PasswordWorkers &instance();
+
+    void start(unsigned threads, std::size_t queueLimit);
+
+    // Run what is already queued, then join the threads
+    void stop();
+
+    // False (and the task dropped) when the queue is full or the pool isn't running
+    bool submit(Task task);
+
+    Stats stats() const;
+
+private:
+    PasswordWorkers() = default;
+    ~PasswordWorkers();
+
+    void run();
+
+    mutable std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<Task> queue;
+    std::vector<std::thread> threads;
+    std::size_t limit = 0;
+    bool running = false;
+
+    std::atomic<std::uint64_t> completed{0};
+    std::atomic<std::uint64_t> rejected{0};
+};
+
+} // namespace auth
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BALANCE_CACHE_HPP
+#define BALANCE_CACHE_HPP
+
+#include <pqxx/pqxx>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// In-process cache of account balances in front of DB::getBalance.
+//
+// The table is split into shards, each with its own lock and CLOCK eviction,
+// so concurrent readers rarely contend. Our own writes update it
+// (write-through); writes made by other server instances arrive through the
+// balance_changed NOTIFY channel (see schema.sql and ChangeListener).
+class BalanceCache {
+public:
+    struct Stats {
+        std::uint64_t hits;
+        std::uint64_t misses;
+        std::uint64_t evictions;
+        std::size_t size;
+        std::size_t capacity;
+    };
+
+    static BalanceCache &instance();
+
+    // Size the cache; a capacity of 0 disables it. Call before serving traffic.
+    void configure(std::size_t capacity);
+    bool enabled() const { return capacity != 0; }
+
+    bool get(int userId, double &balance);
+
+    // A reader takes a ticket before querying the database and passes it to
+    // fill(). If the account was written or invalidated in between, the
+    // (possibly stale) value read from the database is dropped.
+    std::uint64_t ticket(int userId);
+    void fill(int userId, double balance, std::uint64_t ticket);
+
+    // Write-through from a committed change
+    void put(int userId, double balance);
+
+    // Write-through from a money-movement statement's (id, balance) rows. A
+    // NULL balance (a hot account, see statements.cpp) invalidates instead.
+    void putRows(const pqxx::result &rows);
+
+    void invalidate(int userId);
+    void clear();
+
+    // Apply a balance_changed payload: "id,balance", or just "id" when the
+    // account was deleted or its new balance isn't known
+    void applyNotification(const std::string &payload);
+
+    Stats stats();
+
+private:
+    struct Slot {
+        int userId = 0;
+        double balance = 0;
+        bool used = false;
+        bool referenced = false; // CLOCK bit, set on every hit
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<int, std::size_t> index; // userId -> slot
+        std::vector<Slot> slots;
+        std::size_t hand = 0;
+        std::uint64_t epoch = 0; // bumped by every put/invalidate in this shard
+    };
+
+    static constexpr std::size_t shardCount = 64;
+
+    BalanceCache() = default;
+
+    Shard &shardFor(int userId);
+    void store(Shard &shard, int userId, double balance);
+
+    std::size_t capacity = 0;
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+    std::atomic<std::uint64_t> evictions{0};
+};
+
+#endif
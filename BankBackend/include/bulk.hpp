@@ -0,0 +1,121 @@
+#ifndef BULK_HPP
+#define BULK_HPP
+
+#include <pqxx/pqxx>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Bulk loading and dumping of the users and transactions tables through
+// COPY, for onboarding another bank's accounts and for statements/audits.
+// Both directions use CSV with the same columns, so an export can be fed
+// straight back in:
+//   users:        id,name,password,balance
+//   transactions: id,user_id,amount,type,timestamp
+// An unquoted empty field is NULL and a quoted one ("") is an empty string,
+// as in Postgres' own CSV format. A first line equal to the column list is
+// treated as a header and skipped.
+namespace bulk {
+
+enum class Table { users, transactions };
+
+// "users" or "transactions"
+bool parseTable(std::string_view name, Table &table);
+const char *tableName(Table table);
+
+struct ImportOptions {
+    unsigned workers = 0;          // validation threads (0 = one per core)
+    std::size_t maxRejects = 0;    // give up once more rows than this fail validation
+    bool deferIndexes = false;     // drop secondary indexes for the load and rebuild them after
+    const std::atomic<bool> *cancel = nullptr;         // checked between blocks
+    std::atomic<std::uint64_t> *progress = nullptr;    // rows sent so far
+};
+
+struct Reject {
+    std::uint64_t line;            // 1-based line the row starts on
+    std::string reason;
+};
+
+struct ImportResult {
+    bool committed = false;
+    std::uint64_t rows = 0;        // rows written (0 unless committed)
+    std::uint64_t rejected = 0;
+    std::vector<Reject> rejects;   // the first few, by line
+    std::string error;             // why nothing was committed
+    std::chrono::milliseconds elapsed{0};
+};
+
+// Read CSV from `in`, validate it on worker threads and COPY the valid rows
+// into `table`, all in one transaction. Explicit ids are kept and the id
+// sequence is moved past them. Memory is bounded by the blocks in flight,
+// whatever the size of the input. Postgres errors (duplicate ids, unknown
+// user ids) abort the import and are reported in `error`, not thrown.
+ImportResult importCsv(pqxx::connection &conn, Table table, std::istream &in, const ImportOptions &options);
+
+// COPY a table out as CSV with a header, in id order, optionally only one
+// user's rows. Holds a read transaction on `conn` until destroyed.
+class Exporter {
+public:
+    Exporter(pqxx::connection &conn, Table table, int userId = 0);
+
+    // Append roughly `chunkBytes` of CSV to `chunk`. Returns false once the
+    // last rows have been appended.
+    bool next(std::string &chunk, std::size_t chunkBytes = 64 * 1024);
+
+private:
+    Table table;
+    pqxx::read_transaction txn;
+    pqxx::stream_from stream;
+    bool started = false;
+};
+
+// Imports started over HTTP (POST /admin/import) run on their own threads,
+// one pooled connection each, and are polled by id.
+class ImportJobs {
+public:
+    enum class State { running, done, failed };
+
+    struct Status {
+        State state;
+        std::uint64_t rows;        // rows sent so far while running
+        ImportResult result;       // final outcome once not running
+    };
+
+    static ImportJobs &instance();
+
+    // Import the CSV file at `path` on a background thread; returns the job id
+    int start(Table table, const std::string &path, const ImportOptions &options);
+
+    // False for an unknown id
+    bool status(int id, Status &out);
+
+    // Cancel running imports and wait for them (shutdown)
+    void stop();
+
+private:
+    struct Job {
+        State state = State::running;
+        std::atomic<std::uint64_t> progress{0};
+        ImportResult result;
+        std::thread worker;
+    };
+
+    ImportJobs() = default;
+
+    std::mutex mutex;
+    std::unordered_map<int, std::unique_ptr<Job>> jobs;
+    int nextId = 1;
+    std::atomic<bool> cancel{false};
+};
+
+} // namespace bulk
+
+#endif
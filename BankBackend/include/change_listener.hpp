@@ -0,0 +1,49 @@
+#ifndef CHANGE_LISTENER_HPP
+#define CHANGE_LISTENER_HPP
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Owns one dedicated Postgres connection that LISTENs on the channels
+// fed by the triggers in schema.sql and dispatches every NOTIFY payload to
+// the handlers registered for that channel. Runs on its own thread and
+// reconnects by itself if the connection drops.
+class ChangeListener {
+public:
+    using Handler = std::function<void(const std::string &payload)>;
+
+    static ChangeListener &instance();
+
+    // Register before start()
+    void subscribe(const std::string &channel, Handler handler);
+
+    // Called after every (re)connect. Notifications sent while we were
+    // disconnected are lost, so subscribers drop whatever they derived.
+    void onReconnect(std::function<void()> callback);
+
+    void start(const std::string &connectionString);
+    void stop();
+
+private:
+    struct Subscription {
+        std::string channel;
+        Handler handler;
+    };
+
+    ChangeListener() = default;
+    ~ChangeListener();
+
+    void run();
+
+    std::string connectionString;
+    std::vector<Subscription> subscriptions;
+    std::vector<std::function<void()>> reconnectCallbacks;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+};
+
+#endif
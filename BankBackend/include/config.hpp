@@ -0,0 +1,131 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Runtime settings for the HTTP server. Every field can be overridden with a
+// BANK_* environment variable so deployments don't need a rebuild to retune.
+struct ServerConfig {
+    unsigned short port = 8080;                  // BANK_PORT
+    unsigned threads = 0;                        // BANK_THREADS (0 = one per core)
+    std::size_t maxConnections = 10000;          // BANK_MAX_CONNECTIONS
+    std::chrono::seconds idleTimeout{30};        // BANK_IDLE_TIMEOUT (seconds)
+    std::size_t pipelineLimit = 8;               // BANK_PIPELINE_LIMIT (queued responses per connection)
+    std::size_t bodyLimit = 1024 * 1024;         // BANK_BODY_LIMIT (bytes)
+    std::size_t arenaBytes = 4096;               // BANK_ARENA_BYTES (per-connection request memory)
+    std::size_t arenaRetain = 64 * 1024;         // BANK_ARENA_RETAIN (most a connection's arena grows to)
+};
+
+// PostgreSQL connection settings and pool sizing.
+struct DbConfig {
+    std::string connectionString =
+        "dbname=bankapp user=ayaanmunshi hostaddr=127.0.0.1 port=5432"; // BANK_DB_URL
+    std::size_t poolMin = 4;                               // BANK_DB_POOL_MIN (opened at startup)
+    std::size_t poolMax = 32;                              // BANK_DB_POOL_MAX
+    std::chrono::milliseconds acquireTimeout{2000};        // BANK_DB_POOL_TIMEOUT_MS
+    std::chrono::milliseconds healthCheckAfter{5000};      // BANK_DB_POOL_CHECK_MS (idle time before a ping)
+    std::size_t balanceCacheCapacity = 100000;             // BANK_BALANCE_CACHE_CAPACITY (0 disables)
+    std::size_t asyncConnections = 8;                      // BANK_DB_ASYNC_CONNECTIONS (nonblocking ones for the hot path; 0 disables)
+    std::vector<std::string> replicas;                     // BANK_DB_REPLICA_URLS (';'-separated streaming replicas for reads)
+    std::chrono::milliseconds maxReplicaLag{1000};         // BANK_DB_REPLICA_MAX_LAG_MS (staler replicas are skipped)
+    std::chrono::milliseconds replicaCheckInterval{500};   // BANK_DB_REPLICA_CHECK_MS
+    std::chrono::milliseconds stickyWindow{2000};          // BANK_DB_STICKY_MS (an account reads the primary this long after a write)
+};
+
+// Optional group-commit stage for deposits, withdrawals and transfers.
+struct GroupCommitConfig {
+    bool enabled = false;                                  // BANK_GROUP_COMMIT (0/1)
+    std::chrono::microseconds window{500};                 // BANK_GROUP_COMMIT_WINDOW_US
+    std::size_t maxBatch = 64;                             // BANK_GROUP_COMMIT_MAX_BATCH
+};
+
+// Where accounts and ledgers live (see storage.hpp)
+struct StorageConfig {
+    std::string backend = "postgres";                      // BANK_STORAGE (postgres or memory)
+
+    // Durability for the memory backend (see wal.hpp); empty = nothing survives a restart
+    std::string walDir;                                    // BANK_WAL_DIR
+    std::chrono::microseconds walSyncWindow{0};            // BANK_WAL_SYNC_US (extra wait to grow an fsync batch)
+    std::chrono::seconds snapshotInterval{300};            // BANK_SNAPSHOT_INTERVAL_S (0 disables)
+    std::string replicateUrl;                              // BANK_WAL_REPLICATE_URL (back-fill Postgres; empty disables)
+};
+
+// Structured logging (see log.hpp)
+struct LogConfig {
+    std::string level = "info";                            // BANK_LOG_LEVEL (debug, info, warn, error, off)
+    bool json = false;                                     // BANK_LOG_FORMAT (kv or json)
+    std::string file;                                      // BANK_LOG_FILE (empty = stderr)
+};
+
+// Admin endpoints (/admin/import, /admin/export); disabled without a token
+struct AdminConfig {
+    std::string token;                                     // BANK_ADMIN_TOKEN (sent as X-Admin-Token)
+    std::string importDir = ".";                           // BANK_IMPORT_DIR (files /admin/import may read)
+};
+
+// Session tokens and password hashing (see auth.hpp)
+struct AuthConfig {
+    std::string sessionKey;                                // BANK_SESSION_KEY (token signing key; random per process if unset)
+    std::chrono::seconds sessionTtl{3600};                 // BANK_SESSION_TTL_S
+    bool requireToken = false;                             // BANK_REQUIRE_AUTH (0/1: refuse account calls without a token)
+    unsigned hashThreads = 2;                              // BANK_AUTH_THREADS (password hashing pool)
+    std::size_t hashQueue = 256;                           // BANK_AUTH_QUEUE (waiting hashes before /login and /register get 503)
+    unsigned passwordIterations = 100000;                  // BANK_PASSWORD_ITERATIONS (PBKDF2 rounds for new hashes)
+};
+
+// Admission control and rate limits ahead of the handlers (see admission.hpp)
+struct AdmissionConfig {
+    std::size_t maxInFlight = 0;                           // BANK_MAX_INFLIGHT (requests in handlers at once; 0 = DB pool size with postgres, unlimited with memory)
+    std::size_t maxStreams = 0;                            // BANK_MAX_STREAMS (streamed responses being sent at once; 0 = a quarter of maxInFlight, at least 1)
+    std::size_t maxQueued = 1024;                          // BANK_ADMISSION_QUEUE (requests waiting for a slot before 503)
+    std::chrono::milliseconds queueDeadline{200};          // BANK_ADMISSION_DEADLINE_MS (longest wait for a slot)
+    unsigned clientRate = 0;                               // BANK_RATE_CLIENT (requests/s per client address; 0 disables)
+    unsigned clientBurst = 0;                              // BANK_RATE_CLIENT_BURST (0 = one second's worth)
+    unsigned accountRate = 0;                              // BANK_RATE_ACCOUNT (requests/s per account; 0 disables)
+    unsigned accountBurst = 0;                             // BANK_RATE_ACCOUNT_BURST (0 = one second's worth)
+};
+
+struct PushConfig {
+    std::size_t queue = 64;                                // BANK_PUSH_QUEUE (transaction events held per slow subscriber before it is told to resync)
+    std::chrono::seconds idleTimeout{300};                 // BANK_PUSH_IDLE_SECONDS (drop a subscriber that stops answering pings)
+};
+
+// Sampled request tracing (see trace.hpp); off unless a file is given
+struct TraceConfig {
+    std::string file;                                      // BANK_TRACE_FILE (Chrome trace-event JSON; empty disables tracing)
+    unsigned sampleOneIn = 100;                            // BANK_TRACE_SAMPLE_ONE_IN (trace one request in N; 0 = only those a traceparent marks sampled)
+    std::size_t fileBytes = 64 * 1024 * 1024;              // BANK_TRACE_FILE_BYTES (rotate the file past this size)
+    unsigned files = 4;                                    // BANK_TRACE_FILES (rotated files kept as <file>.1 ... <file>.N)
+};
+
+// Hot accounts whose credits are spread over stripe rows (see schema.sql)
+struct HotAccountConfig {
+    std::vector<int> accounts;                             // BANK_HOT_ACCOUNTS (','-separated user ids to flag hot at startup)
+    unsigned stripes = 16;                                 // BANK_HOT_STRIPES (stripes each of those accounts gets)
+    std::chrono::milliseconds consolidateInterval{1000};   // BANK_HOT_CONSOLIDATE_MS (how often stripes are folded back in; 0 disables)
+};
+
+// Monthly partitions of the transactions table (see schema.sql)
+struct LedgerConfig {
+    unsigned monthsAhead = 2;                              // BANK_LEDGER_MONTHS_AHEAD (partitions created past the current month)
+    unsigned retainMonths = 0;                             // BANK_LEDGER_RETAIN_MONTHS (past months kept attached; 0 keeps all)
+    std::chrono::seconds maintainInterval{3600};           // BANK_LEDGER_MAINTAIN_S (how often partitions are checked; 0 = at startup only)
+};
+
+ServerConfig loadServerConfig();
+DbConfig loadDbConfig();
+GroupCommitConfig loadGroupCommitConfig();
+StorageConfig loadStorageConfig();
+LogConfig loadLogConfig();
+AdminConfig loadAdminConfig();
+AuthConfig loadAuthConfig();
+AdmissionConfig loadAdmissionConfig();
+PushConfig loadPushConfig();
+TraceConfig loadTraceConfig();
+HotAccountConfig loadHotAccountConfig();
+LedgerConfig loadLedgerConfig();
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef CRYPTO_HPP
+#define CRYPTO_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Hashing primitives for passwords and session tokens, written in-tree so
+// the server needs no crypto library: SHA-256, HMAC-SHA-256 and PBKDF2.
+namespace crypto {
+
+using Digest = std::array<std::uint8_t, 32>;
+
+Digest sha256(std::string_view data);
+Digest hmacSha256(std::string_view key, std::string_view message);
+
+// PBKDF2-HMAC-SHA-256 with a 32-byte output (one block)
+Digest pbkdf2Sha256(std::string_view password, std::string_view salt, std::uint32_t iterations);
+
+// `n` bytes from the operating system's CSPRNG
+std::string randomBytes(std::size_t n);
+
+// Compare without exiting early, so timing doesn't reveal a matching prefix
+bool constantTimeEqual(std::string_view a, std::string_view b);
+
+std::string toHex(std::string_view bytes);
+bool fromHex(std::string_view hex, std::string &out);
+std::string base64Url(std::string_view bytes); // unpadded
+bool fromBase64Url(std::string_view text, std::string &out);
+
+// Stored password format: pbkdf2-sha256$<iterations>$<salt hex>$<hash hex>.
+// Anything else is treated as a legacy plaintext password.
+std::string hashPassword(std::string_view password, std::uint32_t iterations);
+bool verifyPassword(std::string_view password, const std::string &stored);
+
+// True for legacy plaintext and for hashes weaker than `iterations`
+bool needsRehash(const std::string &stored, std::uint32_t iterations);
+
+} // namespace crypto
+
+#endif
@@ -2,16 +2,20 @@
 #define DB_HPP
 
 #include <pqxx/pqxx>
+#include <optional>
 #include <string>
 #include <vector>
 #include "../src/models/transaction.hpp" 
-#include <mutex>
+#include "db_pool.hpp"
+#include "storage.hpp"
 
 
+// Short-lived handle used for one request. The first call checks a connection
+// out of the shared ConnectionPool; it goes back when the DB is destroyed.
 class DB {
 private:
-    pqxx::connection* conn;
-    std::mutex dbMutex;  // protects the connection
+    ConnectionPool::Lease lease;
+    pqxx::connection* conn = nullptr;
 
 public:
     DB();
@@ -27,22 +31,30 @@ public:
     double getBalance(int userId);
 
     // 3) Deposit
-    bool deposit(int userId, double amount);
+    WriteResult deposit(int userId, double amount);
 
     // 4) Withdraw
-    bool withdraw(int userId, double amount);
+    WriteResult withdraw(int userId, double amount);
 
     // 5) Transfer money between two suers atomically
-    bool transfer(int senderId, int receiverId, double amount);
+    WriteResult transfer(int senderId, int receiverId, double amount);
 
     //6) Register functionality
     bool registerUser(const std::string &name, const std::string &password, double initialBalance);
 
-    //7) Login functionality
-    int loginUser(const std::string &name, const std::string &password);
+    //7) Login: stored passwords of the accounts with this name, by id
+    std::vector<Credential> getCredentials(const std::string &name);
 
+    //8) Transaction history, one page at a time: up to `limit` transactions
+    // after the cursor, oldest first (keyset pagination); nullopt if the
+    // database couldn't be read
+    std::optional<std::vector<Transaction>> getTransactions(int userId, const HistoryCursor &after, int limit);
 
-std::vector<Transaction> getTransactions(int userId);
+    //9) Batch of money movements, pipelined in one transaction (see Storage::executeBatch)
+    std::vector<BatchResult> executeBatch(const std::vector<BatchOperation> &ops, bool atomic);
+
+    //10) Replace a stored password (hash upgrade after login)
+    bool setPassword(int userId, const std::string &password);
 };
 
 #endif
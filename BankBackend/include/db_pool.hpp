@@ -0,0 +1,79 @@
+#ifndef DB_POOL_HPP
+#define DB_POOL_HPP
+
+#include <pqxx/pqxx>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "config.hpp"
+
+// Thread-safe pool of long-lived PostgreSQL connections shared by every DB
+// instance. Connections are checked out through a Lease and go back to the
+// pool when the lease is destroyed; broken ones are dropped and replaced.
+class ConnectionPool {
+public:
+    // RAII handle to one checked-out connection (empty if checkout failed)
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(Lease &&other) noexcept;
+        Lease &operator=(Lease &&other) noexcept;
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease();
+
+        pqxx::connection *get() const { return conn.get(); }
+        pqxx::connection &operator*() const { return *conn; }
+        explicit operator bool() const { return conn != nullptr; }
+
+    private:
+        friend class ConnectionPool;
+        Lease(ConnectionPool *pool, std::unique_ptr<pqxx::connection> conn);
+        void reset();
+
+        ConnectionPool *pool = nullptr;
+        std::unique_ptr<pqxx::connection> conn;
+    };
+
+    struct Stats {
+        std::size_t idle;
+        std::size_t total;
+        std::size_t waiting;
+    };
+
+    // instance() is the primary's pool; ReplicaRouter owns one per replica
+    ConnectionPool() = default;
+
+    static ConnectionPool &instance();
+
+    // Apply the configuration and open poolMin connections up front.
+    // Throws if the database can't be reached so startup fails fast.
+    void init(const DbConfig &cfg);
+
+    // Check out a connection, waiting up to acquireTimeout when every
+    // connection is busy. Returns an empty lease on timeout or connect failure.
+    Lease acquire();
+
+    Stats stats();
+
+private:
+    struct Idle {
+        std::unique_ptr<pqxx::connection> conn;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    std::unique_ptr<pqxx::connection> connect();
+    bool healthy(pqxx::connection &conn, std::chrono::steady_clock::time_point idleSince);
+    void release(std::unique_ptr<pqxx::connection> conn);
+
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<Idle> idle;   // LIFO so the warmest connection is reused first
+    std::size_t total = 0;    // idle + checked out + being opened
+    std::size_t waiting = 0;
+    DbConfig cfg;
+};
+
+#endif
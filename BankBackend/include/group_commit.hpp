@@ -0,0 +1,98 @@
+#ifndef GROUP_COMMIT_HPP
+#define GROUP_COMMIT_HPP
+
+#include <pqxx/pqxx>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "config.hpp"
+#include "storage.hpp"
+
+// Optional write stage behind DB::deposit / DB::withdraw / DB::transfer.
+// Operations that arrive within GroupCommitConfig::window of each other (or
+// until maxBatch is reached) share one Postgres transaction, so the commit
+// (and fsync) rate drops below the request rate. Each caller still gets its
+// own result: an operation that fails doesn't take the rest of its batch down.
+class GroupCommitter {
+public:
+    enum class Kind { deposit, withdraw, transfer };
+
+    struct Operation {
+        Kind kind;
+        int userId;          // account credited/debited, or the sender for transfers
+        int receiverId;      // transfers only
+        double amount;
+    };
+
+    using Callback = std::function<void(WriteResult result)>;
+
+    // Batch-size distribution buckets: 1, 2-3, 4-7, ... , 128+
+    static constexpr std::size_t histogramBuckets = 8;
+
+    struct Stats {
+        std::uint64_t batches;
+        std::uint64_t operations;
+        std::uint64_t retries;
+        std::array<std::uint64_t, histogramBuckets> batchSizes;
+    };
+
+    static GroupCommitter &instance();
+
+    void start(const GroupCommitConfig &cfg);
+    void stop();
+    bool enabled() const { return running.load(std::memory_order_acquire); }
+
+    // Queue an operation; the callback runs on the committer thread once the
+    // batch it landed in has committed (or failed). If the connection is lost
+    // during COMMIT, every operation of the batch gets WriteResult::unknown.
+    void submit(const Operation &op, Callback done);
+
+    // Blocking convenience wrapper around submit()
+    WriteResult execute(const Operation &op);
+
+    Stats stats() const;
+
+    // Run a batch in one transaction on the given connection and return one
+    // result per operation, in order. Used by the committer thread.
+    static std::vector<bool> executeBatch(pqxx::connection &conn, const std::vector<Operation> &ops);
+
+    // All-or-nothing variant for POST /batch: pipeline every operation in one
+    // transaction and commit only if all of them succeeded. `results` gets
+    // each operation's own outcome; returns whether the batch committed.
+    static bool executeAtomic(pqxx::connection &conn, const std::vector<Operation> &ops, std::vector<bool> &results);
+
+private:
+    struct Pending {
+        Operation op;
+        Callback done;
+        std::chrono::steady_clock::time_point arrived;
+    };
+
+    GroupCommitter() = default;
+    ~GroupCommitter();
+
+    void run();
+    void commit(std::vector<Pending> &batch);
+
+    GroupCommitConfig cfg;
+    std::atomic<bool> running{false};
+    bool stopping = false;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::deque<Pending> queue;
+    std::thread worker;
+
+    std::atomic<std::uint64_t> batchCount{0};
+    std::atomic<std::uint64_t> operationCount{0};
+    std::atomic<std::uint64_t> retryCount{0};
+    std::array<std::atomic<std::uint64_t>, histogramBuckets> sizeHistogram{};
+};
+
+#endif
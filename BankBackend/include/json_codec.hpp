@@ -0,0 +1,121 @@
+#ifndef JSON_CODEC_HPP
+#define JSON_CODEC_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "../src/models/transaction.hpp"
+
+// Allocation-light JSON for the request/response path. Request bodies are
+// scanned once and only the fields a handler asks for are decoded, straight
+// into typed structs; responses are written directly into the output string.
+// No intermediate DOM is built in either direction.
+namespace codec {
+
+struct ParseError : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// One field to pull out of a JSON object. Unknown fields are validated and
+// skipped; a missing required field is a ParseError.
+class Field {
+public:
+    Field(std::string_view name, int &target, bool required = true);
+    Field(std::string_view name, double &target, bool required = true);
+    Field(std::string_view name, std::string &target, bool required = true);
+
+private:
+    friend class Reader;
+    enum class Type { integer, number, string };
+
+    std::string_view name;
+    Type type;
+    void *target;
+    bool required;
+};
+
+// Parse `text` as a single JSON object and bind the listed fields.
+// Throws ParseError on malformed JSON, wrong types or missing fields.
+void parseObject(std::string_view text, std::initializer_list<Field> fields);
+
+// Low-level pull reader, also used to walk arrays of objects
+class Reader {
+public:
+    explicit Reader(std::string_view text) : text(text) {}
+
+    void expect(char c);
+    bool consume(char c);      // skip whitespace, then take `c` if it is next
+    char peek();               // next non-whitespace character (0 at end)
+    bool atEnd();
+    std::string_view readKey();        // a string followed by ':'
+    void readObjectInto(std::initializer_list<Field> fields);
+    void readString(std::string &out);
+    double readNumber();
+    int readInt();
+    void skipValue();
+    std::size_t position() const { return pos; }
+
+private:
+    void skipWhitespace();
+    void skipValue(int depth);
+    [[noreturn]] void fail(const char *what) const;
+
+    std::string_view text;
+    std::size_t pos = 0;
+    std::string scratch; // decoded keys / skipped strings, reused
+};
+
+// Streaming writer appending to `out`. Commas are inserted automatically.
+// Writes into std::string, or std::pmr::string for response bodies that
+// live in a connection's arena (see arena.hpp).
+template <class String>
+class Writer {
+public:
+    explicit Writer(String &out) : out(out) {}
+
+    Writer &beginObject();
+    Writer &endObject();
+    Writer &beginArray();
+    Writer &endArray();
+    Writer &key(std::string_view name);
+    Writer &value(std::string_view v);
+    Writer &value(const char *v) { return value(std::string_view(v)); }
+    Writer &value(int v);
+    Writer &value(std::int64_t v);
+    Writer &value(double v);
+    Writer &value(bool v);
+
+private:
+    void separate();
+
+    String &out;
+    std::uint64_t hasItems = 0; // bit per nesting level
+    int depth = 0;
+    bool afterKey = false;
+};
+
+extern template class Writer<std::string>;
+extern template class Writer<std::pmr::string>;
+
+// Append a JSON string literal (quoted and escaped)
+template <class String>
+void appendString(String &out, std::string_view v);
+
+// Append a number the way nlohmann::json formats it (shortest round-trip,
+// always with a fractional part or exponent; non-finite values become null)
+template <class String>
+void appendNumber(String &out, double v);
+
+// {"amount":..,"id":..,"timestamp":..,"type":..,"userId":..}
+template <class String>
+void writeTransaction(Writer<String> &w, const Transaction &tx);
+
+// {"message":..,"status":"success"|"fail"}
+std::string statusBody(bool success, std::string_view message);
+
+} // namespace codec
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef LEDGER_PARTITIONS_HPP
+#define LEDGER_PARTITIONS_HPP
+
+#include <pqxx/pqxx>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Upkeep of the monthly partitions of the transactions table (schema.sql),
+// shared by the server's PartitionMaintainer and the bankledger tool.
+// Partitions are named transactions_YYYY_MM and cover that calendar month
+// of `timestamp`; rows outside every month partition wait in
+// transactions_default until maintain() gives their month a partition.
+// Months past the retention period are detached and moved, whole, into the
+// ledger_archive schema, where they can still be queried, dumped or dropped.
+namespace partitions {
+
+constexpr const char *archiveSchema = "ledger_archive";
+
+struct MaintainResult {
+    std::vector<std::string> created;   // partitions added
+    std::uint64_t moved = 0;            // rows moved out of transactions_default
+    std::vector<std::string> archived;  // partitions detached into ledger_archive
+};
+
+// True if the transactions table is partitioned, false for the single table
+// of older schemas (see migrate())
+bool partitioned(pqxx::connection &conn);
+
+// Create partitions for the current month, `monthsAhead` more, and every
+// month transactions_default holds rows of, moving those rows in. With
+// `retainMonths` > 0, archive the months before the last `retainMonths`.
+// Each partition is its own short transaction with a lock timeout, so a
+// pass that can't get its locks throws instead of stalling inserts; what it
+// did before that is kept.
+MaintainResult maintain(pqxx::connection &conn, unsigned monthsAhead, unsigned retainMonths);
+
+struct MigrateResult {
+    bool migrated = false;              // false: already partitioned
+    std::uint64_t rows = 0;             // rows copied
+    std::vector<std::string> created;   // partitions made for them
+};
+
+// Turn the single transactions table of older schemas into the partitioned
+// one, copying every row, in one transaction that locks the table
+// throughout. Ids, the id sequence and the NOTIFY trigger carry over. A row
+// with no timestamp gets '-infinity' and stays in transactions_default.
+MigrateResult migrate(pqxx::connection &conn, unsigned monthsAhead);
+
+struct Partition {
+    std::string name;                   // schema-qualified for archived ones
+    std::string bounds;                 // as Postgres prints them; empty when archived
+    std::int64_t rows = 0;              // planner estimate (-1 = never analyzed)
+};
+
+// Attached partitions in month order, the default one last, then the archive
+std::vector<Partition> list(pqxx::connection &conn);
+
+} // namespace partitions
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef LEDGER_REPLICATOR_HPP
+#define LEDGER_REPLICATOR_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+class Wal;
+
+// Tails the memory ledger's write-ahead log and back-fills the users and
+// transactions tables from schema.sql, for reporting and as an off-box
+// copy. Runs on its own thread and its own connection. It never delays
+// requests: it only reads records that are already durable.
+//
+// Each batch is applied in one transaction that also stores the last
+// replicated LSN (ledger_replication), so a restart resumes where the last
+// commit left off. Rows are written with explicit ids and ON CONFLICT
+// guards, so replaying a batch twice is harmless.
+class LedgerReplicator {
+public:
+    ~LedgerReplicator();
+
+    void start(const std::string &connectionString, const std::string &walDir, Wal &wal);
+    void stop();
+
+    // Highest LSN committed to Postgres; segments above it must be kept
+    std::uint64_t confirmedLsn() const { return confirmed.load(std::memory_order_acquire); }
+
+private:
+    void run();
+
+    std::string connectionString;
+    std::string walDir;
+    Wal *wal = nullptr;
+    std::atomic<std::uint64_t> confirmed{0};
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread worker;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+struct LogConfig;
+
+// Structured, asynchronous logging. Each call formats one line (key=value or
+// JSON) on the calling thread into that thread's lock-free ring; a background
+// writer drains every ring and writes in batches. A full ring drops the line
+// and counts it instead of blocking the caller.
+//
+//   LOG_WARN("withdraw_failed", {"userId", userId}, {"error", e.what()});
+//
+// Debug calls compile away entirely when BANK_LOG_MIN_LEVEL is above debug
+// (the default for NDEBUG builds); the rest are filtered at runtime.
+namespace logging {
+
+enum class Level : int { debug = 0, info = 1, warn = 2, error = 3, off = 4 };
+
+#ifndef BANK_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define BANK_LOG_MIN_LEVEL 1
+#else
+#define BANK_LOG_MIN_LEVEL 0
+#endif
+#endif
+
+// One key/value pair. Values are only referenced until the line is formatted,
+// which happens before the logging call returns.
+class Field {
+public:
+    template <typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, int> = 0>
+    Field(std::string_view key, T v) : key(key) {
+        if constexpr (std::is_signed_v<T>) {
+            type = Type::integer;
+            i = v;
+        } else {
+            type = Type::unsignedInteger;
+            u = v;
+        }
+    }
+    Field(std::string_view key, double v) : key(key), type(Type::number), d(v) {}
+    Field(std::string_view key, bool v) : key(key), type(Type::boolean), b(v) {}
+    Field(std::string_view key, const char *v) : key(key), type(Type::string), s(v ? v : "") {}
+    Field(std::string_view key, const std::string &v) : key(key), type(Type::string), s(v) {}
+    Field(std::string_view key, std::string_view v) : key(key), type(Type::string), s(v) {}
+
+private:
+    friend void format(std::string &out, Level level, std::string_view event, std::initializer_list<Field> fields);
+    enum class Type { integer, unsignedInteger, number, boolean, string };
+
+    std::string_view key;
+    Type type;
+    union {
+        std::int64_t i;
+        std::uint64_t u;
+        double d;
+        bool b;
+    };
+    std::string_view s;
+};
+
+namespace detail {
+inline std::atomic<int> minLevel{static_cast<int>(Level::info)};
+}
+
+inline bool enabled(Level level) {
+    return static_cast<int>(level) >= detail::minLevel.load(std::memory_order_relaxed);
+}
+
+void configure(const LogConfig &cfg);
+void setLevel(Level level);
+bool parseLevel(std::string_view name, Level &out);
+
+// Format and enqueue one line. Prefer the LOG_* macros, which skip argument
+// evaluation when the level is disabled.
+void write(Level level, std::string_view event, std::initializer_list<Field> fields);
+
+// Append one formatted line (including the newline) to `out`
+void format(std::string &out, Level level, std::string_view event, std::initializer_list<Field> fields);
+
+// Drain every ring and stop the writer thread. Lines logged afterwards are
+// buffered until the ring fills, then dropped.
+void shutdown();
+
+std::uint64_t dropped();
+
+} // namespace logging
+
+#define BANK_LOG_AT(level, event, ...)                           \
+    do {                                                         \
+        if (::logging::enabled(level))                           \
+            ::logging::write(level, event, {__VA_ARGS__});       \
+    } while (0)
+
+#if BANK_LOG_MIN_LEVEL <= 0
+#define LOG_DEBUG(...) BANK_LOG_AT(::logging::Level::debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+#define LOG_INFO(...) BANK_LOG_AT(::logging::Level::info, __VA_ARGS__)
+#define LOG_WARN(...) BANK_LOG_AT(::logging::Level::warn, __VA_ARGS__)
+#define LOG_ERROR(...) BANK_LOG_AT(::logging::Level::error, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef MEMORY_STORAGE_HPP
+#define MEMORY_STORAGE_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "ledger_replicator.hpp"
+#include "storage.hpp"
+#include "wal.hpp"
+
+// Accounts and ledgers kept entirely in process memory, for benchmarking and
+// load-testing the HTTP layer without a database (BANK_STORAGE=memory).
+//
+// Accounts are spread over lock-striped shards by id. Each shard owns the
+// accounts that hash to it, stored in fixed-size chunks that never move, so
+// a balance read needs no lock at all. Writers take the shard lock; a
+// transfer takes both shards' locks in index order, so opposite transfers
+// can't deadlock. Every account has an append-only ledger of chunked entries.
+//
+// Without BANK_WAL_DIR nothing survives a restart. With it, every change is
+// journalled to a write-ahead log while its stripe locks are held and the
+// call returns once the record is fsynced (see wal.hpp). A background thread
+// periodically writes a snapshot through mmap; startup loads the newest
+// snapshot and replays only the log after it. Snapshots are taken stripe by
+// stripe without stopping writers, so replay is idempotent: a record is
+// skipped for any account whose ledger already holds its transaction id.
+class MemoryStorage : public Storage {
+public:
+    struct Stats {
+        std::size_t accounts;
+        std::uint64_t transactions;
+    };
+
+    MemoryStorage();
+    ~MemoryStorage() override;
+
+    // Recover from cfg.walDir and journal every change from now on. Call
+    // before serving traffic. Throws if the snapshot or log can't be read.
+    void enableDurability(const StorageConfig &cfg);
+
+    // Stop the background threads, then snapshot and close the log
+    void close() override;
+
+    bool createUser(const std::string &name, double initialBalance) override;
+    double getBalance(int userId) override;
+    WriteResult deposit(int userId, double amount) override;
+    WriteResult withdraw(int userId, double amount) override;
+    WriteResult transfer(int senderId, int receiverId, double amount) override;
+    bool registerUser(const std::string &name, const std::string &password, double initialBalance) override;
+    std::vector<Credential> credentials(const std::string &name) override;
+    std::optional<std::vector<Transaction>> getTransactions(int userId, const HistoryCursor &after, int limit) override;
+    std::vector<BatchResult> executeBatch(const std::vector<BatchOperation> &ops, bool atomic) override;
+
+    Stats stats() const;
+
+    bool durable() const { return wal != nullptr; }
+    Wal::Stats walStats() { return wal->stats(); }
+
+private:
+    static constexpr std::size_t shardCount = 64;        // lock stripes; power of two
+    static constexpr std::size_t accountsPerChunk = 256;
+    static constexpr std::size_t chunksPerShard = 4096;  // 64 * 256 * 4096 = 67M accounts
+    static constexpr std::size_t entriesPerChunk = 64;
+
+    enum class EntryType : std::uint8_t { deposit, withdrawal, transferSent, transferReceived };
+
+    struct Entry {
+        int id;
+        EntryType type;
+        double amount;
+        std::int64_t micros; // wall clock, microseconds since the epoch
+    };
+
+    // Append-only list of an account's transactions in id order. Entries are
+    // stored in fixed-size chunks, so growing never copies old entries.
+    class Ledger {
+    public:
+        void append(const Entry &entry);
+        void page(int afterId, int limit, std::vector<Entry> &out) const;
+
+        std::size_t count() const { return size; }
+        const Entry &at(std::size_t i) const { return (*chunks[i / entriesPerChunk])[i % entriesPerChunk]; }
+        int lastId() const { return size ? at(size - 1).id : 0; }
+
+    private:
+        std::vector<std::unique_ptr<std::array<Entry, entriesPerChunk>>> chunks;
+        std::size_t size = 0;
+    };
+
+    // Padded to whole cache lines so neighbouring accounts written under
+    // different shards' locks never share a line
+    struct alignas(64) Account {
+        std::atomic<bool> live{false};     // set once fully initialised
+        std::atomic<double> balance{0.0};  // written under the shard lock, read without it
+        std::string name;                  // immutable once live
+        std::string password;
+        bool hasPassword = false;
+        Ledger ledger;                     // guarded by the shard lock
+    };
+
+    using Chunk = std::array<Account, accountsPerChunk>;
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        alignas(64) std::array<std::atomic<Chunk *>, chunksPerShard> chunks{};
+    };
+
+    static std::size_t shardOf(int userId) { return static_cast<std::size_t>(userId - 1) % shardCount; }
+
+    Account *find(int userId) const;
+    int addUser(const std::string &name, const std::string *password, double initialBalance);
+    bool placeUser(int userId, const std::string &name, const std::string *password, double balance,
+                   std::uint64_t *lsn);
+    int record(Account &account, EntryType type, double amount, std::int64_t micros);
+    WalRecord postDeposit(Account &account, int userId, double amount, std::int64_t micros);
+    WalRecord postWithdraw(Account &account, int userId, double amount, std::int64_t micros);
+    WalRecord postTransfer(Account &sender, int senderId, Account &receiver, int receiverId, double amount,
+                           std::int64_t micros);
+    bool depositLogged(int userId, double amount, std::uint64_t &lsn, WalRecord &r);
+    bool withdrawLogged(int userId, double amount, std::uint64_t &lsn, WalRecord &r);
+    bool transferLogged(int senderId, int receiverId, double amount, std::uint64_t &lsn, WalRecord &r);
+    std::vector<BatchResult> executeAtomic(const std::vector<BatchOperation> &ops);
+    void announce(const WalRecord &r); // to push subscribers (push.hpp), once durable
+
+    // Durability (memory_storage.cpp, "Durability" section)
+    std::uint64_t recover();
+    void loadSnapshot(const std::string &path);
+    void replay(const WalRecord &r);
+    void replayEntry(int userId, int txId, EntryType type, double amount, double balance, std::int64_t micros);
+    void writeSnapshot();
+    void runSnapshots();
+
+    std::unique_ptr<Shard[]> shards;
+    std::atomic<int> nextUserId{1};
+    std::atomic<int> nextTransactionId{1};
+
+    // name -> ids, for login
+    mutable std::shared_mutex namesMutex;
+    std::unordered_multimap<std::string, int> byName;
+
+    StorageConfig cfg;
+    std::unique_ptr<Wal> wal;                  // null unless durable
+    std::unique_ptr<LedgerReplicator> replicator;
+    std::uint64_t snapshotLsn = 0;             // snapshot thread (or close) only
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotWake;
+    bool stopping = false;
+    std::thread snapshotter;
+};
+
+#endif
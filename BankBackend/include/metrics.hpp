@@ -0,0 +1,122 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "trace.hpp"
+
+// Always-on instrumentation exported in Prometheus text format.
+//
+// Latencies go into log-linear (HDR-style) histograms kept per thread, per
+// route and per phase. Each thread only ever writes its own counters with
+// relaxed stores, so recording is a clock read plus a few uncontended memory
+// operations; scrapes sum the per-thread copies.
+namespace metrics {
+
+enum class Phase : std::size_t {
+    read,         // first request byte to fully parsed request
+    parse,        // JSON body decoding
+    poolCheckout, // waiting for a pooled database connection
+    sql,          // statement execution, including retries
+    serialize,    // JSON response encoding
+    write,        // response handed to the socket
+    total,        // first request byte to response written
+    count
+};
+
+enum class Counter : std::size_t {
+    dbRetries,     // serialization failures / deadlocks retried
+    poolWaits,     // checkouts that had to wait for a connection
+    poolWaitNanos, // time spent in those waits
+    count
+};
+
+// Routes are identified by Router::Route::id. Ids past the table, and
+// requests that matched no route, are recorded under `unmatchedRoute`.
+constexpr std::size_t maxRoutes = 32;
+constexpr std::size_t unmatchedRoute = maxRoutes - 1;
+
+namespace detail {
+inline thread_local std::size_t currentRoute = unmatchedRoute;
+inline constexpr const char *phaseNames[] = {
+    "read", "parse", "pool_checkout", "sql", "serialize", "write", "total",
+};
+}
+
+// The route the calling thread is serving; phases recorded without an
+// explicit route (pool checkout, SQL, ...) are attributed to it.
+inline void setCurrentRoute(std::size_t id) {
+    detail::currentRoute = id < unmatchedRoute ? id : unmatchedRoute;
+}
+inline std::size_t currentRoute() {
+    return detail::currentRoute;
+}
+
+using Clock = std::chrono::steady_clock;
+
+inline std::uint64_t nanosBetween(Clock::time_point from, Clock::time_point to) {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+void record(std::size_t route, Phase phase, std::uint64_t nanos);
+inline void record(std::size_t route, Phase phase, Clock::time_point since) {
+    record(route, phase, nanosBetween(since, Clock::now()));
+}
+
+void add(Counter counter, std::uint64_t delta = 1);
+void countStatus(unsigned status);
+
+// Heap allocations made while serving one request of `route` (see arena.hpp)
+void countAllocations(std::size_t route, std::uint64_t allocations);
+
+// Records the enclosing scope as `phase` of the current route, and as a
+// span of the current request when it is being traced
+class ScopedPhase {
+public:
+    explicit ScopedPhase(Phase phase)
+        : phase(phase), route(currentRoute()), start(Clock::now()),
+          span(detail::phaseNames[static_cast<std::size_t>(phase)]) {}
+    ~ScopedPhase() { record(route, phase, start); }
+    ScopedPhase(const ScopedPhase &) = delete;
+    ScopedPhase &operator=(const ScopedPhase &) = delete;
+
+private:
+    Phase phase;
+    std::size_t route;
+    Clock::time_point start;
+    trace::Span span;
+};
+
+// Label used for a route in the exported series (e.g. "GET /balance")
+void nameRoute(std::size_t id, std::string name);
+
+// That label, or "unmatched". Routes are named once at startup, so the
+// pointer stays valid.
+const char *routeName(std::size_t id);
+
+// Values owned elsewhere (pool size, cache hits, ...) sampled at scrape time.
+// `type` is the Prometheus type, "gauge" or "counter".
+void registerGauge(std::string name, std::string help, const char *type, std::function<double()> read);
+
+// A histogram kept elsewhere, as read at scrape time: per upper bound, in
+// ascending order, the observations at or below it; `count` makes +Inf
+struct HistogramSample {
+    std::vector<std::pair<double, std::uint64_t>> buckets;
+    double sum = 0;
+    std::uint64_t count = 0;
+};
+
+// Exported as name_bucket{le=...}, name_sum and name_count
+void registerHistogram(std::string name, std::string help, std::function<HistogramSample()> read);
+
+// Append the full exposition to `out`
+void renderPrometheus(std::string &out);
+
+} // namespace metrics
+
+#endif
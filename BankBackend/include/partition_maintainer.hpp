@@ -0,0 +1,52 @@
+#ifndef PARTITION_MAINTAINER_HPP
+#define PARTITION_MAINTAINER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "config.hpp"
+
+// Keeps the monthly partitions of the transactions table in shape
+// (partitions::maintain() in ledger_partitions.hpp): at start, so the current
+// month has its partition before any request comes in, then every
+// LedgerConfig::maintainInterval on a pooled connection. Several server
+// instances can run it against one database; they take turns.
+//
+// A database whose transactions table predates partitioning is left alone
+// with a warning until `bankledger migrate` has converted it.
+class PartitionMaintainer {
+public:
+    struct Stats {
+        std::uint64_t created;   // partitions added
+        std::uint64_t archived;  // partitions detached into ledger_archive
+        std::uint64_t errors;    // passes cut short by a database error
+    };
+
+    static PartitionMaintainer &instance();
+
+    void start(const LedgerConfig &cfg);
+    void stop();
+
+    Stats stats() const;
+
+private:
+    PartitionMaintainer() = default;
+    ~PartitionMaintainer();
+
+    void run();
+    bool maintain(); // false if the table isn't partitioned
+
+    LedgerConfig cfg;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread worker;
+
+    std::atomic<std::uint64_t> created{0};
+    std::atomic<std::uint64_t> archived{0};
+    std::atomic<std::uint64_t> errors{0};
+};
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef PUSH_HPP
+#define PUSH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../src/models/transaction.hpp"
+#include "config.hpp"
+
+// Fan-out of account changes to push subscribers (the /events WebSocket
+// endpoint in server.cpp). Changes arrive once per server instance: through
+// the balance_changed and transaction_posted NOTIFY channels with postgres
+// (see schema.sql and ChangeListener), straight from the engine with memory.
+// The hub hands each one to the subscribers of the account it touched.
+//
+// Events go out as a WebSocket text message holding a JSON array of one or
+// more of
+//   {"event":"balance","userId":..,"balance":..}
+//   {"event":"transaction","transaction":{..as in /transactions..}}
+//   {"event":"resync"}  events were dropped: re-read the balance and page
+//                       /transactions from the last id seen
+namespace push {
+
+// One subscription's pending events. Publishers add to it under a small
+// lock and never wait for the client: balances coalesce to the latest one,
+// and past PushConfig::queue waiting transactions the backlog is dropped
+// for a single resync. Only one message is in flight per subscriber, so a
+// slow reader costs at most that bound, however fast the account changes.
+class Subscriber {
+public:
+    explicit Subscriber(int userId) : userId(userId) {}
+    virtual ~Subscriber() = default;
+
+    const int userId;
+
+    // Replace `frame` with every pending event as one JSON array; false when
+    // nothing is pending. Re-arms wake().
+    bool drain(std::string &frame);
+
+protected:
+    // Events arrived while nothing was pending. Runs on the publisher's
+    // thread and must not block: schedule a drain() on your own executor.
+    virtual void wake() = 0;
+
+private:
+    friend class Hub;
+
+    // Each returns true when the subscriber needs a wake()
+    bool offerBalance(double value, std::uint64_t version, bool &coalesced);
+    bool offerTransaction(const std::string &event, std::size_t limit, bool &overflowed);
+    bool offerResync();
+
+    std::mutex mutex;
+    std::vector<std::string> transactions; // serialized events, oldest first
+    double balance = 0;
+    std::uint64_t balanceVersion = 0;      // newest seen; older updates are ignored
+    bool balancePending = false;
+    bool resync = false;
+    bool woken = false;                    // a drain is due; no need to wake again
+};
+
+class Hub {
+public:
+    struct Stats {
+        std::size_t subscribers;
+        std::uint64_t events;     // events queued to subscribers
+        std::uint64_t coalesced;  // balance updates replaced by a newer one before they went out
+        std::uint64_t resyncs;    // resync markers queued (queue overflow or lost notifications)
+    };
+
+    static Hub &instance();
+
+    void configure(const PushConfig &cfg);
+
+    // Reads an account's current balance and calls `done` with it, possibly
+    // on another thread: -1 if there is no such account, nullopt if the read
+    // failed (the account's subscribers are then told to resync)
+    using BalanceReader = std::function<void(int userId, std::function<void(std::optional<double> balance)> done)>;
+
+    // Where balances come from when a notification doesn't carry one (a hot
+    // account, whose total lives across stripe rows). Without a reader such
+    // notifications are ignored.
+    void setBalanceReader(BalanceReader reader);
+
+    // A subscriber is held weakly; remove() it when it closes
+    void add(const std::shared_ptr<Subscriber> &subscriber);
+    void remove(const Subscriber &subscriber);
+
+    // Whether anyone is subscribed to the account; lets a publisher skip
+    // building an event nobody will read
+    bool watched(int userId) const;
+
+    // `version` orders updates that may be published out of order (the
+    // memory engine passes the ledger id of the change); 0 always applies
+    void balanceChanged(int userId, double balance, std::uint64_t version = 0);
+    void transactionPosted(const Transaction &tx);
+
+    // Changes may have been missed (the NOTIFY connection dropped): every
+    // subscriber is told to resync
+    void resyncAll();
+
+    // NOTIFY payloads: balance_changed "id,balance", or just "id" when the
+    // balance isn't in the payload (a hot account, or a deleted one: the
+    // reader finds no account and nothing is sent), and transaction_posted
+    // "id,user_id,amount,type,timestamp"
+    void applyBalanceNotification(const std::string &payload);
+    void applyTransactionNotification(const std::string &payload);
+
+    Stats stats() const;
+
+private:
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int, std::vector<std::weak_ptr<Subscriber>>> byUser;
+    };
+
+    static constexpr std::size_t shardCount = 64;
+
+    Hub() = default;
+
+    Shard &shardFor(int userId) { return shards[static_cast<unsigned>(userId) % shardCount]; }
+    const Shard &shardFor(int userId) const { return shards[static_cast<unsigned>(userId) % shardCount]; }
+    std::vector<std::shared_ptr<Subscriber>> subscribersOf(int userId) const;
+
+    // Read `userId`'s balance through the reader and publish it. One read
+    // per account is in flight at a time; changes that arrive meanwhile are
+    // covered by a single read after it.
+    void refreshBalance(int userId);
+    void readBalance(int userId);
+
+    Shard shards[shardCount];
+    std::size_t queueLimit = PushConfig{}.queue;
+    std::atomic<std::size_t> count{0};
+    std::atomic<std::uint64_t> eventCount{0};
+    std::atomic<std::uint64_t> coalescedCount{0};
+    std::atomic<std::uint64_t> resyncCount{0};
+
+    BalanceReader balanceReader;
+    std::mutex refreshMutex;
+    std::unordered_map<int, bool> refreshing; // account -> changed again since its read was sent
+};
+
+} // namespace push
+
+#endif
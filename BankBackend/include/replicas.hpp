@@ -0,0 +1,101 @@
+#ifndef REPLICAS_HPP
+#define REPLICAS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "config.hpp"
+#include "db_pool.hpp"
+
+// Read/write splitting. Balance and history reads may be served by streaming
+// replicas (DbConfig::replicas); every write, login and anything the replica
+// can't answer stays on the primary. A monitor thread measures each
+// replica's replay lag every replicaCheckInterval, and a replica further
+// behind than maxReplicaLag (or not heard from lately) is skipped until it
+// catches up: reads then go to the primary.
+//
+// Read-your-writes: an account that was written in the last stickyWindow is
+// read from the primary, so a client never sees its own deposit disappear
+// because the next request landed on a replica that hasn't replayed it yet.
+class ReplicaRouter {
+public:
+    struct Stats {
+        std::size_t replicas;
+        std::size_t usable;           // within the lag bound right now
+        std::uint64_t replicaReads;
+        std::uint64_t stickyReads;    // sent to the primary after a recent write
+        std::uint64_t fallbackReads;  // sent to the primary: no usable replica, or it failed
+        double maxLagSeconds;         // largest lag among reachable replicas
+    };
+
+    static ReplicaRouter &instance();
+
+    // Open a pool per replica and start the lag monitor. A replica that
+    // can't be reached now is retried by the monitor, never fatal.
+    void start(const DbConfig &cfg);
+    void stop();
+
+    bool enabled() const { return !replicas.empty(); }
+
+    // Replica to read `userId` from, or -1 for the primary
+    int pick(int userId);
+
+    // A replica read failed and was retried on the primary
+    void fellBack();
+
+    // `userId` is about to be written: read it from the primary for a while
+    void wrote(int userId);
+
+    ConnectionPool &pool(int replica) { return *replicas[replica]->pool; }
+    const std::string &connectionString(int replica) const { return replicas[replica]->connectionString; }
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Replica {
+        std::string connectionString;
+        std::unique_ptr<ConnectionPool> pool;
+        std::atomic<std::int64_t> lagMs{-1};     // -1 while unreachable
+        std::atomic<std::int64_t> checkedAt{0};  // ms since epoch of the last successful check
+    };
+
+    static constexpr std::size_t stickySlots = 1 << 16;
+
+    ReplicaRouter() = default;
+    ~ReplicaRouter();
+
+    std::int64_t now() const;
+    bool usable(const Replica &replica, std::int64_t at) const;
+    void monitor();
+    void check(std::size_t index);
+
+    std::vector<std::unique_ptr<Replica>> replicas;
+    std::int64_t maxLagMs = 0;
+    std::int64_t checkIntervalMs = 0;
+    std::int64_t stickyMs = 0;
+    Clock::time_point epoch = Clock::now();
+
+    // Time of each account's last write, hashed into a fixed table like the
+    // admission token buckets; a collision only sends a read to the primary
+    std::unique_ptr<std::atomic<std::int64_t>[]> lastWrite;
+
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::uint64_t> replicaReads{0};
+    std::atomic<std::uint64_t> stickyReads{0};
+    std::atomic<std::uint64_t> fallbackReads{0};
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread worker;
+};
+
+#endif
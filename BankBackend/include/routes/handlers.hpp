@@ -2,10 +2,79 @@
 #define HANDLERS_HPP
 
 #include <boost/beast/http.hpp>
+#include <functional>
+#include <memory_resource>
+#include <string>
 
 namespace http = boost::beast::http;
 
-void handle_request(const http::request<http::string_body>& req,
-                    http::response<http::string_body>& res);
+// HTTP messages as the server handles them. Headers and body take their
+// memory from a polymorphic allocator: in a server connection that is the
+// connection's arena (see arena.hpp), anywhere else the default heap.
+using MessageAllocator = std::pmr::polymorphic_allocator<char>;
+using Fields = http::basic_fields<MessageAllocator>;
+using Body = http::basic_string_body<char, std::char_traits<char>, MessageAllocator>;
+using Request = http::request<Body, Fields>;
+using Response = http::response<Body, Fields>;
+
+// Produces the body of a streamed response one piece at a time. Each call
+// fills `chunk` with the next piece and returns false once the body is
+// complete (the piece filled by that last call is still sent). A piece that
+// has to wait for other work is put off with Deferrer::deferChunk().
+using ChunkSource = std::function<bool(std::string &chunk)>;
+
+// Completes a deferred response (see Deferrer)
+using ResponseFiller = std::function<void(Response &res)>;
+
+// Finishes a deferred response with `fill`. Call it exactly once, from any
+// thread; the server runs `fill` on the connection's own strand.
+using Responder = std::function<void(ResponseFiller fill)>;
+
+// Asks for a deferred stream piece again (see Deferrer::deferChunk). Call it
+// exactly once, from any thread.
+using Resumer = std::function<void()>;
+
+// Lets a handler answer later, once work it handed to another thread is
+// done, instead of blocking an I/O thread. defer() marks the response being
+// built as pending: the server holds it (and any pipelined responses behind
+// it) until the returned Responder is called. A stream set by the handler is
+// only sent if `fill` answers 200.
+class Deferrer
+{
+public:
+    virtual Responder defer() = 0;
+
+    // From inside a ChunkSource: the next piece isn't ready. The source
+    // returns without filling anything and is called again, on the
+    // connection's strand, once the returned Resumer is called.
+    virtual Resumer deferChunk() = 0;
+
+    // Marks the stream being built as still reading from storage for its
+    // pieces: the request keeps its admission slot until the last piece is
+    // produced, so that work stays under the in-flight limit. Other streams
+    // only serialize what the handler already has and give the slot back as
+    // soon as the headers are ready.
+    virtual void keepSlot() = 0;
+
+protected:
+    ~Deferrer() = default;
+};
+
+// Fills `res` for the request. Handlers that stream their body leave it
+// empty and set `stream`; the server then sends it with chunked encoding.
+// `deferrer` is null where responses can't be deferred (benchmarks); such
+// handlers then do their work inline.
+void handle_request(const Request& req,
+                    Response& res,
+                    ChunkSource& stream,
+                    Deferrer *deferrer = nullptr);
+
+// Settle which account a GET /events WebSocket handshake subscribes to, by
+// the same rules as any request acting on an account. Browsers can't set
+// headers on a handshake, so the session token may also come as a `token`
+// query parameter. On refusal, fills `res` and returns false.
+bool authorizeSubscription(const Request &req,
+                           Response &res,
+                           int &userId);
 
 #endif
@@ -0,0 +1,101 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <boost/beast/http.hpp>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "handlers.hpp"
+
+namespace http = boost::beast::http;
+
+// Zero-copy view over a URL query string. The string is split once into
+// key/value views (no allocation); values are percent-decoded on access.
+class QueryParams {
+public:
+    enum class Status { missing, invalid, ok };
+
+    static constexpr std::size_t maxParams = 16;
+
+    QueryParams() = default;
+    explicit QueryParams(std::string_view query);
+
+    bool empty() const { return count == 0; }
+    bool has(std::string_view key) const;
+
+    // Typed accessors. `out` is only written when the result is ok.
+    Status getInt(std::string_view key, int &out) const;
+    Status getString(std::string_view key, std::string &out) const;
+
+private:
+    struct Pair {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    const Pair *find(std::string_view key) const;
+
+    std::array<Pair, maxParams> pairs{};
+    std::size_t count = 0;
+};
+
+// Decode %XX escapes (and '+' as space) from `in`, appending to `out`.
+// Returns false on a malformed escape.
+bool percentDecode(std::string_view in, std::string &out);
+
+// Everything a route handler needs about the request, parsed up front
+struct RequestContext {
+    const Request &req;
+    std::string_view path;
+    QueryParams query;
+    Deferrer *deferrer = nullptr; // see handlers.hpp
+};
+
+using RouteHandler = void (*)(RequestContext &ctx,
+                              Response &res,
+                              ChunkSource &stream);
+
+// Exact method + path dispatch. Routes are registered at startup; seal() then
+// builds a perfect hash table over them, so a lookup is one hash of the path
+// and one comparison no matter how many routes exist.
+class Router {
+public:
+    struct Route {
+        http::verb method;
+        std::string path;
+        RouteHandler handler;
+        std::size_t id; // registration order, stable for the process lifetime
+    };
+
+    void add(http::verb method, std::string path, RouteHandler handler);
+    void seal();
+
+    // nullptr if nothing is registered for this method + path
+    const Route *find(http::verb method, std::string_view path) const;
+
+    // True if the path exists under some other method (for 405 responses)
+    bool hasPath(std::string_view path) const;
+
+    const std::vector<Route> &routes() const { return table; }
+
+    // Split the target, look the route up and run it. Unknown paths get 404,
+    // known paths with the wrong method get 405. Returns the matched route,
+    // which is also made the thread's current metrics route while the
+    // handler runs. The caller finalizes the response (prepare_payload).
+    const Route *dispatch(const Request &req,
+                          Response &res,
+                          ChunkSource &stream,
+                          Deferrer *deferrer = nullptr) const;
+
+private:
+    std::uint64_t hash(http::verb method, std::string_view path) const;
+
+    std::vector<Route> table;
+    std::vector<std::int16_t> slots; // slot -> index into table, or -1
+    std::uint64_t seed = 0;
+    std::uint64_t mask = 0;
+};
+
+#endif
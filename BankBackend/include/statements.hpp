@@ -0,0 +1,41 @@
+#ifndef STATEMENTS_HPP
+#define STATEMENTS_HPP
+
+#include <pqxx/pqxx>
+#include <vector>
+
+// Catalogue of every SQL statement the backend runs on the hot path. Each one
+// is prepared once per pooled connection when the connection is opened, and
+// DB methods run them with exec_prepared() using the names below.
+namespace stmt {
+
+constexpr const char *createUser = "create_user";
+constexpr const char *registerUser = "register_user";
+constexpr const char *credentials = "credentials";
+constexpr const char *setPassword = "set_password";
+constexpr const char *getBalance = "get_balance";
+constexpr const char *deposit = "deposit";
+constexpr const char *withdraw = "withdraw";
+constexpr const char *transfer = "transfer";
+constexpr const char *transactionsForUser = "transactions_for_user";
+constexpr const char *stripedAccounts = "striped_accounts";
+constexpr const char *foldStripes = "fold_stripes";
+constexpr const char *setStripes = "set_stripes";
+
+struct Definition {
+    const char *name;
+    const char *sql;
+};
+
+// Prepare the whole catalogue on a freshly opened connection. Throws
+// pqxx::failure naming the offending statement if any of them doesn't
+// prepare against the live schema.
+void prepareAll(pqxx::connection &conn);
+
+// The catalogue itself, for connections that are not driven through pqxx
+// (AsyncDB prepares it over raw libpq)
+const std::vector<Definition> &all();
+
+} // namespace stmt
+
+#endif
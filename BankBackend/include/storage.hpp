@@ -0,0 +1,147 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "../src/models/transaction.hpp"
+#include "config.hpp"
+
+// One money movement in a batch (POST /batch)
+struct BatchOperation {
+    enum class Kind { deposit, withdraw, transfer };
+
+    Kind kind;
+    int userId;      // account credited/debited, or the sender for transfers
+    int receiverId;  // transfers only
+    double amount;
+};
+
+// Outcome of one batch item. rolledBack only occurs in atomic mode: the item
+// would have succeeded but another one failed, so nothing was applied.
+enum class BatchResult { applied, failed, rolledBack };
+
+// Outcome of a deposit, withdrawal or transfer. unknown: the connection was
+// lost while the commit was under way, so it may or may not have applied.
+enum class WriteResult { applied, failed, unknown };
+
+// Where a page of transaction history starts: after the transaction `id`,
+// stamped `timestamp` (empty when unknown). PostgreSQL pages in (timestamp,
+// id) order, so the pair is the exact position and lets it skip older months
+// of the ledger; an empty timestamp is looked up from the id. The in-memory
+// ledger is in id order and only uses `id`.
+struct HistoryCursor {
+    int id = 0;
+    std::string timestamp;
+};
+
+// A password stored for an account, for checking a login. It is a hash in
+// the format described in crypto.hpp, or plaintext for accounts registered
+// before passwords were hashed.
+struct Credential {
+    int userId;
+    std::string password;
+};
+
+// False for operations no backend would accept: a non-positive amount or a
+// transfer to the sender's own account
+bool validBatchOperation(const BatchOperation &op);
+
+// The account and ledger operations the HTTP layer needs, independent of
+// where the data lives. Every implementation is safe to call from any thread
+// and keeps the same semantics:
+//   - getBalance returns -1 for an unknown user
+//   - deposit/withdraw/transfer reject non-positive amounts and unknown users
+//   - withdraw/transfer fail without changing anything on insufficient funds
+//   - deposit/withdraw/transfer only report unknown when the outcome is
+//     truly in doubt (a connection lost during COMMIT)
+//   - a transfer moves both balances and writes both ledger rows atomically
+//   - registerUser stores the password as given; callers hash it first
+class Storage {
+public:
+    virtual ~Storage() = default;
+
+    virtual bool createUser(const std::string &name, double initialBalance) = 0;
+    virtual double getBalance(int userId) = 0;
+    virtual WriteResult deposit(int userId, double amount) = 0;
+    virtual WriteResult withdraw(int userId, double amount) = 0;
+    virtual WriteResult transfer(int senderId, int receiverId, double amount) = 0;
+    virtual bool registerUser(const std::string &name, const std::string &password, double initialBalance) = 0;
+
+    // Stored passwords of every account called `name` that has one, by id
+    virtual std::vector<Credential> credentials(const std::string &name) = 0;
+
+    // Replace an account's stored password, e.g. to upgrade a legacy or
+    // weaker hash after a successful login. Best effort; may be a no-op.
+    virtual void upgradePassword(int /*userId*/, const std::string & /*password*/) {}
+
+    // Up to `limit` transactions after the cursor, oldest first; nullopt if
+    // the backend couldn't read them
+    virtual std::optional<std::vector<Transaction>> getTransactions(int userId, const HistoryCursor &after,
+                                                                    int limit) = 0;
+
+    // Run `ops` in order and return one result per operation. Independent
+    // mode behaves like calling each operation on its own; atomic mode applies
+    // all of them or none. Later operations see the effect of earlier ones.
+    // Throws when a commit is left in doubt, as no result would be true.
+    virtual std::vector<BatchResult> executeBatch(const std::vector<BatchOperation> &ops, bool atomic) = 0;
+
+    // Completion-handler versions of the hot-path calls, for backends that
+    // can wait on the database without holding a thread; suspends() says
+    // whether this one does. `done` may run before the call returns or later
+    // on another thread, and must not block. The defaults make the blocking
+    // call and complete in place.
+    virtual bool suspends() const { return false; }
+    virtual void getBalanceAsync(int userId, std::function<void(double)> done) { done(getBalance(userId)); }
+    virtual void depositAsync(int userId, double amount, std::function<void(WriteResult)> done) {
+        done(deposit(userId, amount));
+    }
+    virtual void withdrawAsync(int userId, double amount, std::function<void(WriteResult)> done) {
+        done(withdraw(userId, amount));
+    }
+    virtual void transferAsync(int senderId, int receiverId, double amount, std::function<void(WriteResult)> done) {
+        done(transfer(senderId, receiverId, amount));
+    }
+    virtual void getTransactionsAsync(int userId, const HistoryCursor &after, int limit,
+                                      std::function<void(std::optional<std::vector<Transaction>>)> done) {
+        done(getTransactions(userId, after, limit));
+    }
+
+    // Flush and stop any background work; called once after serving stops
+    virtual void close() {}
+};
+
+// PostgreSQL through the connection pool; each call leases a DB for its
+// duration. The *Async calls go through AsyncDB when it is running.
+class PostgresStorage : public Storage {
+public:
+    bool createUser(const std::string &name, double initialBalance) override;
+    double getBalance(int userId) override;
+    WriteResult deposit(int userId, double amount) override;
+    WriteResult withdraw(int userId, double amount) override;
+    WriteResult transfer(int senderId, int receiverId, double amount) override;
+    bool registerUser(const std::string &name, const std::string &password, double initialBalance) override;
+    std::vector<Credential> credentials(const std::string &name) override;
+    void upgradePassword(int userId, const std::string &password) override;
+    std::optional<std::vector<Transaction>> getTransactions(int userId, const HistoryCursor &after, int limit) override;
+    std::vector<BatchResult> executeBatch(const std::vector<BatchOperation> &ops, bool atomic) override;
+
+    bool suspends() const override;
+    void getBalanceAsync(int userId, std::function<void(double)> done) override;
+    void depositAsync(int userId, double amount, std::function<void(WriteResult)> done) override;
+    void withdrawAsync(int userId, double amount, std::function<void(WriteResult)> done) override;
+    void transferAsync(int senderId, int receiverId, double amount, std::function<void(WriteResult)> done) override;
+    void getTransactionsAsync(int userId, const HistoryCursor &after, int limit,
+                              std::function<void(std::optional<std::vector<Transaction>>)> done) override;
+};
+
+// Create the backend named by cfg.backend. Call once at startup, before
+// serving traffic. Throws std::invalid_argument for an unknown backend.
+void initStorage(const StorageConfig &cfg);
+
+// The backend chosen by initStorage()
+Storage &storage();
+
+#endif
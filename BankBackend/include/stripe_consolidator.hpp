@@ -0,0 +1,52 @@
+#ifndef STRIPE_CONSOLIDATOR_HPP
+#define STRIPE_CONSOLIDATOR_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include "config.hpp"
+
+// Upkeep for hot accounts, whose credits land on stripe rows instead of the
+// users row (balance_stripes in schema.sql). At start it flags the accounts
+// listed in HotAccountConfig; then every consolidateInterval it folds each
+// account's stripes back into users.balance, one short transaction per
+// account on a pooled connection. That keeps users.balance topped up, so
+// debits from a hot account rarely have to fold the stripes in themselves.
+//
+// Balances are exact whether or not this runs: a fold moves money between
+// two parts of one account's balance in a single transaction.
+class StripeConsolidator {
+public:
+    struct Stats {
+        std::uint64_t folds;   // accounts whose stripes were folded in
+        std::uint64_t errors;  // passes cut short by a database error
+    };
+
+    static StripeConsolidator &instance();
+
+    void start(const HotAccountConfig &cfg);
+    void stop();
+
+    Stats stats() const;
+
+private:
+    StripeConsolidator() = default;
+    ~StripeConsolidator();
+
+    void flagAccounts();
+    void run();
+    void consolidate();
+
+    HotAccountConfig cfg;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+    std::thread worker;
+
+    std::atomic<std::uint64_t> folds{0};
+    std::atomic<std::uint64_t> errors{0};
+};
+
+#endif
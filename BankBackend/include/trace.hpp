@@ -0,0 +1,124 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+struct TraceConfig;
+
+// Sampled request tracing, written as Chrome trace-event JSON (open the file
+// in chrome://tracing or ui.perfetto.dev for a flame view).
+//
+// Whether a request is traced is decided once, when it has been read: a
+// `traceparent` header (W3C Trace Context) marked sampled always is, other
+// requests one in TraceConfig::sampleOneIn. A traced request's Context is
+// made current on whichever thread works on it (trace::Scope), and every Span
+// opened there, metrics::ScopedPhase included, is recorded as one of its
+// spans. Spans go into a buffer per thread; a background writer appends them
+// to the trace file, rotating it past TraceConfig::fileBytes.
+//
+// On threads with no sampled request current, a Span is a thread-local
+// pointer check and nothing else.
+namespace trace {
+
+using Clock = std::chrono::steady_clock;
+
+// One request's place in a trace
+struct Context {
+    std::uint64_t traceHigh = 0;
+    std::uint64_t traceLow = 0;
+    std::uint64_t remoteParent = 0; // the caller's span, from its traceparent
+    std::uint64_t root = 0;         // the span covering the whole request
+    std::uint64_t span = 0;         // innermost open span, parent of the next one
+    bool sampled = false;
+    bool propagated = false;        // arrived with a traceparent
+};
+
+namespace detail {
+inline thread_local Context *current = nullptr;
+}
+
+// The sampled request the calling thread is working for, if any
+inline bool active() {
+    return detail::current != nullptr;
+}
+
+// Copy of the current context, to carry work over to another thread
+inline Context current() {
+    return detail::current ? *detail::current : Context{};
+}
+
+// Makes `ctx` current on this thread for the enclosing scope, if sampled
+class Scope {
+public:
+    explicit Scope(Context &ctx) : previous(detail::current) {
+        if (ctx.sampled) detail::current = &ctx;
+    }
+    ~Scope() { detail::current = previous; }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    Context *previous;
+};
+
+// Records the enclosing scope as a span of the current request. `name` and
+// `what` must outlive the process (string literals, route names).
+class Span {
+public:
+    explicit Span(const char *name, const char *what = nullptr) : ctx(detail::current) {
+        if (ctx) open(name, what);
+    }
+    ~Span() {
+        if (ctx) close();
+    }
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+    // Set `what` once it is known
+    void describe(const char *text) { what = text; }
+
+private:
+    void open(const char *name, const char *what);
+    void close();
+
+    Context *ctx;
+    const char *name = nullptr;
+    const char *what = nullptr;
+    std::uint64_t id = 0;
+    std::uint64_t parent = 0;
+    Clock::time_point start;
+};
+
+void start(const TraceConfig &cfg);
+void stop(); // writes out what is buffered and closes the file
+
+bool enabled();
+
+// Start the trace for a request that carried `traceparent` (empty if none):
+// continue the caller's trace or start a new one, and decide on sampling
+Context begin(std::string_view traceparent);
+
+// `00-<trace id>-<root span>-<flags>`, sent back so the caller can find the
+// request in the trace
+std::string header(const Context &ctx);
+
+// A span of `ctx` timed elsewhere, e.g. by a callback on another thread
+void record(const Context &ctx, const char *name, Clock::time_point start, Clock::time_point end,
+            const char *what = nullptr);
+
+// The request's own span, once its response is written
+void finish(const Context &ctx, const char *route, Clock::time_point start, Clock::time_point end);
+
+struct Stats {
+    std::uint64_t sampled;  // requests traced
+    std::uint64_t spans;    // spans written to the file
+    std::uint64_t dropped;  // spans lost to a full thread buffer
+};
+Stats stats();
+
+} // namespace trace
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// One logged change to the in-memory ledger. Money movements carry the
+// resulting balances and transaction ids, so replaying a record is idempotent
+// and never has to re-check funds.
+struct WalRecord {
+    enum class Type : std::uint8_t { createUser = 1, deposit = 2, withdraw = 3, transfer = 4, batch = 5 };
+
+    Type type = Type::deposit;
+    std::uint64_t lsn = 0;       // assigned by Wal::append
+    int userId = 0;              // account created/credited/debited, or the transfer sender
+    int receiverId = 0;          // transfer only
+    int txId = 0;                // ledger entry on userId
+    int receiverTxId = 0;        // ledger entry on receiverId
+    double amount = 0.0;
+    double balance = 0.0;        // userId's balance afterwards (initial balance for createUser)
+    double receiverBalance = 0.0;
+    std::int64_t micros = 0;     // wall clock of the change
+    bool hasPassword = false;    // createUser only
+    std::string name;
+    std::string password;
+    std::vector<WalRecord> items; // batch only: money movements applied together
+};
+
+// Append-only binary write-ahead log split into segment files
+// (wal-<first lsn>.log). Records are framed as
+//   u32 payload length | u32 crc32 | u64 lsn | u8 type | payload
+// Appends only copy into a buffer; a writer thread writes and fdatasyncs
+// whatever accumulated since its last sync, so one fsync covers every
+// operation that arrived meanwhile (group commit).
+class Wal {
+public:
+    struct Options {
+        std::string dir;
+        std::chrono::microseconds syncWindow{0};     // extra wait to grow a batch
+        std::size_t segmentBytes = 64 * 1024 * 1024; // roll to a new file past this size
+    };
+
+    struct Stats {
+        std::uint64_t records;
+        std::uint64_t syncs;
+        std::uint64_t bytes;
+        std::uint64_t durableLsn;
+    };
+
+    Wal() = default;
+    ~Wal();
+    Wal(const Wal &) = delete;
+    Wal &operator=(const Wal &) = delete;
+
+    // Start appending; the first record gets `nextLsn`. Throws on I/O errors.
+    void open(const Options &options, std::uint64_t nextLsn);
+    void close();
+
+    // Assign the next LSN and queue the record. Callers hold the locks that
+    // ordered the change, so log order matches apply order per account.
+    std::uint64_t append(WalRecord &record);
+
+    // Block until `lsn` is on disk
+    void waitDurable(std::uint64_t lsn);
+
+    std::uint64_t nextLsn();
+    std::uint64_t durableLsn();
+
+    // Start a new segment with the next batch, so everything appended so far
+    // can be dropped once a snapshot covers it
+    void rotate();
+
+    // Delete segments whose records all have lsn < `lsn`
+    void removeSegmentsBefore(std::uint64_t lsn);
+
+    Stats stats();
+
+    // Segment paths in LSN order
+    static std::vector<std::string> segments(const std::string &dir);
+
+private:
+    void run();
+    void openSegment(std::uint64_t firstLsn);
+
+    Options opts;
+    std::mutex mutex;
+    std::condition_variable work;    // writer: records pending or stopping
+    std::condition_variable durable; // appenders: durableLsn advanced
+    std::string pending;             // encoded, not yet written
+    std::uint64_t next = 1;
+    std::uint64_t synced = 0;
+    std::uint64_t pendingFirst = 0;  // lsn of the first record in `pending`
+    bool rotateRequested = false;
+    bool stopping = false;
+    std::uint64_t recordCount = 0;
+    std::uint64_t syncCount = 0;
+    std::uint64_t byteCount = 0;
+
+    int fd = -1;                     // writer thread only
+    std::size_t segmentSize = 0;
+    std::thread writer;
+};
+
+// Sequential reader over the segments in a directory, used for recovery and
+// by the replicator to tail the log.
+class WalReader {
+public:
+    explicit WalReader(std::string dir);
+    ~WalReader();
+    WalReader(const WalReader &) = delete;
+    WalReader &operator=(const WalReader &) = delete;
+
+    // Read the next record with lsn <= upTo. Returns false at the end of the
+    // written log or on a torn/corrupt record (see torn()).
+    bool next(WalRecord &record, std::uint64_t upTo = UINT64_MAX);
+
+    // True if reading stopped at a damaged record rather than a clean end
+    bool torn() const { return damaged; }
+
+    // Truncate the current segment at the last intact record, after a crash
+    // mid-write. Throws if later segments exist, since that is corruption.
+    void truncateTail();
+
+private:
+    bool openNext();
+    bool fill(std::size_t need);
+
+    std::string dir;
+    std::string path;
+    int fd = -1;
+    std::uint64_t offset = 0;   // file offset of buffer[0]
+    std::string buffer;
+    std::size_t pos = 0;
+    bool damaged = false;
+};
+
+// CRC-32 (IEEE). Chainable: crc32(b, n, crc32(a, m)) is the CRC of a then b.
+std::uint32_t crc32(const char *data, std::size_t size, std::uint32_t crc = 0);
+
+// fsync a directory so a file created or renamed in it survives a crash
+void syncDirectory(const std::string &dir);
+
+#endif
@@ -1,21 +1,176 @@
 
 
 -- Drop tables if they exist (for re-runs during dev)
-DROP TABLE IF EXISTS transactions; -- Remove transactions table if it exists
+DROP TABLE IF EXISTS ledger_replication; -- Remove replication progress if it exists
+DROP TABLE IF EXISTS balance_stripes; -- Remove hot-account stripes if they exist
+DROP TABLE IF EXISTS transactions; -- Remove transactions table (and its partitions) if it exists
 DROP TABLE IF EXISTS users; -- Remove users table if it exists
 
 CREATE TABLE users (
   id SERIAL PRIMARY KEY, -- Auto-incrementing user ID
   name TEXT NOT NULL, -- User's name
-  balance NUMERIC NOT NULL DEFAULT 0 -- Account balance with default 0
+  password TEXT, -- Salted PBKDF2 hash of the login password (NULL for users made through /createUser)
+  balance NUMERIC NOT NULL DEFAULT 0, -- Account balance with default 0 (hot accounts: the part not in balance_stripes)
+  stripes INT NOT NULL DEFAULT 0 CHECK (stripes >= 0) -- Credit stripes of a hot account; 0 = an ordinary account
 );
 
+-- Login looks accounts up by name
+CREATE INDEX users_name_idx ON users (name);
+
+-- The ledger, range-partitioned by month: transactions_YYYY_MM holds that
+-- month's rows and transactions_default anything no month partition covers
+-- yet (an import of old history, say). The server's PartitionMaintainer and
+-- `bankledger maintain` create months ahead of time, move rows out of the
+-- default partition into their month, and detach months past the retention
+-- period into the ledger_archive schema. The primary key has to include the
+-- partition key; ids still come from one sequence and are unique.
 CREATE TABLE transactions (
-  id SERIAL PRIMARY KEY, -- Auto-incrementing transaction ID
+  id SERIAL, -- Auto-incrementing transaction ID
   user_id INT NOT NULL REFERENCES users(id) ON DELETE CASCADE, -- Linked user ID
   amount NUMERIC NOT NULL, -- Transaction amount
-  type TEXT NOT NULL CHECK (type IN ('deposit', 'withdrawal')), -- Type must be deposit or withdrawal
-  timestamp TIMESTAMP DEFAULT CURRENT_TIMESTAMP -- Time the transaction occurred
+  type TEXT NOT NULL CHECK (type IN ('deposit', 'withdrawal', 'transfer_sent', 'transfer_received')), -- Kind of movement
+  timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP, -- Time the transaction occurred
+  PRIMARY KEY (id, timestamp)
+) PARTITION BY RANGE (timestamp);
+
+CREATE TABLE transactions_default PARTITION OF transactions DEFAULT;
+
+-- History lookups page through one user's transactions in (timestamp, id)
+-- order; the included columns let them be answered from the index alone
+CREATE INDEX transactions_user_id_timestamp_idx ON transactions (user_id, timestamp, id) INCLUDE (amount, type);
+
+-- Hot accounts (users.stripes > 0) take credits on one of their stripe rows
+-- instead of users.balance, so concurrent credits don't all queue on one row
+-- lock. An account's balance is always users.balance plus the sum of its
+-- stripes; debits draw on users.balance and fold the stripes into it when
+-- that is short, and the server's consolidator folds them in regularly.
+-- Rows are only ever added (see set_account_stripes).
+CREATE TABLE balance_stripes (
+  user_id INT NOT NULL REFERENCES users(id) ON DELETE CASCADE,
+  stripe INT NOT NULL,
+  balance NUMERIC NOT NULL DEFAULT 0,
+  PRIMARY KEY (user_id, stripe)
 );
 
+-- The stripe a credit to a hot account lands on. By default the one the
+-- session's backend hashes to, so each pooled connection keeps to its own
+-- stripe and two only share one when there are more connections than
+-- stripes. With bank.stripe_pick = 'round_robin' (ALTER DATABASE ... SET)
+-- successive credits cycle through the stripes instead.
+DROP SEQUENCE IF EXISTS credit_stripe_seq;
+CREATE SEQUENCE credit_stripe_seq;
+
+CREATE OR REPLACE FUNCTION credit_stripe(stripe_count INT) RETURNS INT AS $$
+  SELECT (abs(CASE current_setting('bank.stripe_pick', true)
+                WHEN 'round_robin' THEN nextval('credit_stripe_seq')
+                ELSE hashint4(pg_backend_pid())
+              END) % stripe_count)::int
+$$ LANGUAGE sql VOLATILE;
+
+-- Move everything an account's stripes hold into users.balance and return
+-- the amount. Locks the account row first and its stripes second, the order
+-- debits take them in.
+CREATE OR REPLACE FUNCTION fold_stripes(account INT) RETURNS NUMERIC AS $$
+DECLARE
+  folded NUMERIC;
+BEGIN
+  PERFORM 1 FROM users WHERE id = account FOR NO KEY UPDATE;
+  IF NOT FOUND THEN
+    RETURN 0;
+  END IF;
+  SELECT COALESCE(sum(balance), 0) INTO folded
+    FROM (SELECT balance FROM balance_stripes WHERE user_id = account FOR UPDATE) locked;
+  IF folded <> 0 THEN
+    UPDATE balance_stripes SET balance = 0 WHERE user_id = account AND balance <> 0;
+    UPDATE users SET balance = balance + folded WHERE id = account;
+  END IF;
+  RETURN folded;
+END;
+$$ LANGUAGE plpgsql;
+
+-- A debit that users.balance alone can't cover: fold the account's stripes
+-- in and try again. Returns the debited row, or nothing if the money still
+-- isn't there (or there were no stripes to fold).
+CREATE OR REPLACE FUNCTION debit_from_stripes(account INT, amount NUMERIC)
+RETURNS TABLE (id INT, balance NUMERIC, stripes INT) AS $$
+BEGIN
+  IF fold_stripes(account) = 0 THEN
+    RETURN;
+  END IF;
+  RETURN QUERY
+    UPDATE users u SET balance = u.balance - amount
+     WHERE u.id = account AND u.balance >= amount
+    RETURNING u.id, u.balance, u.stripes;
+END;
+$$ LANGUAGE plpgsql;
+
+-- Flag an account hot with `stripe_count` stripes, or make it ordinary again
+-- with 0. False if there is no such account. Stripe rows are kept when the
+-- count shrinks, so a credit still aimed at an old stripe isn't lost; it is
+-- folded in with the rest.
+CREATE OR REPLACE FUNCTION set_account_stripes(account INT, stripe_count INT) RETURNS BOOLEAN AS $$
+BEGIN
+  UPDATE users SET stripes = stripe_count WHERE id = account;
+  IF NOT FOUND THEN
+    RETURN false;
+  END IF;
+  PERFORM fold_stripes(account);
+  INSERT INTO balance_stripes (user_id, stripe)
+  SELECT account, s FROM generate_series(0, stripe_count - 1) s
+  ON CONFLICT DO NOTHING;
+  RETURN true;
+END;
+$$ LANGUAGE plpgsql;
+
+-- How far the memory ledger's WAL has been replicated into the tables above
+-- (single row, id = 1). Written by the server's replicator, not by hand.
+CREATE TABLE ledger_replication (
+  id INT PRIMARY KEY,
+  lsn BIGINT NOT NULL
+);
+
+-- Broadcast every balance change so each backend instance can keep its
+-- in-process balance cache coherent. Payload is "id,balance", or just "id"
+-- when the account is deleted or its balance isn't known from this row alone
+-- (a hot account's stripes take credits concurrently).
+CREATE OR REPLACE FUNCTION notify_balance_changed() RETURNS trigger AS $$
+BEGIN
+  IF TG_OP = 'DELETE' THEN
+    PERFORM pg_notify('balance_changed', OLD.id::text);
+  ELSIF NEW.stripes > 0 THEN
+    PERFORM pg_notify('balance_changed', NEW.id::text);
+  ELSE
+    PERFORM pg_notify('balance_changed', NEW.id || ',' || NEW.balance);
+  END IF;
+  RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE TRIGGER users_balance_changed
+AFTER UPDATE OF balance OR DELETE ON users
+FOR EACH ROW EXECUTE FUNCTION notify_balance_changed();
+
+CREATE OR REPLACE FUNCTION notify_stripe_changed() RETURNS trigger AS $$
+BEGIN
+  PERFORM pg_notify('balance_changed', NEW.user_id::text);
+  RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
+
+CREATE TRIGGER balance_stripes_changed
+AFTER UPDATE OF balance ON balance_stripes
+FOR EACH ROW EXECUTE FUNCTION notify_stripe_changed();
+
+-- Announce every new transaction for push subscribers (the /events
+-- WebSocket endpoint). Payload is "id,user_id,amount,type,timestamp".
+CREATE OR REPLACE FUNCTION notify_transaction_posted() RETURNS trigger AS $$
+BEGIN
+  PERFORM pg_notify('transaction_posted',
+    NEW.id || ',' || NEW.user_id || ',' || NEW.amount || ',' || NEW.type || ',' || NEW.timestamp);
+  RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
 
+CREATE TRIGGER transactions_posted
+AFTER INSERT ON transactions
+FOR EACH ROW EXECUTE FUNCTION notify_transaction_posted();
@@ -0,0 +1,291 @@
+#include "../include/admission.hpp"
+#include "../include/auth.hpp"
+#include "../include/json_codec.hpp"
+#include "../include/log.hpp"
+#include "../include/routes/router.hpp"
+#include <algorithm>
+#include <limits>
+
+namespace http = boost::beast::http;
+
+namespace admission {
+namespace {
+
+constexpr std::uint64_t millitokensPerToken = 1000;
+constexpr std::uint64_t maxBurst = 4000000; // capacity must fit the bucket's 32 token bits
+
+std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+std::chrono::seconds roundUp(std::chrono::milliseconds wait) {
+    return std::chrono::seconds(std::max<std::int64_t>(1, (wait.count() + 999) / 1000));
+}
+
+// Which account a request acts on, for the per-account limit: the session
+// token's user, else a userId in the query string, else a top-level userId
+// or senderId in the JSON body. 0 when there is none.
+int requestAccount(const Request &req) {
+    const auto header = req.find(http::field::authorization);
+    if (header != req.end()) {
+        constexpr std::string_view scheme = "Bearer ";
+        std::string_view value(header->value().data(), header->value().size());
+        int userId;
+        if (value.substr(0, scheme.size()) == scheme &&
+            auth::SessionStore::instance().resolve(value.substr(scheme.size()), userId))
+            return userId;
+    }
+
+    std::string_view target(req.target().data(), req.target().size());
+    const std::size_t queryStart = target.find('?');
+    if (queryStart != std::string_view::npos) {
+        int userId;
+        if (QueryParams(target.substr(queryStart + 1)).getInt("userId", userId) == QueryParams::Status::ok)
+            return userId;
+    }
+
+    if (req.body().empty()) return 0;
+    try {
+        codec::Reader r(req.body());
+        r.expect('{');
+        if (r.consume('}')) return 0;
+        do {
+            const std::string_view key = r.readKey();
+            if (key == "userId" || key == "senderId") return r.readInt();
+            r.skipValue();
+        } while (r.consume(','));
+    } catch (const codec::ParseError &) {
+        // The handler reports malformed bodies
+    }
+    return 0;
+}
+
+} // namespace
+
+TokenBuckets::TokenBuckets(unsigned tokensPerSecond, unsigned burst, std::size_t slots)
+    : rate(tokensPerSecond),
+      capacity(std::min<std::uint64_t>(std::max(1u, burst), maxBurst) * millitokensPerToken),
+      mask(slots - 1),
+      epoch(Clock::now()) {
+    // slots is a power of two; zero means an untouched (full) bucket
+    buckets = std::make_unique<std::atomic<std::uint64_t>[]>(slots);
+    for (std::size_t i = 0; i < slots; ++i) buckets[i].store(0, std::memory_order_relaxed);
+}
+
+bool TokenBuckets::take(std::uint64_t key, std::chrono::milliseconds &retryAfter) {
+    // Bucket word: last refill (ms since epoch, wrapping) << 32 | millitokens
+    const auto now = static_cast<std::uint32_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count());
+    std::atomic<std::uint64_t> &bucket = buckets[mix(key) & mask];
+
+    std::uint64_t old = bucket.load(std::memory_order_relaxed);
+    for (;;) {
+        std::uint64_t tokens = capacity;
+        if (old != 0) {
+            // Slightly negative when another thread stored a later time
+            // first; very negative only after the clock wrapped (49 days)
+            auto elapsed = static_cast<std::int32_t>(now - static_cast<std::uint32_t>(old >> 32));
+            if (elapsed < 0) elapsed = elapsed > -60000 ? 0 : std::numeric_limits<std::int32_t>::max();
+            tokens = std::min<std::uint64_t>(capacity, (old & 0xffffffffULL) + static_cast<std::uint64_t>(elapsed) * rate);
+        }
+        if (tokens < millitokensPerToken) {
+            retryAfter = std::chrono::milliseconds((millitokensPerToken - tokens + rate - 1) / rate);
+            return false;
+        }
+        std::uint64_t next = static_cast<std::uint64_t>(now) << 32 | (tokens - millitokensPerToken);
+        if (next == 0) next = 1; // 0 is reserved for untouched buckets
+        if (bucket.compare_exchange_weak(old, next, std::memory_order_relaxed)) return true;
+    }
+}
+
+Controller &Controller::instance() {
+    static Controller controller;
+    return controller;
+}
+
+Controller::~Controller() {
+    stop();
+}
+
+void Controller::start(const AdmissionConfig &config) {
+    cfg = config;
+    if (cfg.clientRate > 0) {
+        clientBuckets = std::make_unique<TokenBuckets>(cfg.clientRate, cfg.clientBurst ? cfg.clientBurst : cfg.clientRate);
+    }
+    if (cfg.accountRate > 0) {
+        accountBuckets =
+            std::make_unique<TokenBuckets>(cfg.accountRate, cfg.accountBurst ? cfg.accountBurst : cfg.accountRate);
+    }
+    streamLimit = cfg.maxStreams;
+    if (streamLimit == 0 && cfg.maxInFlight > 0) streamLimit = std::max<std::size_t>(1, cfg.maxInFlight / 4);
+    if (cfg.maxInFlight > 0) {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = true;
+        sweeper = std::thread([this] { sweep(); });
+    }
+    LOG_INFO("admission_started", {"maxInFlight", cfg.maxInFlight}, {"maxStreams", streamLimit}, {"queue", cfg.maxQueued},
+             {"deadlineMs", static_cast<std::int64_t>(cfg.queueDeadline.count())}, {"clientRate", cfg.clientRate},
+             {"accountRate", cfg.accountRate});
+}
+
+void Controller::stop() {
+    std::deque<Waiter> left;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return;
+        running = false;
+        left.swap(waiters);
+        waiting.store(0);
+    }
+    wakeup.notify_all();
+    sweeper.join();
+    for (Waiter &w : left) w.decide(false);
+}
+
+bool Controller::tryAcquire() {
+    if (cfg.maxInFlight == 0) {
+        inFlight.fetch_add(1);
+        return true;
+    }
+    std::size_t current = inFlight.load();
+    while (current < cfg.maxInFlight) {
+        if (inFlight.compare_exchange_weak(current, current + 1)) return true;
+    }
+    return false;
+}
+
+Outcome Controller::enter(std::uint64_t client, const Request &req,
+                          std::chrono::seconds &retryAfter) {
+    std::string_view target(req.target().data(), req.target().size());
+    if (target.substr(0, target.find('?')) == "/metrics") return Outcome::bypass; // scrapes must work under load
+
+    std::chrono::milliseconds delay{0};
+    if (clientBuckets && !clientBuckets->take(client, delay)) {
+        limitedClientCount.fetch_add(1, std::memory_order_relaxed);
+        retryAfter = roundUp(delay);
+        return Outcome::rateLimited;
+    }
+    if (accountBuckets) {
+        const int account = requestAccount(req);
+        if (account != 0 && !accountBuckets->take(static_cast<std::uint32_t>(account), delay)) {
+            limitedAccountCount.fetch_add(1, std::memory_order_relaxed);
+            retryAfter = roundUp(delay);
+            return Outcome::rateLimited;
+        }
+    }
+
+    // Newcomers only skip the queue when nobody is waiting in it
+    if (waiting.load() == 0 && tryAcquire()) {
+        admittedCount.fetch_add(1, std::memory_order_relaxed);
+        return Outcome::admitted;
+    }
+    return Outcome::wait;
+}
+
+Outcome Controller::wait(Callback onDecision, std::chrono::seconds &retryAfter) {
+    std::vector<Callback> shed;
+    Outcome outcome;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        expire(shed);
+        // Announce the waiter before the last look at inFlight; leave() does
+        // the opposite, so one of the two always sees the other
+        waiting.store(waiters.size() + 1);
+        if (waiters.empty() && tryAcquire()) {
+            admittedCount.fetch_add(1, std::memory_order_relaxed);
+            outcome = Outcome::admitted;
+        } else if (waiters.size() >= cfg.maxQueued) {
+            shedOverloadCount.fetch_add(1, std::memory_order_relaxed);
+            retryAfter = roundUp(cfg.queueDeadline);
+            outcome = Outcome::overloaded;
+        } else {
+            waiters.push_back({Clock::now() + cfg.queueDeadline, std::move(onDecision)});
+            outcome = Outcome::queued;
+        }
+        waiting.store(waiters.size());
+    }
+    for (Callback &cb : shed) cb(false);
+    return outcome;
+}
+
+void Controller::leave() {
+    inFlight.fetch_sub(1);
+    if (waiting.load() == 0) return;
+
+    std::vector<Callback> shed, admitted;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        expire(shed);
+        while (!waiters.empty() && tryAcquire()) {
+            admitted.push_back(std::move(waiters.front().decide));
+            waiters.pop_front();
+        }
+        waiting.store(waiters.size());
+    }
+    admittedCount.fetch_add(admitted.size(), std::memory_order_relaxed);
+    for (Callback &cb : shed) cb(false);
+    for (Callback &cb : admitted) cb(true);
+}
+
+bool Controller::enterStream() {
+    std::size_t current = streams.load();
+    while (streamLimit == 0 || current < streamLimit) {
+        if (streams.compare_exchange_weak(current, current + 1)) return true;
+    }
+    shedStreamsCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Controller::leaveStream() {
+    streams.fetch_sub(1);
+}
+
+void Controller::expire(std::vector<Callback> &shed) {
+    const auto now = Clock::now();
+    while (!waiters.empty() && waiters.front().deadline <= now) {
+        shed.push_back(std::move(waiters.front().decide));
+        waiters.pop_front();
+        shedDeadlineCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Controller::sweep() {
+    const auto interval = std::max(std::chrono::milliseconds(1), cfg.queueDeadline / 4);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        wakeup.wait_for(lock, interval);
+        std::vector<Callback> shed;
+        expire(shed);
+        waiting.store(waiters.size());
+        lock.unlock();
+        for (Callback &cb : shed) cb(false);
+        lock.lock();
+    }
+}
+
+Stats Controller::stats() const {
+    return {inFlight.load(std::memory_order_relaxed),
+            waiting.load(std::memory_order_relaxed),
+            streams.load(std::memory_order_relaxed),
+            admittedCount.load(std::memory_order_relaxed),
+            shedOverloadCount.load(std::memory_order_relaxed),
+            shedDeadlineCount.load(std::memory_order_relaxed),
+            shedStreamsCount.load(std::memory_order_relaxed),
+            limitedClientCount.load(std::memory_order_relaxed),
+            limitedAccountCount.load(std::memory_order_relaxed)};
+}
+
+std::uint64_t clientKey(const unsigned char *address, std::size_t size) {
+    std::uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    for (std::size_t i = 0; i < size; ++i) {
+        h ^= address[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+} // namespace admission
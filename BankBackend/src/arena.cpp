@@ -0,0 +1,94 @@
+#include "../include/arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+// Plain thread_local: zero-initialized, so reading it needs no guard
+thread_local std::uint64_t allocations = 0;
+
+std::size_t alignUp(std::size_t n, std::size_t alignment) {
+    return (n + alignment - 1) & ~(alignment - 1);
+}
+
+} // namespace
+
+// Counting replacement for the global allocator. operator new[] and the
+// nothrow forms forward here in libstdc++, and its operator delete frees
+// with free(), so replacing this pair covers everything but over-aligned
+// allocations (which are rare and not counted).
+void *operator new(std::size_t bytes) {
+    ++allocations;
+    for (;;) {
+        if (void *p = std::malloc(bytes ? bytes : 1)) return p;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace arena {
+
+std::uint64_t heapAllocations() {
+    return allocations;
+}
+
+Arena::Arena(std::size_t initial, std::size_t retain)
+    : retain(std::max(initial, retain)), size(initial), block(new std::byte[initial]) {}
+
+Arena::~Arena() {
+    releaseSpills();
+}
+
+void *Arena::do_allocate(std::size_t bytes, std::size_t alignment) {
+    const auto base = reinterpret_cast<std::uintptr_t>(block.get());
+    const std::size_t start = alignUp(base + offset, alignment) - base;
+    if (start + bytes <= size) {
+        offset = start + bytes;
+        return block.get() + start;
+    }
+
+    // Doesn't fit: a heap block of its own, freed by the next rewind
+    const std::size_t header = alignUp(sizeof(Spill), std::max(alignment, alignof(Spill)));
+    const std::size_t total = header + bytes;
+    const std::size_t align = std::max(alignment, alignof(Spill));
+    auto *raw = static_cast<std::byte *>(::operator new(total, std::align_val_t(align)));
+    ++allocations; // the aligned operator new isn't counted by itself
+    spills = new (raw) Spill{spills, total, align};
+    spilled += bytes;
+    return raw + header;
+}
+
+void Arena::releaseSpills() {
+    while (spills) {
+        Spill *next = spills->next;
+        ::operator delete(spills, spills->bytes, std::align_val_t(spills->alignment));
+        spills = next;
+    }
+}
+
+void Arena::rewind() {
+    if (spills) {
+        // Grow to what the last request needed, so the next one like it fits
+        const std::size_t needed = std::min(retain, alignUp(offset + spilled, 4096));
+        releaseSpills();
+        if (needed > size) {
+            block.reset();
+            block.reset(new std::byte[needed]);
+            size = needed;
+        }
+    }
+    offset = 0;
+    spilled = 0;
+}
+
+} // namespace arena
@@ -0,0 +1,535 @@
+#include "../include/async_db.hpp"
+#include "../include/balance_cache.hpp"
+#include "../include/group_commit.hpp"
+#include "../include/log.hpp"
+#include "../include/metrics.hpp"
+#include "../include/replicas.hpp"
+#include "../include/statements.hpp"
+#include <boost/asio/dispatch.hpp>
+#include <boost/asio/post.hpp>
+#include <poll.h>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <utility>
+
+namespace net = boost::asio;
+
+namespace {
+
+constexpr int maxAttempts = 3;
+constexpr std::chrono::milliseconds retryBackoff{5};
+constexpr std::chrono::seconds reconnectDelay{1};
+
+std::string param(int value) {
+    return std::to_string(value);
+}
+
+// Shortest text that reads back as the same double, as pqxx sends it
+std::string param(double value) {
+    char buf[32];
+    const auto end = std::to_chars(buf, buf + sizeof buf, value).ptr;
+    return std::string(buf, end);
+}
+
+int integer(const PGresult *r, int row, int column) {
+    const char *text = PQgetvalue(r, row, column);
+    int value = 0;
+    std::from_chars(text, text + PQgetlength(r, row, column), value);
+    return value;
+}
+
+double number(const PGresult *r, int row, int column) {
+    const char *text = PQgetvalue(r, row, column);
+    double value = 0;
+    std::from_chars(text, text + PQgetlength(r, row, column), value);
+    return value;
+}
+
+// Serialization failures and deadlocks guarantee nothing was applied
+bool retryable(const PGresult *r) {
+    const char *state = PQresultErrorField(r, PG_DIAG_SQLSTATE);
+    return state && (std::strcmp(state, "40001") == 0 || std::strcmp(state, "40P01") == 0);
+}
+
+// nullopt for a failed query, which callers must not take for an empty page
+std::optional<std::vector<Transaction>> transactionRows(const PGresult *r) {
+    if (!r) return std::nullopt;
+    std::vector<Transaction> transactions;
+    const int rows = PQntuples(r);
+    transactions.reserve(rows);
+    for (int row = 0; row < rows; ++row) {
+        transactions.emplace_back(integer(r, row, 0), integer(r, row, 1), number(r, row, 2),
+                                  PQgetvalue(r, row, 3), PQgetvalue(r, row, 4));
+    }
+    return transactions;
+}
+
+// Write-through from a money-movement statement's (id, balance) rows; a
+// NULL balance is a hot account's, whose total the statement doesn't know
+void cacheRows(const PGresult *r) {
+    BalanceCache &cache = BalanceCache::instance();
+    if (!cache.enabled()) return;
+    for (int row = 0; row < PQntuples(r); ++row) {
+        if (PQgetisnull(r, row, 1)) {
+            cache.invalidate(integer(r, row, 0));
+        } else {
+            cache.put(integer(r, row, 0), number(r, row, 1));
+        }
+    }
+}
+
+// With group commit on, money movements go through the committer as in DB.
+// Its callback runs on the committer thread, so nothing blocks either way.
+bool viaGroupCommit(const GroupCommitter::Operation &op, const AsyncDB::DoneCallback &done) {
+    GroupCommitter &committer = GroupCommitter::instance();
+    if (!committer.enabled()) return false;
+    const std::size_t route = metrics::currentRoute();
+    const auto start = metrics::Clock::now();
+    committer.submit(op, [done, route, start, traced = trace::current()](WriteResult result) {
+        metrics::record(route, metrics::Phase::sql, start);
+        trace::record(traced, "sql", start, metrics::Clock::now(), "group_commit");
+        done(result);
+    });
+    return true;
+}
+
+} // namespace
+
+AsyncDB::Connection::Connection(net::io_context &ioc, Endpoint &endpoint)
+    : endpoint(endpoint), strand(net::make_strand(ioc)), socket(strand), timer(strand) {}
+
+// Never destroyed: the connections belong to an io_context that is gone by
+// the time statics are torn down, so stop() is what closes them
+AsyncDB &AsyncDB::instance() {
+    static AsyncDB &db = *new AsyncDB;
+    return db;
+}
+
+void AsyncDB::start(net::io_context &ioc, const DbConfig &config) {
+    cfg = config;
+    if (cfg.asyncConnections == 0) return;
+    primary.connectionString = cfg.connectionString;
+    for (const std::string &url : cfg.replicas) {
+        replicas.push_back(std::make_unique<Endpoint>());
+        replicas.back()->connectionString = url;
+    }
+    started.store(true, std::memory_order_release);
+    open(ioc, primary);
+    for (auto &replica : replicas) open(ioc, *replica);
+    LOG_INFO("async_db_started", {"connections", cfg.asyncConnections}, {"replicas", replicas.size()});
+}
+
+void AsyncDB::open(net::io_context &ioc, Endpoint &endpoint) {
+    for (std::size_t i = 0; i < cfg.asyncConnections; ++i) {
+        endpoint.connections.push_back(std::make_unique<Connection>(ioc, endpoint));
+    }
+    for (auto &c : endpoint.connections) {
+        net::post(c->strand, [this, conn = c.get()] { connect(*conn); });
+    }
+}
+
+void AsyncDB::stop() {
+    if (!started.exchange(false)) return;
+    close(primary);
+    for (auto &replica : replicas) close(*replica);
+}
+
+void AsyncDB::close(Endpoint &endpoint) {
+    for (auto &c : endpoint.connections) disconnect(*c);
+    endpoint.connections.clear();
+    std::lock_guard<std::mutex> lock(endpoint.mutex);
+    endpoint.idle.clear();
+    endpoint.backlog.clear();
+    endpoint.readyCount = 0;
+}
+
+AsyncDB::Stats AsyncDB::stats() {
+    Stats s{0, 0};
+    auto add = [&s](Endpoint &endpoint) {
+        std::lock_guard<std::mutex> lock(endpoint.mutex);
+        s.connections += endpoint.readyCount;
+        s.queued += endpoint.backlog.size();
+    };
+    add(primary);
+    for (auto &replica : replicas) add(*replica);
+    return s;
+}
+
+// ---- Queries ----
+
+void AsyncDB::submit(Endpoint &endpoint, Query query) {
+    if (query.trace.sampled) query.submitted = trace::Clock::now();
+    Connection *c;
+    {
+        std::lock_guard<std::mutex> lock(endpoint.mutex);
+        if (endpoint.idle.empty()) {
+            endpoint.backlog.push_back(std::move(query));
+            return;
+        }
+        c = endpoint.idle.back(); // LIFO, like the blocking pool
+        endpoint.idle.pop_back();
+    }
+    net::dispatch(c->strand, [this, c, q = std::make_unique<Query>(std::move(query))]() mutable {
+        c->query = std::move(q);
+        c->watching = false;
+        c->socket.cancel();
+        send(*c);
+    });
+}
+
+// A replica that fails the query, or whose answer `onReplica` turns down,
+// hands it to the primary. Either way the caller's callback runs once.
+void AsyncDB::read(int userId, Query query, ReplicaCallback onReplica) {
+    const int replica = replicas.empty() ? -1 : ReplicaRouter::instance().pick(userId);
+    if (replica < 0) return submit(primary, std::move(query));
+
+    // Don't queue behind a replica whose connections are all down; the
+    // monitor may not have noticed yet
+    Endpoint &endpoint = *replicas[replica];
+    bool up;
+    {
+        std::lock_guard<std::mutex> lock(endpoint.mutex);
+        up = endpoint.readyCount != 0;
+    }
+    if (!up) {
+        ReplicaRouter::instance().fellBack();
+        return submit(primary, std::move(query));
+    }
+
+    Query attempt{query.statement, query.params, nullptr, query.route};
+    attempt.trace = query.trace;
+    attempt.done = [this, fallback = std::make_shared<Query>(std::move(query)),
+                    onReplica = std::move(onReplica)](const PGresult *r) {
+        if (r && onReplica(r)) return;
+        ReplicaRouter::instance().fellBack();
+        submit(primary, std::move(*fallback));
+    };
+    submit(endpoint, std::move(attempt));
+}
+
+void AsyncDB::send(Connection &c) {
+    const Query &q = *c.query;
+    std::vector<const char *> values;
+    values.reserve(q.params.size());
+    for (const std::string &p : q.params) values.push_back(p.c_str());
+    if (!PQsendQueryPrepared(c.pg, q.statement, static_cast<int>(values.size()), values.data(), nullptr, nullptr, 0)) {
+        return broken(c, "send");
+    }
+
+    const auto sent = metrics::Clock::now();
+    if (q.attempt == 1) trace::record(q.trace, "pool_checkout", q.submitted, sent, q.statement);
+    exchange(c, [this, &c, sent](PGresult *r) {
+        Query &q = *c.query;
+        metrics::record(q.route, metrics::Phase::sql, sent);
+        trace::record(q.trace, "sql", sent, metrics::Clock::now(), q.statement);
+        if (PQresultStatus(r) == PGRES_TUPLES_OK) return finish(c, r);
+
+        if (retryable(r) && q.attempt < maxAttempts) {
+            LOG_WARN("db_retry", {"op", q.statement}, {"attempt", q.attempt}, {"error", PQresultErrorMessage(r)});
+            metrics::add(metrics::Counter::dbRetries);
+            c.timer.expires_after(retryBackoff * q.attempt++);
+            c.timer.async_wait([this, &c](const boost::system::error_code &ec) {
+                if (!ec) send(c);
+            });
+            return;
+        }
+        LOG_ERROR("db_error", {"op", q.statement}, {"error", PQresultErrorMessage(r)});
+        finish(c, nullptr);
+    });
+}
+
+// Hand the connection to the next query before running the callback, so
+// the queue moves on while the callback works
+void AsyncDB::finish(Connection &c, const PGresult *result) {
+    std::unique_ptr<Query> q = std::move(c.query);
+    release(c);
+    q->done(result);
+}
+
+void AsyncDB::release(Connection &c) {
+    Endpoint &endpoint = c.endpoint;
+    Query next;
+    {
+        std::lock_guard<std::mutex> lock(endpoint.mutex);
+        if (!endpoint.backlog.empty()) {
+            next = std::move(endpoint.backlog.front());
+            endpoint.backlog.pop_front();
+        } else {
+            endpoint.idle.push_back(&c);
+        }
+    }
+    if (!next.statement) {
+        c.watching = true;
+        return watch(c);
+    }
+    c.query = std::make_unique<Query>(std::move(next));
+    send(c);
+}
+
+// An idle connection keeps reading, so a server that goes away (restart,
+// idle timeout) is noticed and the connection replaced before a query is
+// sent down it. submit() cancels the watch when it takes the connection.
+void AsyncDB::watch(Connection &c) {
+    waitFor(c, false, [this, &c] {
+        if (!c.watching) return; // taken for a query since
+        if (PQconsumeInput(c.pg) && PQstatus(c.pg) == CONNECTION_OK) return watch(c);
+        {
+            std::lock_guard<std::mutex> lock(c.endpoint.mutex);
+            std::vector<Connection *> &idle = c.endpoint.idle;
+            auto it = std::find(idle.begin(), idle.end(), &c);
+            if (it == idle.end()) return; // just taken; its query will find out
+            idle.erase(it);
+        }
+        broken(c, "idle");
+    });
+}
+
+// ---- libpq plumbing ----
+
+void AsyncDB::connect(Connection &c) {
+    c.pg = PQconnectStart(c.endpoint.connectionString.c_str());
+    if (!c.pg || PQstatus(c.pg) == CONNECTION_BAD) return connectFailed(c);
+    pollConnect(c, PGRES_POLLING_WRITING);
+}
+
+void AsyncDB::pollConnect(Connection &c, PostgresPollingStatusType status) {
+    switch (status) {
+    case PGRES_POLLING_READING:
+    case PGRES_POLLING_WRITING:
+        // libpq may switch sockets (even to a reused descriptor number)
+        // while it tries each address, so register afresh on every step
+        if (c.socket.is_open()) c.socket.release();
+        c.socket.assign(PQsocket(c.pg));
+        waitFor(c, status == PGRES_POLLING_WRITING, [this, &c] { pollConnect(c, PQconnectPoll(c.pg)); });
+        return;
+    case PGRES_POLLING_OK:
+        PQsetnonblocking(c.pg, 1);
+        prepareNext(c);
+        return;
+    default:
+        connectFailed(c);
+    }
+}
+
+// Prepare the statement catalogue one statement at a time, then go to work
+void AsyncDB::prepareNext(Connection &c) {
+    const std::vector<stmt::Definition> &catalogue = stmt::all();
+    if (c.prepared == catalogue.size()) {
+        c.ready = true;
+        {
+            std::lock_guard<std::mutex> lock(c.endpoint.mutex);
+            ++c.endpoint.readyCount;
+        }
+        return release(c);
+    }
+
+    const stmt::Definition &def = catalogue[c.prepared];
+    if (!PQsendPrepare(c.pg, def.name, def.sql, 0, nullptr)) return broken(c, "prepare");
+    exchange(c, [this, &c, name = def.name](PGresult *r) {
+        if (PQresultStatus(r) != PGRES_COMMAND_OK) {
+            LOG_ERROR("db_prepare_failed", {"statement", name}, {"error", PQresultErrorMessage(r)});
+            return connectFailed(c);
+        }
+        ++c.prepared;
+        prepareNext(c);
+    });
+}
+
+void AsyncDB::exchange(Connection &c, std::function<void(PGresult *)> onResult) {
+    c.onResult = std::move(onResult);
+    flush(c);
+}
+
+// The parameters of our statements are small, so a command rarely fails to
+// go out in one write; when it does, wait until the socket drains
+void AsyncDB::flush(Connection &c) {
+    const int pending = PQflush(c.pg);
+    if (pending < 0) return broken(c, "flush");
+    if (pending > 0) return waitFor(c, true, [this, &c] { flush(c); });
+    receive(c);
+}
+
+// Read what has arrived; once the command's last result is in, pass it on
+void AsyncDB::receive(Connection &c) {
+    if (!PQconsumeInput(c.pg)) return broken(c, "receive");
+    while (!PQisBusy(c.pg)) {
+        PGresult *r = PQgetResult(c.pg);
+        if (r) {
+            if (c.result) PQclear(c.result); // keep the last one
+            c.result = r;
+            continue;
+        }
+
+        PGresult *result = std::exchange(c.result, nullptr);
+        if (PQstatus(c.pg) == CONNECTION_BAD) {
+            PQclear(result);
+            return broken(c, "receive");
+        }
+        auto next = std::move(c.onResult);
+        next(result);
+        PQclear(result);
+        return;
+    }
+    waitFor(c, false, [this, &c] { receive(c); });
+}
+
+void AsyncDB::waitFor(Connection &c, bool write, std::function<void()> then) {
+    using Wait = net::posix::descriptor_base::wait_type;
+    // Whatever the outcome (even an error or the nudge below), the next libpq
+    // call finds out whether there is progress to make
+    c.socket.async_wait(write ? Wait::wait_write : Wait::wait_read,
+                        [then = std::move(then)](const boost::system::error_code &) { then(); });
+
+    // The reactor only reports readiness that arrives after a wait is
+    // registered; input already sitting in the socket (or left there by
+    // libpq) would never be announced. Look once more and wake the wait
+    // ourselves if it is already satisfied.
+    pollfd fd{c.socket.native_handle(), static_cast<short>(write ? POLLOUT : POLLIN), 0};
+    if (::poll(&fd, 1, 0) > 0) c.socket.cancel();
+}
+
+// The query in flight fails: it may or may not have been applied, so it
+// must not be retried on another connection
+void AsyncDB::broken(Connection &c, const char *what) {
+    LOG_ERROR("db_connection_lost", {"step", what}, {"error", c.pg ? PQerrorMessage(c.pg) : ""});
+    std::unique_ptr<Query> lost = std::move(c.query);
+    disconnect(c);
+    if (lost) lost->done(nullptr);
+    connect(c);
+}
+
+void AsyncDB::connectFailed(Connection &c) {
+    LOG_ERROR("db_connect_failed", {"error", c.pg ? PQerrorMessage(c.pg) : "out of memory"});
+    disconnect(c);
+
+    // With no connection up, queued queries fail now rather than wait out
+    // an outage (reads queued for a replica go to the primary)
+    std::deque<Query> failed;
+    {
+        std::lock_guard<std::mutex> lock(c.endpoint.mutex);
+        if (c.endpoint.readyCount == 0) failed.swap(c.endpoint.backlog);
+    }
+    for (Query &q : failed) q.done(nullptr);
+
+    c.timer.expires_after(reconnectDelay);
+    c.timer.async_wait([this, &c](const boost::system::error_code &ec) {
+        if (!ec) connect(c);
+    });
+}
+
+void AsyncDB::disconnect(Connection &c) {
+    if (c.ready) {
+        std::lock_guard<std::mutex> lock(c.endpoint.mutex);
+        --c.endpoint.readyCount;
+    }
+    c.ready = false;
+    c.watching = false;
+    c.prepared = 0;
+    c.onResult = nullptr;
+    if (c.result) PQclear(std::exchange(c.result, nullptr));
+    if (c.socket.is_open()) c.socket.release(); // libpq closes it
+    if (c.pg) PQfinish(std::exchange(c.pg, nullptr));
+}
+
+// ---- Operations ----
+
+void AsyncDB::getBalance(int userId, BalanceCallback done) {
+    BalanceCache &cache = BalanceCache::instance();
+    double cached;
+    if (cache.get(userId, cached)) return done(cached);
+    const std::uint64_t ticket = cache.ticket(userId);
+
+    Query query{stmt::getBalance, {param(userId)}, [userId, ticket, done](const PGresult *r) {
+        if (!r) return done(-1.0);
+        if (PQntuples(r) == 0) {
+            LOG_INFO("user_not_found", {"userId", userId});
+            return done(-1.0);
+        }
+        const double balance = number(r, 0, 0);
+        BalanceCache::instance().fill(userId, balance, ticket);
+        done(balance);
+    }, metrics::currentRoute()};
+
+    // A replica's answer may trail the primary's, so it is never cached
+    read(userId, std::move(query), [done](const PGresult *r) {
+        if (PQntuples(r) == 0) return false; // created after the replica's snapshot, perhaps
+        done(number(r, 0, 0));
+        return true;
+    });
+}
+
+void AsyncDB::deposit(int userId, double amount, DoneCallback done) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "deposit"}, {"amount", amount});
+        return done(WriteResult::failed);
+    }
+    if (viaGroupCommit({GroupCommitter::Kind::deposit, userId, 0, amount}, done)) return;
+
+    submit(primary, {stmt::deposit, {param(userId), param(amount)}, [userId, done](const PGresult *r) {
+        if (r && PQntuples(r) > 0) {
+            cacheRows(r);
+            return done(WriteResult::applied);
+        }
+        if (r) LOG_INFO("user_not_found", {"userId", userId});
+        done(WriteResult::failed);
+    }, metrics::currentRoute()});
+}
+
+void AsyncDB::withdraw(int userId, double amount, DoneCallback done) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "withdraw"}, {"amount", amount});
+        return done(WriteResult::failed);
+    }
+    if (viaGroupCommit({GroupCommitter::Kind::withdraw, userId, 0, amount}, done)) return;
+
+    submit(primary, {stmt::withdraw, {param(userId), param(amount)}, [userId, amount, done](const PGresult *r) {
+        if (r && PQntuples(r) > 0) {
+            cacheRows(r);
+            return done(WriteResult::applied);
+        }
+        // No such account or not enough in it, as in DB::withdraw
+        if (r) LOG_INFO("withdraw_refused", {"userId", userId}, {"amount", amount});
+        done(WriteResult::failed);
+    }, metrics::currentRoute()});
+}
+
+void AsyncDB::transfer(int senderId, int receiverId, double amount, DoneCallback done) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "transfer"}, {"amount", amount});
+        return done(WriteResult::failed);
+    }
+    if (senderId == receiverId) {
+        LOG_INFO("self_transfer", {"userId", senderId});
+        return done(WriteResult::failed);
+    }
+    if (viaGroupCommit({GroupCommitter::Kind::transfer, senderId, receiverId, amount}, done)) return;
+
+    submit(primary, {stmt::transfer, {param(senderId), param(receiverId), param(amount)},
+            [senderId, receiverId, amount, done](const PGresult *r) {
+                if (r && PQntuples(r) > 0) {
+                    cacheRows(r);
+                    LOG_DEBUG("transfer_complete", {"senderId", senderId}, {"receiverId", receiverId}, {"amount", amount});
+                    return done(WriteResult::applied);
+                }
+                if (r) LOG_INFO("transfer_refused", {"senderId", senderId}, {"receiverId", receiverId}, {"amount", amount});
+                done(WriteResult::failed);
+            }, metrics::currentRoute()});
+}
+
+void AsyncDB::getTransactions(int userId, const HistoryCursor &after, int limit, TransactionsCallback done) {
+        Query query{stmt::transactionsForUser, {param(userId), param(after.id), param(limit), after.timestamp}, [done](const PGresult *r) {
+        done(transactionRows(r));
+    }, metrics::currentRoute()};
+    read(userId, std::move(query), [done](const PGresult *r) {
+        done(transactionRows(r));
+        return true;
+    });
+}
+
+void AsyncDB::readBalance(int userId, std::function<void(std::optional<double>)> done) {
+    submit(primary, {stmt::getBalance, {param(userId)}, [done](const PGresult *r) {
+        if (!r) return done(std::nullopt);
+        done(PQntuples(r) > 0 ? number(r, 0, 0) : -1.0);
+    }, metrics::currentRoute()});
+}
@@ -0,0 +1,186 @@
+#include "../include/auth.hpp"
+#include "../include/crypto.hpp"
+#include "../include/log.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace auth {
+namespace {
+
+// Expired sessions are swept from a shard at most this often, when a new
+// session lands in it; until then resolve() just refuses them
+constexpr std::int64_t sweepIntervalSeconds = 60;
+
+std::int64_t unixNow() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace
+
+SessionStore &SessionStore::instance() {
+    static SessionStore store;
+    return store;
+}
+
+void SessionStore::configure(const AuthConfig &cfg) {
+    // Without a configured key, tokens only survive as long as the process
+    key = cfg.sessionKey.empty() ? crypto::randomBytes(32) : cfg.sessionKey;
+    lifetime = cfg.sessionTtl;
+}
+
+SessionStore::Shard &SessionStore::shardFor(const std::string &id) const {
+    // Session ids are random, so any of their bytes spread evenly
+    std::uint32_t h;
+    std::memcpy(&h, id.data(), sizeof h);
+    return shards[h % shardCount];
+}
+
+std::string SessionStore::issue(int userId) {
+    const std::int64_t now = unixNow();
+    const std::int64_t expires = now + lifetime.count();
+    std::string id = crypto::randomBytes(idBytes);
+
+    std::string payload = id;
+    payload.append(reinterpret_cast<const char *>(&userId), sizeof userId);
+    payload.append(reinterpret_cast<const char *>(&expires), sizeof expires);
+    const crypto::Digest mac = crypto::hmacSha256(key, payload);
+
+    Shard &shard = shardFor(id);
+    {
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if (now >= shard.nextSweep) {
+            for (auto it = shard.sessions.begin(); it != shard.sessions.end();) {
+                it = it->second.expires <= now ? shard.sessions.erase(it) : std::next(it);
+            }
+            shard.nextSweep = now + sweepIntervalSeconds;
+        }
+        shard.sessions.emplace(std::move(id), Session{userId, expires});
+    }
+
+    return crypto::base64Url(payload) + "." +
+           crypto::base64Url(std::string_view(reinterpret_cast<const char *>(mac.data()), mac.size()));
+}
+
+bool SessionStore::decode(std::string_view token, std::string &id, int &userId, std::int64_t &expires) const {
+    const std::size_t dot = token.find('.');
+    if (dot == std::string_view::npos) return false;
+    std::string payload, mac;
+    if (!crypto::fromBase64Url(token.substr(0, dot), payload) || !crypto::fromBase64Url(token.substr(dot + 1), mac))
+        return false;
+    if (payload.size() != idBytes + sizeof userId + sizeof expires) return false;
+
+    const crypto::Digest expected = crypto::hmacSha256(key, payload);
+    if (!crypto::constantTimeEqual(mac, std::string_view(reinterpret_cast<const char *>(expected.data()), expected.size())))
+        return false;
+
+    id.assign(payload, 0, idBytes);
+    std::memcpy(&userId, payload.data() + idBytes, sizeof userId);
+    std::memcpy(&expires, payload.data() + idBytes + sizeof userId, sizeof expires);
+    return true;
+}
+
+bool SessionStore::resolve(std::string_view token, int &userId) const {
+    std::string id;
+    int tokenUser;
+    std::int64_t expires;
+    if (!decode(token, id, tokenUser, expires) || expires <= unixNow()) return false;
+
+    const Shard &shard = shardFor(id);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.sessions.find(id);
+    if (it == shard.sessions.end() || it->second.userId != tokenUser) return false;
+    userId = tokenUser;
+    return true;
+}
+
+bool SessionStore::revoke(std::string_view token) {
+    std::string id;
+    int userId;
+    std::int64_t expires;
+    if (!decode(token, id, userId, expires)) return false;
+
+    Shard &shard = shardFor(id);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.sessions.erase(id) > 0 && expires > unixNow();
+}
+
+std::size_t SessionStore::size() const {
+    std::size_t total = 0;
+    for (const Shard &shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        total += shard.sessions.size();
+    }
+    return total;
+}
+
+PasswordWorkers &PasswordWorkers::instance() {
+    static PasswordWorkers workers;
+    return workers;
+}
+
+PasswordWorkers::~PasswordWorkers() {
+    stop();
+}
+
+void PasswordWorkers::start(unsigned count, std::size_t queueLimit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (running) return;
+    running = true;
+    limit = queueLimit;
+    for (unsigned i = 0; i < std::max(1u, count); ++i) {
+        threads.emplace_back([this] { run(); });
+    }
+    LOG_INFO("password_workers_started", {"threads", std::max(1u, count)}, {"queue", queueLimit});
+}
+
+void PasswordWorkers::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return;
+        running = false;
+    }
+    wakeup.notify_all();
+    for (std::thread &t : threads) t.join();
+    threads.clear();
+}
+
+bool PasswordWorkers::submit(Task task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (running && queue.size() < limit) {
+            queue.push_back(std::move(task));
+            wakeup.notify_one();
+            return true;
+        }
+    }
+    rejected.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+PasswordWorkers::Stats PasswordWorkers::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {queue.size(), completed.load(std::memory_order_relaxed), rejected.load(std::memory_order_relaxed)};
+}
+
+void PasswordWorkers::run() {
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait(lock, [this] { return !running || !queue.empty(); });
+            if (queue.empty()) return; // stopped and drained
+            task = std::move(queue.front());
+            queue.pop_front();
+        }
+        try {
+            task();
+        } catch (const std::exception &e) {
+            LOG_ERROR("password_task_failed", {"error", e.what()});
+        }
+        completed.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+} // namespace auth
@@ -0,0 +1,169 @@
+#include "../include/balance_cache.hpp"
+#include "../include/log.hpp"
+#include <string>
+
+BalanceCache &BalanceCache::instance() {
+    static BalanceCache cache;
+    return cache;
+}
+
+void BalanceCache::configure(std::size_t requested) {
+    capacity = requested;
+    if (capacity == 0) {
+        shards.reset();
+        return;
+    }
+    const std::size_t perShard = (capacity + shardCount - 1) / shardCount;
+    shards.reset(new Shard[shardCount]);
+    for (std::size_t i = 0; i < shardCount; ++i) {
+        shards[i].slots.resize(perShard);
+        shards[i].index.reserve(perShard);
+    }
+    LOG_INFO("balance_cache_enabled", {"capacity", capacity});
+}
+
+BalanceCache::Shard &BalanceCache::shardFor(int userId) {
+    // Multiplicative hash so sequential ids spread across shards
+    std::uint32_t h = static_cast<std::uint32_t>(userId) * 2654435761u;
+    return shards[h % shardCount];
+}
+
+bool BalanceCache::get(int userId, double &balance) {
+    if (!enabled()) return false;
+    Shard &shard = shardFor(userId);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.index.find(userId);
+        if (it != shard.index.end()) {
+            Slot &slot = shard.slots[it->second];
+            slot.referenced = true;
+            balance = slot.balance;
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+std::uint64_t BalanceCache::ticket(int userId) {
+    if (!enabled()) return 0;
+    Shard &shard = shardFor(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.epoch;
+}
+
+void BalanceCache::fill(int userId, double balance, std::uint64_t ticket) {
+    if (!enabled()) return;
+    Shard &shard = shardFor(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.epoch != ticket) return; // raced with a write; don't cache what we read
+    store(shard, userId, balance);
+}
+
+void BalanceCache::put(int userId, double balance) {
+    if (!enabled()) return;
+    Shard &shard = shardFor(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.epoch;
+    store(shard, userId, balance);
+}
+
+void BalanceCache::putRows(const pqxx::result &rows) {
+    if (!enabled()) return;
+    for (const auto &row : rows) {
+        if (row[1].is_null()) {
+            invalidate(row[0].as<int>()); // a hot account; its total isn't known here
+        } else {
+            put(row[0].as<int>(), row[1].as<double>());
+        }
+    }
+}
+
+// Caller holds shard.mutex
+void BalanceCache::store(Shard &shard, int userId, double balance) {
+    auto it = shard.index.find(userId);
+    if (it != shard.index.end()) {
+        shard.slots[it->second].balance = balance;
+        return;
+    }
+
+    // CLOCK: sweep until a slot that is free or hasn't been hit since the
+    // last sweep; recently used entries get a second chance.
+    for (;;) {
+        Slot &slot = shard.slots[shard.hand];
+        const std::size_t victim = shard.hand;
+        shard.hand = (shard.hand + 1) % shard.slots.size();
+        if (slot.used && slot.referenced) {
+            slot.referenced = false;
+            continue;
+        }
+        if (slot.used) {
+            shard.index.erase(slot.userId);
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+        slot.userId = userId;
+        slot.balance = balance;
+        slot.used = true;
+        slot.referenced = false;
+        shard.index.emplace(userId, victim);
+        return;
+    }
+}
+
+void BalanceCache::invalidate(int userId) {
+    if (!enabled()) return;
+    Shard &shard = shardFor(userId);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.epoch;
+    auto it = shard.index.find(userId);
+    if (it == shard.index.end()) return;
+    shard.slots[it->second].used = false;
+    shard.slots[it->second].referenced = false;
+    shard.index.erase(it);
+}
+
+void BalanceCache::clear() {
+    if (!enabled()) return;
+    for (std::size_t i = 0; i < shardCount; ++i) {
+        std::lock_guard<std::mutex> lock(shards[i].mutex);
+        ++shards[i].epoch;
+        shards[i].index.clear();
+        for (Slot &slot : shards[i].slots) slot = Slot();
+    }
+}
+
+// Another writer changed this account. Entries we hold are refreshed in
+// place; accounts we don't hold aren't pulled in, so changes elsewhere in the
+// bank can't evict our hot entries.
+void BalanceCache::applyNotification(const std::string &payload) {
+    if (!enabled()) return;
+    try {
+        std::size_t comma = payload.find(',');
+        int userId = std::stoi(payload.substr(0, comma));
+        if (comma == std::string::npos) {
+            invalidate(userId);
+            return;
+        }
+        double balance = std::stod(payload.substr(comma + 1));
+
+        Shard &shard = shardFor(userId);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        ++shard.epoch;
+        auto it = shard.index.find(userId);
+        if (it != shard.index.end()) shard.slots[it->second].balance = balance;
+    } catch (const std::exception &e) {
+        LOG_WARN("balance_notification_malformed", {"payload", payload}, {"error", e.what()});
+    }
+}
+
+BalanceCache::Stats BalanceCache::stats() {
+    std::size_t size = 0;
+    if (enabled()) {
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            std::lock_guard<std::mutex> lock(shards[i].mutex);
+            size += shards[i].index.size();
+        }
+    }
+    return {hits.load(), misses.load(), evictions.load(), size, capacity};
+}
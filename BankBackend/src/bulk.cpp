@@ -0,0 +1,511 @@
+#include "../include/bulk.hpp"
+#include "../include/log.hpp"
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <optional>
+
+namespace bulk {
+
+namespace {
+
+constexpr std::size_t blockBytes = 256 * 1024;    // CSV handed to a worker at a time
+constexpr std::size_t maxRecordBytes = 1 << 20;   // one row can't be larger than this
+constexpr std::size_t maxReportedRejects = 100;
+
+constexpr const char *usersHeader = "id,name,password,balance";
+constexpr const char *transactionsHeader = "id,user_id,amount,type,timestamp";
+
+// Values the transactions.type CHECK constraint accepts (schema.sql)
+constexpr std::string_view transactionTypes[] = {"deposit", "withdrawal", "transfer_sent", "transfer_received"};
+
+// Secondary indexes dropped and rebuilt by ImportOptions::deferIndexes.
+// Primary keys stay: the foreign key from transactions needs users' one.
+struct Index {
+    const char *name;
+    const char *definition;
+};
+constexpr Index transactionIndexes[] = {
+    {"transactions_user_id_timestamp_idx",
+     "CREATE INDEX transactions_user_id_timestamp_idx ON transactions (user_id, timestamp, id) INCLUDE (amount, type)"},
+};
+
+using Value = std::optional<std::string>; // nullopt is NULL
+
+std::size_t columnCount(Table table) {
+    return table == Table::users ? 4 : 5;
+}
+
+const char *header(Table table) {
+    return table == Table::users ? usersHeader : transactionsHeader;
+}
+
+// Bounded multi-producer/multi-consumer queue between the pipeline stages.
+// close() lets consumers drain what is left; cancel() drops it.
+template <typename T>
+class Queue {
+public:
+    explicit Queue(std::size_t capacity) : capacity(capacity) {}
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+        if (closed) return false;
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+    void cancel() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        items.clear();
+        notEmpty.notify_all();
+        notFull.notify_all();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::condition_variable notFull;
+    std::deque<T> items;
+    std::size_t capacity;
+    bool closed = false;
+};
+
+// Whole rows of CSV text as read from the input
+struct RawBlock {
+    std::uint64_t firstLine = 0;
+    std::string text;
+};
+
+// Validated rows, columnCount(table) values each, ready for COPY
+struct ParsedBlock {
+    std::vector<Value> values;
+    std::vector<Reject> rejects;
+    std::uint64_t rejected = 0;
+};
+
+// Split one CSV record off `text` at `pos` into `fields` and move past its
+// line end. Returns false on broken quoting.
+bool parseRecord(std::string_view text, std::size_t &pos, std::vector<Value> &fields) {
+    fields.clear();
+    for (;;) {
+        if (pos < text.size() && text[pos] == '"') {
+            std::string value;
+            ++pos;
+            for (;;) {
+                const std::size_t quote = text.find('"', pos);
+                if (quote == std::string_view::npos) return false;
+                value.append(text, pos, quote - pos);
+                pos = quote + 1;
+                if (pos < text.size() && text[pos] == '"') {
+                    value.push_back('"');
+                    ++pos;
+                    continue;
+                }
+                break;
+            }
+            fields.emplace_back(std::move(value));
+        } else {
+            std::size_t end = text.find_first_of(",\r\n\"", pos);
+            if (end == std::string_view::npos) end = text.size();
+            if (end < text.size() && text[end] == '"') return false;
+            if (end > pos) {
+                fields.emplace_back(std::string(text.substr(pos, end - pos)));
+            } else {
+                fields.emplace_back(std::nullopt);
+            }
+            pos = end;
+        }
+
+        if (pos >= text.size()) return true;
+        if (text[pos] == ',') {
+            ++pos;
+            continue;
+        }
+        if (text[pos] == '\r') ++pos;
+        if (pos >= text.size()) return true;
+        if (text[pos] != '\n') return false;
+        ++pos;
+        return true;
+    }
+}
+
+bool validId(const Value &v) {
+    if (!v || v->empty()) return false;
+    int id = 0;
+    const char *end = v->data() + v->size();
+    const auto [ptr, ec] = std::from_chars(v->data(), end, id);
+    return ec == std::errc() && ptr == end && id > 0;
+}
+
+// Plain decimal as accepted by NUMERIC: [-]digits[.digits]. Kept as text so
+// no precision is lost on the way to the database.
+bool validDecimal(const Value &v, bool positive) {
+    if (!v) return false;
+    const std::string &s = *v;
+    std::size_t i = 0;
+    bool negative = false;
+    if (i < s.size() && s[i] == '-') {
+        negative = true;
+        ++i;
+    }
+    bool digits = false;
+    bool nonZero = false;
+    bool point = false;
+    for (; i < s.size(); ++i) {
+        if (s[i] >= '0' && s[i] <= '9') {
+            digits = true;
+            nonZero = nonZero || s[i] != '0';
+        } else if (s[i] == '.' && !point) {
+            point = true;
+        } else {
+            return false;
+        }
+    }
+    if (!digits) return false;
+    if (positive) return !negative && nonZero;
+    return !negative || !nonZero; // balances can't go below zero
+}
+
+bool digitsAt(const std::string &s, std::size_t at, std::size_t n, int lo, int hi) {
+    int value = 0;
+    for (std::size_t i = at; i < at + n; ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        value = value * 10 + (s[i] - '0');
+    }
+    return value >= lo && value <= hi;
+}
+
+// YYYY-MM-DD HH:MM:SS[.ffffff], the way Postgres prints a TIMESTAMP
+bool validTimestamp(const Value &v) {
+    if (!v || v->size() < 19) return false;
+    const std::string &s = *v;
+    if (s[4] != '-' || s[7] != '-' || (s[10] != ' ' && s[10] != 'T') || s[13] != ':' || s[16] != ':') return false;
+    if (!digitsAt(s, 0, 4, 1, 9999) || !digitsAt(s, 5, 2, 1, 12) || !digitsAt(s, 8, 2, 1, 31) ||
+        !digitsAt(s, 11, 2, 0, 23) || !digitsAt(s, 14, 2, 0, 59) || !digitsAt(s, 17, 2, 0, 60)) {
+        return false;
+    }
+    if (s.size() == 19) return true;
+    return s[19] == '.' && s.size() > 20 && s.size() <= 26 && digitsAt(s, 20, s.size() - 20, 0, 999999);
+}
+
+// Null when the row is fine, otherwise why it is rejected
+const char *validate(Table table, const std::vector<Value> &f) {
+    if (f.size() != columnCount(table)) return "wrong number of columns";
+    if (!validId(f[0])) return "id must be a positive integer";
+    if (table == Table::users) {
+        if (!f[1] || f[1]->empty()) return "name is required";
+        if (!validDecimal(f[3], false)) return "balance must be a non-negative decimal";
+        return nullptr;
+    }
+    if (!validId(f[1])) return "user_id must be a positive integer";
+    if (!validDecimal(f[2], true)) return "amount must be a positive decimal";
+    if (!f[3] || std::find(std::begin(transactionTypes), std::end(transactionTypes), *f[3]) ==
+                     std::end(transactionTypes)) {
+        return "unknown transaction type";
+    }
+    if (!validTimestamp(f[4])) return "timestamp must be YYYY-MM-DD HH:MM:SS[.ffffff]";
+    return nullptr;
+}
+
+bool isHeader(Table table, std::string_view record) {
+    while (!record.empty() && (record.back() == '\n' || record.back() == '\r')) record.remove_suffix(1);
+    return record == header(table);
+}
+
+ParsedBlock parseBlock(Table table, const RawBlock &block) {
+    ParsedBlock out;
+    const std::string_view text = block.text;
+    std::vector<Value> fields;
+    std::uint64_t line = block.firstLine;
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        const std::size_t start = pos;
+        const bool parsed = parseRecord(text, pos, fields);
+        if (!parsed) {
+            // Resynchronise on the next line
+            const std::size_t next = text.find('\n', start);
+            pos = next == std::string_view::npos ? text.size() : next + 1;
+        }
+        const std::uint64_t rowLine = line;
+        line += static_cast<std::uint64_t>(std::count(text.begin() + start, text.begin() + pos, '\n'));
+
+        if (parsed && fields.size() == 1 && !fields[0]) continue; // blank line
+        if (parsed && rowLine == 1 && isHeader(table, text.substr(start, pos - start))) continue;
+        const char *reason = parsed ? validate(table, fields) : "malformed CSV quoting";
+        if (reason) {
+            ++out.rejected;
+            if (out.rejects.size() < maxReportedRejects) out.rejects.push_back({rowLine, reason});
+            continue;
+        }
+        for (Value &v : fields) out.values.push_back(std::move(v));
+    }
+    return out;
+}
+
+// Cut the input into blocks of whole rows. A newline inside a quoted field
+// doesn't end a row, so the reader tracks quote state as it scans.
+void readBlocks(std::istream &in, Queue<RawBlock> &out, std::string &error) {
+    std::string pending;           // rows not yet handed out, ending mid-row
+    std::size_t scanned = 0;       // bytes of `pending` already scanned
+    std::size_t rowEnd = 0;        // end of the last complete row in `pending`
+    std::uint64_t line = 1;        // line `pending` starts on
+    bool quoted = false;
+    std::vector<char> buffer(blockBytes);
+
+    auto flush = [&](std::size_t end) {
+        RawBlock block;
+        block.firstLine = line;
+        block.text.assign(pending, 0, end);
+        line += static_cast<std::uint64_t>(std::count(block.text.begin(), block.text.end(), '\n'));
+        pending.erase(0, end);
+        scanned -= end;
+        rowEnd = 0;
+        return out.push(std::move(block));
+    };
+
+    while (in) {
+        in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const std::size_t got = static_cast<std::size_t>(in.gcount());
+        if (got == 0) break;
+        pending.append(buffer.data(), got);
+        for (; scanned < pending.size(); ++scanned) {
+            const char c = pending[scanned];
+            if (c == '"') {
+                quoted = !quoted;
+            } else if (c == '\n' && !quoted) {
+                rowEnd = scanned + 1;
+            }
+        }
+        if (rowEnd >= blockBytes || (rowEnd > 0 && pending.size() >= 2 * blockBytes)) {
+            if (!flush(rowEnd)) return;
+        }
+        if (pending.size() - rowEnd > maxRecordBytes) {
+            error = "row at line " + std::to_string(line + static_cast<std::uint64_t>(std::count(
+                                                               pending.begin(), pending.begin() + rowEnd, '\n'))) +
+                    " is longer than " + std::to_string(maxRecordBytes) + " bytes";
+            return;
+        }
+    }
+    if (in.bad()) {
+        error = "read error";
+        return;
+    }
+    if (!pending.empty()) flush(pending.size());
+}
+
+// COPY into the table's columns
+pqxx::stream_to openStream(pqxx::work &txn, Table table) {
+    if (table == Table::users) {
+        return pqxx::stream_to::table(txn, {"users"}, {"id", "name", "password", "balance"});
+    }
+    return pqxx::stream_to::table(txn, {"transactions"}, {"id", "user_id", "amount", "type", "timestamp"});
+}
+
+void writeRows(pqxx::stream_to &stream, Table table, const std::vector<Value> &values) {
+    if (table == Table::users) {
+        for (std::size_t i = 0; i + 4 <= values.size(); i += 4) {
+            stream.write_values(values[i], values[i + 1], values[i + 2], values[i + 3]);
+        }
+    } else {
+        for (std::size_t i = 0; i + 5 <= values.size(); i += 5) {
+            stream.write_values(values[i], values[i + 1], values[i + 2], values[i + 3], values[i + 4]);
+        }
+    }
+}
+
+void appendCsv(std::string &out, const char *data, std::size_t size) {
+    if (!data) return; // NULL stays an empty unquoted field
+    const std::string_view v(data, size);
+    if (!v.empty() && v.find_first_of(",\"\r\n") == std::string_view::npos) {
+        out.append(v);
+        return;
+    }
+    out.push_back('"');
+    for (char c : v) {
+        if (c == '"') out.push_back('"');
+        out.push_back(c);
+    }
+    out.push_back('"');
+}
+
+std::string exportQuery(Table table, int userId) {
+    // A hot account's balance includes what its stripes hold (see schema.sql)
+    std::string sql = table == Table::users
+                          ? "SELECT id, name, password, balance + COALESCE((SELECT sum(s.balance) FROM balance_stripes s"
+                            " WHERE s.user_id = users.id), 0) FROM users"
+                          : "SELECT id, user_id, amount, type, timestamp FROM transactions";
+    if (userId > 0) sql += (table == Table::users ? " WHERE id = " : " WHERE user_id = ") + std::to_string(userId);
+    sql += " ORDER BY id";
+    return sql;
+}
+
+} // namespace
+
+bool parseTable(std::string_view name, Table &table) {
+    if (name == "users") {
+        table = Table::users;
+        return true;
+    }
+    if (name == "transactions") {
+        table = Table::transactions;
+        return true;
+    }
+    return false;
+}
+
+const char *tableName(Table table) {
+    return table == Table::users ? "users" : "transactions";
+}
+
+// ---- Import ----
+
+// One reader thread cuts the input into blocks, `workers` threads parse and
+// validate them, and this thread streams the results into COPY. The queues
+// between the stages are bounded, so a slow database pushes back on the
+// reader instead of letting the input pile up in memory.
+ImportResult importCsv(pqxx::connection &conn, Table table, std::istream &in, const ImportOptions &options) {
+    const auto started = std::chrono::steady_clock::now();
+    const unsigned workers = options.workers ? options.workers : std::max(1u, std::thread::hardware_concurrency());
+    ImportResult result;
+
+    Queue<RawBlock> raw(workers * 2);
+    Queue<ParsedBlock> parsed(workers * 2);
+    std::string readError;
+    std::atomic<unsigned> running{workers};
+
+    std::thread reader([&] {
+        readBlocks(in, raw, readError);
+        raw.close();
+    });
+    std::vector<std::thread> validators;
+    validators.reserve(workers);
+    for (unsigned i = 0; i < workers; ++i) {
+        validators.emplace_back([&] {
+            RawBlock block;
+            while (raw.pop(block)) {
+                if (!parsed.push(parseBlock(table, block))) break;
+            }
+            if (running.fetch_sub(1) == 1) parsed.close();
+        });
+    }
+    auto joinAll = [&] {
+        raw.cancel();
+        parsed.cancel();
+        reader.join();
+        for (std::thread &t : validators) t.join();
+    };
+
+    try {
+        pqxx::work txn(conn);
+        if (options.deferIndexes && table == Table::transactions) {
+            for (const Index &index : transactionIndexes) txn.exec(std::string("DROP INDEX IF EXISTS ") + index.name);
+        }
+
+        {
+            pqxx::stream_to stream = openStream(txn, table);
+            ParsedBlock block;
+            while (parsed.pop(block)) {
+                result.rejected += block.rejected;
+                for (Reject &r : block.rejects) {
+                    if (result.rejects.size() < maxReportedRejects) result.rejects.push_back(std::move(r));
+                }
+                if (result.rejected > options.maxRejects) {
+                    result.error = "too many invalid rows";
+                    break;
+                }
+                if (options.cancel && options.cancel->load(std::memory_order_relaxed)) {
+                    result.error = "cancelled";
+                    break;
+                }
+                writeRows(stream, table, block.values);
+                result.rows += block.values.size() / columnCount(table);
+                if (options.progress) options.progress->store(result.rows, std::memory_order_relaxed);
+            }
+            joinAll();
+            if (result.error.empty() && !readError.empty()) result.error = readError;
+            if (result.error.empty()) stream.complete();
+        }
+
+        if (result.error.empty()) {
+            if (options.deferIndexes && table == Table::transactions) {
+                for (const Index &index : transactionIndexes) txn.exec(index.definition);
+            }
+            // Keep SERIAL defaults ahead of the ids loaded explicitly
+            const std::string name = tableName(table);
+            txn.exec("SELECT setval(pg_get_serial_sequence('" + name + "', 'id'), max(id)) FROM " + name);
+            txn.commit();
+            result.committed = true;
+        }
+    } catch (const std::exception &e) {
+        if (reader.joinable()) joinAll();
+        result.error = e.what();
+    }
+
+    if (!result.committed) result.rows = 0;
+    std::sort(result.rejects.begin(), result.rejects.end(),
+              [](const Reject &a, const Reject &b) { return a.line < b.line; });
+    result.elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    if (result.committed) {
+        LOG_INFO("bulk_import_done", {"table", tableName(table)}, {"rows", result.rows},
+                 {"rejected", result.rejected}, {"ms", result.elapsed.count()});
+    } else {
+        LOG_WARN("bulk_import_failed", {"table", tableName(table)}, {"rejected", result.rejected},
+                 {"error", result.error});
+    }
+    return result;
+}
+
+// ---- Export ----
+
+Exporter::Exporter(pqxx::connection &conn, Table table, int userId)
+    : table(table), txn(conn), stream(pqxx::stream_from::query(txn, exportQuery(table, userId))) {}
+
+bool Exporter::next(std::string &chunk, std::size_t chunkBytes) {
+    const std::size_t limit = chunk.size() + chunkBytes;
+    if (!started) {
+        chunk += header(table);
+        chunk += '\n';
+        started = true;
+    }
+    while (chunk.size() < limit) {
+        const auto *row = stream.read_row();
+        if (!row) {
+            stream.complete();
+            txn.commit();
+            return false;
+        }
+        bool first = true;
+        for (const auto &field : *row) {
+            if (!first) chunk += ',';
+            first = false;
+            appendCsv(chunk, field.data(), field.size());
+        }
+        chunk += '\n';
+    }
+    return true;
+}
+
+} // namespace bulk
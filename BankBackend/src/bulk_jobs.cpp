@@ -0,0 +1,73 @@
+#include "../include/bulk.hpp"
+#include "../include/db_pool.hpp"
+#include "../include/log.hpp"
+#include <fstream>
+
+// Kept apart from bulk.cpp so the command-line tool doesn't pull in the pool
+
+namespace bulk {
+
+ImportJobs &ImportJobs::instance() {
+    static ImportJobs jobs;
+    return jobs;
+}
+
+int ImportJobs::start(Table table, const std::string &path, const ImportOptions &options) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Reap finished jobs' threads; their results stay queryable
+    for (auto &entry : jobs) {
+        if (entry.second->state != State::running && entry.second->worker.joinable()) entry.second->worker.join();
+    }
+
+    const int id = nextId++;
+    auto job = std::make_unique<Job>();
+    Job *raw = job.get();
+    ImportOptions opts = options;
+    opts.cancel = &cancel;
+    opts.progress = &raw->progress;
+    jobs.emplace(id, std::move(job));
+
+    raw->worker = std::thread([this, raw, id, table, path, opts] {
+        LOG_INFO("bulk_import_started", {"job", id}, {"table", tableName(table)}, {"path", path});
+        ImportResult result;
+        std::ifstream in(path, std::ios::binary);
+        ConnectionPool::Lease lease = in ? ConnectionPool::instance().acquire() : ConnectionPool::Lease();
+        if (!in) {
+            result.error = "cannot open " + path;
+        } else if (!lease) {
+            result.error = "no database connection";
+        } else {
+            result = importCsv(*lease, table, in, opts);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        raw->state = result.committed ? State::done : State::failed;
+        raw->result = std::move(result);
+    });
+    return id;
+}
+
+bool ImportJobs::status(int id, Status &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = jobs.find(id);
+    if (it == jobs.end()) return false;
+    const Job &job = *it->second;
+    out.state = job.state;
+    out.rows = job.progress.load(std::memory_order_relaxed);
+    if (job.state != State::running) out.result = job.result;
+    return true;
+}
+
+void ImportJobs::stop() {
+    cancel.store(true);
+    std::vector<std::thread> workers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : jobs) {
+            if (entry.second->worker.joinable()) workers.push_back(std::move(entry.second->worker));
+        }
+    }
+    for (std::thread &t : workers) t.join();
+}
+
+} // namespace bulk
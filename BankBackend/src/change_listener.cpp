@@ -0,0 +1,74 @@
+#include "../include/change_listener.hpp"
+#include "../include/log.hpp"
+#include <pqxx/pqxx>
+#include <chrono>
+#include <memory>
+
+namespace {
+
+// Forwards notifications on one channel to a subscriber
+class Receiver : public pqxx::notification_receiver {
+public:
+    Receiver(pqxx::connection &conn, const std::string &channel, const ChangeListener::Handler &handler)
+        : pqxx::notification_receiver(conn, channel), handler(handler) {}
+
+    void operator()(const std::string &payload, int) override {
+        handler(payload);
+    }
+
+private:
+    const ChangeListener::Handler &handler;
+};
+
+} // namespace
+
+ChangeListener &ChangeListener::instance() {
+    static ChangeListener listener;
+    return listener;
+}
+
+ChangeListener::~ChangeListener() {
+    stop();
+}
+
+void ChangeListener::subscribe(const std::string &channel, Handler handler) {
+    subscriptions.push_back({channel, std::move(handler)});
+}
+
+void ChangeListener::onReconnect(std::function<void()> callback) {
+    reconnectCallbacks.push_back(std::move(callback));
+}
+
+void ChangeListener::start(const std::string &connString) {
+    if (subscriptions.empty() || worker.joinable()) return;
+    connectionString = connString;
+    stopping = false;
+    worker = std::thread(&ChangeListener::run, this);
+}
+
+void ChangeListener::stop() {
+    if (!worker.joinable()) return;
+    stopping = true;
+    worker.join();
+}
+
+void ChangeListener::run() {
+    while (!stopping) {
+        try {
+            pqxx::connection conn(connectionString);
+            std::vector<std::unique_ptr<Receiver>> receivers;
+            for (const Subscription &sub : subscriptions) {
+                receivers.push_back(std::make_unique<Receiver>(conn, sub.channel, sub.handler));
+            }
+            for (const auto &callback : reconnectCallbacks) callback();
+            LOG_INFO("change_listener_connected", {"channels", subscriptions.size()});
+
+            // Wake up at least once a second to notice stop()
+            while (!stopping) conn.await_notification(1, 0);
+        } catch (const std::exception &e) {
+            LOG_ERROR("change_listener_error", {"error", e.what()});
+            for (const auto &callback : reconnectCallbacks) callback();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+    }
+}
@@ -0,0 +1,180 @@
+#include "../include/config.hpp"
+#include "../include/log.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+// Read an unsigned integer from the environment, keeping the default when the
+// variable is unset or malformed.
+unsigned long envUnsigned(const char *name, unsigned long fallback) {
+    const char *raw = std::getenv(name);
+    if (!raw || !*raw) return fallback;
+    try {
+        std::size_t used = 0;
+        unsigned long value = std::stoul(raw, &used);
+        if (used == std::string(raw).size()) return value;
+    } catch (const std::exception &) {
+    }
+    LOG_WARN("config_invalid", {"name", name}, {"value", raw});
+    return fallback;
+}
+
+std::string envString(const char *name, const std::string &fallback) {
+    const char *raw = std::getenv(name);
+    return (raw && *raw) ? std::string(raw) : fallback;
+}
+
+} // namespace
+
+ServerConfig loadServerConfig() {
+    ServerConfig cfg;
+    cfg.port = static_cast<unsigned short>(envUnsigned("BANK_PORT", cfg.port));
+    cfg.threads = static_cast<unsigned>(envUnsigned("BANK_THREADS", cfg.threads));
+    if (cfg.threads == 0) {
+        cfg.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    cfg.maxConnections = envUnsigned("BANK_MAX_CONNECTIONS", cfg.maxConnections);
+    cfg.idleTimeout = std::chrono::seconds(envUnsigned("BANK_IDLE_TIMEOUT", cfg.idleTimeout.count()));
+    cfg.pipelineLimit = std::max(1ul, envUnsigned("BANK_PIPELINE_LIMIT", cfg.pipelineLimit));
+    cfg.bodyLimit = envUnsigned("BANK_BODY_LIMIT", cfg.bodyLimit);
+    cfg.arenaBytes = std::max(256ul, envUnsigned("BANK_ARENA_BYTES", cfg.arenaBytes));
+    cfg.arenaRetain = envUnsigned("BANK_ARENA_RETAIN", cfg.arenaRetain);
+    return cfg;
+}
+
+DbConfig loadDbConfig() {
+    DbConfig cfg;
+    cfg.connectionString = envString("BANK_DB_URL", cfg.connectionString);
+    cfg.poolMax = std::max(1ul, envUnsigned("BANK_DB_POOL_MAX", cfg.poolMax));
+    cfg.poolMin = std::min(cfg.poolMax, envUnsigned("BANK_DB_POOL_MIN", cfg.poolMin));
+    cfg.acquireTimeout = std::chrono::milliseconds(envUnsigned("BANK_DB_POOL_TIMEOUT_MS", cfg.acquireTimeout.count()));
+    cfg.healthCheckAfter = std::chrono::milliseconds(envUnsigned("BANK_DB_POOL_CHECK_MS", cfg.healthCheckAfter.count()));
+    cfg.balanceCacheCapacity = envUnsigned("BANK_BALANCE_CACHE_CAPACITY", cfg.balanceCacheCapacity);
+    cfg.asyncConnections = envUnsigned("BANK_DB_ASYNC_CONNECTIONS", cfg.asyncConnections);
+
+    const std::string replicas = envString("BANK_DB_REPLICA_URLS", "");
+    for (std::size_t start = 0; start < replicas.size();) {
+        std::size_t end = replicas.find(';', start);
+        if (end == std::string::npos) end = replicas.size();
+        if (end > start) cfg.replicas.push_back(replicas.substr(start, end - start));
+        start = end + 1;
+    }
+    cfg.maxReplicaLag = std::chrono::milliseconds(envUnsigned("BANK_DB_REPLICA_MAX_LAG_MS", cfg.maxReplicaLag.count()));
+    cfg.replicaCheckInterval =
+        std::chrono::milliseconds(std::max(1ul, envUnsigned("BANK_DB_REPLICA_CHECK_MS", cfg.replicaCheckInterval.count())));
+    cfg.stickyWindow = std::chrono::milliseconds(envUnsigned("BANK_DB_STICKY_MS", cfg.stickyWindow.count()));
+    return cfg;
+}
+
+GroupCommitConfig loadGroupCommitConfig() {
+    GroupCommitConfig cfg;
+    cfg.enabled = envUnsigned("BANK_GROUP_COMMIT", cfg.enabled) != 0;
+    cfg.window = std::chrono::microseconds(envUnsigned("BANK_GROUP_COMMIT_WINDOW_US", cfg.window.count()));
+    cfg.maxBatch = std::max(1ul, envUnsigned("BANK_GROUP_COMMIT_MAX_BATCH", cfg.maxBatch));
+    return cfg;
+}
+
+StorageConfig loadStorageConfig() {
+    StorageConfig cfg;
+    cfg.backend = envString("BANK_STORAGE", cfg.backend);
+    cfg.walDir = envString("BANK_WAL_DIR", cfg.walDir);
+    cfg.walSyncWindow = std::chrono::microseconds(envUnsigned("BANK_WAL_SYNC_US", cfg.walSyncWindow.count()));
+    cfg.snapshotInterval = std::chrono::seconds(envUnsigned("BANK_SNAPSHOT_INTERVAL_S", cfg.snapshotInterval.count()));
+    cfg.replicateUrl = envString("BANK_WAL_REPLICATE_URL", cfg.replicateUrl);
+    return cfg;
+}
+
+LogConfig loadLogConfig() {
+    LogConfig cfg;
+    cfg.level = envString("BANK_LOG_LEVEL", cfg.level);
+    const std::string format = envString("BANK_LOG_FORMAT", "kv");
+    cfg.json = format == "json";
+    if (format != "kv" && format != "json") {
+        LOG_WARN("config_invalid", {"name", "BANK_LOG_FORMAT"}, {"value", format});
+    }
+    cfg.file = envString("BANK_LOG_FILE", cfg.file);
+    return cfg;
+}
+
+AdminConfig loadAdminConfig() {
+    AdminConfig cfg;
+    cfg.token = envString("BANK_ADMIN_TOKEN", cfg.token);
+    cfg.importDir = envString("BANK_IMPORT_DIR", cfg.importDir);
+    return cfg;
+}
+
+AuthConfig loadAuthConfig() {
+    AuthConfig cfg;
+    cfg.sessionKey = envString("BANK_SESSION_KEY", cfg.sessionKey);
+    cfg.sessionTtl = std::chrono::seconds(std::max(1ul, envUnsigned("BANK_SESSION_TTL_S", cfg.sessionTtl.count())));
+    cfg.requireToken = envUnsigned("BANK_REQUIRE_AUTH", cfg.requireToken) != 0;
+    cfg.hashThreads = static_cast<unsigned>(std::max(1ul, envUnsigned("BANK_AUTH_THREADS", cfg.hashThreads)));
+    cfg.hashQueue = envUnsigned("BANK_AUTH_QUEUE", cfg.hashQueue);
+    cfg.passwordIterations =
+        static_cast<unsigned>(std::max(1ul, envUnsigned("BANK_PASSWORD_ITERATIONS", cfg.passwordIterations)));
+    return cfg;
+}
+
+AdmissionConfig loadAdmissionConfig() {
+    AdmissionConfig cfg;
+    cfg.maxInFlight = envUnsigned("BANK_MAX_INFLIGHT", cfg.maxInFlight);
+    cfg.maxStreams = envUnsigned("BANK_MAX_STREAMS", cfg.maxStreams);
+    cfg.maxQueued = envUnsigned("BANK_ADMISSION_QUEUE", cfg.maxQueued);
+    cfg.queueDeadline = std::chrono::milliseconds(envUnsigned("BANK_ADMISSION_DEADLINE_MS", cfg.queueDeadline.count()));
+    cfg.clientRate = static_cast<unsigned>(envUnsigned("BANK_RATE_CLIENT", cfg.clientRate));
+    cfg.clientBurst = static_cast<unsigned>(envUnsigned("BANK_RATE_CLIENT_BURST", cfg.clientBurst));
+    cfg.accountRate = static_cast<unsigned>(envUnsigned("BANK_RATE_ACCOUNT", cfg.accountRate));
+    cfg.accountBurst = static_cast<unsigned>(envUnsigned("BANK_RATE_ACCOUNT_BURST", cfg.accountBurst));
+    return cfg;
+}
+
+PushConfig loadPushConfig() {
+    PushConfig cfg;
+    cfg.queue = std::max(1ul, envUnsigned("BANK_PUSH_QUEUE", cfg.queue));
+    cfg.idleTimeout = std::chrono::seconds(std::max(2ul, envUnsigned("BANK_PUSH_IDLE_SECONDS", cfg.idleTimeout.count())));
+    return cfg;
+}
+
+TraceConfig loadTraceConfig() {
+    TraceConfig cfg;
+    cfg.file = envString("BANK_TRACE_FILE", cfg.file);
+    cfg.sampleOneIn = static_cast<unsigned>(envUnsigned("BANK_TRACE_SAMPLE_ONE_IN", cfg.sampleOneIn));
+    cfg.fileBytes = std::max(4096ul, envUnsigned("BANK_TRACE_FILE_BYTES", cfg.fileBytes));
+    cfg.files = static_cast<unsigned>(envUnsigned("BANK_TRACE_FILES", cfg.files));
+    return cfg;
+}
+
+HotAccountConfig loadHotAccountConfig() {
+    HotAccountConfig cfg;
+    const std::string accounts = envString("BANK_HOT_ACCOUNTS", "");
+    for (std::size_t start = 0; start < accounts.size();) {
+        std::size_t end = accounts.find(',', start);
+        if (end == std::string::npos) end = accounts.size();
+        const std::string id = accounts.substr(start, end - start);
+        try {
+            std::size_t used = 0;
+            const int value = std::stoi(id, &used);
+            if (used != id.size() || value <= 0) throw std::invalid_argument(id);
+            cfg.accounts.push_back(value);
+        } catch (const std::exception &) {
+            LOG_WARN("config_invalid", {"name", "BANK_HOT_ACCOUNTS"}, {"value", id});
+        }
+        start = end + 1;
+    }
+    cfg.stripes = static_cast<unsigned>(std::max(1ul, envUnsigned("BANK_HOT_STRIPES", cfg.stripes)));
+    cfg.consolidateInterval =
+        std::chrono::milliseconds(envUnsigned("BANK_HOT_CONSOLIDATE_MS", cfg.consolidateInterval.count()));
+    return cfg;
+}
+
+LedgerConfig loadLedgerConfig() {
+    LedgerConfig cfg;
+    cfg.monthsAhead = static_cast<unsigned>(envUnsigned("BANK_LEDGER_MONTHS_AHEAD", cfg.monthsAhead));
+    cfg.retainMonths = static_cast<unsigned>(envUnsigned("BANK_LEDGER_RETAIN_MONTHS", cfg.retainMonths));
+    cfg.maintainInterval = std::chrono::seconds(envUnsigned("BANK_LEDGER_MAINTAIN_S", cfg.maintainInterval.count()));
+    return cfg;
+}
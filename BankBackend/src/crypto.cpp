@@ -0,0 +1,351 @@
+#include "../include/crypto.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+namespace crypto {
+namespace {
+
+constexpr std::uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr const char *hashPrefix = "pbkdf2-sha256$";
+
+inline std::uint32_t rotr(std::uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+// Incremental SHA-256. The state can be copied, which PBKDF2 uses to hash
+// the HMAC pads once instead of on every iteration.
+class Sha256 {
+public:
+    Sha256() { reset(); }
+
+    void reset() {
+        static constexpr std::uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        std::memcpy(state, init, sizeof state);
+        length = 0;
+        buffered = 0;
+    }
+
+    void update(const std::uint8_t *data, std::size_t size) {
+        length += size;
+        if (buffered > 0) {
+            const std::size_t take = std::min(size, sizeof block - buffered);
+            std::memcpy(block + buffered, data, take);
+            buffered += take;
+            data += take;
+            size -= take;
+            if (buffered < sizeof block)
+                return;
+            compress(block);
+            buffered = 0;
+        }
+        for (; size >= sizeof block; data += sizeof block, size -= sizeof block)
+            compress(data);
+        std::memcpy(block, data, size);
+        buffered = size;
+    }
+
+    void update(std::string_view data) {
+        update(reinterpret_cast<const std::uint8_t *>(data.data()), data.size());
+    }
+
+    Digest finish() {
+        const std::uint64_t bits = length * 8;
+        const std::uint8_t pad = 0x80;
+        update(&pad, 1);
+        const std::uint8_t zero = 0;
+        while (buffered != 56)
+            update(&zero, 1);
+        std::uint8_t tail[8];
+        for (int i = 0; i < 8; ++i)
+            tail[i] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+        update(tail, sizeof tail);
+
+        Digest out;
+        for (int i = 0; i < 8; ++i)
+            for (int j = 0; j < 4; ++j)
+                out[4 * i + j] = static_cast<std::uint8_t>(state[i] >> (24 - 8 * j));
+        return out;
+    }
+
+private:
+    void compress(const std::uint8_t *chunk) {
+        std::uint32_t w[64];
+        for (int i = 0; i < 16; ++i)
+            w[i] = (std::uint32_t(chunk[4 * i]) << 24) | (std::uint32_t(chunk[4 * i + 1]) << 16) |
+                   (std::uint32_t(chunk[4 * i + 2]) << 8) | std::uint32_t(chunk[4 * i + 3]);
+        for (int i = 16; i < 64; ++i) {
+            const std::uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const std::uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            const std::uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) +
+                                     roundConstants[i] + w[i];
+            const std::uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    std::uint32_t state[8];
+    std::uint8_t block[64];
+    std::uint64_t length;
+    std::size_t buffered;
+};
+
+// HMAC with the inner and outer pad states hashed up front
+class Hmac {
+public:
+    explicit Hmac(std::string_view key) {
+        std::uint8_t k[64] = {};
+        if (key.size() > sizeof k) {
+            const Digest d = sha256(key);
+            std::memcpy(k, d.data(), d.size());
+        } else {
+            std::memcpy(k, key.data(), key.size());
+        }
+        std::uint8_t pad[64];
+        for (int i = 0; i < 64; ++i)
+            pad[i] = k[i] ^ 0x36;
+        inner.update(pad, sizeof pad);
+        for (int i = 0; i < 64; ++i)
+            pad[i] = k[i] ^ 0x5c;
+        outer.update(pad, sizeof pad);
+    }
+
+    Digest mac(const std::uint8_t *data, std::size_t size) const {
+        Sha256 in = inner;
+        in.update(data, size);
+        const Digest d = in.finish();
+        Sha256 out = outer;
+        out.update(d.data(), d.size());
+        return out.finish();
+    }
+
+private:
+    Sha256 inner;
+    Sha256 outer;
+};
+
+bool parseHash(const std::string &stored, std::uint32_t &iterations, std::string &salt, std::string &hash) {
+    if (stored.compare(0, std::strlen(hashPrefix), hashPrefix) != 0)
+        return false;
+    const std::size_t itEnd = stored.find('$', std::strlen(hashPrefix));
+    if (itEnd == std::string::npos)
+        return false;
+    const std::size_t saltEnd = stored.find('$', itEnd + 1);
+    if (saltEnd == std::string::npos)
+        return false;
+
+    const std::string count = stored.substr(std::strlen(hashPrefix), itEnd - std::strlen(hashPrefix));
+    if (count.empty() || count.size() > 9 || count.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    iterations = static_cast<std::uint32_t>(std::stoul(count));
+    return iterations > 0 &&
+           fromHex(std::string_view(stored).substr(itEnd + 1, saltEnd - itEnd - 1), salt) &&
+           fromHex(std::string_view(stored).substr(saltEnd + 1), hash) && hash.size() == sizeof(Digest);
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+constexpr const char *base64Alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if (c >= 'a' && c <= 'z')
+        return c - 'a' + 26;
+    if (c >= '0' && c <= '9')
+        return c - '0' + 52;
+    if (c == '-')
+        return 62;
+    if (c == '_')
+        return 63;
+    return -1;
+}
+
+} // namespace
+
+Digest sha256(std::string_view data) {
+    Sha256 h;
+    h.update(data);
+    return h.finish();
+}
+
+Digest hmacSha256(std::string_view key, std::string_view message) {
+    return Hmac(key).mac(reinterpret_cast<const std::uint8_t *>(message.data()), message.size());
+}
+
+Digest pbkdf2Sha256(std::string_view password, std::string_view salt, std::uint32_t iterations) {
+    const Hmac prf(password);
+
+    // U1 = PRF(password, salt || INT(1))
+    std::string first(salt);
+    first.append("\0\0\0\1", 4);
+    Digest u = prf.mac(reinterpret_cast<const std::uint8_t *>(first.data()), first.size());
+    Digest result = u;
+    for (std::uint32_t i = 1; i < iterations; ++i) {
+        u = prf.mac(u.data(), u.size());
+        for (std::size_t j = 0; j < result.size(); ++j)
+            result[j] ^= u[j];
+    }
+    return result;
+}
+
+std::string randomBytes(std::size_t n) {
+    std::string out(n, '\0');
+    std::ifstream urandom("/dev/urandom", std::ios::binary);
+    if (urandom.read(&out[0], static_cast<std::streamsize>(n)))
+        return out;
+
+    // No /dev/urandom (unusual container); random_device is the next best source
+    std::random_device device;
+    for (char &c : out)
+        c = static_cast<char>(device());
+    return out;
+}
+
+bool constantTimeEqual(std::string_view a, std::string_view b) {
+    if (a.size() != b.size())
+        return false;
+    unsigned char diff = 0;
+    for (std::size_t i = 0; i < a.size(); ++i)
+        diff |= static_cast<unsigned char>(a[i] ^ b[i]);
+    return diff == 0;
+}
+
+std::string toHex(std::string_view bytes) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(bytes.size() * 2);
+    for (unsigned char c : bytes) {
+        out.push_back(digits[c >> 4]);
+        out.push_back(digits[c & 0xf]);
+    }
+    return out;
+}
+
+bool fromHex(std::string_view hex, std::string &out) {
+    if (hex.size() % 2 != 0)
+        return false;
+    out.clear();
+    out.reserve(hex.size() / 2);
+    for (std::size_t i = 0; i < hex.size(); i += 2) {
+        const int hi = hexValue(hex[i]);
+        const int lo = hexValue(hex[i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out.push_back(static_cast<char>(hi << 4 | lo));
+    }
+    return true;
+}
+
+std::string base64Url(std::string_view bytes) {
+    std::string out;
+    out.reserve((bytes.size() + 2) / 3 * 4);
+    std::size_t i = 0;
+    for (; i + 3 <= bytes.size(); i += 3) {
+        const std::uint32_t v = std::uint32_t(static_cast<unsigned char>(bytes[i])) << 16 |
+                                std::uint32_t(static_cast<unsigned char>(bytes[i + 1])) << 8 |
+                                static_cast<unsigned char>(bytes[i + 2]);
+        out.push_back(base64Alphabet[v >> 18 & 63]);
+        out.push_back(base64Alphabet[v >> 12 & 63]);
+        out.push_back(base64Alphabet[v >> 6 & 63]);
+        out.push_back(base64Alphabet[v & 63]);
+    }
+    const std::size_t rest = bytes.size() - i;
+    if (rest > 0) {
+        std::uint32_t v = std::uint32_t(static_cast<unsigned char>(bytes[i])) << 16;
+        if (rest == 2)
+            v |= std::uint32_t(static_cast<unsigned char>(bytes[i + 1])) << 8;
+        out.push_back(base64Alphabet[v >> 18 & 63]);
+        out.push_back(base64Alphabet[v >> 12 & 63]);
+        if (rest == 2)
+            out.push_back(base64Alphabet[v >> 6 & 63]);
+    }
+    return out;
+}
+
+bool fromBase64Url(std::string_view text, std::string &out) {
+    if (text.size() % 4 == 1)
+        return false;
+    out.clear();
+    out.reserve(text.size() * 3 / 4);
+    std::uint32_t acc = 0;
+    int bits = 0;
+    for (char c : text) {
+        const int v = base64Value(c);
+        if (v < 0)
+            return false;
+        acc = acc << 6 | static_cast<std::uint32_t>(v);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>(acc >> bits & 0xff));
+        }
+    }
+    return true;
+}
+
+std::string hashPassword(std::string_view password, std::uint32_t iterations) {
+    if (iterations == 0)
+        throw std::invalid_argument("hashPassword: iterations must be positive");
+    const std::string salt = randomBytes(16);
+    const Digest hash = pbkdf2Sha256(password, salt, iterations);
+    return hashPrefix + std::to_string(iterations) + "$" + toHex(salt) + "$" +
+           toHex(std::string_view(reinterpret_cast<const char *>(hash.data()), hash.size()));
+}
+
+bool verifyPassword(std::string_view password, const std::string &stored) {
+    std::uint32_t iterations;
+    std::string salt, hash;
+    if (!parseHash(stored, iterations, salt, hash))
+        return constantTimeEqual(password, stored);
+    const Digest actual = pbkdf2Sha256(password, salt, iterations);
+    return constantTimeEqual(std::string_view(reinterpret_cast<const char *>(actual.data()), actual.size()), hash);
+}
+
+bool needsRehash(const std::string &stored, std::uint32_t iterations) {
+    std::uint32_t current;
+    std::string salt, hash;
+    return !parseHash(stored, current, salt, hash) || current < iterations;
+}
+
+} // namespace crypto
@@ -1,173 +1,277 @@
 #include "../include/db.hpp"
-#include <iostream>
+#include "../include/balance_cache.hpp"
+#include "../include/group_commit.hpp"
+#include "../include/log.hpp"
+#include "../include/metrics.hpp"
+#include "../include/replicas.hpp"
+#include "../include/statements.hpp"
+#include "../include/trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
-// Constructor / Destructor remain the same:
-DB::DB() {
-    try {
-        conn = new pqxx::connection("dbname=bankapp user=ayaanmunshi hostaddr=127.0.0.1 port=5432");
-        if (conn->is_open()) {
-            std::cout << "Connected to database: " << conn->dbname() << std::endl;
-        } else {
-            std::cerr << "Connection failed." << std::endl;
+namespace {
+
+constexpr int maxAttempts = 3;
+constexpr std::chrono::milliseconds retryBackoff{5};
+
+// Run a single-statement money movement, retrying a bounded number of times
+// when Postgres aborts it with a serialization failure or deadlock. Those
+// errors guarantee nothing was applied, so a retry can't double-apply.
+template <typename Fn>
+auto withRetry(const char *what, Fn &&fn) -> decltype(fn()) {
+    for (int attempt = 1;; ++attempt) {
+        try {
+            trace::Span span("statement", what); // one per attempt
+            return fn();
+        } catch (const pqxx::serialization_failure &e) {
+            if (attempt >= maxAttempts) throw;
+            LOG_WARN("db_retry", {"op", what}, {"attempt", attempt}, {"error", e.what()});
+            metrics::add(metrics::Counter::dbRetries);
+        } catch (const pqxx::deadlock_detected &e) {
+            if (attempt >= maxAttempts) throw;
+            LOG_WARN("db_retry", {"op", what}, {"attempt", attempt}, {"error", e.what()});
+            metrics::add(metrics::Counter::dbRetries);
         }
-    } catch (const std::exception &e) {
-        std::cerr << "DB Constructor Error: " << e.what() << std::endl;
-        conn = nullptr;
+        std::this_thread::sleep_for(retryBackoff * attempt);
     }
 }
 
-DB::~DB() {
-    if (conn) {
-        delete conn;
-        std::cout << "🔌 Disconnected from database." << std::endl;
+// A single-statement money movement either applied or it didn't: no commit
+// is left in doubt without raising
+WriteResult written(bool applied) {
+    return applied ? WriteResult::applied : WriteResult::failed;
+}
+
+// Commit as a span of its own, so a slow WAL flush stands out in traces
+template <typename Txn>
+void commit(Txn &txn) {
+    trace::Span span("commit");
+    txn.commit();
+}
+
+// Run a read on the replica ReplicaRouter picks for `userId`. False when the
+// primary should answer instead: no replica is usable, or `read` failed or
+// returned false there (e.g. a row the replica hasn't replayed yet).
+template <typename Fn>
+bool readReplica(int userId, const char *what, Fn &&read) {
+    ReplicaRouter &router = ReplicaRouter::instance();
+    const int replica = router.pick(userId);
+    if (replica < 0) return false;
+
+    ConnectionPool::Lease lease = router.pool(replica).acquire();
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+    try {
+        if (lease && read(*lease)) return true;
+    } catch (const std::exception &e) {
+        LOG_WARN("db_replica_error", {"op", what}, {"replica", replica}, {"error", e.what()});
     }
+    router.fellBack();
+    return false;
 }
 
+} // namespace
+
+// Connections come from the shared pool; nothing is opened until first use
+DB::DB() = default;
+
+// The lease returns the connection to the pool
+DB::~DB() = default;
+
 bool DB::isConnected() {
+    if (!lease) {
+        lease = ConnectionPool::instance().acquire();
+        conn = lease.get();
+    }
     return conn && conn->is_open();
 }
 
 pqxx::connection* DB::getConn() {
-    return conn;
+    return isConnected() ? conn : nullptr;
 }
 
 // 1) Create a new user in 'users' table
 bool DB::createUser(const std::string &name, double initialBalance) {
     if (!isConnected()) return false;
     
-    std::lock_guard<std::mutex> lock(dbMutex);  
-
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params(
-            "INSERT INTO users (name, balance) VALUES ($1, $2)",
-            name, initialBalance
-        );
-        txn.commit();
+        txn.exec_prepared(stmt::createUser, name, initialBalance);
+        commit(txn);
         return true;
     } catch (const std::exception &e) {
-        std::cerr << "createUser Error: " << e.what() << std::endl;
+        LOG_ERROR("db_error", {"op", "createUser"}, {"error", e.what()});
         return false;
     }
 }
 
-// 2) Get a user's current balance
+// 2) Get a user's current balance (served from the balance cache when possible)
 double DB::getBalance(int userId) {
+    BalanceCache &cache = BalanceCache::instance();
+    double cached;
+    if (cache.get(userId, cached)) return cached;
+    const std::uint64_t ticket = cache.ticket(userId);
+
+    // A replica's answer may trail the primary's by up to the lag bound, so
+    // it is returned but never cached
+    double balance = -1.0;
+    if (readReplica(userId, "getBalance", [&](pqxx::connection &replica) {
+            pqxx::read_transaction txn(replica);
+            pqxx::result r = txn.exec_prepared(stmt::getBalance, userId);
+            if (r.empty()) return false; // created after the replica's snapshot, perhaps
+            balance = r[0][0].as<double>();
+            return true;
+        })) {
+        return balance;
+    }
+
     if (!isConnected()) return -1.0;
-    std::lock_guard<std::mutex> lock(dbMutex);  
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
         pqxx::work txn(*conn);
-        pqxx::result r = txn.exec_params(
-            "SELECT balance FROM users WHERE id = $1",
-            userId
-        );
+        pqxx::result r = txn.exec_prepared(stmt::getBalance, userId);
 
         // If user not found
         if (r.empty()) {
-            std::cerr << "No user found with id: " << userId << std::endl;
+            LOG_INFO("user_not_found", {"userId", userId});
             return -1.0;
         }
 
-        double balance = r[0][0].as<double>();
-        txn.commit();
+        balance = r[0][0].as<double>();
+        commit(txn);
+        cache.fill(userId, balance, ticket);
         return balance;
     } catch (const std::exception &e) {
-        std::cerr << "getBalance Error: " << e.what() << std::endl;
+        LOG_ERROR("db_error", {"op", "getBalance"}, {"error", e.what()});
         return -1.0;
     }
 }
 
-// 3) Deposit -> also record transaction in 'transactions' table
-bool DB::deposit(int userId, double amount) {
-    if (!isConnected()) return false;
+// 3) Deposit -> also record transaction in 'transactions' table.
+// One statement credits the balance and writes the ledger row.
+WriteResult DB::deposit(int userId, double amount) {
     if (amount <= 0) {
-        std::cerr << "⚠️ Deposit amount must be > 0\n";
-        return false;
+        LOG_INFO("invalid_amount", {"op", "deposit"}, {"amount", amount});
+        return WriteResult::failed;
     }
-    std::lock_guard<std::mutex> lock(dbMutex);  
-
+    GroupCommitter &committer = GroupCommitter::instance();
+    if (committer.enabled()) {
+        metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+        return committer.execute({GroupCommitter::Kind::deposit, userId, 0, amount});
+    }
+    if (!isConnected()) return WriteResult::failed;
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
-        pqxx::work txn(*conn);
-
-        // 3a) Update user balance
-        txn.exec_params(
-            "UPDATE users SET balance = balance + $1 WHERE id = $2",
-            amount, userId
-        );
-
-        // 3b) Insert into transactions
-        txn.exec_params(
-            "INSERT INTO transactions (user_id, amount, type) VALUES ($1, $2, 'deposit')",
-            userId, amount
-        );
-
-        txn.commit();
-        return true;
+        return written(withRetry("deposit", [&] {
+            pqxx::nontransaction txn(*conn);
+            pqxx::result r = txn.exec_prepared(stmt::deposit, userId, amount);
+            if (r.empty()) {
+                LOG_INFO("user_not_found", {"userId", userId});
+                return false;
+            }
+            BalanceCache::instance().putRows(r);
+            return true;
+        }));
     } catch (const std::exception &e) {
-        std::cerr << "deposit Error: " << e.what() << std::endl;
-        return false;
+        LOG_ERROR("db_error", {"op", "deposit"}, {"error", e.what()});
+        return WriteResult::failed;
     }
 }
 
-// 4) Withdraw -> also record transaction
-bool DB::withdraw(int userId, double amount) {
-    if (!isConnected()) return false;
+// 4) Withdraw -> also record transaction.
+// The balance check is part of the UPDATE, so there is no read-then-write
+// race and the whole withdrawal is one round trip.
+WriteResult DB::withdraw(int userId, double amount) {
     if (amount <= 0) {
-        std::cerr << "⚠️ Withdraw amount must be > 0\n";
-        return false;
+        LOG_INFO("invalid_amount", {"op", "withdraw"}, {"amount", amount});
+        return WriteResult::failed;
     }
+    GroupCommitter &committer = GroupCommitter::instance();
+    if (committer.enabled()) {
+        metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+        return committer.execute({GroupCommitter::Kind::withdraw, userId, 0, amount});
+    }
+    if (!isConnected()) return WriteResult::failed;
 
-    std::lock_guard<std::mutex> lock(dbMutex);  
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
-        pqxx::work txn(*conn);
+        return written(withRetry("withdraw", [&] {
+            pqxx::nontransaction txn(*conn);
+            pqxx::result r = txn.exec_prepared(stmt::withdraw, userId, amount);
+            if (!r.empty()) {
+                BalanceCache::instance().putRows(r);
+                return true;
+            }
 
-        // 4a) Check current balance
-        pqxx::result r = txn.exec_params(
-            "SELECT balance FROM users WHERE id = $1",
-            userId
-        );
-        if (r.empty()) {
-            std::cerr << "No user found with id: " << userId << std::endl;
-            return false;
-        }
-        double currentBalance = r[0][0].as<double>();
-        if (currentBalance < amount) {
-            std::cerr << "Insufficient funds. Current balance: " << currentBalance << std::endl;
+            // Nothing was debited: no such account, or not enough in it.
+            // Telling which would take another query on a held connection.
+            LOG_INFO("withdraw_refused", {"userId", userId}, {"amount", amount});
             return false;
-        }
+        }));
+    } catch (const std::exception &e) {
+        LOG_ERROR("db_error", {"op", "withdraw"}, {"error", e.what()});
+        return WriteResult::failed;
+    }
+}
 
-        // 4b) Deduct from user balance
-        txn.exec_params(
-            "UPDATE users SET balance = balance - $1 WHERE id = $2",
-            amount, userId
-        );
+// Transfer money between two users atomically. Both rows are locked in
+// ascending id order inside the statement, so opposite transfers between the
+// same pair of accounts queue behind each other instead of deadlocking.
+WriteResult DB::transfer(int senderId, int receiverId, double amount) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "transfer"}, {"amount", amount});
+        return WriteResult::failed;
+    }
+    if (senderId == receiverId) {
+        LOG_INFO("self_transfer", {"userId", senderId});
+        return WriteResult::failed;
+    }
+    GroupCommitter &committer = GroupCommitter::instance();
+    if (committer.enabled()) {
+        metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+        return committer.execute({GroupCommitter::Kind::transfer, senderId, receiverId, amount});
+    }
+    if (!isConnected()) {
+        LOG_ERROR("db_unavailable", {"op", "transfer"});
+        return WriteResult::failed;
+    }
 
-        // 4c) Insert into transactions
-        txn.exec_params(
-            "INSERT INTO transactions (user_id, amount, type) VALUES ($1, $2, 'withdrawal')",
-            userId, amount
-        );
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+    try {
+        return written(withRetry("transfer", [&] {
+            pqxx::nontransaction txn(*conn);
+            pqxx::result r = txn.exec_prepared(stmt::transfer, senderId, receiverId, amount);
+            if (!r.empty()) {
+                BalanceCache::instance().putRows(r);
+                LOG_DEBUG("transfer_complete", {"senderId", senderId}, {"receiverId", receiverId}, {"amount", amount});
+                return true;
+            }
 
-        txn.commit();
-        return true;
+            // Nothing moved: an account is missing or the sender is short,
+            // logged as is rather than looked up again
+            LOG_INFO("transfer_refused", {"senderId", senderId}, {"receiverId", receiverId}, {"amount", amount});
+            return false;
+        }));
     } catch (const std::exception &e) {
-        std::cerr << "withdraw Error: " << e.what() << std::endl;
-        return false;
+        LOG_ERROR("db_error", {"op", "transfer"}, {"error", e.what()});
+        return WriteResult::failed;
     }
 }
 
-// 5) (Optional) Return list of transactions as strings
-std::vector<Transaction> DB::getTransactions(int userId) {
+// 5) Return one page of a user's transactions. Seeks straight to the
+// cursor's (timestamp, id) on the (user_id, timestamp, id) index, and the
+// timestamp keeps older monthly partitions out of the scan, so deep pages
+// cost the same as the first one.
+// A failed read is nullopt, never an empty page, so a caller can't mistake
+// it for the end of the history.
+std::optional<std::vector<Transaction>> DB::getTransactions(int userId, const HistoryCursor &after, int limit) {
     std::vector<Transaction> transactions;
-    if (!isConnected()) return transactions;
-
-    std::lock_guard<std::mutex> lock(dbMutex);  
-    try {
-        pqxx::work txn(*conn);
-        pqxx::result r = txn.exec_params(
-            "SELECT id, user_id, amount, type, timestamp FROM transactions WHERE user_id = $1 ORDER BY id",
-            userId
-        );
+        auto readPage = [&](pqxx::connection &c) {
+        pqxx::read_transaction txn(c);
+        pqxx::result r = txn.exec_prepared(stmt::transactionsForUser, userId, after.id, limit, after.timestamp);
+        transactions.clear();
+        transactions.reserve(r.size());
 
         for (auto row : r) {
             Transaction tx(
@@ -179,10 +283,18 @@ std::vector<Transaction> DB::getTransactions(int userId) {
             );
             transactions.push_back(tx);
         }
+        return true;
+    };
+
+    if (readReplica(userId, "getTransactions", readPage)) return transactions;
+    if (!isConnected()) return std::nullopt;
 
-        txn.commit();
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+    try {
+        readPage(*conn);
     } catch (const std::exception &e) {
-        std::cerr << "getTransactions Error: " << e.what() << std::endl;
+        LOG_ERROR("db_error", {"op", "getTransactions"}, {"error", e.what()});
+        return std::nullopt;
     }
 
     return transactions;
@@ -191,31 +303,103 @@ std::vector<Transaction> DB::getTransactions(int userId) {
 // 6) Register User DB Functionality
 bool DB::registerUser(const std::string &name, const std::string &password, double initialBalance) {
     if (!isConnected()) return false;
-    std::lock_guard<std::mutex> lock(dbMutex);  
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
         pqxx::work txn(*conn);
-        txn.exec_params("INSERT INTO users (name, password, balance) VALUES ($1, $2, $3)",
-                        name, password, initialBalance);
-        txn.commit();
+        txn.exec_prepared(stmt::registerUser, name, password, initialBalance);
+        commit(txn);
         return true;
     } catch (const std::exception &e) {
-        std::cerr << "registerUser Error: " << e.what() << std::endl;
+        LOG_ERROR("db_error", {"op", "registerUser"}, {"error", e.what()});
         return false;
     }
 }
 
-//DB Functionality to check login feature
-int DB::loginUser(const std::string &name, const std::string &password) {
-    if (!isConnected()) return -1;
-    std::lock_guard<std::mutex> lock(dbMutex);  
+// 7) Login candidates: the caller verifies the password against each. Always
+// read from the primary, so a password just changed can't be checked
+// against a replica's stale copy.
+std::vector<Credential> DB::getCredentials(const std::string &name) {
+    std::vector<Credential> found;
+    if (!isConnected()) return found;
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+    try {
+        pqxx::read_transaction txn(*conn);
+        pqxx::result r = txn.exec_prepared(stmt::credentials, name);
+        found.reserve(r.size());
+        for (const auto &row : r) {
+            found.push_back({row[0].as<int>(), row[1].as<std::string>()});
+        }
+    } catch (const std::exception &e) {
+        LOG_ERROR("db_error", {"op", "getCredentials"}, {"error", e.what()});
+    }
+    return found;
+}
+
+// 9) Batch of deposits/withdrawals/transfers in one round trip and one commit,
+// reusing the group-commit pipeline. Serialization failures re-run the whole
+// batch, since nothing from an aborted attempt was applied.
+std::vector<BatchResult> DB::executeBatch(const std::vector<BatchOperation> &ops, bool atomic) {
+    std::vector<BatchResult> results(ops.size(), BatchResult::failed);
+    if (ops.empty()) return results;
+
+    // Requests that can never succeed don't go to the server. In atomic mode
+    // one of them sinks the whole batch.
+    std::vector<std::size_t> sent;
+    std::vector<GroupCommitter::Operation> converted;
+    converted.reserve(ops.size());
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const BatchOperation &op = ops[i];
+        if (!validBatchOperation(op)) continue;
+        GroupCommitter::Kind kind = GroupCommitter::Kind::deposit;
+        if (op.kind == BatchOperation::Kind::withdraw) kind = GroupCommitter::Kind::withdraw;
+        if (op.kind == BatchOperation::Kind::transfer) kind = GroupCommitter::Kind::transfer;
+        converted.push_back({kind, op.userId, op.receiverId, op.amount});
+        sent.push_back(i);
+    }
+    if (atomic && sent.size() != ops.size()) {
+        for (std::size_t i : sent) results[i] = BatchResult::rolledBack;
+        return results;
+    }
+    if (converted.empty() || !isConnected()) return results;
+
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
+    try {
+        std::vector<bool> succeeded;
+        BatchResult ok = BatchResult::applied;
+        if (atomic) {
+            const bool committed = withRetry("batch", [&] {
+                return GroupCommitter::executeAtomic(*conn, converted, succeeded);
+            });
+            if (!committed) ok = BatchResult::rolledBack;
+        } else {
+            succeeded = withRetry("batch", [&] { return GroupCommitter::executeBatch(*conn, converted); });
+        }
+        for (std::size_t j = 0; j < sent.size(); ++j) {
+            if (succeeded[j]) results[sent[j]] = ok;
+        }
+    } catch (const pqxx::in_doubt_error &e) {
+        // The batch may have committed, so no result would be true: the
+        // request fails as a whole instead
+        LOG_ERROR("db_error", {"op", "batch"}, {"size", ops.size()}, {"error", e.what()});
+        throw;
+    } catch (const std::exception &e) {
+        LOG_ERROR("db_error", {"op", "batch"}, {"size", ops.size()}, {"error", e.what()});
+        std::fill(results.begin(), results.end(), BatchResult::failed);
+    }
+    return results;
+}
+
+// 10) Password replacement, used to upgrade legacy plaintext and weaker hashes
+bool DB::setPassword(int userId, const std::string &password) {
+    if (!isConnected()) return false;
+    metrics::ScopedPhase sqlTimer(metrics::Phase::sql);
     try {
         pqxx::work txn(*conn);
-        pqxx::result r = txn.exec_params("SELECT id FROM users WHERE name = $1 AND password = $2",
-                                         name, password);
-        if (r.empty()) return -1; // Login failed
-        return r[0][0].as<int>();
+        txn.exec_prepared(stmt::setPassword, userId, password);
+        commit(txn);
+        return true;
     } catch (const std::exception &e) {
-        std::cerr << "loginUser Error: " << e.what() << std::endl;
-        return -1;
+        LOG_ERROR("db_error", {"op", "setPassword"}, {"error", e.what()});
+        return false;
     }
 }
@@ -0,0 +1,153 @@
+#include "../include/db_pool.hpp"
+#include "../include/log.hpp"
+#include "../include/metrics.hpp"
+#include "../include/statements.hpp"
+#include <algorithm>
+
+// ---- Lease ----
+
+ConnectionPool::Lease::Lease(ConnectionPool *pool, std::unique_ptr<pqxx::connection> conn)
+    : pool(pool), conn(std::move(conn)) {}
+
+ConnectionPool::Lease::Lease(Lease &&other) noexcept
+    : pool(other.pool), conn(std::move(other.conn)) {
+    other.pool = nullptr;
+}
+
+ConnectionPool::Lease &ConnectionPool::Lease::operator=(Lease &&other) noexcept {
+    if (this != &other) {
+        reset();
+        pool = other.pool;
+        conn = std::move(other.conn);
+        other.pool = nullptr;
+    }
+    return *this;
+}
+
+ConnectionPool::Lease::~Lease() {
+    reset();
+}
+
+void ConnectionPool::Lease::reset() {
+    if (pool && conn) pool->release(std::move(conn));
+    pool = nullptr;
+}
+
+// ---- ConnectionPool ----
+
+ConnectionPool &ConnectionPool::instance() {
+    static ConnectionPool pool;
+    return pool;
+}
+
+void ConnectionPool::init(const DbConfig &config) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        cfg = config;
+    }
+
+    // Warm up: open the minimum number of connections before serving traffic.
+    // At least one is always opened so the statement catalogue gets checked
+    // against the schema before the server accepts requests.
+    const std::size_t warmCount = std::max<std::size_t>(1, config.poolMin);
+    std::vector<Lease> warm;
+    for (std::size_t i = 0; i < warmCount; ++i) {
+        Lease lease = acquire();
+        if (!lease) {
+            throw std::runtime_error("could not open database connection " + std::to_string(i + 1) +
+                                     " of " + std::to_string(warmCount));
+        }
+        warm.push_back(std::move(lease));
+    }
+    LOG_INFO("db_pool_ready", {"connections", warmCount}, {"max", config.poolMax});
+}
+
+std::unique_ptr<pqxx::connection> ConnectionPool::connect() {
+    try {
+        auto conn = std::make_unique<pqxx::connection>(cfg.connectionString);
+        if (conn->is_open()) {
+            stmt::prepareAll(*conn);
+            return conn;
+        }
+        LOG_ERROR("db_connect_failed");
+    } catch (const std::exception &e) {
+        LOG_ERROR("db_connect_failed", {"error", e.what()});
+    }
+    return nullptr;
+}
+
+// A connection that sat idle for a while may have been dropped by the server
+// or a proxy, so ping it before handing it out.
+bool ConnectionPool::healthy(pqxx::connection &conn, std::chrono::steady_clock::time_point idleSince) {
+    if (!conn.is_open()) return false;
+    if (std::chrono::steady_clock::now() - idleSince < cfg.healthCheckAfter) return true;
+    try {
+        pqxx::nontransaction ping(conn);
+        ping.exec("SELECT 1");
+        return true;
+    } catch (const std::exception &e) {
+        LOG_WARN("db_pool_drop", {"error", e.what()});
+        return false;
+    }
+}
+
+ConnectionPool::Lease ConnectionPool::acquire() {
+    metrics::ScopedPhase timer(metrics::Phase::poolCheckout);
+    std::unique_lock<std::mutex> lock(mutex);
+    const auto deadline = std::chrono::steady_clock::now() + cfg.acquireTimeout;
+
+    for (;;) {
+        if (!idle.empty()) {
+            Idle entry = std::move(idle.back());
+            idle.pop_back();
+
+            lock.unlock();
+            if (healthy(*entry.conn, entry.since)) return Lease(this, std::move(entry.conn));
+            entry.conn.reset();
+            lock.lock();
+            --total; // replaced below or by the next caller
+            continue;
+        }
+
+        if (total < cfg.poolMax) {
+            ++total;
+            lock.unlock();
+            auto conn = connect();
+            if (conn) return Lease(this, std::move(conn));
+
+            lock.lock();
+            --total;
+            available.notify_one();
+            return Lease();
+        }
+
+        ++waiting;
+        const auto waitStart = metrics::Clock::now();
+        bool signalled = available.wait_until(lock, deadline, [this] {
+            return !idle.empty() || total < cfg.poolMax;
+        });
+        --waiting;
+        metrics::add(metrics::Counter::poolWaits);
+        metrics::add(metrics::Counter::poolWaitNanos, metrics::nanosBetween(waitStart, metrics::Clock::now()));
+        if (!signalled) {
+            LOG_WARN("db_pool_exhausted", {"timeoutMs", cfg.acquireTimeout.count()});
+            return Lease();
+        }
+    }
+}
+
+void ConnectionPool::release(std::unique_ptr<pqxx::connection> conn) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (conn && conn->is_open()) {
+        idle.push_back({std::move(conn), std::chrono::steady_clock::now()});
+    } else {
+        // Broken during use (e.g. pqxx::broken_connection); let a waiter reconnect
+        --total;
+    }
+    available.notify_one();
+}
+
+ConnectionPool::Stats ConnectionPool::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {idle.size(), total, waiting};
+}
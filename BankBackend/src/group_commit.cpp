@@ -0,0 +1,257 @@
+#include "../include/group_commit.hpp"
+#include "../include/balance_cache.hpp"
+#include "../include/db_pool.hpp"
+#include "../include/log.hpp"
+#include "../include/metrics.hpp"
+#include "../include/statements.hpp"
+#include <future>
+#include <string>
+
+namespace {
+
+constexpr int maxAttempts = 3;
+
+const char *statementFor(GroupCommitter::Kind kind) {
+    switch (kind) {
+    case GroupCommitter::Kind::deposit: return stmt::deposit;
+    case GroupCommitter::Kind::withdraw: return stmt::withdraw;
+    case GroupCommitter::Kind::transfer: return stmt::transfer;
+    }
+    return nullptr;
+}
+
+// EXECUTE text for one operation so a whole batch can go through one
+// pqxx::pipeline while still using the prepared statements.
+std::string executeSql(pqxx::transaction_base &txn, const GroupCommitter::Operation &op) {
+    std::string sql = "EXECUTE ";
+    sql += statementFor(op.kind);
+    sql += "(" + pqxx::to_string(op.userId);
+    if (op.kind == GroupCommitter::Kind::transfer) sql += ", " + pqxx::to_string(op.receiverId);
+    sql += ", " + txn.quote(op.amount) + ")";
+    return sql;
+}
+
+pqxx::result runOne(pqxx::transaction_base &txn, const GroupCommitter::Operation &op) {
+    if (op.kind == GroupCommitter::Kind::transfer) {
+        return txn.exec_prepared(statementFor(op.kind), op.userId, op.receiverId, op.amount);
+    }
+    return txn.exec_prepared(statementFor(op.kind), op.userId, op.amount);
+}
+
+// Send every operation through one pipeline in `txn`; `changed` gets the rows each one touched
+void pipelineAll(pqxx::transaction_base &txn, const std::vector<GroupCommitter::Operation> &ops,
+                 std::vector<pqxx::result> &changed) {
+    std::vector<pqxx::pipeline::query_id> ids;
+    ids.reserve(ops.size());
+    pqxx::pipeline pipe(txn);
+    for (const GroupCommitter::Operation &op : ops) ids.push_back(pipe.insert(executeSql(txn, op)));
+    pipe.complete();
+    for (std::size_t i = 0; i < ops.size(); ++i) changed[i] = pipe.retrieve(ids[i]);
+}
+
+std::size_t bucketFor(std::size_t batchSize) {
+    std::size_t bucket = 0;
+    while (batchSize > 1 && bucket + 1 < GroupCommitter::histogramBuckets) {
+        batchSize >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+} // namespace
+
+GroupCommitter &GroupCommitter::instance() {
+    static GroupCommitter committer;
+    return committer;
+}
+
+GroupCommitter::~GroupCommitter() {
+    stop();
+}
+
+void GroupCommitter::start(const GroupCommitConfig &config) {
+    if (!config.enabled || running.load()) return;
+    cfg = config;
+    stopping = false;
+    worker = std::thread(&GroupCommitter::run, this);
+    running.store(true, std::memory_order_release);
+    LOG_INFO("group_commit_enabled", {"windowUs", cfg.window.count()}, {"maxBatch", cfg.maxBatch});
+}
+
+void GroupCommitter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!worker.joinable()) return;
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+    running.store(false, std::memory_order_release);
+}
+
+void GroupCommitter::submit(const Operation &op, Callback done) {
+    std::size_t depth;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back({op, std::move(done), std::chrono::steady_clock::now()});
+        depth = queue.size();
+    }
+    // Wake the committer for the first operation of a batch, or early when full
+    if (depth == 1 || depth >= cfg.maxBatch) wakeup.notify_one();
+}
+
+WriteResult GroupCommitter::execute(const Operation &op) {
+    std::promise<WriteResult> result;
+    std::future<WriteResult> future = result.get_future();
+    submit(op, [&result](WriteResult outcome) { result.set_value(outcome); });
+    return future.get();
+}
+
+GroupCommitter::Stats GroupCommitter::stats() const {
+    Stats s{batchCount.load(), operationCount.load(), retryCount.load(), {}};
+    for (std::size_t i = 0; i < histogramBuckets; ++i) s.batchSizes[i] = sizeHistogram[i].load();
+    return s;
+}
+
+void GroupCommitter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wakeup.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) return; // stopping and drained
+
+        // Hold the batch open until the window closes or it fills up
+        const auto closesAt = queue.front().arrived + cfg.window;
+        wakeup.wait_until(lock, closesAt, [this] { return stopping || queue.size() >= cfg.maxBatch; });
+
+        const std::size_t take = std::min(queue.size(), cfg.maxBatch);
+        std::vector<Pending> batch;
+        batch.reserve(take);
+        for (std::size_t i = 0; i < take; ++i) {
+            batch.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+
+        lock.unlock();
+        commit(batch);
+        lock.lock();
+    }
+}
+
+void GroupCommitter::commit(std::vector<Pending> &batch) {
+    std::vector<Operation> ops;
+    ops.reserve(batch.size());
+    for (const Pending &p : batch) ops.push_back(p.op);
+
+    std::vector<bool> results(batch.size(), false);
+    bool inDoubt = false;
+    ConnectionPool::Lease lease = ConnectionPool::instance().acquire();
+    if (lease) {
+        for (int attempt = 1; attempt <= maxAttempts; ++attempt) {
+            try {
+                results = executeBatch(*lease, ops);
+                break;
+            } catch (const pqxx::in_doubt_error &e) {
+                // The connection went while COMMIT was under way: the batch
+                // may have been applied, so nobody is told it failed
+                LOG_ERROR("group_commit_in_doubt", {"batch", ops.size()}, {"error", e.what()});
+                inDoubt = true;
+                break;
+            } catch (const pqxx::transaction_rollback &e) {
+                // Serialization failure or deadlock: nothing committed, run it again
+                LOG_WARN("group_commit_retry", {"attempt", attempt}, {"batch", ops.size()}, {"error", e.what()});
+                retryCount.fetch_add(1, std::memory_order_relaxed);
+                metrics::add(metrics::Counter::dbRetries);
+            } catch (const std::exception &e) {
+                LOG_ERROR("group_commit_error", {"batch", ops.size()}, {"error", e.what()});
+                break;
+            }
+        }
+    }
+    lease = ConnectionPool::Lease();
+
+    batchCount.fetch_add(1, std::memory_order_relaxed);
+    operationCount.fetch_add(batch.size(), std::memory_order_relaxed);
+    sizeHistogram[bucketFor(batch.size())].fetch_add(1, std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (inDoubt) batch[i].done(WriteResult::unknown);
+        else batch[i].done(results[i] ? WriteResult::applied : WriteResult::failed);
+    }
+}
+
+std::vector<bool> GroupCommitter::executeBatch(pqxx::connection &conn, const std::vector<Operation> &ops) {
+    std::vector<bool> results(ops.size(), false);
+    std::vector<pqxx::result> changed(ops.size());
+
+    // Balances only go into the cache once the batch has committed
+    auto writeThrough = [&changed] {
+        for (const pqxx::result &rows : changed) BalanceCache::instance().putRows(rows);
+    };
+
+    // Fast path: pipeline every statement and commit once. The statements
+    // report business failures (missing account, insufficient funds) as an
+    // empty result rather than an error, so this almost always succeeds.
+    try {
+        pqxx::work txn(conn);
+        pipelineAll(txn, ops, changed);
+        for (std::size_t i = 0; i < ops.size(); ++i) results[i] = !changed[i].empty();
+        txn.commit();
+        writeThrough();
+        return results;
+    } catch (const pqxx::transaction_rollback &) {
+        throw; // let the caller retry the whole batch
+    } catch (const pqxx::sql_error &e) {
+        LOG_WARN("group_commit_fallback", {"batch", ops.size()}, {"error", e.what()});
+    }
+
+    // Slow path: one statement raised an error, which aborted the shared
+    // transaction. Re-run with a savepoint per operation so only it fails.
+    pqxx::work txn(conn);
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        try {
+            pqxx::subtransaction savepoint(txn);
+            changed[i] = runOne(savepoint, ops[i]);
+            results[i] = !changed[i].empty();
+            savepoint.commit();
+        } catch (const pqxx::transaction_rollback &) {
+            throw;
+        } catch (const pqxx::sql_error &e) {
+            LOG_WARN("group_commit_op_failed", {"index", i}, {"error", e.what()});
+            changed[i] = pqxx::result();
+            results[i] = false;
+        }
+    }
+    txn.commit();
+    writeThrough();
+    return results;
+}
+
+bool GroupCommitter::executeAtomic(pqxx::connection &conn, const std::vector<Operation> &ops,
+                                   std::vector<bool> &results) {
+    results.assign(ops.size(), false);
+    std::vector<pqxx::result> changed(ops.size());
+    pqxx::work txn(conn);
+    try {
+        pipelineAll(txn, ops, changed);
+    } catch (const pqxx::transaction_rollback &) {
+        throw;
+    } catch (const pqxx::sql_error &e) {
+        // The pipeline doesn't say which statement raised, so every item
+        // reports failed; nothing was applied either way
+        LOG_WARN("batch_aborted", {"batch", ops.size()}, {"error", e.what()});
+        return false;
+    }
+
+    bool all = true;
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        results[i] = !changed[i].empty();
+        all = all && results[i];
+    }
+    if (!all) {
+        txn.abort();
+        return false;
+    }
+    txn.commit();
+    for (const pqxx::result &rows : changed) BalanceCache::instance().putRows(rows);
+    return true;
+}
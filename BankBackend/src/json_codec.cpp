@@ -0,0 +1,455 @@
+#include "../include/json_codec.hpp"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+namespace codec {
+
+namespace {
+
+constexpr int maxDepth = 64;
+constexpr std::size_t maxFields = 64;
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void appendUtf8(std::string &out, std::uint32_t cp) {
+    if (cp < 0x80) {
+        out.push_back(static_cast<char>(cp));
+    } else if (cp < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
+
+} // namespace
+
+// ---- Field ----
+
+Field::Field(std::string_view name, int &target, bool required)
+    : name(name), type(Type::integer), target(&target), required(required) {}
+
+Field::Field(std::string_view name, double &target, bool required)
+    : name(name), type(Type::number), target(&target), required(required) {}
+
+Field::Field(std::string_view name, std::string &target, bool required)
+    : name(name), type(Type::string), target(&target), required(required) {}
+
+// ---- Reader ----
+
+void Reader::fail(const char *what) const {
+    throw ParseError(std::string("JSON parse error at offset ") + std::to_string(pos) + ": " + what);
+}
+
+void Reader::skipWhitespace() {
+    while (pos < text.size()) {
+        char c = text[pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        ++pos;
+    }
+}
+
+char Reader::peek() {
+    skipWhitespace();
+    return pos < text.size() ? text[pos] : '\0';
+}
+
+bool Reader::atEnd() {
+    skipWhitespace();
+    return pos == text.size();
+}
+
+bool Reader::consume(char c) {
+    if (peek() != c) return false;
+    ++pos;
+    return true;
+}
+
+void Reader::expect(char c) {
+    if (!consume(c)) {
+        char msg[] = "expected ' '";
+        msg[10] = c;
+        fail(msg);
+    }
+}
+
+void Reader::readString(std::string &out) {
+    out.clear();
+    expect('"');
+    for (;;) {
+        // Copy the run of plain characters in one go
+        std::size_t start = pos;
+        while (pos < text.size() && text[pos] != '"' && text[pos] != '\\' &&
+               static_cast<unsigned char>(text[pos]) >= 0x20) {
+            ++pos;
+        }
+        out.append(text.data() + start, pos - start);
+
+        if (pos >= text.size()) fail("unterminated string");
+        char c = text[pos++];
+        if (c == '"') return;
+        if (c != '\\') fail("control character in string");
+
+        if (pos >= text.size()) fail("unterminated escape");
+        char e = text[pos++];
+        switch (e) {
+        case '"': out.push_back('"'); break;
+        case '\\': out.push_back('\\'); break;
+        case '/': out.push_back('/'); break;
+        case 'b': out.push_back('\b'); break;
+        case 'f': out.push_back('\f'); break;
+        case 'n': out.push_back('\n'); break;
+        case 'r': out.push_back('\r'); break;
+        case 't': out.push_back('\t'); break;
+        case 'u': {
+            auto readHex4 = [this]() -> std::uint32_t {
+                if (pos + 4 > text.size()) fail("truncated \\u escape");
+                std::uint32_t v = 0;
+                for (int i = 0; i < 4; ++i) {
+                    int d = hexDigit(text[pos++]);
+                    if (d < 0) fail("invalid \\u escape");
+                    v = v * 16 + static_cast<std::uint32_t>(d);
+                }
+                return v;
+            };
+            std::uint32_t cp = readHex4();
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                // High surrogate: must be followed by a low one
+                if (pos + 2 > text.size() || text[pos] != '\\' || text[pos + 1] != 'u') fail("unpaired surrogate");
+                pos += 2;
+                std::uint32_t low = readHex4();
+                if (low < 0xDC00 || low > 0xDFFF) fail("invalid surrogate pair");
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+                fail("unpaired surrogate");
+            }
+            appendUtf8(out, cp);
+            break;
+        }
+        default:
+            fail("invalid escape");
+        }
+    }
+}
+
+std::string_view Reader::readKey() {
+    if (peek() != '"') fail("expected object key");
+    readString(scratch);
+    expect(':');
+    return scratch;
+}
+
+double Reader::readNumber() {
+    skipWhitespace();
+    const std::size_t start = pos;
+
+    // Validate against the JSON number grammar before converting
+    if (pos < text.size() && text[pos] == '-') ++pos;
+    if (pos >= text.size()) fail("expected a number");
+    if (text[pos] == '0') {
+        ++pos;
+    } else if (text[pos] >= '1' && text[pos] <= '9') {
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++pos;
+    } else {
+        fail("expected a number");
+    }
+    if (pos < text.size() && text[pos] == '.') {
+        ++pos;
+        if (pos >= text.size() || text[pos] < '0' || text[pos] > '9') fail("invalid number");
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++pos;
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+        ++pos;
+        if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) ++pos;
+        if (pos >= text.size() || text[pos] < '0' || text[pos] > '9') fail("invalid number");
+        while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') ++pos;
+    }
+
+    // strtod needs a terminated buffer; numbers in our payloads are short
+    char buf[64];
+    std::size_t len = pos - start;
+    if (len >= sizeof(buf)) fail("number too long");
+    text.copy(buf, len, start);
+    buf[len] = '\0';
+    return std::strtod(buf, nullptr);
+}
+
+int Reader::readInt() {
+    double v = readNumber();
+    if (v != std::trunc(v) || v < std::numeric_limits<int>::min() || v > std::numeric_limits<int>::max()) {
+        fail("expected an integer");
+    }
+    return static_cast<int>(v);
+}
+
+void Reader::skipValue() {
+    skipValue(0);
+}
+
+void Reader::skipValue(int depth) {
+    if (depth > maxDepth) fail("nesting too deep");
+    char c = peek();
+    if (c == '{') {
+        ++pos;
+        if (consume('}')) return;
+        do {
+            readKey();
+            skipValue(depth + 1);
+        } while (consume(','));
+        expect('}');
+    } else if (c == '[') {
+        ++pos;
+        if (consume(']')) return;
+        do {
+            skipValue(depth + 1);
+        } while (consume(','));
+        expect(']');
+    } else if (c == '"') {
+        readString(scratch);
+    } else if (c == 't' || c == 'f' || c == 'n') {
+        for (std::string_view word : {"true", "false", "null"}) {
+            if (text.substr(pos, word.size()) == word) {
+                pos += word.size();
+                return;
+            }
+        }
+        fail("invalid literal");
+    } else {
+        readNumber();
+    }
+}
+
+void Reader::readObjectInto(std::initializer_list<Field> fields) {
+    if (fields.size() > maxFields) fail("too many fields");
+    std::uint64_t seen = 0;
+
+    expect('{');
+    if (!consume('}')) {
+        do {
+            std::string_view key = readKey();
+            std::size_t index = 0;
+            const Field *match = nullptr;
+            for (const Field &f : fields) {
+                if (f.name == key) {
+                    match = &f;
+                    break;
+                }
+                ++index;
+            }
+            if (!match) {
+                skipValue();
+                continue;
+            }
+
+            switch (match->type) {
+            case Field::Type::integer:
+                if (peek() == '"') fail("expected an integer");
+                *static_cast<int *>(match->target) = readInt();
+                break;
+            case Field::Type::number:
+                if (peek() == '"') fail("expected a number");
+                *static_cast<double *>(match->target) = readNumber();
+                break;
+            case Field::Type::string:
+                readString(*static_cast<std::string *>(match->target));
+                break;
+            }
+            seen |= std::uint64_t(1) << index;
+        } while (consume(','));
+        expect('}');
+    }
+
+    std::size_t index = 0;
+    for (const Field &f : fields) {
+        if (f.required && !(seen & (std::uint64_t(1) << index))) {
+            throw ParseError("missing field '" + std::string(f.name) + "'");
+        }
+        ++index;
+    }
+}
+
+void parseObject(std::string_view text, std::initializer_list<Field> fields) {
+    Reader reader(text);
+    reader.readObjectInto(fields);
+    if (!reader.atEnd()) throw ParseError("unexpected data after JSON object");
+}
+
+// ---- Writer ----
+
+template <class String>
+void appendString(String &out, std::string_view v) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(v[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        out.append(v.data() + start, i - start);
+        start = i + 1;
+        switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+            out.append("\\u00");
+            out.push_back(hex[c >> 4]);
+            out.push_back(hex[c & 0xF]);
+        }
+    }
+    out.append(v.data() + start, v.size() - start);
+    out.push_back('"');
+}
+
+template <class String>
+void appendNumber(String &out, double v) {
+    if (!std::isfinite(v)) {
+        out.append("null");
+        return;
+    }
+    char buf[32];
+    auto result = std::to_chars(buf, buf + sizeof(buf), v);
+    std::string_view text(buf, static_cast<std::size_t>(result.ptr - buf));
+    out.append(text);
+    if (text.find_first_of(".e") == std::string_view::npos) out.append(".0");
+}
+
+template <class String>
+void Writer<String>::separate() {
+    if (afterKey) {
+        afterKey = false;
+        return;
+    }
+    if (depth == 0) return;
+    const std::uint64_t bit = std::uint64_t(1) << (depth - 1);
+    if (hasItems & bit) out.push_back(',');
+    hasItems |= bit;
+}
+
+template <class String>
+Writer<String> &Writer<String>::beginObject() {
+    separate();
+    out.push_back('{');
+    ++depth;
+    hasItems &= ~(std::uint64_t(1) << (depth - 1));
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::endObject() {
+    out.push_back('}');
+    --depth;
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::beginArray() {
+    separate();
+    out.push_back('[');
+    ++depth;
+    hasItems &= ~(std::uint64_t(1) << (depth - 1));
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::endArray() {
+    out.push_back(']');
+    --depth;
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::key(std::string_view name) {
+    separate();
+    appendString(out, name);
+    out.push_back(':');
+    afterKey = true;
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::value(std::string_view v) {
+    separate();
+    appendString(out, v);
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::value(int v) {
+    return value(static_cast<std::int64_t>(v));
+}
+
+template <class String>
+Writer<String> &Writer<String>::value(std::int64_t v) {
+    separate();
+    char buf[24];
+    auto result = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, static_cast<std::size_t>(result.ptr - buf));
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::value(double v) {
+    separate();
+    appendNumber(out, v);
+    return *this;
+}
+
+template <class String>
+Writer<String> &Writer<String>::value(bool v) {
+    separate();
+    out.append(v ? "true" : "false");
+    return *this;
+}
+
+// Keys in alphabetical order, matching what nlohmann::json produced before
+template <class String>
+void writeTransaction(Writer<String> &w, const Transaction &tx) {
+    w.beginObject()
+        .key("amount").value(tx.amount)
+        .key("id").value(tx.id)
+        .key("timestamp").value(tx.timestamp)
+        .key("type").value(tx.type)
+        .key("userId").value(tx.user_id)
+        .endObject();
+}
+
+std::string statusBody(bool success, std::string_view message) {
+    std::string out;
+    out.reserve(48 + message.size());
+    Writer w(out);
+    w.beginObject()
+        .key("message").value(message)
+        .key("status").value(success ? "success" : "fail")
+        .endObject();
+    return out;
+}
+
+template class Writer<std::string>;
+template class Writer<std::pmr::string>;
+template void appendString(std::string &, std::string_view);
+template void appendString(std::pmr::string &, std::string_view);
+template void appendNumber(std::string &, double);
+template void appendNumber(std::pmr::string &, double);
+template void writeTransaction(Writer<std::string> &, const Transaction &);
+template void writeTransaction(Writer<std::pmr::string> &, const Transaction &);
+
+} // namespace codec
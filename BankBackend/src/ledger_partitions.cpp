@@ -0,0 +1,195 @@
+#include "../include/ledger_partitions.hpp"
+#include <stdexcept>
+
+namespace partitions {
+
+namespace {
+
+// Serialises partition changes between server instances and bankledger
+constexpr long long lockKey = 0x62616e6b6c6564; // "bankled"
+
+struct Month {
+    std::string name;  // transactions_YYYY_MM
+    std::string from;  // first day of the month
+    std::string to;    // first day of the next one
+};
+
+void lockPartitions(pqxx::transaction_base &txn) {
+    txn.exec("SELECT pg_advisory_xact_lock(" + std::to_string(lockKey) + ")");
+}
+
+bool isPartitioned(pqxx::transaction_base &txn) {
+    return txn.exec("SELECT COALESCE((SELECT relkind = 'p' FROM pg_class WHERE oid = to_regclass('transactions')), false)")[0][0]
+        .as<bool>();
+}
+
+// The current month, `monthsAhead` more, and every month `source` has rows
+// of, less those that already have a partition
+std::vector<Month> monthsNeeded(pqxx::transaction_base &txn, const std::string &source, unsigned monthsAhead) {
+    std::vector<Month> months;
+    const pqxx::result r = txn.exec_params(
+        "SELECT 'transactions_' || to_char(m, 'YYYY_MM'), m::date::text, (m + interval '1 month')::date::text FROM ("
+        "  SELECT generate_series(date_trunc('month', localtimestamp),"
+        "                         date_trunc('month', localtimestamp) + $1::int * interval '1 month',"
+        "                         interval '1 month') AS m"
+        "  UNION SELECT DISTINCT date_trunc('month', timestamp) FROM " + source + " WHERE isfinite(timestamp)"
+        ") months "
+        "WHERE to_regclass('transactions_' || to_char(m, 'YYYY_MM')) IS NULL ORDER BY m",
+        static_cast<int>(monthsAhead));
+    for (const auto &row : r) months.push_back({row[0].as<std::string>(), row[1].as<std::string>(), row[2].as<std::string>()});
+    return months;
+}
+
+// Build the month's table on its own, take its rows out of the default
+// partition, then attach it. Attaching locks only the default partition
+// exclusively, where CREATE TABLE ... PARTITION OF would lock the whole
+// ledger, and the default partition must not hold rows of the month by then.
+// Returns the rows moved.
+std::uint64_t addPartition(pqxx::transaction_base &txn, const Month &month) {
+    const std::string name = txn.quote_name(month.name);
+    txn.exec("CREATE TABLE " + name + " (LIKE transactions INCLUDING DEFAULTS INCLUDING CONSTRAINTS)");
+    const pqxx::result moved = txn.exec_params(
+        "WITH moved AS ("
+        "  DELETE FROM transactions_default WHERE timestamp >= $1::timestamp AND timestamp < $2::timestamp"
+        "  RETURNING id, user_id, amount, type, timestamp"
+        ") INSERT INTO " + name + " (id, user_id, amount, type, timestamp) SELECT * FROM moved",
+        month.from, month.to);
+    txn.exec("ALTER TABLE transactions ATTACH PARTITION " + name + " FOR VALUES FROM (" + txn.quote(month.from) +
+             ") TO (" + txn.quote(month.to) + ")");
+    return moved.affected_rows();
+}
+
+// Detach a month and move it into the archive schema. The foreign key to
+// users it inherited goes, so deleting an account leaves its archived
+// history alone, and so do the column defaults, which would tie it to the
+// id sequence.
+void archivePartition(pqxx::transaction_base &txn, const std::string &partition) {
+    const std::string name = txn.quote_name(partition);
+    txn.exec(std::string("CREATE SCHEMA IF NOT EXISTS ") + archiveSchema);
+    txn.exec("ALTER TABLE transactions DETACH PARTITION " + name);
+    for (const auto &row :
+         txn.exec_params("SELECT conname FROM pg_constraint WHERE conrelid = $1::regclass AND contype = 'f'", partition))
+        txn.exec("ALTER TABLE " + name + " DROP CONSTRAINT " + txn.quote_name(row[0].as<std::string>()));
+    txn.exec("ALTER TABLE " + name + " ALTER COLUMN id DROP DEFAULT, ALTER COLUMN timestamp DROP DEFAULT");
+    txn.exec("ALTER TABLE " + name + " SET SCHEMA " + archiveSchema);
+}
+
+} // namespace
+
+bool partitioned(pqxx::connection &conn) {
+    pqxx::read_transaction txn(conn);
+    return isPartitioned(txn);
+}
+
+MaintainResult maintain(pqxx::connection &conn, unsigned monthsAhead, unsigned retainMonths) {
+    MaintainResult result;
+    std::vector<Month> months;
+    std::vector<std::string> expired;
+    {
+        pqxx::read_transaction txn(conn);
+        if (!isPartitioned(txn)) throw std::runtime_error("transactions is not partitioned; run bankledger migrate");
+        months = monthsNeeded(txn, "transactions_default", monthsAhead);
+        if (retainMonths > 0) {
+            const pqxx::result r = txn.exec_params(
+                "SELECT c.relname FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid"
+                " WHERE i.inhparent = 'transactions'::regclass AND c.relname ~ '^transactions_[0-9]{4}_[0-9]{2}$'"
+                "   AND to_date(substr(c.relname, 14), 'YYYY_MM')"
+                "       < date_trunc('month', localtimestamp) - $1::int * interval '1 month'"
+                " ORDER BY c.relname",
+                static_cast<int>(retainMonths));
+            for (const auto &row : r) expired.push_back(row[0].as<std::string>());
+        }
+    }
+
+    // One transaction per partition, each giving up rather than queueing
+    // inserts behind it for long; another instance may have got there first
+    for (const Month &month : months) {
+        pqxx::work txn(conn);
+        txn.exec("SET LOCAL lock_timeout = '2s'");
+        lockPartitions(txn);
+        if (!txn.exec_params("SELECT to_regclass($1)", month.name)[0][0].is_null()) continue;
+        result.moved += addPartition(txn, month);
+        txn.commit();
+        result.created.push_back(month.name);
+    }
+    for (const std::string &partition : expired) {
+        pqxx::work txn(conn);
+        txn.exec("SET LOCAL lock_timeout = '2s'");
+        lockPartitions(txn);
+        if (txn.exec_params("SELECT to_regclass($1)", partition)[0][0].is_null()) continue;
+        archivePartition(txn, partition);
+        txn.commit();
+        result.archived.push_back(partition);
+    }
+    return result;
+}
+
+MigrateResult migrate(pqxx::connection &conn, unsigned monthsAhead) {
+    MigrateResult result;
+    pqxx::work txn(conn);
+    lockPartitions(txn);
+    if (txn.exec("SELECT to_regclass('transactions') IS NULL")[0][0].as<bool>())
+        throw std::runtime_error("there is no transactions table; apply schema.sql");
+    if (isPartitioned(txn)) return result;
+
+    txn.exec("LOCK TABLE transactions IN ACCESS EXCLUSIVE MODE");
+    txn.exec("ALTER TABLE transactions RENAME TO transactions_unpartitioned");
+    txn.exec("ALTER INDEX IF EXISTS transactions_pkey RENAME TO transactions_unpartitioned_pkey");
+    txn.exec("ALTER INDEX IF EXISTS transactions_user_id_id_idx RENAME TO transactions_unpartitioned_user_id_id_idx");
+    txn.exec("ALTER INDEX IF EXISTS transactions_user_id_timestamp_idx"
+             " RENAME TO transactions_unpartitioned_user_id_timestamp_idx");
+    const pqxx::field sequence = txn.exec("SELECT pg_get_serial_sequence('transactions_unpartitioned', 'id')")[0][0];
+    if (sequence.is_null()) throw std::runtime_error("transactions.id has no sequence");
+    const std::string sequenceName = sequence.as<std::string>();
+
+    // As in schema.sql, with ids still drawn from the old table's sequence
+    txn.exec("CREATE TABLE transactions ("
+             "  id INT NOT NULL DEFAULT nextval(" + txn.quote(sequenceName) + "::regclass),"
+             "  user_id INT NOT NULL REFERENCES users(id) ON DELETE CASCADE,"
+             "  amount NUMERIC NOT NULL,"
+             "  type TEXT NOT NULL CHECK (type IN ('deposit', 'withdrawal', 'transfer_sent', 'transfer_received')),"
+             "  timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
+             "  PRIMARY KEY (id, timestamp)"
+             ") PARTITION BY RANGE (timestamp)");
+    txn.exec("ALTER SEQUENCE " + sequenceName + " OWNED BY transactions.id");
+    txn.exec("CREATE TABLE transactions_default PARTITION OF transactions DEFAULT");
+    for (const Month &month : monthsNeeded(txn, "transactions_unpartitioned", monthsAhead)) {
+        addPartition(txn, month);
+        result.created.push_back(month.name);
+    }
+
+    result.rows = txn.exec("INSERT INTO transactions (id, user_id, amount, type, timestamp)"
+                           " SELECT id, user_id, amount, type, COALESCE(timestamp, '-infinity')"
+                           " FROM transactions_unpartitioned")
+                      .affected_rows();
+    // Built once over the copied rows rather than row by row, and the NOTIFY
+    // trigger only now, so the copy doesn't announce every old transaction
+    txn.exec("CREATE INDEX transactions_user_id_timestamp_idx ON transactions (user_id, timestamp, id) INCLUDE (amount, type)");
+    if (!txn.exec("SELECT to_regproc('notify_transaction_posted') IS NULL")[0][0].as<bool>())
+        txn.exec("CREATE TRIGGER transactions_posted AFTER INSERT ON transactions"
+                 " FOR EACH ROW EXECUTE FUNCTION notify_transaction_posted()");
+    txn.exec("DROP TABLE transactions_unpartitioned");
+    txn.commit();
+    result.migrated = true;
+    return result;
+}
+
+std::vector<Partition> list(pqxx::connection &conn) {
+    std::vector<Partition> partitions;
+    pqxx::read_transaction txn(conn);
+    const pqxx::result r = txn.exec(
+        "SELECT name, bounds, rows FROM ("
+        "  SELECT c.relname::text AS name, pg_get_expr(c.relpartbound, c.oid) AS bounds, c.reltuples::bigint AS rows,"
+        "         CASE WHEN c.relname = 'transactions_default' THEN 1 ELSE 0 END AS rank"
+        "    FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid"
+        "   WHERE i.inhparent = 'transactions'::regclass"
+        "  UNION ALL"
+        "  SELECT n.nspname || '.' || c.relname, '', c.reltuples::bigint, 2"
+        "    FROM pg_class c JOIN pg_namespace n ON n.oid = c.relnamespace"
+        "   WHERE n.nspname = " + txn.quote(archiveSchema) + " AND c.relkind = 'r'"
+        ") p ORDER BY rank, name");
+    for (const auto &row : r) partitions.push_back({row[0].as<std::string>(), row[1].as<std::string>(), row[2].as<std::int64_t>()});
+    return partitions;
+}
+
+} // namespace partitions
@@ -0,0 +1,154 @@
+#include "../include/ledger_replicator.hpp"
+#include "../include/log.hpp"
+#include "../include/wal.hpp"
+#include <pqxx/pqxx>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace {
+
+constexpr std::size_t maxBatch = 1000;
+constexpr auto idlePoll = std::chrono::milliseconds(50);
+
+constexpr const char *insertUser = "repl_insert_user";
+constexpr const char *setBalance = "repl_set_balance";
+constexpr const char *insertTransaction = "repl_insert_transaction";
+constexpr const char *saveProgress = "repl_save_progress";
+
+void prepare(pqxx::connection &conn) {
+    conn.prepare(insertUser,
+                 "INSERT INTO users (id, name, password, balance) VALUES ($1, $2, $3, $4) "
+                 "ON CONFLICT (id) DO NOTHING");
+    conn.prepare(setBalance, "UPDATE users SET balance = $2 WHERE id = $1");
+    // No conflict target: the key is (id, timestamp) once the ledger is
+    // partitioned and id before, and a replayed row repeats both
+    conn.prepare(insertTransaction,
+                 "INSERT INTO transactions (id, user_id, amount, type, timestamp) "
+                 "VALUES ($1, $2, $3, $4, to_timestamp($5::float8 / 1000000)::timestamp) "
+                 "ON CONFLICT DO NOTHING");
+    conn.prepare(saveProgress,
+                 "INSERT INTO ledger_replication (id, lsn) VALUES (1, $1) "
+                 "ON CONFLICT (id) DO UPDATE SET lsn = EXCLUDED.lsn");
+}
+
+void apply(pqxx::work &txn, const WalRecord &r) {
+    switch (r.type) {
+    case WalRecord::Type::createUser: {
+        const std::optional<std::string> password =
+            r.hasPassword ? std::optional<std::string>(r.password) : std::nullopt;
+        txn.exec_prepared(insertUser, r.userId, r.name, password, r.balance);
+        break;
+    }
+    case WalRecord::Type::deposit:
+    case WalRecord::Type::withdraw: {
+        const char *type = r.type == WalRecord::Type::deposit ? "deposit" : "withdrawal";
+        txn.exec_prepared(setBalance, r.userId, r.balance);
+        txn.exec_prepared(insertTransaction, r.txId, r.userId, r.amount, type, r.micros);
+        break;
+    }
+    case WalRecord::Type::transfer:
+        txn.exec_prepared(setBalance, r.userId, r.balance);
+        txn.exec_prepared(setBalance, r.receiverId, r.receiverBalance);
+        txn.exec_prepared(insertTransaction, r.txId, r.userId, r.amount, "transfer_sent", r.micros);
+        txn.exec_prepared(insertTransaction, r.receiverTxId, r.receiverId, r.amount, "transfer_received", r.micros);
+        break;
+    case WalRecord::Type::batch:
+        for (const WalRecord &item : r.items) apply(txn, item);
+        break;
+    }
+}
+
+} // namespace
+
+LedgerReplicator::~LedgerReplicator() {
+    stop();
+}
+
+void LedgerReplicator::start(const std::string &connString, const std::string &dir, Wal &log) {
+    if (worker.joinable()) return;
+    connectionString = connString;
+    walDir = dir;
+    wal = &log;
+    stopping = false;
+    worker = std::thread(&LedgerReplicator::run, this);
+}
+
+void LedgerReplicator::stop() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void LedgerReplicator::run() {
+    WalReader reader(walDir);
+    std::unique_ptr<pqxx::connection> conn;
+    std::vector<WalRecord> batch; // kept across a failed commit and retried
+    std::uint64_t done = 0;
+    bool checkedGap = false;
+
+    auto idle = [this](std::chrono::milliseconds wait) {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait_for(lock, wait, [this] { return stopping; });
+        return !stopping;
+    };
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (stopping) break;
+        }
+        try {
+            if (!conn) {
+                conn = std::make_unique<pqxx::connection>(connectionString);
+                prepare(*conn);
+                pqxx::nontransaction txn(*conn);
+                pqxx::result r = txn.exec("SELECT lsn FROM ledger_replication WHERE id = 1");
+                done = r.empty() ? 0 : r[0][0].as<std::uint64_t>();
+                confirmed.store(done, std::memory_order_release);
+                LOG_INFO("replicator_connected", {"lsn", done});
+            }
+
+            const std::uint64_t upTo = wal->durableLsn();
+            WalRecord record;
+            while (batch.size() < maxBatch && reader.next(record, upTo)) {
+                if (record.lsn <= done) continue;
+                if (!checkedGap && record.lsn > done + 1) {
+                    // The segments in between were removed before we ever ran
+                    LOG_WARN("replicator_gap", {"from", done + 1}, {"to", record.lsn - 1});
+                }
+                checkedGap = true;
+                batch.push_back(std::move(record));
+            }
+            batch.erase(std::remove_if(batch.begin(), batch.end(),
+                                       [done](const WalRecord &r) { return r.lsn <= done; }),
+                        batch.end());
+            if (batch.empty()) {
+                if (!idle(idlePoll)) break;
+                continue;
+            }
+
+            pqxx::work txn(*conn);
+            for (const WalRecord &r : batch) apply(txn, r);
+            // Keep SERIAL defaults ahead of the ids we inserted explicitly
+            txn.exec("SELECT setval(pg_get_serial_sequence('users', 'id'), max(id)) FROM users");
+            txn.exec("SELECT setval(pg_get_serial_sequence('transactions', 'id'), max(id)) FROM transactions");
+            txn.exec_prepared(saveProgress, batch.back().lsn);
+            txn.commit();
+
+            done = batch.back().lsn;
+            confirmed.store(done, std::memory_order_release);
+            batch.clear();
+        } catch (const std::exception &e) {
+            LOG_ERROR("replicator_error", {"error", e.what()});
+            conn.reset();
+            if (!idle(std::chrono::seconds(1))) break;
+        }
+    }
+}
@@ -0,0 +1,352 @@
+#include "../include/log.hpp"
+#include "../include/config.hpp"
+#include "../include/json_codec.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace logging {
+
+namespace {
+
+constexpr std::size_t kSlotSize = 512;   // longer lines are truncated
+constexpr std::size_t kRingSlots = 256;  // per producing thread
+constexpr auto kIdleWait = std::chrono::milliseconds(5);
+
+struct Slot {
+    std::uint32_t length;
+    char data[kSlotSize - sizeof(std::uint32_t)];
+};
+
+// Single producer (the owning thread), single consumer (the writer thread)
+struct Ring {
+    alignas(64) std::atomic<std::uint64_t> head{0};
+    alignas(64) std::atomic<std::uint64_t> tail{0};
+    std::atomic<bool> retired{false};
+    Slot slots[kRingSlots];
+
+    bool push(std::string_view line) {
+        std::uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == kRingSlots) return false;
+
+        Slot &slot = slots[h % kRingSlots];
+        std::size_t n = std::min(line.size(), sizeof(slot.data));
+        std::memcpy(slot.data, line.data(), n);
+        if (n < line.size()) slot.data[n - 1] = '\n';
+        slot.length = static_cast<std::uint32_t>(n);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Append everything published so far to `out`; returns false if empty
+    bool drainInto(std::string &out) {
+        std::uint64_t t = tail.load(std::memory_order_relaxed);
+        const std::uint64_t h = head.load(std::memory_order_acquire);
+        if (t == h) return false;
+        for (; t != h; ++t) {
+            const Slot &slot = slots[t % kRingSlots];
+            out.append(slot.data, slot.length);
+        }
+        tail.store(h, std::memory_order_release);
+        return true;
+    }
+};
+
+class Logger {
+public:
+    static Logger &instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    ~Logger() { shutdown(); }
+
+    Ring *localRing();
+    void shutdown();
+
+    std::atomic<bool> json{false};
+    std::atomic<int> fd{STDERR_FILENO};
+    std::atomic<std::uint64_t> droppedLines{0};
+
+private:
+    void run();
+    void drain(std::string &batch);
+    void writeAll(const std::string &batch);
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::thread writer;
+    bool started = false;
+    bool stopping = false;
+};
+
+// Marks the thread's ring retired on thread exit; the writer frees it once
+// it has been drained.
+struct LocalRing {
+    std::shared_ptr<Ring> ring;
+    ~LocalRing() {
+        if (ring) ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+Ring *Logger::localRing() {
+    thread_local LocalRing local;
+    if (!local.ring) {
+        auto ring = std::make_shared<Ring>();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return nullptr;
+        rings.push_back(ring);
+        local.ring = std::move(ring);
+        if (!started) {
+            started = true;
+            writer = std::thread([this] { run(); });
+        }
+    }
+    return local.ring.get();
+}
+
+void Logger::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) return;
+        stopping = true;
+    }
+    wakeup.notify_all();
+    if (writer.joinable()) writer.join();
+}
+
+void Logger::run() {
+    std::string batch;
+    batch.reserve(64 * 1024);
+    std::uint64_t reportedDrops = 0;
+
+    for (;;) {
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = stopping;
+            drain(batch);
+        }
+
+        std::uint64_t drops = droppedLines.load(std::memory_order_relaxed);
+        if (drops != reportedDrops) {
+            format(batch, Level::warn, "log_dropped", {{"count", drops - reportedDrops}, {"total", drops}});
+            reportedDrops = drops;
+        }
+
+        if (!batch.empty()) {
+            writeAll(batch);
+            batch.clear();
+            continue;
+        }
+        if (stop) return;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait_for(lock, kIdleWait, [this] { return stopping; });
+    }
+}
+
+// Caller holds `mutex`
+void Logger::drain(std::string &batch) {
+    for (auto it = rings.begin(); it != rings.end();) {
+        Ring &ring = **it;
+        bool retired = ring.retired.load(std::memory_order_acquire);
+        if (!ring.drainInto(batch) && retired) {
+            it = rings.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void Logger::writeAll(const std::string &batch) {
+    const int out = fd.load(std::memory_order_relaxed);
+    const char *p = batch.data();
+    std::size_t left = batch.size();
+    while (left > 0) {
+        ssize_t n = ::write(out, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += n;
+        left -= static_cast<std::size_t>(n);
+    }
+}
+
+const char *levelName(Level level) {
+    switch (level) {
+    case Level::debug: return "debug";
+    case Level::info: return "info";
+    case Level::warn: return "warn";
+    case Level::error: return "error";
+    default: return "off";
+    }
+}
+
+// RFC 3339 UTC with microseconds. The date/time part is cached per thread
+// and only reformatted when the second changes.
+void appendTimestamp(std::string &out) {
+    using namespace std::chrono;
+    const auto us = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    const std::time_t secs = static_cast<std::time_t>(us / 1000000);
+
+    thread_local std::time_t cachedSecond = -1;
+    thread_local char cached[24];
+    if (secs != cachedSecond) {
+        std::tm tm{};
+        gmtime_r(&secs, &tm);
+        std::strftime(cached, sizeof(cached), "%Y-%m-%dT%H:%M:%S", &tm);
+        cachedSecond = secs;
+    }
+    out += cached;
+
+    char frac[8] = {'.', '0', '0', '0', '0', '0', '0', 'Z'};
+    long micros = static_cast<long>(us % 1000000);
+    for (int i = 6; i >= 1 && micros > 0; --i, micros /= 10) frac[i] = static_cast<char>('0' + micros % 10);
+    out.append(frac, sizeof(frac));
+}
+
+template <typename T>
+void appendInteger(std::string &out, T v) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+// logfmt: bare when safe, otherwise quoted with JSON escapes
+void appendKvString(std::string &out, std::string_view v) {
+    bool bare = !v.empty();
+    for (char c : v) {
+        if (c == ' ' || c == '"' || c == '=' || c == '\\' || static_cast<unsigned char>(c) < 0x20) {
+            bare = false;
+            break;
+        }
+    }
+    if (bare) {
+        out.append(v.data(), v.size());
+    } else {
+        codec::appendString(out, v);
+    }
+}
+
+} // namespace
+
+void format(std::string &out, Level level, std::string_view event, std::initializer_list<Field> fields) {
+    const bool json = Logger::instance().json.load(std::memory_order_relaxed);
+
+    if (json) {
+        out += "{\"ts\":\"";
+        appendTimestamp(out);
+        out += "\",\"level\":\"";
+        out += levelName(level);
+        out += "\",\"event\":";
+        codec::appendString(out, event);
+    } else {
+        out += "ts=";
+        appendTimestamp(out);
+        out += " level=";
+        out += levelName(level);
+        out += " event=";
+        appendKvString(out, event);
+    }
+
+    for (const Field &f : fields) {
+        if (json) {
+            out += ',';
+            codec::appendString(out, f.key);
+            out += ':';
+        } else {
+            out += ' ';
+            out.append(f.key.data(), f.key.size());
+            out += '=';
+        }
+        switch (f.type) {
+        case Field::Type::integer: appendInteger(out, f.i); break;
+        case Field::Type::unsignedInteger: appendInteger(out, f.u); break;
+        case Field::Type::number: codec::appendNumber(out, f.d); break;
+        case Field::Type::boolean: out += f.b ? "true" : "false"; break;
+        case Field::Type::string:
+            if (json) {
+                codec::appendString(out, f.s);
+            } else {
+                appendKvString(out, f.s);
+            }
+            break;
+        }
+    }
+    out += json ? "}\n" : "\n";
+}
+
+void write(Level level, std::string_view event, std::initializer_list<Field> fields) {
+    thread_local std::string line;
+    line.clear();
+    format(line, level, event, fields);
+
+    Logger &logger = Logger::instance();
+    Ring *ring = logger.localRing();
+    if (!ring || !ring->push(line)) {
+        logger.droppedLines.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool parseLevel(std::string_view name, Level &out) {
+    static constexpr std::pair<std::string_view, Level> names[] = {
+        {"debug", Level::debug}, {"info", Level::info}, {"warn", Level::warn},
+        {"warning", Level::warn}, {"error", Level::error}, {"off", Level::off},
+    };
+    for (const auto &[n, level] : names) {
+        if (n == name) {
+            out = level;
+            return true;
+        }
+    }
+    return false;
+}
+
+void setLevel(Level level) {
+    detail::minLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+void configure(const LogConfig &cfg) {
+    Logger &logger = Logger::instance();
+    logger.json.store(cfg.json, std::memory_order_relaxed);
+
+    Level level = Level::info;
+    if (!parseLevel(cfg.level, level)) {
+        LOG_WARN("config_invalid", {"name", "BANK_LOG_LEVEL"}, {"value", cfg.level});
+    } else if (static_cast<int>(level) < BANK_LOG_MIN_LEVEL) {
+        LOG_WARN("log_level_compiled_out", {"level", cfg.level});
+    }
+    setLevel(level);
+
+    if (!cfg.file.empty()) {
+        int fd = ::open(cfg.file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            LOG_ERROR("log_open_failed", {"file", cfg.file}, {"error", std::strerror(errno)});
+        } else {
+            logger.fd.store(fd, std::memory_order_relaxed);
+        }
+    }
+}
+
+void shutdown() {
+    Logger::instance().shutdown();
+}
+
+std::uint64_t dropped() {
+    return Logger::instance().droppedLines.load(std::memory_order_relaxed);
+}
+
+} // namespace logging
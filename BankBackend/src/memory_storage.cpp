@@ -0,0 +1,878 @@
+#include "../include/memory_storage.hpp"
+#include "../include/log.hpp"
+#include "../include/push.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+std::int64_t nowMicros() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+// Same text Postgres produces for a TIMESTAMP column: local time, with the
+// fractional seconds trimmed of trailing zeros
+std::string formatTimestamp(std::int64_t micros) {
+    std::time_t secs = static_cast<std::time_t>(micros / 1000000);
+    long frac = static_cast<long>(micros % 1000000);
+    std::tm tm{};
+    localtime_r(&secs, &tm);
+
+    char buf[40];
+    std::size_t n = std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    if (frac > 0) {
+        int digits = 6;
+        while (frac % 10 == 0) {
+            frac /= 10;
+            --digits;
+        }
+        n += static_cast<std::size_t>(std::snprintf(buf + n, sizeof(buf) - n, ".%0*ld", digits, frac));
+    }
+    return std::string(buf, n);
+}
+
+// Transaction.type for each MemoryStorage::EntryType
+const char *const entryTypeNames[] = {"deposit", "withdrawal", "transfer_sent", "transfer_received"};
+
+// Snapshot file: header, then per account
+//   i32 id | f64 balance | u8 hasPassword | u32 name length | u32 password length |
+//   u64 entry count | name | password | entries (i32 id, u8 type, f64 amount, i64 micros)
+constexpr char snapshotMagic[8] = {'B', 'A', 'N', 'K', 'S', 'N', 'P', '1'};
+constexpr std::size_t entryBytes = 4 + 1 + 8 + 8;
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint64_t lsn;        // replay the log from here
+    std::int32_t nextUserId;
+    std::int32_t nextTransactionId;
+    std::uint64_t accounts;
+    std::uint64_t bodyBytes;
+    std::uint32_t bodyCrc;
+    std::uint32_t reserved;
+};
+
+template <typename T>
+void put(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+std::string snapshotName(std::uint64_t lsn) {
+    char buf[40];
+    std::snprintf(buf, sizeof(buf), "snapshot-%016llx.bin", static_cast<unsigned long long>(lsn));
+    return buf;
+}
+
+// Completed snapshots in the directory, oldest first
+std::vector<std::string> snapshotFiles(const std::string &dir) {
+    std::vector<std::string> paths;
+    DIR *d = ::opendir(dir.c_str());
+    if (!d) return paths;
+    while (dirent *e = ::readdir(d)) {
+        const std::string name = e->d_name;
+        if (name.size() == 29 && name.compare(0, 9, "snapshot-") == 0 && name.compare(25, 4, ".bin") == 0) {
+            paths.push_back(dir + "/" + name);
+        }
+    }
+    ::closedir(d);
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+// Recovery: make sure `next` hands out nothing at or below `id`
+void atLeast(std::atomic<int> &next, int id) {
+    if (next.load(std::memory_order_relaxed) <= id) next.store(id + 1, std::memory_order_relaxed);
+}
+
+[[noreturn]] void ioError(const std::string &what, const std::string &path) {
+    throw std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+} // namespace
+
+// ---- Ledger ----
+
+void MemoryStorage::Ledger::append(const Entry &entry) {
+    if (size == chunks.size() * entriesPerChunk) {
+        chunks.push_back(std::make_unique<std::array<Entry, entriesPerChunk>>());
+    }
+    (*chunks[size / entriesPerChunk])[size % entriesPerChunk] = entry;
+    ++size;
+}
+
+void MemoryStorage::Ledger::page(int afterId, int limit, std::vector<Entry> &out) const {
+    // Ids are ascending, so binary search for the first one past the cursor
+    std::size_t lo = 0, hi = size;
+    while (lo < hi) {
+        std::size_t mid = lo + (hi - lo) / 2;
+        if (at(mid).id <= afterId) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    for (std::size_t i = lo; i < size && out.size() < static_cast<std::size_t>(limit); ++i) {
+        out.push_back(at(i));
+    }
+}
+
+// ---- MemoryStorage ----
+
+MemoryStorage::MemoryStorage() : shards(std::make_unique<Shard[]>(shardCount)) {}
+
+MemoryStorage::~MemoryStorage() {
+    close();
+    for (std::size_t s = 0; s < shardCount; ++s) {
+        for (auto &chunk : shards[s].chunks) delete chunk.load(std::memory_order_relaxed);
+    }
+}
+
+MemoryStorage::Account *MemoryStorage::find(int userId) const {
+    if (userId <= 0) return nullptr;
+    const std::size_t slot = static_cast<std::size_t>(userId - 1) / shardCount;
+    const std::size_t chunkIndex = slot / accountsPerChunk;
+    if (chunkIndex >= chunksPerShard) return nullptr;
+
+    Chunk *chunk = shards[shardOf(userId)].chunks[chunkIndex].load(std::memory_order_acquire);
+    if (!chunk) return nullptr;
+    Account &account = (*chunk)[slot % accountsPerChunk];
+    return account.live.load(std::memory_order_acquire) ? &account : nullptr;
+}
+
+// Allocate the next id and publish the account. Returns 0 when the table is full.
+int MemoryStorage::addUser(const std::string &name, const std::string *password, double initialBalance) {
+    const int userId = nextUserId.fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t lsn = 0;
+    if (!placeUser(userId, name, password, initialBalance, wal ? &lsn : nullptr)) return 0;
+    if (lsn) wal->waitDurable(lsn);
+    return userId;
+}
+
+// Store and publish the account with a given id. When `lsn` is set the
+// creation is journalled before the account becomes visible, so no change
+// to it can reach the log ahead of it.
+bool MemoryStorage::placeUser(int userId, const std::string &name, const std::string *password, double balance,
+                              std::uint64_t *lsn) {
+    const std::size_t slot = static_cast<std::size_t>(userId - 1) / shardCount;
+    const std::size_t chunkIndex = slot / accountsPerChunk;
+    if (chunkIndex >= chunksPerShard) return false;
+
+    Shard &shard = shards[shardOf(userId)];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        Chunk *chunk = shard.chunks[chunkIndex].load(std::memory_order_relaxed);
+        if (!chunk) {
+            chunk = new Chunk();
+            shard.chunks[chunkIndex].store(chunk, std::memory_order_release);
+        }
+        Account &account = (*chunk)[slot % accountsPerChunk];
+        account.name = name;
+        if (password) {
+            account.password = *password;
+            account.hasPassword = true;
+        }
+        account.balance.store(balance, std::memory_order_relaxed);
+        if (lsn) {
+            WalRecord r;
+            r.type = WalRecord::Type::createUser;
+            r.userId = userId;
+            r.balance = balance;
+            r.hasPassword = password != nullptr;
+            r.name = name;
+            if (password) r.password = *password;
+            *lsn = wal->append(r);
+        }
+        account.live.store(true, std::memory_order_release);
+    }
+
+    std::unique_lock<std::shared_mutex> lock(namesMutex);
+    byName.emplace(name, userId);
+    return true;
+}
+
+// Caller holds the account's shard lock, so ids are ascending per ledger
+int MemoryStorage::record(Account &account, EntryType type, double amount, std::int64_t micros) {
+    const int id = nextTransactionId.fetch_add(1, std::memory_order_relaxed);
+    account.ledger.append({id, type, amount, micros});
+    return id;
+}
+
+// Apply a deposit to an account whose shard lock the caller holds, and
+// describe it for the log
+WalRecord MemoryStorage::postDeposit(Account &account, int userId, double amount, std::int64_t micros) {
+    WalRecord r;
+    r.type = WalRecord::Type::deposit;
+    r.userId = userId;
+    r.amount = amount;
+    r.balance = account.balance.load(std::memory_order_relaxed) + amount;
+    r.micros = micros;
+    account.balance.store(r.balance, std::memory_order_release);
+    r.txId = record(account, EntryType::deposit, amount, micros);
+    return r;
+}
+
+// As postDeposit; the caller has checked the balance covers `amount`
+WalRecord MemoryStorage::postWithdraw(Account &account, int userId, double amount, std::int64_t micros) {
+    WalRecord r;
+    r.type = WalRecord::Type::withdraw;
+    r.userId = userId;
+    r.amount = amount;
+    r.balance = account.balance.load(std::memory_order_relaxed) - amount;
+    r.micros = micros;
+    account.balance.store(r.balance, std::memory_order_release);
+    r.txId = record(account, EntryType::withdrawal, amount, micros);
+    return r;
+}
+
+// As postWithdraw, with both accounts' shard locks held
+WalRecord MemoryStorage::postTransfer(Account &sender, int senderId, Account &receiver, int receiverId, double amount,
+                                      std::int64_t micros) {
+    WalRecord r;
+    r.type = WalRecord::Type::transfer;
+    r.userId = senderId;
+    r.receiverId = receiverId;
+    r.amount = amount;
+    r.balance = sender.balance.load(std::memory_order_relaxed) - amount;
+    r.receiverBalance = receiver.balance.load(std::memory_order_relaxed) + amount;
+    r.micros = micros;
+    sender.balance.store(r.balance, std::memory_order_release);
+    receiver.balance.store(r.receiverBalance, std::memory_order_release);
+
+    // Same row order as the SQL transfer: lower account id first
+    if (senderId < receiverId) {
+        r.txId = record(sender, EntryType::transferSent, amount, micros);
+        r.receiverTxId = record(receiver, EntryType::transferReceived, amount, micros);
+    } else {
+        r.receiverTxId = record(receiver, EntryType::transferReceived, amount, micros);
+        r.txId = record(sender, EntryType::transferSent, amount, micros);
+    }
+    return r;
+}
+
+// Hand a change to push subscribers. Runs once the change is durable (a
+// subscriber must never see a balance a crash could take back) and the
+// stripe locks are released, so updates to one account can reach the hub
+// out of order; the ledger id versions each balance to keep the newest.
+void MemoryStorage::announce(const WalRecord &r) {
+    push::Hub &hub = push::Hub::instance();
+    auto post = [&hub](int userId, int txId, EntryType type, double amount, double balance, std::int64_t micros) {
+        if (!hub.watched(userId)) return;
+        hub.transactionPosted(
+            Transaction(txId, userId, amount, entryTypeNames[static_cast<int>(type)], formatTimestamp(micros)));
+        hub.balanceChanged(userId, balance, static_cast<std::uint64_t>(txId));
+    };
+    switch (r.type) {
+    case WalRecord::Type::deposit:
+        post(r.userId, r.txId, EntryType::deposit, r.amount, r.balance, r.micros);
+        break;
+    case WalRecord::Type::withdraw:
+        post(r.userId, r.txId, EntryType::withdrawal, r.amount, r.balance, r.micros);
+        break;
+    case WalRecord::Type::transfer:
+        post(r.userId, r.txId, EntryType::transferSent, r.amount, r.balance, r.micros);
+        post(r.receiverId, r.receiverTxId, EntryType::transferReceived, r.amount, r.receiverBalance, r.micros);
+        break;
+    case WalRecord::Type::batch:
+        for (const WalRecord &item : r.items) announce(item);
+        break;
+    default:
+        break;
+    }
+}
+
+bool MemoryStorage::createUser(const std::string &name, double initialBalance) {
+    return addUser(name, nullptr, initialBalance) != 0;
+}
+
+bool MemoryStorage::registerUser(const std::string &name, const std::string &password, double initialBalance) {
+    return addUser(name, &password, initialBalance) != 0;
+}
+
+std::vector<Credential> MemoryStorage::credentials(const std::string &name) {
+    std::vector<Credential> found;
+    {
+        std::shared_lock<std::shared_mutex> lock(namesMutex);
+        auto [first, last] = byName.equal_range(name);
+        for (auto it = first; it != last; ++it) {
+            Account *account = find(it->second);
+            if (account && account->hasPassword) found.push_back({it->second, account->password});
+        }
+    }
+    std::sort(found.begin(), found.end(),
+              [](const Credential &a, const Credential &b) { return a.userId < b.userId; });
+    return found;
+}
+
+double MemoryStorage::getBalance(int userId) {
+    Account *account = find(userId);
+    if (!account) {
+        LOG_INFO("user_not_found", {"userId", userId});
+        return -1.0;
+    }
+    return account->balance.load(std::memory_order_acquire);
+}
+
+WriteResult MemoryStorage::deposit(int userId, double amount) {
+    std::uint64_t lsn = 0;
+    WalRecord r;
+    if (!depositLogged(userId, amount, lsn, r)) return WriteResult::failed;
+    if (lsn) wal->waitDurable(lsn);
+    announce(r);
+    return WriteResult::applied;
+}
+
+WriteResult MemoryStorage::withdraw(int userId, double amount) {
+    std::uint64_t lsn = 0;
+    WalRecord r;
+    if (!withdrawLogged(userId, amount, lsn, r)) return WriteResult::failed;
+    if (lsn) wal->waitDurable(lsn);
+    announce(r);
+    return WriteResult::applied;
+}
+
+WriteResult MemoryStorage::transfer(int senderId, int receiverId, double amount) {
+    std::uint64_t lsn = 0;
+    WalRecord r;
+    if (!transferLogged(senderId, receiverId, amount, lsn, r)) return WriteResult::failed;
+    if (lsn) wal->waitDurable(lsn);
+    announce(r);
+    return WriteResult::applied;
+}
+
+// The *Logged operations apply and journal a change, filling `r` with it,
+// but leave waiting for the log and announcing the change to the caller, so
+// a batch can wait once for all of its items. `lsn` is set only when
+// something was journalled.
+bool MemoryStorage::depositLogged(int userId, double amount, std::uint64_t &lsn, WalRecord &r) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "deposit"}, {"amount", amount});
+        return false;
+    }
+    Account *account = find(userId);
+    if (!account) {
+        LOG_INFO("user_not_found", {"userId", userId});
+        return false;
+    }
+
+    const std::int64_t micros = nowMicros();
+    std::lock_guard<std::mutex> lock(shards[shardOf(userId)].mutex);
+    r = postDeposit(*account, userId, amount, micros);
+    if (wal) lsn = wal->append(r);
+    return true;
+}
+
+bool MemoryStorage::withdrawLogged(int userId, double amount, std::uint64_t &lsn, WalRecord &r) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "withdraw"}, {"amount", amount});
+        return false;
+    }
+    Account *account = find(userId);
+    if (!account) {
+        LOG_INFO("user_not_found", {"userId", userId});
+        return false;
+    }
+
+    const std::int64_t micros = nowMicros();
+    std::unique_lock<std::mutex> lock(shards[shardOf(userId)].mutex);
+    const double balance = account->balance.load(std::memory_order_relaxed);
+    if (balance < amount) {
+        lock.unlock();
+        LOG_INFO("insufficient_funds", {"userId", userId}, {"amount", amount}, {"balance", balance});
+        return false;
+    }
+    r = postWithdraw(*account, userId, amount, micros);
+    if (wal) lsn = wal->append(r);
+    return true;
+}
+
+bool MemoryStorage::transferLogged(int senderId, int receiverId, double amount, std::uint64_t &lsn, WalRecord &r) {
+    if (amount <= 0) {
+        LOG_INFO("invalid_amount", {"op", "transfer"}, {"amount", amount});
+        return false;
+    }
+    if (senderId == receiverId) {
+        LOG_INFO("self_transfer", {"userId", senderId});
+        return false;
+    }
+    Account *sender = find(senderId);
+    Account *receiver = find(receiverId);
+    if (!sender || !receiver) {
+        LOG_INFO("user_not_found", {"userId", sender ? receiverId : senderId});
+        return false;
+    }
+
+    // Lock both stripes in index order (once if they share one)
+    const std::size_t a = std::min(shardOf(senderId), shardOf(receiverId));
+    const std::size_t b = std::max(shardOf(senderId), shardOf(receiverId));
+    std::unique_lock<std::mutex> first(shards[a].mutex);
+    std::unique_lock<std::mutex> second;
+    if (b != a) second = std::unique_lock<std::mutex>(shards[b].mutex);
+
+    const double balance = sender->balance.load(std::memory_order_relaxed);
+    if (balance < amount) {
+        first.unlock();
+        if (second) second.unlock();
+        LOG_INFO("insufficient_funds", {"userId", senderId}, {"amount", amount}, {"balance", balance});
+        return false;
+    }
+
+    r = postTransfer(*sender, senderId, *receiver, receiverId, amount, nowMicros());
+    if (wal) lsn = wal->append(r);
+    return true;
+}
+
+std::vector<BatchResult> MemoryStorage::executeBatch(const std::vector<BatchOperation> &ops, bool atomic) {
+    if (atomic) return executeAtomic(ops);
+
+    std::vector<BatchResult> results(ops.size(), BatchResult::failed);
+    std::vector<WalRecord> applied;
+    applied.reserve(ops.size());
+    std::uint64_t last = 0;
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const BatchOperation &op = ops[i];
+        std::uint64_t lsn = 0;
+        WalRecord r;
+        bool ok = false;
+        switch (op.kind) {
+        case BatchOperation::Kind::deposit: ok = depositLogged(op.userId, op.amount, lsn, r); break;
+        case BatchOperation::Kind::withdraw: ok = withdrawLogged(op.userId, op.amount, lsn, r); break;
+        case BatchOperation::Kind::transfer: ok = transferLogged(op.userId, op.receiverId, op.amount, lsn, r); break;
+        }
+        if (ok) {
+            results[i] = BatchResult::applied;
+            applied.push_back(std::move(r));
+        }
+        if (lsn) last = lsn;
+    }
+    // LSNs ascend, so one wait covers every item
+    if (last) wal->waitDurable(last);
+    for (const WalRecord &r : applied) announce(r);
+    return results;
+}
+
+// All-or-nothing: take every stripe the batch touches (in index order, like
+// a transfer), check the whole batch against running balances, and only then
+// apply it. The items go to the log as one record, so recovery and the
+// replicator also see all of them or none.
+std::vector<BatchResult> MemoryStorage::executeAtomic(const std::vector<BatchOperation> &ops) {
+    std::vector<BatchResult> results(ops.size(), BatchResult::rolledBack);
+    auto reject = [&results](std::size_t i) {
+        results[i] = BatchResult::failed;
+        return results;
+    };
+
+    std::vector<std::pair<Account *, Account *>> accounts(ops.size());
+    std::vector<std::size_t> stripes;
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const BatchOperation &op = ops[i];
+        if (!validBatchOperation(op)) return reject(i);
+        accounts[i].first = find(op.userId);
+        if (!accounts[i].first) return reject(i);
+        stripes.push_back(shardOf(op.userId));
+        if (op.kind == BatchOperation::Kind::transfer) {
+            accounts[i].second = find(op.receiverId);
+            if (!accounts[i].second) return reject(i);
+            stripes.push_back(shardOf(op.receiverId));
+        }
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(stripes.size());
+    for (std::size_t s : stripes) locks.emplace_back(shards[s].mutex);
+
+    // Dry run: debits must be covered by the balance left after the items before them
+    std::unordered_map<Account *, double> balances;
+    auto balanceOf = [&balances](Account *account) -> double & {
+        auto it = balances.find(account);
+        if (it == balances.end()) {
+            it = balances.emplace(account, account->balance.load(std::memory_order_relaxed)).first;
+        }
+        return it->second;
+    };
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const BatchOperation &op = ops[i];
+        double &balance = balanceOf(accounts[i].first);
+        if (op.kind == BatchOperation::Kind::deposit) {
+            balance += op.amount;
+            continue;
+        }
+        if (balance < op.amount) {
+            LOG_INFO("insufficient_funds", {"userId", op.userId}, {"amount", op.amount}, {"balance", balance});
+            return reject(i);
+        }
+        balance -= op.amount;
+        if (op.kind == BatchOperation::Kind::transfer) balanceOf(accounts[i].second) += op.amount;
+    }
+
+    const std::int64_t micros = nowMicros();
+    WalRecord batch;
+    batch.type = WalRecord::Type::batch;
+    batch.items.reserve(ops.size());
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        const BatchOperation &op = ops[i];
+        Account &account = *accounts[i].first;
+        switch (op.kind) {
+        case BatchOperation::Kind::deposit:
+            batch.items.push_back(postDeposit(account, op.userId, op.amount, micros));
+            break;
+        case BatchOperation::Kind::withdraw:
+            batch.items.push_back(postWithdraw(account, op.userId, op.amount, micros));
+            break;
+        case BatchOperation::Kind::transfer:
+            batch.items.push_back(postTransfer(account, op.userId, *accounts[i].second, op.receiverId, op.amount, micros));
+            break;
+        }
+        results[i] = BatchResult::applied;
+    }
+    std::uint64_t lsn = 0;
+    if (wal && !batch.items.empty()) lsn = wal->append(batch);
+    locks.clear();
+    if (lsn) wal->waitDurable(lsn);
+    announce(batch);
+    return results;
+}
+
+// Each account's ledger is its own array, so the cursor's timestamp has
+// nothing to skip here
+std::optional<std::vector<Transaction>> MemoryStorage::getTransactions(int userId, const HistoryCursor &after,
+                                                                       int limit) {
+    std::vector<Transaction> transactions;
+    Account *account = find(userId);
+    if (!account || limit <= 0) return transactions;
+
+    std::vector<Entry> entries;
+    {
+        std::lock_guard<std::mutex> lock(shards[shardOf(userId)].mutex);
+        account->ledger.page(after.id, limit, entries);
+    }
+
+    transactions.reserve(entries.size());
+    for (const Entry &e : entries) {
+        transactions.emplace_back(e.id, userId, e.amount, entryTypeNames[static_cast<int>(e.type)],
+                                  formatTimestamp(e.micros));
+    }
+    return transactions;
+}
+
+MemoryStorage::Stats MemoryStorage::stats() const {
+    const int users = nextUserId.load(std::memory_order_relaxed) - 1;
+    const int transactions = nextTransactionId.load(std::memory_order_relaxed) - 1;
+    return {static_cast<std::size_t>(users), static_cast<std::uint64_t>(transactions)};
+}
+
+// ---- Durability ----
+
+void MemoryStorage::enableDurability(const StorageConfig &config) {
+    cfg = config;
+    if (::mkdir(cfg.walDir.c_str(), 0755) != 0 && errno != EEXIST) ioError("cannot create", cfg.walDir);
+
+    const std::uint64_t nextLsn = recover();
+    snapshotLsn = nextLsn;
+
+    wal = std::make_unique<Wal>();
+    Wal::Options options;
+    options.dir = cfg.walDir;
+    options.syncWindow = cfg.walSyncWindow;
+    wal->open(options, nextLsn);
+
+    if (!cfg.replicateUrl.empty()) {
+        replicator = std::make_unique<LedgerReplicator>();
+        replicator->start(cfg.replicateUrl, cfg.walDir, *wal);
+    }
+    if (cfg.snapshotInterval.count() > 0) {
+        stopping = false;
+        snapshotter = std::thread(&MemoryStorage::runSnapshots, this);
+    }
+    LOG_INFO("wal_enabled", {"dir", cfg.walDir}, {"lsn", nextLsn}, {"replicate", replicator != nullptr});
+}
+
+void MemoryStorage::close() {
+    if (!wal) return;
+    if (snapshotter.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            stopping = true;
+        }
+        snapshotWake.notify_one();
+        snapshotter.join();
+    }
+    if (replicator) replicator->stop();
+
+    // A final snapshot keeps the next startup from replaying this run's log
+    try {
+        if (wal->nextLsn() != snapshotLsn) writeSnapshot();
+    } catch (const std::exception &e) {
+        LOG_ERROR("snapshot_failed", {"error", e.what()});
+    }
+    wal->close();
+    wal.reset();
+}
+
+// Load the newest snapshot and replay the log after it. Returns the LSN the
+// log continues from.
+std::uint64_t MemoryStorage::recover() {
+    const auto started = std::chrono::steady_clock::now();
+    std::uint64_t from = 1;
+    const auto snapshots = snapshotFiles(cfg.walDir);
+    if (!snapshots.empty()) {
+        // Older snapshots are deleted once a newer one is complete, and the
+        // log before the newest may be gone, so there is no falling back
+        loadSnapshot(snapshots.back());
+        from = snapshotLsn;
+    }
+
+    WalReader reader(cfg.walDir);
+    WalRecord r;
+    std::uint64_t next = from;
+    std::size_t replayed = 0;
+    while (reader.next(r)) {
+        if (r.lsn < from) continue;
+        replay(r);
+        next = r.lsn + 1;
+        ++replayed;
+    }
+    if (reader.torn()) reader.truncateTail();
+
+    const Stats s = stats();
+    LOG_INFO("ledger_recovered", {"snapshotLsn", from}, {"replayed", replayed}, {"accounts", s.accounts},
+             {"transactions", s.transactions},
+             {"ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started)
+                        .count()});
+    return next;
+}
+
+void MemoryStorage::loadSnapshot(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) ioError("cannot open", path);
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader)) {
+        ::close(fd);
+        throw std::runtime_error("snapshot too short: " + path);
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) ioError("cannot map", path);
+    ::madvise(map, size, MADV_SEQUENTIAL);
+    struct Unmap {
+        std::size_t size;
+        void operator()(void *p) const { ::munmap(p, size); }
+    };
+    std::unique_ptr<void, Unmap> unmap(map, Unmap{size});
+
+    const char *data = static_cast<const char *>(map);
+    SnapshotHeader header;
+    std::memcpy(&header, data, sizeof(header));
+    const char *body = data + sizeof(header);
+    if (std::memcmp(header.magic, snapshotMagic, sizeof(snapshotMagic)) != 0 ||
+        header.bodyBytes != size - sizeof(header) || crc32(body, header.bodyBytes) != header.bodyCrc) {
+        throw std::runtime_error("corrupt snapshot: " + path);
+    }
+
+    std::size_t pos = 0;
+    auto get = [&](void *out, std::size_t n) {
+        if (pos + n > header.bodyBytes) throw std::runtime_error("truncated snapshot: " + path);
+        std::memcpy(out, body + pos, n);
+        pos += n;
+    };
+    for (std::uint64_t i = 0; i < header.accounts; ++i) {
+        std::int32_t id;
+        double balance;
+        std::uint8_t hasPassword;
+        std::uint32_t nameLen, passwordLen;
+        std::uint64_t entries;
+        get(&id, 4);
+        get(&balance, 8);
+        get(&hasPassword, 1);
+        get(&nameLen, 4);
+        get(&passwordLen, 4);
+        get(&entries, 8);
+        std::string name(nameLen, '\0'), password(passwordLen, '\0');
+        get(&name[0], nameLen);
+        get(&password[0], passwordLen);
+        if (!placeUser(id, name, hasPassword ? &password : nullptr, balance, nullptr)) {
+            throw std::runtime_error("snapshot account id out of range: " + path);
+        }
+        atLeast(nextUserId, id);
+
+        Account *account = find(id);
+        for (std::uint64_t e = 0; e < entries; ++e) {
+            Entry entry;
+            std::uint8_t type;
+            get(&entry.id, 4);
+            get(&type, 1);
+            get(&entry.amount, 8);
+            get(&entry.micros, 8);
+            entry.type = static_cast<EntryType>(type);
+            account->ledger.append(entry);
+            atLeast(nextTransactionId, entry.id);
+        }
+    }
+    // The header's counters are read before the stripes are copied, so an
+    // account or entry added meanwhile can be in the snapshot with an id at
+    // or past them; never hand such an id out again
+    atLeast(nextUserId, header.nextUserId - 1);
+    atLeast(nextTransactionId, header.nextTransactionId - 1);
+    snapshotLsn = header.lsn;
+}
+
+// Apply one logged change during recovery (single-threaded). Records carry
+// the resulting balances, so nothing is re-validated.
+void MemoryStorage::replay(const WalRecord &r) {
+    switch (r.type) {
+    case WalRecord::Type::createUser:
+        if (!find(r.userId)) placeUser(r.userId, r.name, r.hasPassword ? &r.password : nullptr, r.balance, nullptr);
+        atLeast(nextUserId, r.userId);
+        break;
+    case WalRecord::Type::deposit:
+    case WalRecord::Type::withdraw:
+        replayEntry(r.userId, r.txId, r.type == WalRecord::Type::deposit ? EntryType::deposit : EntryType::withdrawal,
+                    r.amount, r.balance, r.micros);
+        atLeast(nextTransactionId, r.txId);
+        break;
+    case WalRecord::Type::transfer:
+        replayEntry(r.userId, r.txId, EntryType::transferSent, r.amount, r.balance, r.micros);
+        replayEntry(r.receiverId, r.receiverTxId, EntryType::transferReceived, r.amount, r.receiverBalance, r.micros);
+        atLeast(nextTransactionId, std::max(r.txId, r.receiverTxId));
+        break;
+    case WalRecord::Type::batch:
+        for (const WalRecord &item : r.items) replay(item);
+        break;
+    }
+}
+
+void MemoryStorage::replayEntry(int userId, int txId, EntryType type, double amount, double balance,
+                                std::int64_t micros) {
+    Account *account = find(userId);
+    if (!account) {
+        LOG_WARN("wal_replay_unknown_user", {"userId", userId}, {"txId", txId});
+        return;
+    }
+    // Ids ascend per account in log order, so anything at or below the last
+    // one was already captured by the snapshot
+    if (account->ledger.lastId() >= txId) return;
+    account->ledger.append({txId, type, amount, micros});
+    account->balance.store(balance, std::memory_order_relaxed);
+}
+
+// Copy each stripe under its own lock, so writers only ever wait for one
+// stripe's copy. Every record at or after the LSN read first is replayed on
+// top, which covers whatever changed while later stripes were being copied.
+void MemoryStorage::writeSnapshot() {
+    const auto started = std::chrono::steady_clock::now();
+    const std::uint64_t lsn = wal->nextLsn();
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshotMagic, sizeof(snapshotMagic));
+    header.lsn = lsn;
+    header.nextUserId = nextUserId.load(std::memory_order_relaxed);
+    header.nextTransactionId = nextTransactionId.load(std::memory_order_relaxed);
+
+    std::vector<std::string> parts(shardCount);
+    for (std::size_t s = 0; s < shardCount; ++s) {
+        std::string &out = parts[s];
+        std::lock_guard<std::mutex> lock(shards[s].mutex);
+        for (std::size_t c = 0; c < chunksPerShard; ++c) {
+            const Chunk *chunk = shards[s].chunks[c].load(std::memory_order_acquire);
+            if (!chunk) continue;
+            for (std::size_t i = 0; i < accountsPerChunk; ++i) {
+                const Account &account = (*chunk)[i];
+                if (!account.live.load(std::memory_order_acquire)) continue;
+                const auto id = static_cast<std::int32_t>((c * accountsPerChunk + i) * shardCount + s + 1);
+                put(out, id);
+                put(out, account.balance.load(std::memory_order_relaxed));
+                put(out, static_cast<std::uint8_t>(account.hasPassword));
+                put(out, static_cast<std::uint32_t>(account.name.size()));
+                put(out, static_cast<std::uint32_t>(account.password.size()));
+                put(out, static_cast<std::uint64_t>(account.ledger.count()));
+                out.append(account.name);
+                out.append(account.password);
+                out.reserve(out.size() + account.ledger.count() * entryBytes);
+                for (std::size_t e = 0; e < account.ledger.count(); ++e) {
+                    const Entry &entry = account.ledger.at(e);
+                    put(out, entry.id);
+                    put(out, static_cast<std::uint8_t>(entry.type));
+                    put(out, entry.amount);
+                    put(out, entry.micros);
+                }
+                ++header.accounts;
+            }
+        }
+    }
+    for (const std::string &part : parts) {
+        header.bodyCrc = crc32(part.data(), part.size(), header.bodyCrc);
+        header.bodyBytes += part.size();
+    }
+
+    // Write through a shared mapping into a temporary file, then rename it
+    // into place once it is on disk
+    const std::string tmp = cfg.walDir + "/snapshot.tmp";
+    const std::string path = cfg.walDir + "/" + snapshotName(lsn);
+    const std::size_t size = sizeof(header) + header.bodyBytes;
+    const int fd = ::open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) ioError("cannot create", tmp);
+    if (::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        ioError("cannot size", tmp);
+    }
+    void *map = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        ::close(fd);
+        ioError("cannot map", tmp);
+    }
+    char *dst = static_cast<char *>(map);
+    std::memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+    for (std::string &part : parts) {
+        std::memcpy(dst, part.data(), part.size());
+        dst += part.size();
+        std::string().swap(part);
+    }
+    const bool synced = ::msync(map, size, MS_SYNC) == 0;
+    ::munmap(map, size);
+    const bool closed = ::fsync(fd) == 0 && ::close(fd) == 0;
+    if (!synced || !closed) ioError("cannot sync", tmp);
+    if (::rename(tmp.c_str(), path.c_str()) != 0) ioError("cannot rename", tmp);
+    syncDirectory(cfg.walDir);
+
+    // The new snapshot supersedes older ones and every segment before its
+    // LSN, except what the replicator hasn't shipped yet
+    for (const std::string &old : snapshotFiles(cfg.walDir)) {
+        if (old != path) ::unlink(old.c_str());
+    }
+    snapshotLsn = lsn;
+    wal->rotate();
+    const std::uint64_t keepFrom = replicator ? std::min(lsn, replicator->confirmedLsn() + 1) : lsn;
+    wal->removeSegmentsBefore(keepFrom);
+
+    LOG_INFO("snapshot_written", {"lsn", lsn}, {"accounts", header.accounts}, {"bytes", size},
+             {"ms", std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started)
+                        .count()});
+}
+
+void MemoryStorage::runSnapshots() {
+    std::unique_lock<std::mutex> lock(snapshotMutex);
+    while (!stopping) {
+        snapshotWake.wait_for(lock, cfg.snapshotInterval, [this] { return stopping; });
+        if (stopping) break;
+        lock.unlock();
+        try {
+            if (wal->nextLsn() != snapshotLsn) writeSnapshot();
+        } catch (const std::exception &e) {
+            LOG_ERROR("snapshot_failed", {"error", e.what()});
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,377 @@
+#include "../include/metrics.hpp"
+#include "../include/json_codec.hpp"
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace metrics {
+
+namespace {
+
+constexpr std::size_t phaseCount = static_cast<std::size_t>(Phase::count);
+constexpr std::size_t counterCount = static_cast<std::size_t>(Counter::count);
+constexpr unsigned maxStatus = 600;
+
+// Log-linear buckets: values below 8ns are exact, above that every power of
+// two is split into 8 sub-buckets (<= 12.5% relative error), up to ~18 min.
+constexpr unsigned subBucketBits = 3;
+constexpr unsigned subBuckets = 1u << subBucketBits;
+constexpr unsigned maxMsb = 40;
+constexpr std::size_t bucketCount = (maxMsb - subBucketBits + 2) * subBuckets;
+
+// Exported cumulative buckets are whole powers of two, which line up exactly
+// with sub-bucket boundaries: 2^10ns (~1us) .. 2^34ns (~17s).
+constexpr unsigned firstLeMsb = 10;
+constexpr unsigned lastLeMsb = 34;
+
+using detail::phaseNames;
+static_assert(std::size(phaseNames) == phaseCount);
+constexpr double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+inline std::size_t bucketFor(std::uint64_t v) {
+    if (v < subBuckets) return static_cast<std::size_t>(v);
+    unsigned msb = 63u - static_cast<unsigned>(__builtin_clzll(v));
+    if (msb > maxMsb) return bucketCount - 1;
+    unsigned shift = msb - subBucketBits;
+    return (shift + 1) * subBuckets + ((v >> shift) & (subBuckets - 1));
+}
+
+// Exclusive upper bound of a bucket, in nanoseconds
+inline std::uint64_t bucketLimit(std::size_t index) {
+    if (index < subBuckets) return index + 1;
+    std::size_t octave = index / subBuckets;
+    std::size_t sub = index % subBuckets;
+    return static_cast<std::uint64_t>(subBuckets + sub + 1) << (octave - 1);
+}
+
+// Only the owning thread writes, so a relaxed load + store is enough
+inline void bump(std::atomic<std::uint64_t> &cell, std::uint64_t delta = 1) {
+    cell.store(cell.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+struct Histogram {
+    std::array<std::atomic<std::uint64_t>, bucketCount> buckets{};
+    std::atomic<std::uint64_t> count{0};
+    std::atomic<std::uint64_t> sum{0};
+};
+
+struct RouteBlock {
+    std::array<Histogram, phaseCount> phases{};
+    std::atomic<std::uint64_t> allocations{0};
+};
+
+// One per recording thread, allocated on first use and kept for the life of
+// the process so totals survive the thread
+struct ThreadBlock {
+    std::array<std::atomic<RouteBlock *>, maxRoutes> routes{};
+    std::array<std::atomic<std::uint64_t>, counterCount> counters{};
+    std::array<std::atomic<std::uint64_t>, maxStatus> statuses{};
+
+    ~ThreadBlock() {
+        for (auto &r : routes) delete r.load(std::memory_order_relaxed);
+    }
+
+    RouteBlock &route(std::size_t id) {
+        RouteBlock *block = routes[id].load(std::memory_order_relaxed);
+        if (!block) {
+            block = new RouteBlock();
+            routes[id].store(block, std::memory_order_release);
+        }
+        return *block;
+    }
+};
+
+struct Gauge {
+    std::string name;
+    std::string help;
+    const char *type;
+    std::function<double()> read;
+};
+
+struct ExternalHistogram {
+    std::string name;
+    std::string help;
+    std::function<HistogramSample()> read;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadBlock>> threads;
+    std::array<std::string, maxRoutes> routeNames;
+    std::vector<Gauge> gauges;
+    std::vector<ExternalHistogram> histograms;
+
+    static Registry &instance() {
+        static Registry registry;
+        return registry;
+    }
+};
+
+ThreadBlock &local() {
+    thread_local ThreadBlock *block = [] {
+        auto owned = std::make_unique<ThreadBlock>();
+        ThreadBlock *raw = owned.get();
+        Registry &reg = Registry::instance();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.threads.push_back(std::move(owned));
+        return raw;
+    }();
+    return *block;
+}
+
+// Merged view of one histogram across threads
+struct Snapshot {
+    std::array<std::uint64_t, bucketCount> buckets{};
+    std::uint64_t count = 0;
+    std::uint64_t sum = 0;
+
+    void merge(const Histogram &h) {
+        for (std::size_t i = 0; i < bucketCount; ++i) buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+        count += h.count.load(std::memory_order_relaxed);
+        sum += h.sum.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t below(std::uint64_t limit) const {
+        std::uint64_t n = 0;
+        for (std::size_t i = 0; i < bucketCount && bucketLimit(i) <= limit; ++i) n += buckets[i];
+        return n;
+    }
+
+    std::uint64_t quantile(double q) const {
+        std::uint64_t rank = static_cast<std::uint64_t>(q * static_cast<double>(count));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            seen += buckets[i];
+            if (seen > rank) return bucketLimit(i);
+        }
+        return bucketLimit(bucketCount - 1);
+    }
+};
+
+template <typename T>
+void appendInteger(std::string &out, T v) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+void appendSeconds(std::string &out, std::uint64_t nanos) {
+    codec::appendNumber(out, static_cast<double>(nanos) / 1e9);
+}
+
+void appendLabelValue(std::string &out, std::string_view v) {
+    for (char c : v) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+}
+
+void appendHeader(std::string &out, const char *name, const char *help, const char *type) {
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+void appendHistogram(std::string &out, const char *name, const std::string &labels, const Snapshot &s) {
+    for (unsigned msb = firstLeMsb; msb <= lastLeMsb; ++msb) {
+        out.append(name).append("_bucket{").append(labels).append(",le=\"");
+        appendSeconds(out, std::uint64_t{1} << msb);
+        out.append("\"} ");
+        appendInteger(out, s.below(std::uint64_t{1} << msb));
+        out += '\n';
+    }
+    out.append(name).append("_bucket{").append(labels).append(",le=\"+Inf\"} ");
+    appendInteger(out, s.count);
+    out.append("\n").append(name).append("_sum{").append(labels).append("} ");
+    appendSeconds(out, s.sum);
+    out.append("\n").append(name).append("_count{").append(labels).append("} ");
+    appendInteger(out, s.count);
+    out += '\n';
+}
+
+} // namespace
+
+void record(std::size_t route, Phase phase, std::uint64_t nanos) {
+    Histogram &h = local().route(route).phases[static_cast<std::size_t>(phase)];
+    bump(h.buckets[bucketFor(nanos)]);
+    bump(h.count);
+    bump(h.sum, nanos);
+}
+
+void add(Counter counter, std::uint64_t delta) {
+    bump(local().counters[static_cast<std::size_t>(counter)], delta);
+}
+
+void countStatus(unsigned status) {
+    if (status < maxStatus) bump(local().statuses[status]);
+}
+
+void countAllocations(std::size_t route, std::uint64_t allocations) {
+    bump(local().route(route).allocations, allocations);
+}
+
+void nameRoute(std::size_t id, std::string name) {
+    if (id >= unmatchedRoute) return;
+    Registry &reg = Registry::instance();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.routeNames[id] = std::move(name);
+}
+
+const char *routeName(std::size_t id) {
+    if (id >= unmatchedRoute) return "unmatched";
+    return Registry::instance().routeNames[id].c_str();
+}
+
+void registerGauge(std::string name, std::string help, const char *type, std::function<double()> read) {
+    Registry &reg = Registry::instance();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.gauges.push_back({std::move(name), std::move(help), type, std::move(read)});
+}
+
+void registerHistogram(std::string name, std::string help, std::function<HistogramSample()> read) {
+    Registry &reg = Registry::instance();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.histograms.push_back({std::move(name), std::move(help), std::move(read)});
+}
+
+void renderPrometheus(std::string &out) {
+    Registry &reg = Registry::instance();
+    std::unique_lock<std::mutex> lock(reg.mutex);
+
+    // Merge every thread's histograms and counters
+    std::vector<std::array<Snapshot, phaseCount>> routes(maxRoutes);
+    std::array<std::uint64_t, maxRoutes> allocations{};
+    std::array<std::uint64_t, counterCount> counters{};
+    std::array<std::uint64_t, maxStatus> statuses{};
+    for (const auto &thread : reg.threads) {
+        for (std::size_t r = 0; r < maxRoutes; ++r) {
+            const RouteBlock *block = thread->routes[r].load(std::memory_order_acquire);
+            if (!block) continue;
+            for (std::size_t p = 0; p < phaseCount; ++p) routes[r][p].merge(block->phases[p]);
+            allocations[r] += block->allocations.load(std::memory_order_relaxed);
+        }
+        for (std::size_t c = 0; c < counterCount; ++c) counters[c] += thread->counters[c].load(std::memory_order_relaxed);
+        for (unsigned s = 0; s < maxStatus; ++s) statuses[s] += thread->statuses[s].load(std::memory_order_relaxed);
+    }
+
+    auto routeLabel = [&](std::size_t r) {
+        std::string label = "route=\"";
+        appendLabelValue(label, r == unmatchedRoute ? "unmatched" : reg.routeNames[r]);
+        label += '"';
+        return label;
+    };
+
+    appendHeader(out, "bank_phase_duration_seconds", "Time spent in each phase of a request.", "histogram");
+    for (std::size_t r = 0; r < maxRoutes; ++r) {
+        for (std::size_t p = 0; p < phaseCount; ++p) {
+            if (p == static_cast<std::size_t>(Phase::total) || routes[r][p].count == 0) continue;
+            appendHistogram(out, "bank_phase_duration_seconds",
+                            routeLabel(r) + ",phase=\"" + phaseNames[p] + "\"", routes[r][p]);
+        }
+    }
+
+    appendHeader(out, "bank_request_duration_seconds", "First request byte to response written.", "histogram");
+    for (std::size_t r = 0; r < maxRoutes; ++r) {
+        const Snapshot &s = routes[r][static_cast<std::size_t>(Phase::total)];
+        if (s.count) appendHistogram(out, "bank_request_duration_seconds", routeLabel(r), s);
+    }
+
+    appendHeader(out, "bank_phase_duration_quantile_seconds",
+                 "Latency quantiles since startup, from the high-resolution histograms.", "gauge");
+    for (std::size_t r = 0; r < maxRoutes; ++r) {
+        for (std::size_t p = 0; p < phaseCount; ++p) {
+            const Snapshot &s = routes[r][p];
+            if (s.count == 0) continue;
+            for (double q : quantiles) {
+                out.append("bank_phase_duration_quantile_seconds{").append(routeLabel(r));
+                out.append(",phase=\"").append(phaseNames[p]).append("\",quantile=\"");
+                codec::appendNumber(out, q);
+                out.append("\"} ");
+                appendSeconds(out, s.quantile(q));
+                out += '\n';
+            }
+        }
+    }
+
+    appendHeader(out, "bank_requests_total", "Requests served.", "counter");
+    for (std::size_t r = 0; r < maxRoutes; ++r) {
+        const Snapshot &s = routes[r][static_cast<std::size_t>(Phase::total)];
+        if (s.count == 0) continue;
+        out.append("bank_requests_total{").append(routeLabel(r)).append("} ");
+        appendInteger(out, s.count);
+        out += '\n';
+    }
+
+    appendHeader(out, "bank_request_heap_allocations_total",
+                 "Heap allocations made serving requests; divide by bank_requests_total for the per-request count.",
+                 "counter");
+    for (std::size_t r = 0; r < maxRoutes; ++r) {
+        if (routes[r][static_cast<std::size_t>(Phase::total)].count == 0) continue;
+        out.append("bank_request_heap_allocations_total{").append(routeLabel(r)).append("} ");
+        appendInteger(out, allocations[r]);
+        out += '\n';
+    }
+
+    appendHeader(out, "bank_http_responses_total", "Responses by HTTP status code.", "counter");
+    for (unsigned s = 0; s < maxStatus; ++s) {
+        if (statuses[s] == 0) continue;
+        out.append("bank_http_responses_total{code=\"");
+        appendInteger(out, s);
+        out.append("\"} ");
+        appendInteger(out, statuses[s]);
+        out += '\n';
+    }
+
+    appendHeader(out, "bank_db_retries_total", "Statements retried after a serialization failure or deadlock.", "counter");
+    out.append("bank_db_retries_total ");
+    appendInteger(out, counters[static_cast<std::size_t>(Counter::dbRetries)]);
+    out += '\n';
+    appendHeader(out, "bank_db_pool_waits_total", "Connection checkouts that had to wait.", "counter");
+    out.append("bank_db_pool_waits_total ");
+    appendInteger(out, counters[static_cast<std::size_t>(Counter::poolWaits)]);
+    out += '\n';
+    appendHeader(out, "bank_db_pool_wait_seconds_total", "Time spent waiting for a pooled connection.", "counter");
+    out.append("bank_db_pool_wait_seconds_total ");
+    appendSeconds(out, counters[static_cast<std::size_t>(Counter::poolWaitNanos)]);
+    out += '\n';
+
+    // Gauges take other components' locks, and those components record
+    // metrics (which may register a thread) while holding them
+    const std::vector<Gauge> gauges = reg.gauges;
+    const std::vector<ExternalHistogram> histograms = reg.histograms;
+    lock.unlock();
+    for (const Gauge &g : gauges) {
+        appendHeader(out, g.name.c_str(), g.help.c_str(), g.type);
+        out.append(g.name).append(" ");
+        codec::appendNumber(out, g.read());
+        out += '\n';
+    }
+    for (const ExternalHistogram &h : histograms) {
+        const HistogramSample s = h.read();
+        appendHeader(out, h.name.c_str(), h.help.c_str(), "histogram");
+        for (const auto &[le, below] : s.buckets) {
+            out.append(h.name).append("_bucket{le=\"");
+            codec::appendNumber(out, le);
+            out.append("\"} ");
+            appendInteger(out, below);
+            out += '\n';
+        }
+        out.append(h.name).append("_bucket{le=\"+Inf\"} ");
+        appendInteger(out, s.count);
+        out.append("\n").append(h.name).append("_sum ");
+        codec::appendNumber(out, s.sum);
+        out.append("\n").append(h.name).append("_count ");
+        appendInteger(out, s.count);
+        out += '\n';
+    }
+}
+
+} // namespace metrics
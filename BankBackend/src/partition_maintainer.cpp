@@ -0,0 +1,70 @@
+#include "../include/partition_maintainer.hpp"
+#include "../include/db_pool.hpp"
+#include "../include/ledger_partitions.hpp"
+#include "../include/log.hpp"
+
+PartitionMaintainer &PartitionMaintainer::instance() {
+    static PartitionMaintainer maintainer;
+    return maintainer;
+}
+
+PartitionMaintainer::~PartitionMaintainer() {
+    stop();
+}
+
+void PartitionMaintainer::start(const LedgerConfig &config) {
+    if (worker.joinable()) return;
+    cfg = config;
+    if (!maintain() || cfg.maintainInterval.count() == 0) return;
+    stopping = false;
+    worker = std::thread(&PartitionMaintainer::run, this);
+    LOG_INFO("partition_maintainer_started", {"intervalS", cfg.maintainInterval.count()},
+             {"monthsAhead", cfg.monthsAhead}, {"retainMonths", cfg.retainMonths});
+}
+
+void PartitionMaintainer::stop() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+}
+
+PartitionMaintainer::Stats PartitionMaintainer::stats() const {
+    return {created.load(), archived.load(), errors.load()};
+}
+
+void PartitionMaintainer::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, cfg.maintainInterval, [this] { return stopping; });
+        if (stopping) break;
+        lock.unlock();
+        maintain();
+        lock.lock();
+    }
+}
+
+bool PartitionMaintainer::maintain() {
+    ConnectionPool::Lease lease = ConnectionPool::instance().acquire();
+    if (!lease) return true;
+    try {
+        if (!partitions::partitioned(*lease)) {
+            LOG_WARN("ledger_not_partitioned", {"hint", "run bankledger migrate"});
+            return false;
+        }
+        const partitions::MaintainResult result = partitions::maintain(*lease, cfg.monthsAhead, cfg.retainMonths);
+        for (const std::string &name : result.created) LOG_INFO("ledger_partition_created", {"partition", name});
+        for (const std::string &name : result.archived) LOG_INFO("ledger_partition_archived", {"partition", name});
+        if (result.moved > 0) LOG_INFO("ledger_rows_moved", {"rows", result.moved});
+        created.fetch_add(result.created.size(), std::memory_order_relaxed);
+        archived.fetch_add(result.archived.size(), std::memory_order_relaxed);
+    } catch (const std::exception &e) {
+        // A lock timeout behind a long transaction, say; the next pass retries
+        LOG_WARN("ledger_maintenance_failed", {"error", e.what()});
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
@@ -0,0 +1,267 @@
+#include "../include/push.hpp"
+#include "../include/json_codec.hpp"
+#include "../include/log.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+namespace push {
+
+bool Subscriber::drain(std::string &frame) {
+    std::vector<std::string> events;
+    double value = 0;
+    bool sendBalance, sendResync;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        woken = false;
+        if (!balancePending && !resync && transactions.empty()) return false;
+        events.swap(transactions); // leaves an idle subscriber holding no buffer
+        value = balance;
+        sendBalance = balancePending;
+        sendResync = resync;
+        balancePending = false;
+        resync = false;
+    }
+
+    frame.assign(1, '[');
+    if (sendResync) frame.append(R"({"event":"resync"})");
+    for (const std::string &event : events) {
+        if (frame.size() > 1) frame.push_back(',');
+        frame.append(event);
+    }
+    if (sendBalance) {
+        if (frame.size() > 1) frame.push_back(',');
+        codec::Writer(frame)
+            .beginObject()
+            .key("event").value("balance")
+            .key("userId").value(userId)
+            .key("balance").value(value)
+            .endObject();
+    }
+    frame.push_back(']');
+    return true;
+}
+
+bool Subscriber::offerBalance(double value, std::uint64_t version, bool &coalesced) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (version != 0) {
+        if (version < balanceVersion) return false;
+        balanceVersion = version;
+    }
+    coalesced = balancePending;
+    balance = value;
+    balancePending = true;
+    const bool wake = !woken;
+    woken = true;
+    return wake;
+}
+
+bool Subscriber::offerTransaction(const std::string &event, std::size_t limit, bool &overflowed) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (resync) return false; // the client re-reads history anyway
+    if (transactions.size() >= limit) {
+        std::vector<std::string>().swap(transactions);
+        resync = true;
+        overflowed = true;
+    } else {
+        transactions.push_back(event);
+    }
+    const bool wake = !woken;
+    woken = true;
+    return wake;
+}
+
+bool Subscriber::offerResync() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string>().swap(transactions);
+    resync = true;
+    const bool wake = !woken;
+    woken = true;
+    return wake;
+}
+
+Hub &Hub::instance() {
+    static Hub hub;
+    return hub;
+}
+
+void Hub::configure(const PushConfig &cfg) {
+    queueLimit = cfg.queue;
+}
+
+void Hub::add(const std::shared_ptr<Subscriber> &subscriber) {
+    Shard &shard = shardFor(subscriber->userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.byUser[subscriber->userId].push_back(subscriber);
+    count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Hub::remove(const Subscriber &subscriber) {
+    count.fetch_sub(1, std::memory_order_relaxed);
+    Shard &shard = shardFor(subscriber.userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.byUser.find(subscriber.userId);
+    if (it == shard.byUser.end()) return;
+
+    // Typically called from the subscriber's destructor, when its entry has
+    // already expired; drop every expired entry for the account (another
+    // subscriber's remove() may have beaten us to ours)
+    auto &list = it->second;
+    list.erase(std::remove_if(list.begin(), list.end(),
+                              [&subscriber](const std::weak_ptr<Subscriber> &weak) {
+                                  const auto live = weak.lock();
+                                  return !live || live.get() == &subscriber;
+                              }),
+               list.end());
+    if (list.empty()) shard.byUser.erase(it);
+}
+
+bool Hub::watched(int userId) const {
+    if (count.load(std::memory_order_relaxed) == 0) return false;
+    const Shard &shard = shardFor(userId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.byUser.count(userId) != 0;
+}
+
+std::vector<std::shared_ptr<Subscriber>> Hub::subscribersOf(int userId) const {
+    std::vector<std::shared_ptr<Subscriber>> live;
+    if (count.load(std::memory_order_relaxed) == 0) return live;
+    const Shard &shard = shardFor(userId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.byUser.find(userId);
+    if (it == shard.byUser.end()) return live;
+    live.reserve(it->second.size());
+    for (const auto &weak : it->second) {
+        if (auto subscriber = weak.lock()) live.push_back(std::move(subscriber));
+    }
+    return live;
+}
+
+void Hub::balanceChanged(int userId, double balance, std::uint64_t version) {
+    for (const auto &subscriber : subscribersOf(userId)) {
+        bool coalesced = false;
+        const bool wake = subscriber->offerBalance(balance, version, coalesced);
+        eventCount.fetch_add(1, std::memory_order_relaxed);
+        if (coalesced) coalescedCount.fetch_add(1, std::memory_order_relaxed);
+        if (wake) subscriber->wake();
+    }
+}
+
+void Hub::transactionPosted(const Transaction &tx) {
+    const auto subscribers = subscribersOf(tx.user_id);
+    if (subscribers.empty()) return;
+
+    // Serialized once, whoever is listening
+    std::string event;
+    event.reserve(160);
+    codec::Writer w(event);
+    w.beginObject().key("event").value("transaction").key("transaction");
+    codec::writeTransaction(w, tx);
+    w.endObject();
+
+    for (const auto &subscriber : subscribers) {
+        bool overflowed = false;
+        const bool wake = subscriber->offerTransaction(event, queueLimit, overflowed);
+        eventCount.fetch_add(1, std::memory_order_relaxed);
+        if (overflowed) resyncCount.fetch_add(1, std::memory_order_relaxed);
+        if (wake) subscriber->wake();
+    }
+}
+
+void Hub::resyncAll() {
+    std::vector<std::shared_ptr<Subscriber>> live;
+    for (Shard &shard : shards) {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto &entry : shard.byUser) {
+            for (const auto &weak : entry.second) {
+                if (auto subscriber = weak.lock()) live.push_back(std::move(subscriber));
+            }
+        }
+    }
+    for (const auto &subscriber : live) {
+        if (subscriber->offerResync()) subscriber->wake();
+    }
+    resyncCount.fetch_add(live.size(), std::memory_order_relaxed);
+}
+
+void Hub::setBalanceReader(BalanceReader reader) {
+    balanceReader = std::move(reader);
+}
+
+void Hub::refreshBalance(int userId) {
+    if (!balanceReader) return;
+    {
+        std::lock_guard<std::mutex> lock(refreshMutex);
+        const auto pending = refreshing.try_emplace(userId, false);
+        if (!pending.second) {
+            pending.first->second = true;
+            return;
+        }
+    }
+    readBalance(userId);
+}
+
+void Hub::readBalance(int userId) {
+    balanceReader(userId, [this, userId](std::optional<double> balance) {
+        if (!balance) {
+            for (const auto &subscriber : subscribersOf(userId)) {
+                if (subscriber->offerResync()) subscriber->wake();
+                resyncCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        } else if (*balance >= 0) {
+            balanceChanged(userId, *balance);
+        }
+        {
+            std::lock_guard<std::mutex> lock(refreshMutex);
+            const auto it = refreshing.find(userId);
+            if (it == refreshing.end()) return;
+            if (!it->second) {
+                refreshing.erase(it);
+                return;
+            }
+            it->second = false;
+        }
+        readBalance(userId);
+    });
+}
+
+void Hub::applyBalanceNotification(const std::string &payload) {
+    try {
+        const std::size_t comma = payload.find(',');
+        const int userId = std::stoi(payload.substr(0, comma));
+        if (!watched(userId)) return;
+        // Only the id: the balance has to be read (and a deleted account
+        // reads as none, so nothing goes out)
+        if (comma == std::string::npos) return refreshBalance(userId);
+        balanceChanged(userId, std::stod(payload.substr(comma + 1)));
+    } catch (const std::exception &e) {
+        LOG_WARN("push_notification_malformed", {"payload", payload}, {"error", e.what()});
+    }
+}
+
+void Hub::applyTransactionNotification(const std::string &payload) {
+    try {
+        std::size_t fieldStart[5];
+        fieldStart[0] = 0;
+        for (int i = 1; i < 5; ++i) {
+            const std::size_t comma = payload.find(',', fieldStart[i - 1]);
+            if (comma == std::string::npos) throw std::invalid_argument("expected 5 fields");
+            fieldStart[i] = comma + 1;
+        }
+        auto field = [&](int i) {
+            return payload.substr(fieldStart[i], i < 4 ? fieldStart[i + 1] - 1 - fieldStart[i] : std::string::npos);
+        };
+
+        const int userId = std::stoi(field(1));
+        if (!watched(userId)) return;
+        transactionPosted(Transaction(std::stoi(field(0)), userId, std::stod(field(2)), field(3), field(4)));
+    } catch (const std::exception &e) {
+        LOG_WARN("push_notification_malformed", {"payload", payload}, {"error", e.what()});
+    }
+}
+
+Hub::Stats Hub::stats() const {
+    return {count.load(std::memory_order_relaxed), eventCount.load(std::memory_order_relaxed),
+            coalescedCount.load(std::memory_order_relaxed), resyncCount.load(std::memory_order_relaxed)};
+}
+
+} // namespace push
@@ -0,0 +1,179 @@
+#include "../include/replicas.hpp"
+#include "../include/log.hpp"
+#include <pqxx/pqxx>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Milliseconds the server is behind the primary; 0 for a primary, and for a
+// replica that has replayed everything it received while still streaming
+// (an idle primary sends no new transactions, so the last replay timestamp
+// ages without the replica falling behind). 1e9 when it never replayed.
+constexpr const char *lagQuery =
+    "SELECT CASE"
+    " WHEN NOT pg_is_in_recovery() THEN 0"
+    " WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn()"
+    "  AND EXISTS (SELECT 1 FROM pg_stat_wal_receiver) THEN 0"
+    " ELSE COALESCE(1000 * EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()), 1e9)"
+    " END";
+
+std::uint64_t mix(std::uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+ReplicaRouter &ReplicaRouter::instance() {
+    static ReplicaRouter router;
+    return router;
+}
+
+ReplicaRouter::~ReplicaRouter() {
+    stop();
+}
+
+void ReplicaRouter::start(const DbConfig &cfg) {
+    if (cfg.replicas.empty() || worker.joinable()) return;
+    maxLagMs = cfg.maxReplicaLag.count();
+    checkIntervalMs = cfg.replicaCheckInterval.count();
+    stickyMs = cfg.stickyWindow.count();
+
+    lastWrite = std::make_unique<std::atomic<std::int64_t>[]>(stickySlots);
+    for (std::size_t i = 0; i < stickySlots; ++i) lastWrite[i].store(0, std::memory_order_relaxed);
+
+    for (const std::string &url : cfg.replicas) {
+        auto replica = std::make_unique<Replica>();
+        replica->connectionString = url;
+        replica->pool = std::make_unique<ConnectionPool>();
+        DbConfig replicaCfg = cfg;
+        replicaCfg.connectionString = url;
+        try {
+            replica->pool->init(replicaCfg);
+        } catch (const std::exception &e) {
+            LOG_WARN("db_replica_unreachable", {"replica", replicas.size()}, {"error", e.what()});
+        }
+        replicas.push_back(std::move(replica));
+    }
+
+    // Measure once up front so reads can use the replicas straight away
+    for (std::size_t i = 0; i < replicas.size(); ++i) check(i);
+    stopping = false;
+    worker = std::thread(&ReplicaRouter::monitor, this);
+    LOG_INFO("db_replicas_ready", {"replicas", replicas.size()}, {"maxLagMs", maxLagMs},
+             {"stickyMs", stickyMs});
+}
+
+void ReplicaRouter::stop() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+}
+
+std::int64_t ReplicaRouter::now() const {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count();
+}
+
+bool ReplicaRouter::usable(const Replica &replica, std::int64_t at) const {
+    const std::int64_t lag = replica.lagMs.load(std::memory_order_relaxed);
+    if (lag < 0 || lag > maxLagMs) return false;
+    // A replica whose checks stopped coming back may be arbitrarily behind
+    return at - replica.checkedAt.load(std::memory_order_relaxed) <= 3 * checkIntervalMs;
+}
+
+int ReplicaRouter::pick(int userId) {
+    if (replicas.empty()) return -1;
+    const std::int64_t at = now();
+
+    const std::int64_t written =
+        lastWrite[mix(static_cast<std::uint64_t>(userId)) & (stickySlots - 1)].load(std::memory_order_relaxed);
+    if (written != 0 && at - written < stickyMs) {
+        stickyReads.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    // Round-robin over the replicas that are close enough
+    const std::size_t count = replicas.size();
+    const std::size_t first = next.fetch_add(1, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::size_t index = (first + i) % count;
+        if (usable(*replicas[index], at)) {
+            replicaReads.fetch_add(1, std::memory_order_relaxed);
+            return static_cast<int>(index);
+        }
+    }
+    fallbackReads.fetch_add(1, std::memory_order_relaxed);
+    return -1;
+}
+
+void ReplicaRouter::fellBack() {
+    replicaReads.fetch_sub(1, std::memory_order_relaxed);
+    fallbackReads.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ReplicaRouter::wrote(int userId) {
+    if (replicas.empty()) return;
+    // 0 marks an account never written; the first millisecond counts as 1
+    lastWrite[mix(static_cast<std::uint64_t>(userId)) & (stickySlots - 1)].store(
+        std::max<std::int64_t>(1, now()), std::memory_order_relaxed);
+}
+
+void ReplicaRouter::monitor() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, std::chrono::milliseconds(checkIntervalMs), [this] { return stopping; });
+        if (stopping) break;
+        lock.unlock();
+        for (std::size_t i = 0; i < replicas.size(); ++i) check(i);
+        lock.lock();
+    }
+}
+
+void ReplicaRouter::check(std::size_t index) {
+    Replica &replica = *replicas[index];
+    std::int64_t lag = -1;
+    ConnectionPool::Lease lease = replica.pool->acquire();
+    if (lease) {
+        try {
+            pqxx::nontransaction txn(*lease);
+            lag = std::llround(txn.exec(lagQuery)[0][0].as<double>());
+        } catch (const std::exception &e) {
+            LOG_WARN("db_replica_check_failed", {"replica", index}, {"error", e.what()});
+        }
+    }
+
+    const std::int64_t previous = replica.lagMs.exchange(lag, std::memory_order_relaxed);
+    if (lag >= 0) replica.checkedAt.store(now(), std::memory_order_relaxed);
+
+    // Log only transitions between reachable/unreachable and within/over the bound
+    const bool wasUsable = previous >= 0 && previous <= maxLagMs;
+    const bool isUsable = lag >= 0 && lag <= maxLagMs;
+    if (wasUsable == isUsable && (previous < 0) == (lag < 0)) return;
+    if (lag < 0) {
+        LOG_WARN("db_replica_down", {"replica", index});
+    } else if (!isUsable) {
+        LOG_WARN("db_replica_lagging", {"replica", index}, {"lagMs", lag}, {"maxLagMs", maxLagMs});
+    } else {
+        LOG_INFO("db_replica_usable", {"replica", index}, {"lagMs", lag});
+    }
+}
+
+ReplicaRouter::Stats ReplicaRouter::stats() const {
+    Stats s{replicas.size(), 0, replicaReads.load(std::memory_order_relaxed),
+            stickyReads.load(std::memory_order_relaxed), fallbackReads.load(std::memory_order_relaxed), 0};
+    const std::int64_t at = now();
+    for (const auto &replica : replicas) {
+        if (usable(*replica, at)) ++s.usable;
+        const std::int64_t lag = replica->lagMs.load(std::memory_order_relaxed);
+        if (lag >= 0) s.maxLagSeconds = std::max(s.maxLagSeconds, lag / 1000.0);
+    }
+    return s;
+}
@@ -1,355 +1,1173 @@
 #include "../../include/routes/handlers.hpp"
+#include "../../include/routes/router.hpp"
+#include "../../include/auth.hpp"
+#include "../../include/bulk.hpp"
+#include "../../include/config.hpp"
+#include "../../include/crypto.hpp"
 #include "../../include/db.hpp"
-#include <sstream>
-#include <iostream>
-#include <nlohmann/json.hpp> // JSON library
+#include "../../include/json_codec.hpp"
+#include "../../include/log.hpp"
+#include "../../include/metrics.hpp"
+#include "../../include/storage.hpp"
+#include "../../include/trace.hpp"
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <memory>
+#include <stdexcept>
 
 namespace http = boost::beast::http;
-using json = nlohmann::json;
 
-// Utility function to extract a specific query parameter from a URL query string
-std::string getQueryParam(const std::string &query, const std::string &key)
+namespace
 {
-    std::size_t keyPos = query.find(key + "=");
-    if (keyPos == std::string::npos)
-        return ""; // Return empty string if key is not found
-    std::size_t valueStart = keyPos + key.length() + 1;
-    std::size_t valueEnd = query.find("&", valueStart);
-    if (valueEnd == std::string::npos)
-        valueEnd = query.length(); // Use end of string if no further parameters
-    return query.substr(valueStart, valueEnd - valueStart);
+
+// Page sizes for GET /transactions
+constexpr int defaultPageSize = 100;
+constexpr int maxPageSize = 1000;
+constexpr int streamPageSize = 500;
+
+// POST /batch: operations per request, and per transaction / response chunk
+// in independent mode
+constexpr std::size_t maxBatchOperations = 10000;
+constexpr std::size_t batchSliceSize = 500;
+
+// Fill a JSON response carrying a {"message","status"} body
+void statusResponse(Response &res, bool success,
+                    const char *okMessage, const char *failMessage)
+{
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(success ? http::status::ok : http::status::bad_request);
+    res.set(http::field::content_type, "application/json");
+    res.body() = codec::statusBody(success, success ? okMessage : failMessage);
 }
 
-// Main request handler function to process incoming HTTP requests and generate responses
-void handle_request(const http::request<http::string_body> &req,
-                    http::response<http::string_body> &res)
+// Fill the response to a deposit, withdrawal or transfer. An unknown outcome
+// is a 500 rather than either answer, since a client retrying a "failed"
+// one could apply it twice.
+void writeResponse(Response &res, WriteResult result, const char *okMessage, const char *failMessage)
+{
+    if (result != WriteResult::unknown)
+        return statusResponse(res, result == WriteResult::applied, okMessage, failMessage);
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(http::status::internal_server_error);
+    res.set(http::field::content_type, "application/json");
+    res.body() = codec::statusBody(false, "Outcome unknown, check the balance before retrying");
+}
+
+// Decode the request body into `fields`, timed as the parse phase
+void parseBody(const RequestContext &ctx, std::initializer_list<codec::Field> fields)
+{
+    metrics::ScopedPhase timer(metrics::Phase::parse);
+    codec::parseObject(ctx.req.body(), fields);
+}
+
+// The cursor for the page after `tx`. A timestamp that isn't a date (the
+// '-infinity' of rows migrated without one) is left out.
+HistoryCursor cursorAfter(const Transaction &tx)
 {
+    HistoryCursor cursor{tx.id, tx.timestamp};
+    if (cursor.timestamp.empty() || !std::isdigit(static_cast<unsigned char>(cursor.timestamp[0])))
+        cursor.timestamp.clear();
+    return cursor;
+}
 
-    std::string target(req.target());
-    std::cout << "[DEBUG] Received target: " << target << std::endl;
+// X-Next-Cursor: "<id>@<timestamp>", the timestamp with a 'T' for its space
+// so the value goes into a query string as is, or just "<id>"
+std::string formatCursor(const HistoryCursor &cursor)
+{
+    std::string out = std::to_string(cursor.id);
+    if (cursor.timestamp.empty())
+        return out;
+    out += '@';
+    for (char c : cursor.timestamp)
+        out += c == ' ' ? 'T' : c;
+    return out;
+}
 
-    DB db;
+// Read an `after` value: a transaction id, as earlier servers handed out,
+// or a cursor from formatCursor(). The timestamp must be
+// YYYY-MM-DDTHH:MM:SS with up to six fractional digits.
+bool parseCursor(std::string_view text, HistoryCursor &cursor)
+{
+    const std::size_t at = text.find('@');
+    const std::string_view id = text.substr(0, at);
+    auto [end, ec] = std::from_chars(id.data(), id.data() + id.size(), cursor.id);
+    if (id.empty() || ec != std::errc() || end != id.data() + id.size() || cursor.id < 0)
+        return false;
+    cursor.timestamp.clear();
+    if (at == std::string_view::npos)
+        return true;
 
-    // Handle GET request to retrieve user balance
-    if (req.method() == http::verb::get && target.find("/balance") != std::string::npos)
+    const std::string_view ts = text.substr(at + 1);
+    static constexpr char shape[] = "dddd-dd-ddTdd:dd:dd";
+    constexpr std::size_t whole = sizeof(shape) - 1;
+    if (ts.size() < whole || ts.size() == whole + 1 || ts.size() > whole + 7)
+        return false;
+    for (std::size_t i = 0; i < ts.size(); ++i)
     {
-        std::string fullTarget = std::string(req.target());
-        std::size_t queryStart = fullTarget.find("?");
-        int userId = 1;
+        const char want = i < whole ? shape[i] : (i == whole ? '.' : 'd');
+        if (want == 'd' ? !std::isdigit(static_cast<unsigned char>(ts[i])) : ts[i] != want)
+            return false;
+    }
+    auto field = [&ts](std::size_t pos) { return (ts[pos] - '0') * 10 + (ts[pos + 1] - '0'); };
+    if (field(5) < 1 || field(5) > 12 || field(8) < 1 || field(8) > 31 || field(11) > 23 || field(14) > 59 ||
+        field(17) > 59)
+        return false;
+    cursor.timestamp = ts;
+    return true;
+}
+
+// A history stream's progress. `page` is filled by a storage completion
+// and only read once the session has resumed the stream, so the two never
+// overlap.
+struct HistoryStream
+{
+    int userId = 0;
+    HistoryCursor after;
+    std::optional<std::vector<Transaction>> page; // the rows to send next; nullopt if the read failed
+    bool read = false;                             // `page` holds a read not yet sent
+    bool opened = false;
+    bool empty = true;
+};
+
+// For a stream's next piece, what suspend() is for a response: a Resumer
+// when the backend can wait on the database without holding a thread,
+// otherwise empty and the source reads in place.
+Resumer suspendChunk(Deferrer *deferrer)
+{
+    if (!deferrer || !storage().suspends())
+        return nullptr;
+    return deferrer->deferChunk();
+}
 
-        // Parse query string for userId parameter
-        if (queryStart != std::string::npos)
+// Stream a user's whole history as one JSON array, starting with the page
+// the handler read before committing to a 200. Later rows are read one page
+// at a time along the (user_id, timestamp, id) index and each page is sent
+// as soon as it is ready, so memory stays bounded by a page however long the
+// history is. A page that can't be read throws, which drops the connection
+// before the closing chunk: the client sees a broken response, not a short
+// history.
+ChunkSource streamTransactions(std::shared_ptr<HistoryStream> history, Deferrer *deferrer)
+{
+    return [history, deferrer](std::string &chunk)
+    {
+        HistoryStream &h = *history;
+        if (!h.read)
         {
-            std::string queryStr = fullTarget.substr(queryStart + 1);
-            std::string userIdStr = getQueryParam(queryStr, "userId");
-            try
+            if (Resumer resume = suspendChunk(deferrer))
             {
-                userId = std::stoi(userIdStr); // Convert userId from string to int
-            }
-            catch (...)
-            {
-                res.result(http::status::bad_request);
-                res.body() = "Invalid or missing userId";
-                res.prepare_payload();
-                return;
+                storage().getTransactionsAsync(h.userId, h.after, streamPageSize,
+                                               [history, resume](std::optional<std::vector<Transaction>> page)
+                                               {
+                                                   history->page = std::move(page);
+                                                   history->read = true;
+                                                   resume();
+                                               });
+                return true;
             }
+            h.page = storage().getTransactions(h.userId, h.after, streamPageSize);
         }
+        h.read = false;
+        if (!h.page)
+            throw std::runtime_error("transaction history read failed");
 
-        double balance = db.getBalance(userId); // Fetch balance from database
-        std::stringstream ss;
-        ss << "{\"balance\": " << balance << "}"; // Construct JSON response
-        res.result(http::status::ok);
-        res.set(http::field::content_type, "application/json");
-        res.body() = ss.str();
-    }
-
-    // Handle POST request to deposit funds into a user's account
-    else if (req.method() == http::verb::post && target.find("/deposit") != std::string::npos)
-    {
-        try
+        metrics::ScopedPhase timer(metrics::Phase::serialize);
+        if (!h.opened)
         {
-            json body = json::parse(req.body());
-            int userId = body.at("userId").get<int>();
-            double amount = body.at("amount").get<double>();
-
-            bool success = db.deposit(userId, amount); // Attempt deposit in database
-            json resBody;
-            resBody["status"] = success ? "success" : "fail";
-            resBody["message"] = success ? "Deposit successful" : "Deposit failed";
-            res.result(success ? http::status::ok : http::status::bad_request);
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
+            chunk += "[";
+            h.opened = true;
         }
-        catch (const std::exception &e)
+        for (const auto &tx : *h.page)
         {
-            std::cerr << "JSON Parse Error: " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload";
+            if (!h.empty)
+                chunk += ",";
+            h.empty = false;
+            codec::Writer w(chunk);
+            codec::writeTransaction(w, tx);
         }
-    }
 
-    // Handle POST request to withdraw funds from a user's account
-    else if (req.method() == http::verb::post && target.find("/withdraw") != std::string::npos)
-    {
-        try
+        if (h.page->size() < static_cast<std::size_t>(streamPageSize))
         {
-            json body = json::parse(req.body());
-            int userId = body.at("userId").get<int>();
-            double amount = body.at("amount").get<double>();
-
-            bool success = db.withdraw(userId, amount); // Attempt withdrawal
-            json resBody;
-            resBody["status"] = success ? "success" : "fail";
-            resBody["message"] = success ? "Withdrawal successful" : "Withdrawal failed";
-
-            res.result(success ? http::status::ok : http::status::bad_request);
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
+            chunk += "]";
+            return false;
         }
+        h.after = cursorAfter(h.page->back());
+        return true;
+    };
+}
 
-        catch (const std::exception &e)
+// Decode a /batch body:
+//   {"mode":"atomic"|"independent","operations":[{"type":"deposit","userId":1,"amount":10},
+//    {"type":"transfer","senderId":1,"receiverId":2,"amount":5},...]}
+// Operations are read one by one with the pull reader, straight into
+// BatchOperation; mode defaults to independent.
+std::vector<BatchOperation> parseBatch(std::string_view body, bool &atomic)
+{
+    metrics::ScopedPhase timer(metrics::Phase::parse);
+    std::vector<BatchOperation> ops;
+    bool sawOperations = false;
+    atomic = false;
+
+    codec::Reader r(body);
+    r.expect('{');
+    if (!r.consume('}'))
+    {
+        do
         {
-            std::cerr << "JSON Parse Error: " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload";
+            std::string_view key = r.readKey();
+            if (key == "mode")
+            {
+                std::string mode;
+                r.readString(mode);
+                if (mode != "atomic" && mode != "independent")
+                    throw codec::ParseError("mode must be \"atomic\" or \"independent\"");
+                atomic = mode == "atomic";
+            }
+            else if (key == "operations")
+            {
+                sawOperations = true;
+                r.expect('[');
+                if (r.consume(']'))
+                    continue;
+                do
+                {
+                    if (ops.size() == maxBatchOperations)
+                        throw codec::ParseError("too many operations");
+                    std::string type;
+                    int userId = 0;
+                    int senderId = 0;
+                    int receiverId = 0;
+                    double amount;
+                    r.readObjectInto({{"type", type},
+                                      {"userId", userId, false},
+                                      {"senderId", senderId, false},
+                                      {"receiverId", receiverId, false},
+                                      {"amount", amount}});
+
+                    if (type == "deposit" || type == "withdraw")
+                    {
+                        if (userId == 0)
+                            throw codec::ParseError("missing field: userId");
+                        BatchOperation::Kind kind =
+                            type == "deposit" ? BatchOperation::Kind::deposit : BatchOperation::Kind::withdraw;
+                        ops.push_back({kind, userId, 0, amount});
+                    }
+                    else if (type == "transfer")
+                    {
+                        if (senderId == 0 || receiverId == 0)
+                            throw codec::ParseError("missing field: senderId or receiverId");
+                        ops.push_back({BatchOperation::Kind::transfer, senderId, receiverId, amount});
+                    }
+                    else
+                    {
+                        throw codec::ParseError("unknown operation type");
+                    }
+                } while (r.consume(','));
+                r.expect(']');
+            }
+            else
+            {
+                r.skipValue();
+            }
+        } while (r.consume(','));
+        r.expect('}');
+    }
+    if (!r.atEnd())
+        throw codec::ParseError("unexpected data after JSON object");
+    if (!sawOperations)
+        throw codec::ParseError("missing field: operations");
+    return ops;
+}
+
+// Run a batch: atomic ones whole in one transaction, independent ones a
+// slice at a time, each slice in its own transaction
+std::vector<BatchResult> runBatch(const std::vector<BatchOperation> &ops, bool atomic)
+{
+    if (atomic)
+        return storage().executeBatch(ops, true);
+    std::vector<BatchResult> results;
+    results.reserve(ops.size());
+    for (std::size_t done = 0; done < ops.size(); done += batchSliceSize)
+    {
+        const std::size_t end = std::min(done + batchSliceSize, ops.size());
+        std::vector<BatchOperation> slice(ops.begin() + done, ops.begin() + end);
+        std::vector<BatchResult> sliceResults = storage().executeBatch(slice, false);
+        results.insert(results.end(), sliceResults.begin(), sliceResults.end());
+    }
+    return results;
+}
+
+// Stream a finished batch's results as
+// {"results":[...],"applied":..,"failed":..,"rolledBack":..}, one slice per
+// chunk. The batch has run before the response is sent, so this only
+// serializes.
+ChunkSource streamBatch(std::shared_ptr<const std::vector<BatchResult>> batch)
+{
+    std::size_t done = 0;
+    std::size_t counts[3] = {0, 0, 0}; // applied, failed, rolledBack
+    return [batch, done, counts](std::string &chunk) mutable
+    {
+        const std::vector<BatchResult> &results = *batch;
+        metrics::ScopedPhase timer(metrics::Phase::serialize);
+        static const char *const names[] = {"\"success\"", "\"fail\"", "\"rolled_back\""};
+        const std::size_t end = std::min(done + batchSliceSize, results.size());
+        if (done == 0)
+            chunk += "{\"results\":[";
+        for (std::size_t i = done; i < end; ++i)
+        {
+            const auto index = static_cast<std::size_t>(results[i]);
+            if (i > 0)
+                chunk += ",";
+            chunk += names[index];
+            ++counts[index];
         }
+        done = end;
+        if (done < results.size())
+            return true;
+
+        chunk += "],\"applied\":" + std::to_string(counts[0]) + ",\"failed\":" + std::to_string(counts[1]) +
+                 ",\"rolledBack\":" + std::to_string(counts[2]) + "}";
+        return false;
+    };
+}
+
+const AdminConfig &adminConfig()
+{
+    static const AdminConfig admin = loadAdminConfig();
+    return admin;
+}
+
+// Admin endpoints are off unless BANK_ADMIN_TOKEN is set; callers send it
+// back in X-Admin-Token
+bool authorizeAdmin(const RequestContext &ctx, Response &res)
+{
+    const AdminConfig &admin = adminConfig();
+    const auto header = ctx.req.find("X-Admin-Token");
+    std::string_view given;
+    if (header != ctx.req.end())
+        given = std::string_view(header->value().data(), header->value().size());
+
+    // Look at every byte so the time taken doesn't reveal a matching prefix
+    unsigned char diff = given.size() == admin.token.size() ? 0 : 1;
+    for (std::size_t i = 0; i < given.size() && i < admin.token.size(); ++i)
+        diff |= static_cast<unsigned char>(given[i] ^ admin.token[i]);
+    if (!admin.token.empty() && diff == 0)
+        return true;
+
+    LOG_WARN("admin_denied", {"target", std::string(ctx.req.target())});
+    res.result(http::status::forbidden);
+    res.body() = "Admin access denied";
+    return false;
+}
+
+// Bulk import/export goes straight to the Postgres tables
+bool requirePostgres(Response &res)
+{
+    if (dynamic_cast<PostgresStorage *>(&storage()))
+        return true;
+    res.result(http::status::not_implemented);
+    res.body() = "Bulk import/export needs BANK_STORAGE=postgres";
+    return false;
+}
+
+const AuthConfig &authConfig()
+{
+    static const AuthConfig auth = loadAuthConfig();
+    return auth;
+}
+
+// The user behind "Authorization: Bearer <token>", or 0 when the request has
+// no token. A token that doesn't resolve gets 401 and false. No database
+// access: sessions live in auth::SessionStore.
+bool sessionUser(const RequestContext &ctx, Response &res, int &userId)
+{
+    userId = 0;
+    const auto header = ctx.req.find(http::field::authorization);
+    if (header == ctx.req.end())
+        return true;
+
+    constexpr std::string_view scheme = "Bearer ";
+    std::string_view value(header->value().data(), header->value().size());
+    if (value.substr(0, scheme.size()) == scheme &&
+        auth::SessionStore::instance().resolve(value.substr(scheme.size()), userId))
+        return true;
+
+    res.result(http::status::unauthorized);
+    res.set(http::field::www_authenticate, "Bearer");
+    res.body() = "Invalid or expired session token";
+    return false;
+}
+
+// Settle which account a request acts on. `userId` is the id the request
+// names (0 if none): with a session token it defaults to the session's user
+// and may not name anyone else (403). Without a token the request is taken
+// at its word, unless BANK_REQUIRE_AUTH is set (401).
+bool authorize(const RequestContext &ctx, Response &res, int &userId)
+{
+    int session;
+    if (!sessionUser(ctx, res, session))
+        return false;
+    if (session == 0)
+    {
+        if (!authConfig().requireToken)
+            return true;
+        res.result(http::status::unauthorized);
+        res.set(http::field::www_authenticate, "Bearer");
+        res.body() = "Missing session token";
+        return false;
     }
+    if (userId != 0 && userId != session)
+    {
+        res.result(http::status::forbidden);
+        res.body() = "Session token belongs to another user";
+        return false;
+    }
+    userId = session;
+    return true;
+}
+
+// 503 for hashing work the password pool had no room for
+void overloadedResponse(Response &res)
+{
+    res.result(http::status::service_unavailable);
+    res.set(http::field::retry_after, "1");
+    res.body() = "Server busy, try again";
+}
 
-    // Handle POST request to transfer funds between users
-    else if (req.method() == http::verb::post && (target == "/transfer" || target.find("/transfer") != std::string::npos))
+// Run `work` on the password-hashing pool and answer with the filler it
+// returns, keeping slow hashes (and batches) off the I/O threads. When the
+// pool's queue is full the request gets 503 straight away.
+void offload(RequestContext &ctx, Response &res, std::function<ResponseFiller()> work)
+{
+    if (!ctx.deferrer)
     {
-        std::cerr << "[DEBUG] Hit /transfer endpoint\n";
-        std::cerr << "[DEBUG] Raw body: " << req.body() << std::endl;
+        work()(res);
+        return;
+    }
 
+    Responder respond = ctx.deferrer->defer();
+    const std::size_t route = metrics::currentRoute();
+    const std::string path(ctx.path);
+    auto task = [respond, route, path, work, traced = trace::current()]() mutable
+    {
+        metrics::setCurrentRoute(route);
+        trace::Scope scope(traced);
+        ResponseFiller fill;
         try
         {
-            json body = json::parse(req.body());
-            int senderId = body.at("senderId").get<int>();
-            int receiverId = body.at("receiverId").get<int>();
-            double amount = body.at("amount").get<double>();
-
-            bool success = db.transfer(senderId, receiverId, amount);
-            json resBody;
-            resBody["status"] = success ? "success" : "fail";
-            resBody["message"] = success ? "Transfer successful" : "Transfer failed";
-
-            res.result(success ? http::status::ok : http::status::bad_request);
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
+            fill = work();
         }
         catch (const std::exception &e)
         {
-            std::cerr << "JSON Parse Error (transfer): " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload";
+            LOG_ERROR("handler_error", {"route", path}, {"error", e.what()});
+            fill = [](Response &out)
+            {
+                out.result(http::status::internal_server_error);
+                out.body() = "Internal server error";
+            };
         }
+        respond(std::move(fill));
+    };
+    if (!auth::PasswordWorkers::instance().submit(std::move(task)))
+    {
+        LOG_WARN("password_queue_full", {"route", path});
+        respond(overloadedResponse);
+    }
+}
+
+// The lowest user id called `name` whose password matches, or -1. Legacy
+// plaintext and weaker hashes are re-hashed at the current strength on the
+// way through. Runs on the password pool.
+int authenticate(const std::string &name, const std::string &password)
+{
+    const unsigned iterations = authConfig().passwordIterations;
+    const std::vector<Credential> candidates = storage().credentials(name);
+    if (candidates.empty())
+    {
+        // Spend the same time as a real check, so response times don't
+        // reveal which names exist
+        static const std::string decoy = crypto::hashPassword("", iterations);
+        crypto::verifyPassword(password, decoy);
+        return -1;
+    }
+    for (const Credential &candidate : candidates)
+    {
+        if (!crypto::verifyPassword(password, candidate.password))
+            continue;
+        if (crypto::needsRehash(candidate.password, iterations))
+            storage().upgradePassword(candidate.userId, crypto::hashPassword(password, iterations));
+        return candidate.userId;
+    }
+    return -1;
+}
+
+// When the backend can wait on the database without holding a thread (see
+// Storage::suspends), defer the response and return the Responder that fills
+// it in from the storage call's completion. Otherwise an empty Responder: the
+// handler makes the blocking call in place.
+Responder suspend(RequestContext &ctx)
+{
+    if (!ctx.deferrer || !storage().suspends())
+        return nullptr;
+    return ctx.deferrer->defer();
+}
+
+// Storage completion answering with writeResponse
+std::function<void(WriteResult)> respondWrite(Responder respond, const char *okMessage, const char *failMessage)
+{
+    return [respond, okMessage, failMessage](WriteResult result)
+    {
+        respond([result, okMessage, failMessage](Response &out)
+                { writeResponse(out, result, okMessage, failMessage); });
+    };
+}
+
+void balanceResponse(Response &res, double balance)
+{
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "application/json");
+    codec::Writer(res.body()).beginObject().key("balance").value(balance).endObject();
+}
+
+// One page of GET /transactions; a full page carries the cursor for the next
+void pageResponse(Response &res, const std::vector<Transaction> &transactions, int limit)
+{
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "application/json");
+    codec::Writer w(res.body());
+    w.beginArray();
+    for (const auto &tx : transactions)
+    {
+        codec::writeTransaction(w, tx);
+    }
+    w.endArray();
+    if (transactions.size() == static_cast<std::size_t>(limit))
+    {
+        res.set("X-Next-Cursor", formatCursor(cursorAfter(transactions.back())));
     }
+}
 
-    // Handle GET request to retrieve a user's transaction history
-    else if (req.method() == http::verb::get && target.find("/transactions") != std::string::npos)
+// 503 for a read the database failed; the client can retry
+void unavailableResponse(Response &res)
+{
+    res.result(http::status::service_unavailable);
+    res.set(http::field::retry_after, "1");
+    res.body() = "Database unavailable";
+}
+
+// userId for the GET endpoints, from the query string or the session token.
+// Requests with neither a query string nor a token keep the historical
+// default of user 1; a query string without a valid userId is an error.
+bool queryUserId(const RequestContext &ctx, Response &res, int &userId)
+{
+    userId = 0;
+    if (ctx.query.getInt("userId", userId) == QueryParams::Status::invalid)
+    {
+        res.result(http::status::bad_request);
+        res.body() = "Invalid or missing userId";
+        return false;
+    }
+    if (!authorize(ctx, res, userId))
+        return false;
+    if (userId != 0)
+        return true;
+    if (ctx.query.empty())
+    {
+        userId = 1;
+        return true;
+    }
+
+    res.result(http::status::bad_request);
+    res.body() = "Invalid or missing userId";
+    return false;
+}
+
+// Handle GET request to retrieve user balance
+void handleBalance(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    int userId;
+    if (!queryUserId(ctx, res, userId))
+        return;
+
+    if (Responder respond = suspend(ctx))
+    {
+        storage().getBalanceAsync(userId, [respond](double balance)
+                                  { respond([balance](Response &out)
+                                            { balanceResponse(out, balance); }); });
+        return;
+    }
+    balanceResponse(res, storage().getBalance(userId));
+}
+
+// Handle POST request to deposit funds into a user's account
+void handleDeposit(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    try
     {
-        std::string fullTarget = std::string(req.target());
-        std::size_t queryStart = fullTarget.find("?");
-        int userId = 1;
+        int userId = 0;
+        double amount;
+        parseBody(ctx, {{"userId", userId, false}, {"amount", amount}});
+        if (!authorize(ctx, res, userId))
+            return;
+        if (userId == 0)
+            throw codec::ParseError("missing field: userId");
 
-        if (queryStart != std::string::npos)
+        if (Responder respond = suspend(ctx))
         {
-            std::string queryStr = fullTarget.substr(queryStart + 1);
-            std::string userIdStr = getQueryParam(queryStr, "userId");
-            try
-            {
-                userId = std::stoi(userIdStr);
-            }
-            catch (...)
-            {
-                res.result(http::status::bad_request);
-                res.body() = "Invalid or missing userId";
-                res.prepare_payload();
-                return;
-            }
+            storage().depositAsync(userId, amount, respondWrite(respond, "Deposit successful", "Deposit failed"));
+            return;
         }
+        WriteResult result = storage().deposit(userId, amount);
+        writeResponse(res, result, "Deposit successful", "Deposit failed");
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/deposit"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload";
+    }
+}
+
+// Handle POST request to withdraw funds from a user's account
+void handleWithdraw(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    try
+    {
+        int userId = 0;
+        double amount;
+        parseBody(ctx, {{"userId", userId, false}, {"amount", amount}});
+        if (!authorize(ctx, res, userId))
+            return;
+        if (userId == 0)
+            throw codec::ParseError("missing field: userId");
 
-        std::vector<Transaction> transactions = db.getTransactions(userId);
-        json jsonArray = json::array();
-        for (const auto &tx : transactions)
+        if (Responder respond = suspend(ctx))
         {
-            // Construct JSON object for each transaction
-            jsonArray.push_back({{"id", tx.id},
-                                 {"userId", tx.user_id},
-                                 {"amount", tx.amount},
-                                 {"type", tx.type},
-                                 {"timestamp", tx.timestamp}});
+            storage().withdrawAsync(userId, amount, respondWrite(respond, "Withdrawal successful", "Withdrawal failed"));
+            return;
         }
+        WriteResult result = storage().withdraw(userId, amount);
+        writeResponse(res, result, "Withdrawal successful", "Withdrawal failed");
+    }
 
-        res.result(http::status::ok);
-        res.set(http::field::content_type, "application/json");
-        res.body() = jsonArray.dump();
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/withdraw"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload";
     }
+}
 
-    // Handle POST request to register a new user with a password
-    else if (req.method() == http::verb::post && target.find("/register") != std::string::npos)
+// Handle POST request to transfer funds between users
+void handleTransfer(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    LOG_DEBUG("transfer_request", {"body", ctx.req.body()});
+
+    try
     {
-        try
+        int senderId = 0;
+        int receiverId;
+        double amount;
+        parseBody(ctx, {{"senderId", senderId, false}, {"receiverId", receiverId}, {"amount", amount}});
+        if (!authorize(ctx, res, senderId))
+            return;
+        if (senderId == 0)
+            throw codec::ParseError("missing field: senderId");
+
+        if (Responder respond = suspend(ctx))
         {
-            json body = json::parse(req.body());
-            std::string name = body.at("name").get<std::string>();
-            std::string password = body.at("password").get<std::string>();
-            double balance = body.value("initialBalance", 0.0);
-
-            bool success = db.registerUser(name, password, balance);
-            json resBody = {
-                {"status", success ? "success" : "fail"},
-                {"message", success ? "User registered" : "Registration failed"}};
-
-            res.result(success ? http::status::ok : http::status::bad_request);
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
+            storage().transferAsync(senderId, receiverId, amount,
+                                    respondWrite(respond, "Transfer successful", "Transfer failed"));
+            return;
         }
-        catch (const std::exception &e)
+        WriteResult result = storage().transfer(senderId, receiverId, amount);
+        writeResponse(res, result, "Transfer successful", "Transfer failed");
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/transfer"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload";
+    }
+}
+
+// Handle GET request to retrieve a user's transaction history.
+// With `limit` and/or `after` one page is returned and X-Next-Cursor holds
+// the `after` value for the next page (see formatCursor); without them the
+// whole history is streamed back with chunked transfer encoding.
+void handleTransactions(RequestContext &ctx, Response &res, ChunkSource &stream)
+{
+    int userId;
+    if (!queryUserId(ctx, res, userId))
+        return;
+
+    int limit = defaultPageSize;
+    std::string afterText;
+    HistoryCursor after;
+    QueryParams::Status limitStatus = ctx.query.getInt("limit", limit);
+    QueryParams::Status afterStatus = ctx.query.getString("after", afterText);
+    if (limitStatus == QueryParams::Status::invalid || afterStatus == QueryParams::Status::invalid ||
+        limit < 1 || limit > maxPageSize ||
+        (afterStatus == QueryParams::Status::ok && !parseCursor(afterText, after)))
+    {
+        res.result(http::status::bad_request);
+        res.body() = "Invalid limit or after";
+        return;
+    }
+
+    if (limitStatus == QueryParams::Status::missing && afterStatus == QueryParams::Status::missing)
+    {
+        auto history = std::make_shared<HistoryStream>();
+        history->userId = userId;
+        history->read = true;
+        stream = streamTransactions(history, ctx.deferrer);
+        if (ctx.deferrer)
+            ctx.deferrer->keepSlot(); // later pages still read from storage
+
+        // The first page decides between 200 and 503
+        auto firstPage = [history](Response &out)
+        {
+            if (!history->page)
+                return unavailableResponse(out);
+            out.result(http::status::ok);
+            out.set(http::field::content_type, "application/json");
+        };
+        if (Responder respond = suspend(ctx))
         {
-            std::cerr << "JSON Parse Error (register): " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload for registration";
+            storage().getTransactionsAsync(userId, HistoryCursor(), streamPageSize,
+                                           [history, respond, firstPage](std::optional<std::vector<Transaction>> page)
+                                           {
+                                               history->page = std::move(page);
+                                               respond(firstPage);
+                                           });
+            return;
         }
+        history->page = storage().getTransactions(userId, HistoryCursor(), streamPageSize);
+        firstPage(res);
+        if (!history->page)
+            stream = nullptr;
+        return; // body is produced by the stream, no Content-Length
     }
 
-    // Handle POST request to authenticate a user
-    else if (req.method() == http::verb::post && target.find("/login") != std::string::npos)
+    if (Responder respond = suspend(ctx))
     {
-        try
-        {
-            json body = json::parse(req.body());
-            std::string name = body.at("name").get<std::string>();
-            std::string password = body.at("password").get<std::string>();
+        storage().getTransactionsAsync(userId, after, limit,
+                                       [respond, limit](std::optional<std::vector<Transaction>> transactions)
+                                       { respond([transactions = std::move(transactions), limit](Response &out)
+                                                 {
+                                                     if (!transactions)
+                                                         return unavailableResponse(out);
+                                                     pageResponse(out, *transactions, limit);
+                                                 }); });
+        return;
+    }
+    std::optional<std::vector<Transaction>> transactions = storage().getTransactions(userId, after, limit);
+    if (!transactions)
+        return unavailableResponse(res);
+    pageResponse(res, *transactions, limit);
+}
+
+// Handle POST request to register a new user with a password. The password
+// is hashed on the password pool and only the hash is stored.
+void handleRegister(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    std::string name;
+    std::string password;
+    double balance = 0.0;
+    try
+    {
+        parseBody(ctx, {{"name", name}, {"password", password}, {"initialBalance", balance, false}});
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/register"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload for registration";
+        return;
+    }
 
-            int userId = db.loginUser(name, password);
-            json resBody;
-            if (userId != -1)
+    offload(ctx, res, [name, password, balance]() -> ResponseFiller
             {
-                resBody = {{"status", "success"}, {"userId", userId}};
-                res.result(http::status::ok);
-            }
-            else
+                const std::string hash = crypto::hashPassword(password, authConfig().passwordIterations);
+                const bool success = storage().registerUser(name, hash, balance);
+                return [success](Response &out)
+                { statusResponse(out, success, "User registered", "Registration failed"); };
+            });
+}
+
+// Handle POST request to authenticate a user. The password check runs on
+// the password pool; on success the response carries a session token for
+// the Authorization header of later requests.
+void handleLogin(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    std::string name;
+    std::string password;
+    try
+    {
+        parseBody(ctx, {{"name", name}, {"password", password}});
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/login"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload for login";
+        return;
+    }
+
+    offload(ctx, res, [name, password]() -> ResponseFiller
             {
-                resBody = {{"status", "fail"}, {"message", "Invalid credentials"}};
-                res.result(http::status::unauthorized);
-            }
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << "JSON Parse Error (login): " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload for login";
-        }
+                const int userId = authenticate(name, password);
+                const std::string token = userId != -1 ? auth::SessionStore::instance().issue(userId) : std::string();
+                return [userId, token](Response &out)
+                {
+                    metrics::ScopedPhase timer(metrics::Phase::serialize);
+                    codec::Writer w(out.body());
+                    if (userId != -1)
+                    {
+                        const auto ttl = auth::SessionStore::instance().ttl().count();
+                        w.beginObject().key("status").value("success").key("userId").value(userId);
+                        w.key("token").value(token).key("expiresIn").value(static_cast<std::int64_t>(ttl)).endObject();
+                        out.result(http::status::ok);
+                    }
+                    else
+                    {
+                        w.beginObject().key("message").value("Invalid credentials").key("status").value("fail").endObject();
+                        out.result(http::status::unauthorized);
+                    }
+                    out.set(http::field::content_type, "application/json");
+                };
+            });
+}
+
+// Handle POST request to end the session named by the bearer token
+void handleLogout(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    const auto header = ctx.req.find(http::field::authorization);
+    constexpr std::string_view scheme = "Bearer ";
+    std::string_view value;
+    if (header != ctx.req.end())
+        value = std::string_view(header->value().data(), header->value().size());
+    const bool revoked = value.substr(0, scheme.size()) == scheme &&
+                         auth::SessionStore::instance().revoke(value.substr(scheme.size()));
+    statusResponse(res, revoked, "Logged out", "No such session");
+    if (!revoked)
+        res.result(http::status::unauthorized);
+}
+
+// Handle POST request to create a user without a password
+void handleCreateUser(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    try
+    {
+        std::string name;
+        double initialBalance;
+        parseBody(ctx, {{"name", name}, {"initialBalance", initialBalance}});
+
+        bool success = storage().createUser(name, initialBalance);
+        statusResponse(res, success, "User created successfully", "Failed to create user");
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/createUser"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload for user creation";
     }
+}
 
-    // Handle POST request to create a user without a password
-    else if (req.method() == http::verb::post && target.find("/createUser") != std::string::npos)
+// Handle POST request to run many deposits/withdrawals/transfers at once.
+// The response is 200 with one result per operation, in request order. The
+// batch runs on the password pool (see offload) rather than an I/O thread,
+// since its transactions block until they commit.
+void handleBatch(RequestContext &ctx, Response &res, ChunkSource &stream)
+{
+    bool atomic;
+    std::vector<BatchOperation> ops;
+    try
     {
-        try
-        {
-            json body = json::parse(req.body());
-            std::string name = body.at("name").get<std::string>();
-            double initialBalance = body.at("initialBalance").get<double>();
-            bool success = db.createUser(name, initialBalance);
-            json resBody;
-            resBody["status"] = success ? "success" : "fail";
-            resBody["message"] = success ? "User created successfully" : "Failed to create user";
-
-            res.result(success ? http::status::ok : http::status::bad_request);
-            res.set(http::field::content_type, "application/json");
-            res.body() = resBody.dump();
-        }
-        catch (const std::exception &e)
-        {
-            std::cerr << "JSON Parse Error (createUser): " << e.what() << std::endl;
-            res.result(http::status::bad_request);
-            res.body() = "Invalid JSON payload for user creation";
-        }
+        ops = parseBatch(ctx.req.body(), atomic);
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/batch"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload for batch";
+        return;
     }
 
-    // Fallback for unmatched endpoints
-    else
+    // With a session, every operation must debit or credit the caller's account
+    int session = 0;
+    if (!authorize(ctx, res, session))
+        return;
+    if (session != 0 && std::any_of(ops.begin(), ops.end(), [session](const BatchOperation &op)
+                                    { return op.userId != session; }))
+    {
+        res.result(http::status::forbidden);
+        res.body() = "Session token belongs to another user";
+        return;
+    }
+
+    auto results = std::make_shared<std::vector<BatchResult>>();
+    stream = streamBatch(results);
+    offload(ctx, res, [results, ops = std::move(ops), atomic]
+            {
+                *results = runBatch(ops, atomic);
+                return ResponseFiller([](Response &out)
+                                      {
+                                          out.result(http::status::ok);
+                                          out.set(http::field::content_type, "application/json");
+                                      });
+            });
+}
+
+// Handle POST request to start loading a CSV file from BANK_IMPORT_DIR.
+// The import runs in the background; poll GET /admin/import?job=<id>.
+void handleAdminImport(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    if (!authorizeAdmin(ctx, res) || !requirePostgres(res))
+        return;
+
+    std::string table;
+    std::string file;
+    int workers = 0;
+    int maxRejects = 0;
+    int deferIndexes = 0;
+    bulk::Table target;
+    try
+    {
+        parseBody(ctx, {{"table", table},
+                        {"file", file},
+                        {"workers", workers, false},
+                        {"maxRejects", maxRejects, false},
+                        {"deferIndexes", deferIndexes, false}});
+        if (!bulk::parseTable(table, target))
+            throw codec::ParseError("table must be users or transactions");
+        // A bare file name, so requests can't read outside the import directory
+        if (file.empty() || file[0] == '.' || file.find('/') != std::string::npos)
+            throw codec::ParseError("file must be a plain file name");
+        if (workers < 0 || maxRejects < 0)
+            throw codec::ParseError("workers and maxRejects can't be negative");
+    }
+    catch (const std::exception &e)
+    {
+        LOG_WARN("bad_request", {"route", "/admin/import"}, {"error", e.what()});
+        res.result(http::status::bad_request);
+        res.body() = "Invalid JSON payload for import";
+        return;
+    }
+
+    bulk::ImportOptions options;
+    options.workers = static_cast<unsigned>(workers);
+    options.maxRejects = static_cast<std::size_t>(maxRejects);
+    options.deferIndexes = deferIndexes != 0;
+    const int job = bulk::ImportJobs::instance().start(target, adminConfig().importDir + "/" + file, options);
+
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(http::status::accepted);
+    res.set(http::field::content_type, "application/json");
+    codec::Writer(res.body()).beginObject().key("job").value(job).endObject();
+}
+
+// Handle GET request for the progress or outcome of an import
+void handleAdminImportStatus(RequestContext &ctx, Response &res, ChunkSource &)
+{
+    if (!authorizeAdmin(ctx, res))
+        return;
+
+    int job;
+    bulk::ImportJobs::Status status;
+    if (ctx.query.getInt("job", job) != QueryParams::Status::ok || !bulk::ImportJobs::instance().status(job, status))
     {
-        std::cerr << "[DEBUG] No matching endpoint for: " << target << std::endl;
         res.result(http::status::not_found);
-        res.body() = "Endpoint not found";
+        res.body() = "Unknown import job";
+        return;
     }
 
-    res.prepare_payload(); // Finalize response headers and body
+    static const char *const states[] = {"running", "done", "failed"};
+    metrics::ScopedPhase timer(metrics::Phase::serialize);
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "application/json");
+    codec::Writer w(res.body());
+    w.beginObject().key("job").value(job).key("state").value(states[static_cast<int>(status.state)]);
+    if (status.state == bulk::ImportJobs::State::running)
+    {
+        w.key("rows").value(static_cast<std::int64_t>(status.rows)).endObject();
+        return;
+    }
+    const bulk::ImportResult &result = status.result;
+    w.key("rows").value(static_cast<std::int64_t>(result.rows));
+    w.key("rejected").value(static_cast<std::int64_t>(result.rejected));
+    w.key("rejects").beginArray();
+    for (const bulk::Reject &reject : result.rejects)
+        w.beginObject().key("line").value(static_cast<std::int64_t>(reject.line)).key("reason").value(reject.reason).endObject();
+    w.endArray();
+    if (!result.committed)
+        w.key("error").value(result.error);
+    w.key("ms").value(static_cast<std::int64_t>(result.elapsed.count())).endObject();
 }
 
-// Database method to transfer funds between two users
-bool DB::transfer(int senderId, int receiverId, double amount)
+// Handle GET request to download a table (optionally one user's rows) as
+// CSV. Rows are streamed from COPY in chunks, so memory stays flat however
+// large the table is.
+void handleAdminExport(RequestContext &ctx, Response &res, ChunkSource &stream)
 {
-    if (!isConnected())
+    if (!authorizeAdmin(ctx, res) || !requirePostgres(res))
+        return;
+
+    std::string table;
+    int userId = 0;
+    bulk::Table target;
+    if (ctx.query.getString("table", table) != QueryParams::Status::ok || !bulk::parseTable(table, target) ||
+        ctx.query.getInt("userId", userId) == QueryParams::Status::invalid || userId < 0)
     {
-        std::cerr << "[ERROR] Not connected to DB.\n";
-        return false;
+        res.result(http::status::bad_request);
+        res.body() = "Invalid table or userId";
+        return;
     }
-    if (amount <= 0)
+
+    // The pooled connection stays checked out until the last chunk is sent
+    struct Export
     {
-        std::cerr << "[ERROR] Invalid transfer amount: " << amount << std::endl;
-        return false;
+        DB db;
+        std::unique_ptr<bulk::Exporter> exporter;
+    };
+    auto state = std::make_shared<Export>();
+    if (!state->db.isConnected())
+    {
+        res.result(http::status::service_unavailable);
+        res.body() = "Database unavailable";
+        return;
     }
+    state->exporter = std::make_unique<bulk::Exporter>(*state->db.getConn(), target, userId);
 
-    try
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "text/csv");
+    res.set(http::field::content_disposition, "attachment; filename=\"" + table + ".csv\"");
+    if (ctx.deferrer)
+        ctx.deferrer->keepSlot();
+    stream = [state](std::string &chunk)
     {
-        pqxx::work txn(*conn);
+        metrics::ScopedPhase timer(metrics::Phase::sql);
+        return state->exporter->next(chunk);
+    };
+}
 
-        // Verify sender exists and has sufficient funds
-        pqxx::result senderRes = txn.exec_params(
-            "SELECT balance FROM users WHERE id = $1", senderId);
-        if (senderRes.empty())
-        {
-            std::cerr << "[ERROR] Sender does not exist.\n";
-            return false;
-        }
+// Handle GET request for Prometheus metrics
+void handleMetrics(RequestContext &, Response &res, ChunkSource &)
+{
+    res.result(http::status::ok);
+    res.set(http::field::content_type, "text/plain; version=0.0.4");
+    std::string text;
+    metrics::renderPrometheus(text);
+    res.body() = text;
+}
+
+// GET /events only makes sense as a WebSocket handshake, which the server
+// takes over before routing (see authorizeSubscription)
+void handleEvents(RequestContext &, Response &res, ChunkSource &)
+{
+    res.result(http::status::upgrade_required);
+    res.set(http::field::upgrade, "websocket");
+    res.body() = "GET /events is a WebSocket endpoint";
+}
+
+// Route table, built and sealed once on first use
+const Router &router()
+{
+    static const Router instance = []
+    {
+        Router r;
+        r.add(http::verb::get, "/balance", handleBalance);
+        r.add(http::verb::post, "/deposit", handleDeposit);
+        r.add(http::verb::post, "/withdraw", handleWithdraw);
+        r.add(http::verb::post, "/transfer", handleTransfer);
+        r.add(http::verb::get, "/transactions", handleTransactions);
+        r.add(http::verb::post, "/register", handleRegister);
+        r.add(http::verb::post, "/login", handleLogin);
+        r.add(http::verb::post, "/logout", handleLogout);
+        r.add(http::verb::post, "/createUser", handleCreateUser);
+        r.add(http::verb::post, "/batch", handleBatch);
+        r.add(http::verb::get, "/metrics", handleMetrics);
+        r.add(http::verb::get, "/events", handleEvents);
+        r.add(http::verb::post, "/admin/import", handleAdminImport);
+        r.add(http::verb::get, "/admin/import", handleAdminImportStatus);
+        r.add(http::verb::get, "/admin/export", handleAdminExport);
+        r.seal();
+        for (const auto &route : r.routes())
+            metrics::nameRoute(route.id, std::string(http::to_string(route.method)) + " " + route.path);
+        return r;
+    }();
+    return instance;
+}
+
+} // namespace
+
+// Main request handler function to process incoming HTTP requests and generate responses
+void handle_request(const Request &req,
+                    Response &res,
+                    ChunkSource &stream,
+                    Deferrer *deferrer)
+{
+    LOG_DEBUG("request", {"method", std::string(req.method_string())}, {"target", std::string(req.target())});
+
+    trace::Span span("route");
+    if (!router().dispatch(req, res, stream, deferrer))
+    {
+        LOG_DEBUG("no_route", {"target", std::string(req.target())}, {"status", res.result_int()});
+    }
+    span.describe(metrics::routeName(metrics::currentRoute()));
+
+    if (!stream)
+        res.prepare_payload(); // Finalize response headers and body
+}
+
+bool authorizeSubscription(const Request &req,
+                           Response &res,
+                           int &userId)
+{
+    std::string_view target(req.target().data(), req.target().size());
+    const std::size_t queryStart = target.find('?');
+    RequestContext ctx{req, target.substr(0, queryStart),
+                       queryStart == std::string_view::npos ? QueryParams() : QueryParams(target.substr(queryStart + 1))};
 
-        double senderBalance = senderRes[0][0].as<double>();
-        std::cerr << "[DEBUG] Sender balance: " << senderBalance << std::endl;
+    userId = 0;
+    if (ctx.query.getInt("userId", userId) == QueryParams::Status::invalid || userId < 0)
+    {
+        res.result(http::status::bad_request);
+        res.body() = "Invalid userId";
+        return false;
+    }
 
-        if (senderBalance < amount)
+    std::string token;
+    if (req.find(http::field::authorization) == req.end() &&
+        ctx.query.getString("token", token) == QueryParams::Status::ok)
+    {
+        int session;
+        if (!auth::SessionStore::instance().resolve(token, session))
         {
-            std::cerr << "[ERROR] Insufficient funds: trying to send " << amount << ", but only " << senderBalance << " available.\n";
+            res.result(http::status::unauthorized);
+            res.body() = "Invalid or expired session token";
             return false;
         }
-
-        // Verify receiver exists
-        pqxx::result receiverRes = txn.exec_params(
-            "SELECT id FROM users WHERE id = $1", receiverId);
-        if (receiverRes.empty())
+        if (userId != 0 && userId != session)
         {
-            std::cerr << "[ERROR] Receiver does not exist.\n";
+            res.result(http::status::forbidden);
+            res.body() = "Session token belongs to another user";
             return false;
         }
-
-        // Update sender and receiver balances
-        txn.exec_params(
-            "UPDATE users SET balance = balance - $1 WHERE id = $2",
-            amount, senderId);
-        txn.exec_params(
-            "UPDATE users SET balance = balance + $1 WHERE id = $2",
-            amount, receiverId);
-
-        // Record the transaction for both sender and receiver
-        txn.exec_params(
-            "INSERT INTO transactions (user_id, amount, type) VALUES ($1, $2, 'transfer_sent')",
-            senderId, amount);
-        txn.exec_params(
-            "INSERT INTO transactions (user_id, amount, type) VALUES ($1, $2, 'transfer_received')",
-            receiverId, amount);
-
-        txn.commit();
-
-        std::cerr << "[INFO] Transfer of $" << amount << " from User " << senderId << " to User " << receiverId << " complete.\n";
-        return true;
+        userId = session;
     }
-    catch (const std::exception &e)
+    else if (!authorize(ctx, res, userId))
     {
-        std::cerr << "[ERROR] Transfer Exception: " << e.what() << std::endl;
         return false;
     }
-}
\ No newline at end of file
+
+    if (userId == 0)
+    {
+        res.result(http::status::bad_request);
+        res.body() = "Missing userId";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,256 @@
+#include "../../include/routes/router.hpp"
+#include "../../include/metrics.hpp"
+#include <charconv>
+
+// ---- Query string parsing ----
+
+namespace
+{
+
+int hexValue(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decode into a caller-provided buffer; used for short values (numbers, keys)
+// so the typed accessors never allocate.
+bool decodeInto(std::string_view in, char *buf, std::size_t cap, std::string_view &out)
+{
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < in.size(); ++i)
+    {
+        if (n == cap)
+            return false;
+        char c = in[i];
+        if (c == '+')
+        {
+            c = ' ';
+        }
+        else if (c == '%')
+        {
+            if (i + 2 >= in.size())
+                return false;
+            int hi = hexValue(in[i + 1]);
+            int lo = hexValue(in[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            c = static_cast<char>(hi * 16 + lo);
+            i += 2;
+        }
+        buf[n++] = c;
+    }
+    out = std::string_view(buf, n);
+    return true;
+}
+
+} // namespace
+
+bool percentDecode(std::string_view in, std::string &out)
+{
+    out.reserve(out.size() + in.size());
+    for (std::size_t i = 0; i < in.size(); ++i)
+    {
+        char c = in[i];
+        if (c == '+')
+        {
+            c = ' ';
+        }
+        else if (c == '%')
+        {
+            if (i + 2 >= in.size())
+                return false;
+            int hi = hexValue(in[i + 1]);
+            int lo = hexValue(in[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            c = static_cast<char>(hi * 16 + lo);
+            i += 2;
+        }
+        out.push_back(c);
+    }
+    return true;
+}
+
+QueryParams::QueryParams(std::string_view query)
+{
+    while (!query.empty() && count < maxParams)
+    {
+        std::size_t amp = query.find('&');
+        std::string_view part = query.substr(0, amp);
+        query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+        if (part.empty())
+            continue;
+
+        std::size_t eq = part.find('=');
+        if (eq == std::string_view::npos)
+            pairs[count++] = {part, std::string_view()};
+        else
+            pairs[count++] = {part.substr(0, eq), part.substr(eq + 1)};
+    }
+}
+
+const QueryParams::Pair *QueryParams::find(std::string_view key) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string_view k = pairs[i].key;
+        if (k == key)
+            return &pairs[i];
+
+        // Keys are almost never escaped; only decode when they are
+        if (k.find('%') != std::string_view::npos || k.find('+') != std::string_view::npos)
+        {
+            char buf[64];
+            std::string_view decoded;
+            if (decodeInto(k, buf, sizeof(buf), decoded) && decoded == key)
+                return &pairs[i];
+        }
+    }
+    return nullptr;
+}
+
+bool QueryParams::has(std::string_view key) const
+{
+    return find(key) != nullptr;
+}
+
+QueryParams::Status QueryParams::getInt(std::string_view key, int &out) const
+{
+    const Pair *p = find(key);
+    if (!p)
+        return Status::missing;
+
+    char buf[32];
+    std::string_view value;
+    if (!decodeInto(p->value, buf, sizeof(buf), value) || value.empty())
+        return Status::invalid;
+
+    int parsed = 0;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+    if (ec != std::errc() || end != value.data() + value.size())
+        return Status::invalid;
+    out = parsed;
+    return Status::ok;
+}
+
+QueryParams::Status QueryParams::getString(std::string_view key, std::string &out) const
+{
+    const Pair *p = find(key);
+    if (!p)
+        return Status::missing;
+    std::string decoded;
+    if (!percentDecode(p->value, decoded))
+        return Status::invalid;
+    out = std::move(decoded);
+    return Status::ok;
+}
+
+// ---- Router ----
+
+std::uint64_t Router::hash(http::verb method, std::string_view path) const
+{
+    // FNV-1a over the path, seeded, with the method mixed in at the end
+    std::uint64_t h = 14695981039346656037ull ^ seed;
+    for (char c : path)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    h ^= static_cast<std::uint64_t>(method);
+    h *= 1099511628211ull;
+    return h ^ (h >> 29);
+}
+
+void Router::add(http::verb method, std::string path, RouteHandler handler)
+{
+    table.push_back({method, std::move(path), handler, table.size()});
+}
+
+void Router::seal()
+{
+    // Table at least twice the route count, then search for a seed under
+    // which no two routes share a slot: that makes the hash perfect.
+    std::size_t size = 8;
+    while (size < table.size() * 2)
+        size <<= 1;
+
+    for (;;)
+    {
+        mask = size - 1;
+        for (seed = 1; seed < 100000; ++seed)
+        {
+            slots.assign(size, -1);
+            bool collision = false;
+            for (std::size_t i = 0; i < table.size() && !collision; ++i)
+            {
+                std::int16_t &slot = slots[hash(table[i].method, table[i].path) & mask];
+                if (slot != -1)
+                    collision = true;
+                else
+                    slot = static_cast<std::int16_t>(i);
+            }
+            if (!collision)
+                return;
+        }
+        size <<= 1;
+    }
+}
+
+const Router::Route *Router::find(http::verb method, std::string_view path) const
+{
+    if (slots.empty())
+        return nullptr;
+    std::int16_t slot = slots[hash(method, path) & mask];
+    if (slot < 0)
+        return nullptr;
+    const Route &route = table[slot];
+    return (route.method == method && route.path == path) ? &route : nullptr;
+}
+
+bool Router::hasPath(std::string_view path) const
+{
+    for (const Route &route : table)
+    {
+        if (route.path == path)
+            return true;
+    }
+    return false;
+}
+
+const Router::Route *Router::dispatch(const Request &req,
+                                      Response &res,
+                                      ChunkSource &stream,
+                                      Deferrer *deferrer) const
+{
+    std::string_view target(req.target().data(), req.target().size());
+    std::size_t queryStart = target.find('?');
+    std::string_view path = target.substr(0, queryStart);
+    std::string_view query = queryStart == std::string_view::npos ? std::string_view() : target.substr(queryStart + 1);
+
+    const Route *route = find(req.method(), path);
+    metrics::setCurrentRoute(route ? route->id : metrics::unmatchedRoute);
+    if (!route)
+    {
+        if (hasPath(path))
+        {
+            res.result(http::status::method_not_allowed);
+            res.body() = "Method not allowed";
+        }
+        else
+        {
+            res.result(http::status::not_found);
+            res.body() = "Endpoint not found";
+        }
+        return nullptr;
+    }
+
+    RequestContext ctx{req, path, QueryParams(query), deferrer};
+    route->handler(ctx, res, stream);
+    return route;
+}
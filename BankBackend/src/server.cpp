@@ -1,54 +1,1005 @@
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
+#include <boost/beast/websocket.hpp>
 #include <boost/asio/ip/tcp.hpp>
-#include <iostream>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/strand.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <vector>
+#include "../include/admission.hpp"
+#include "../include/arena.hpp"
+#include "../include/async_db.hpp"
+#include "../include/auth.hpp"
+#include "../include/balance_cache.hpp"
+#include "../include/bulk.hpp"
+#include "../include/change_listener.hpp"
+#include "../include/config.hpp"
+#include "../include/db_pool.hpp"
+#include "../include/group_commit.hpp"
+#include "../include/log.hpp"
+#include "../include/memory_storage.hpp"
+#include "../include/metrics.hpp"
+#include "../include/partition_maintainer.hpp"
+#include "../include/push.hpp"
+#include "../include/replicas.hpp"
 #include "../include/routes/handlers.hpp"
+#include "../include/storage.hpp"
+#include "../include/stripe_consolidator.hpp"
+#include "../include/trace.hpp"
 
+namespace beast = boost::beast;
+namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;
 namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
 
-void do_session(tcp::socket socket)
+// A connection's stream. Naming the strand type, rather than Beast's default
+// type-erased executor, saves Asio a heap copy of the executor for every
+// operation started on the connection.
+using Stream = beast::basic_stream<tcp, net::strand<net::io_context::executor_type>>;
+
+// Number of sessions currently open, checked against ServerConfig::maxConnections
+static std::atomic<std::size_t> activeSessions{0};
+
+static const PushConfig &pushConfig()
 {
-    try
+    static const PushConfig cfg = loadPushConfig();
+    return cfg;
+}
+
+// A GET /events subscriber (see push.hpp) once its connection has left the
+// HTTP session. It reads only to answer pings and notice the close; what it
+// sends comes from push::Hub, one message in flight at a time, so a client
+// that reads slowly just gets its events coalesced. An idle subscriber holds
+// little more than the WebSocket stream itself.
+class PushSession : public push::Subscriber, public std::enable_shared_from_this<PushSession>
+{
+public:
+    PushSession(Stream &&stream, int userId)
+        : push::Subscriber(userId), ws_(std::move(stream))
     {
-        boost::beast::flat_buffer buffer;
-        http::request<http::string_body> req;
-        http::read(socket, buffer, req);
+        ++activeSessions;
+    }
 
-        http::response<http::string_body> res;
-        handle_request(req, res);
-        http::write(socket, res);
+    ~PushSession()
+    {
+        if (subscribed_)
+            push::Hub::instance().remove(*this);
+        --activeSessions;
     }
-    catch (const std::exception &e)
+
+    // Subscribe before the handshake response goes out, so a client that
+    // reads its balance once upgraded can't miss a change in between
+    void run(const Request &req)
+    {
+        push::Hub::instance().add(shared_from_this());
+        subscribed_ = true;
+
+        websocket::stream_base::timeout timeouts{};
+        timeouts.handshake_timeout = std::chrono::seconds(30);
+        timeouts.idle_timeout = pushConfig().idleTimeout;
+        timeouts.keep_alive_pings = true;
+        beast::get_lowest_layer(ws_).expires_never(); // the WebSocket keeps its own time
+        ws_.set_option(timeouts);
+        ws_.set_option(websocket::stream_base::decorator([](websocket::response_type &res)
+                                                         { res.set(http::field::server, BOOST_BEAST_VERSION_STRING); }));
+        ws_.read_message_max(readLimit);
+        ws_.async_accept(req, beast::bind_front_handler(&PushSession::onAccept, shared_from_this()));
+    }
+
+private:
+    // Clients have nothing to say; anything larger is a protocol error
+    static constexpr std::size_t readLimit = 1024;
+    // Message buffer capacity kept between writes
+    static constexpr std::size_t frameKeep = 4096;
+
+    websocket::stream<Stream> ws_;
+    beast::flat_buffer buffer_; // stays empty unless the client sends a message
+    std::string frame_;         // message being written
+    bool subscribed_ = false;
+    bool open_ = false;         // handshake done, not yet closed
+    bool writing_ = false;
+
+    // Hub: events are waiting. Called from the publisher's thread.
+    void wake() override
+    {
+        net::post(ws_.get_executor(), beast::bind_front_handler(&PushSession::flush, shared_from_this()));
+    }
+
+    void onAccept(beast::error_code ec)
+    {
+        if (ec)
+        {
+            LOG_DEBUG("push_handshake_failed", {"userId", userId}, {"error", ec.message()});
+            return;
+        }
+        open_ = true;
+        doRead();
+        flush();
+    }
+
+    void doRead()
+    {
+        ws_.async_read(buffer_, beast::bind_front_handler(&PushSession::onRead, shared_from_this()));
+    }
+
+    void onRead(beast::error_code ec, std::size_t)
+    {
+        if (ec)
+        {
+            // Closed by the peer, timed out, or broken: the pending write (if
+            // any) fails too and the session ends
+            open_ = false;
+            return;
+        }
+        buffer_.consume(buffer_.size());
+        doRead();
+    }
+
+    void flush()
+    {
+        if (!open_ || writing_ || !drain(frame_))
+            return;
+        writing_ = true;
+        ws_.text(true);
+        ws_.async_write(net::buffer(frame_), beast::bind_front_handler(&PushSession::onWrite, shared_from_this()));
+    }
+
+    void onWrite(beast::error_code ec, std::size_t)
+    {
+        writing_ = false;
+        if (ec)
+        {
+            open_ = false;
+            return;
+        }
+        if (frame_.capacity() > frameKeep)
+            std::string().swap(frame_); // don't keep a burst's buffer around
+        flush();
+    }
+};
+
+// One keep-alive HTTP connection. Reads are pipelined: while a response is
+// being written the next request is already being parsed, up to
+// ServerConfig::pipelineLimit responses queued per connection. Responses a
+// handler deferred stay queued, in order, until their Responder fires.
+class Session : public std::enable_shared_from_this<Session>, public Deferrer
+{
+public:
+    Session(Stream::socket_type &&socket, const ServerConfig &cfg)
+        : arena_(cfg.arenaBytes, cfg.arenaRetain), stream_(std::move(socket)), cfg_(cfg)
+    {
+        ++activeSessions;
+
+        // Rate-limit key for the peer's address
+        beast::error_code ec;
+        const auto peer = stream_.socket().remote_endpoint(ec).address();
+        if (peer.is_v4())
+            client_ = admission::clientKey(peer.to_v4().to_bytes().data(), 4);
+        else if (peer.is_v6())
+            client_ = admission::clientKey(peer.to_v6().to_bytes().data(), 16);
+    }
+
+    ~Session()
+    {
+        for (Outgoing &out : queue_)
+        {
+            releaseSlot(out);
+            releaseStream(out);
+        }
+        --activeSessions;
+    }
+
+    void run()
+    {
+        // Start on the session's strand so every handler below is serialized
+        net::dispatch(stream_.get_executor(),
+                      beast::bind_front_handler(&Session::doRead, shared_from_this()));
+    }
+
+private:
+    // Bytes read while waiting for the start of a new request
+    static constexpr std::size_t readChunk = 4096;
+
+    // W3C Trace Context header, read from requests and sent back (see trace.hpp)
+    static constexpr const char *traceparentField = "traceparent";
+
+    // A queued response. Streamed ones have their body produced by `stream`
+    // and are sent with chunked transfer encoding.
+    struct Outgoing
+    {
+        explicit Outgoing(MessageAllocator alloc)
+            : res(std::piecewise_construct, std::make_tuple(alloc), std::make_tuple(alloc))
+        {
+        }
+
+        Response res;
+        ChunkSource stream;
+        std::size_t route = metrics::unmatchedRoute;
+        metrics::Clock::time_point started; // first byte of the request
+        std::uint64_t id = 0;               // per-connection sequence, for deferred completion
+        bool pending = false;               // deferred or queued for admission, not yet filled in
+        bool holdsSlot = false;             // admitted; the slot goes back once the response is ready
+        bool keepsSlot = false;             // a stream holding it until its last piece (Deferrer::keepSlot)
+        bool holdsStream = false;           // a stream slot (admission.hpp), until the last chunk is sent
+        std::uint64_t allocations = 0;      // heap allocations made for it on this strand (arena::Tally)
+        trace::Context trace;               // made current wherever it is worked on
+        std::optional<Request> parked; // waiting for an admission slot
+    };
+
+    // Headers and bodies of the requests and responses below (see arena.hpp).
+    // Declared first so it outlives everything allocated from it.
+    arena::Arena arena_;
+    Stream stream_;
+    const ServerConfig &cfg_;
+    beast::flat_buffer buffer_; // reused for the lifetime of the connection
+    std::optional<http::request_parser<Body, MessageAllocator>> parser_;
+    std::deque<Outgoing> queue_; // responses waiting to be written, in request order
+    std::optional<http::response<http::empty_body, Fields>> streamHeader_;
+    std::optional<http::response_serializer<http::empty_body, Fields>> streamSerializer_;
+    std::string chunkBody_; // filled by the ChunkSource
+    std::string chunk_;     // chunkBody_ framed for the wire
+    bool streamDone_ = false;
+    metrics::Clock::time_point readStart_;
+    metrics::Clock::time_point writeStart_;
+    bool reading_ = false;
+    bool writing_ = false;
+    bool closing_ = false;
+    std::uint64_t nextId_ = 0;
+    std::uint64_t running_ = 0; // id of the request in handle_request
+    bool deferred_ = false;     // set by defer() during handle_request
+    bool slotKept_ = false;     // set by keepSlot() during handle_request
+    bool chunkDeferred_ = false; // set by deferChunk() during a ChunkSource call
+    std::uint64_t client_ = 0;  // admission::clientKey of the peer
+    std::uint64_t readAllocations_ = 0; // made parsing the request being read
+
+    // Deferrer: the response being built by handle_request gets filled in later
+    Responder defer() override
+    {
+        deferred_ = true;
+        auto self = shared_from_this();
+        const std::uint64_t id = running_;
+        return [self, id](ResponseFiller fill)
+        {
+            net::post(self->stream_.get_executor(),
+                      [self, id, fill = std::move(fill)]
+                      { self->onDeferred(id, fill); });
+        };
+    }
+
+    void keepSlot() override
+    {
+        slotKept_ = true;
+    }
+
+    // Deferrer: the stream being sent makes its next piece later
+    Resumer deferChunk() override
+    {
+        chunkDeferred_ = true;
+        auto self = shared_from_this();
+        return [self]
+        {
+            net::post(self->stream_.get_executor(), [self]
+                      { self->nextChunk(); });
+        };
+    }
+
+    void onDeferred(std::uint64_t id, const ResponseFiller &fill)
+    {
+        auto it = std::find_if(queue_.begin(), queue_.end(), [id](const Outgoing &out)
+                               { return out.id == id; });
+        if (it == queue_.end() || !it->pending)
+            return; // the handler failed after deferring, and already answered
+
+        arena::Tally tally(it->allocations);
+        trace::Scope traced(it->trace);
+        metrics::setCurrentRoute(it->route);
+        fill(it->res);
+        if (it->stream && it->res.result() != http::status::ok)
+            it->stream = nullptr; // answered with an error instead
+        if (!it->stream)
+            it->res.prepare_payload();
+        it->pending = false;
+        settle(*it);
+        if (!writing_)
+            doWrite();
+    }
+
+    // Run the handler for an admitted request
+    void runHandler(Outgoing &out, const Request &req)
+    {
+        running_ = out.id;
+        deferred_ = false;
+        slotKept_ = false;
+        try
+        {
+            handle_request(req, out.res, out.stream, this);
+            out.pending = deferred_;
+            out.keepsSlot = slotKept_;
+        }
+        catch (const std::exception &e)
+        {
+            LOG_ERROR("handler_error", {"target", std::string(req.target())}, {"error", e.what()});
+            out.res.result(http::status::internal_server_error);
+            out.res.body() = "Internal server error";
+            out.res.prepare_payload();
+            out.stream = nullptr;
+            out.pending = false;
+        }
+        out.route = metrics::currentRoute();
+
+        // Deferred responses hold their slot until filled in
+        if (!out.pending)
+            settle(out);
+    }
+
+    // A response is filled in. A stream takes a stream slot, held until the
+    // last chunk is sent, and one still reading from storage keeps its
+    // request slot until its last piece is made; anything else gives the
+    // request slot back now.
+    void settle(Outgoing &out)
+    {
+        if (out.stream && out.holdsSlot)
+        {
+            if (admission::Controller::instance().enterStream())
+            {
+                out.holdsStream = true;
+            }
+            else
+            {
+                out.stream = nullptr;
+                out.res.erase(http::field::content_type);
+                out.res.erase(http::field::content_disposition);
+                reject(out.res, http::status::service_unavailable, std::chrono::seconds(1));
+            }
+        }
+        if (!out.stream || !out.keepsSlot)
+            releaseSlot(out);
+    }
+
+    // Admission's answer for a queued request (see admission.hpp)
+    void onAdmission(std::uint64_t id, bool admitted)
+    {
+        auto it = std::find_if(queue_.begin(), queue_.end(), [id](const Outgoing &out)
+                               { return out.id == id; });
+        if (it == queue_.end() || !it->parked)
+        {
+            if (admitted)
+                admission::Controller::instance().leave();
+            return;
+        }
+
+        arena::Tally tally(it->allocations);
+        trace::Scope traced(it->trace);
+        Request req = std::move(*it->parked);
+        it->parked.reset();
+        it->pending = false;
+        metrics::setCurrentRoute(metrics::unmatchedRoute);
+        if (admitted)
+        {
+            it->holdsSlot = true;
+            runHandler(*it, req);
+        }
+        else
+        {
+            reject(it->res, http::status::service_unavailable, std::chrono::seconds(1));
+        }
+        if (!writing_)
+            doWrite();
+    }
+
+    // Admission control before any handler work
+    void admit(Outgoing &out, Request &&req)
+    {
+        admission::Controller &admission = admission::Controller::instance();
+        std::chrono::seconds retryAfter{1};
+        admission::Outcome outcome = admission.enter(client_, req, retryAfter);
+        if (outcome == admission::Outcome::wait)
+        {
+            auto self = shared_from_this();
+            const std::uint64_t id = out.id;
+            outcome = admission.wait([self, id](bool admitted)
+                                     { net::post(self->stream_.get_executor(), [self, id, admitted]
+                                                 { self->onAdmission(id, admitted); }); },
+                                     retryAfter);
+        }
+        switch (outcome)
+        {
+        case admission::Outcome::admitted:
+            out.holdsSlot = true;
+            runHandler(out, req);
+            break;
+        case admission::Outcome::queued:
+            out.pending = true;
+            out.parked.emplace(std::move(req));
+            break;
+        case admission::Outcome::overloaded:
+            reject(out.res, http::status::service_unavailable, retryAfter);
+            break;
+        case admission::Outcome::rateLimited:
+            reject(out.res, http::status::too_many_requests, retryAfter);
+            break;
+        default:
+            runHandler(out, req);
+            break;
+        }
+    }
+
+    static bool eventsTarget(beast::string_view target)
+    {
+        return target.substr(0, target.find('?')) == "/events";
+    }
+
+    // Hand the connection to a PushSession once the handshake is authorized.
+    // The socket leaves this session for good, so only when no earlier
+    // response is still queued; otherwise `res` gets the refusal.
+    bool upgrade(const Request &req, Response &res)
+    {
+        int userId = 0;
+        if (!queue_.empty())
+        {
+            res.result(http::status::bad_request);
+            res.body() = "Upgrade must not be pipelined behind other requests";
+        }
+        else if (authorizeSubscription(req, res, userId))
+        {
+            closing_ = true;
+            stream_.expires_never();
+            std::make_shared<PushSession>(std::move(stream_), userId)->run(req);
+            return true;
+        }
+        res.prepare_payload();
+        return false;
+    }
+
+    void releaseStream(Outgoing &out)
     {
-        std::cerr << "Session error: " << e.what() << std::endl;
+        if (!out.holdsStream)
+            return;
+        out.holdsStream = false;
+        admission::Controller::instance().leaveStream();
+    }
+
+    void releaseSlot(Outgoing &out)
+    {
+        if (!out.holdsSlot)
+            return;
+        out.holdsSlot = false;
+        admission::Controller::instance().leave();
+    }
+
+    // Fill a 429/503 for a request admission turned away
+    static void reject(Response &res, http::status status, std::chrono::seconds retryAfter)
+    {
+        res.result(status);
+        res.set(http::field::retry_after, std::to_string(retryAfter.count()));
+        res.body() = status == http::status::too_many_requests ? "Too many requests" : "Server busy, try again";
+        res.prepare_payload();
+    }
+
+    void doRead()
+    {
+        if (closing_ || reading_ || queue_.size() >= cfg_.pipelineLimit)
+            return;
+
+        // The parser is re-emplaced in place rather than reallocated; Beast
+        // parsers can't be reset once they've completed a message. With no
+        // response queued, nothing of the earlier requests is left in the
+        // arena and the next one starts over at its beginning.
+        parser_.reset();
+        if (queue_.empty())
+            arena_.rewind();
+        const MessageAllocator alloc(&arena_);
+        parser_.emplace(std::piecewise_construct, std::make_tuple(alloc), std::make_tuple(alloc));
+        parser_->body_limit(cfg_.bodyLimit);
+
+        reading_ = true;
+        stream_.expires_after(cfg_.idleTimeout);
+
+        // The read phase is timed from the first byte of the request, not
+        // from when the connection started waiting for it. A pipelined
+        // request is already buffered; otherwise wait for some bytes first.
+        if (buffer_.size() > 0)
+            return readMessage();
+        stream_.async_read_some(buffer_.prepare(readChunk),
+                                beast::bind_front_handler(&Session::onFirstBytes, shared_from_this()));
+    }
+
+    void onFirstBytes(beast::error_code ec, std::size_t bytes)
+    {
+        if (ec)
+            return onRead(ec, 0);
+        buffer_.commit(bytes);
+        readMessage();
+    }
+
+    void readMessage()
+    {
+        // A request already in the buffer is parsed right here
+        arena::Tally tally(readAllocations_);
+        readStart_ = metrics::Clock::now();
+        http::async_read(stream_, buffer_, *parser_,
+                         beast::bind_front_handler(&Session::onRead, shared_from_this()));
+    }
+
+    void onRead(beast::error_code ec, std::size_t)
+    {
+        reading_ = false;
+
+        if (ec == http::error::end_of_stream || ec == net::error::eof || ec == beast::error::timeout)
+            return finish();
+        if (ec)
+        {
+            if (ec != net::error::operation_aborted)
+                LOG_WARN("session_read_error", {"error", ec.message()});
+            return finish();
+        }
+
+        const auto readDone = metrics::Clock::now();
+        Request req = parser_->release();
+
+        Outgoing out(&arena_);
+        out.allocations = std::exchange(readAllocations_, 0);
+        std::optional<arena::Tally> tally(std::in_place, out.allocations);
+        out.started = readStart_;
+        out.id = nextId_++;
+        Response &res = out.res;
+        res.version(req.version());
+        res.keep_alive(req.keep_alive());
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        metrics::setCurrentRoute(metrics::unmatchedRoute);
+
+        // Sampling is decided here, once the headers are in
+        if (trace::enabled())
+        {
+            const beast::string_view parent = req[traceparentField];
+            out.trace = trace::begin({parent.data(), parent.size()});
+            if (out.trace.propagated || out.trace.sampled)
+                res.set(traceparentField, trace::header(out.trace));
+            trace::record(out.trace, "read", readStart_, readDone);
+        }
+        std::optional<trace::Scope> traced(std::in_place, out.trace);
+
+        // A WebSocket handshake for push events takes the connection over
+        if (websocket::is_upgrade(req) && eventsTarget(req.target()))
+        {
+            if (upgrade(req, res))
+                return;
+        }
+        else
+        {
+            admit(out, std::move(req));
+        }
+        metrics::record(out.route, metrics::Phase::read, metrics::nanosBetween(readStart_, readDone));
+
+        if (!res.keep_alive())
+            closing_ = true;
+
+        traced.reset();
+        tally.reset();
+        queue_.push_back(std::move(out));
+        if (!writing_)
+            doWrite();
+        doRead();
+    }
+
+    void doWrite()
+    {
+        if (queue_.empty() || queue_.front().pending)
+            return; // resumed by onDeferred / onAdmission
+        writing_ = true;
+        writeStart_ = metrics::Clock::now();
+        stream_.expires_after(cfg_.idleTimeout);
+        Outgoing &out = queue_.front();
+        arena::Tally tally(out.allocations);
+        if (!out.stream)
+        {
+            http::async_write(stream_, out.res,
+                              beast::bind_front_handler(&Session::onWrite, shared_from_this()));
+            return;
+        }
+
+        // Streamed body: send the header now, then one chunk at a time
+        streamHeader_.emplace(out.res.base());
+        streamHeader_->erase(http::field::content_length);
+        streamHeader_->chunked(true);
+        streamSerializer_.emplace(*streamHeader_);
+        streamDone_ = false;
+        http::async_write_header(stream_, *streamSerializer_,
+                                 beast::bind_front_handler(&Session::onChunk, shared_from_this()));
+    }
+
+    void onChunk(beast::error_code ec, std::size_t)
+    {
+        if (ec || streamDone_)
+            return onWrite(ec, 0);
+        nextChunk();
+    }
+
+    // Fill the next chunk from the stream and send it. A piece the stream
+    // defers (deferChunk) ends this call; its Resumer calls back in here.
+    void nextChunk()
+    {
+        bool more = false;
+        chunk_.clear();
+        arena::Tally tally(queue_.front().allocations);
+        trace::Scope traced(queue_.front().trace);
+        metrics::setCurrentRoute(queue_.front().route);
+        do
+        {
+            chunkBody_.clear();
+            chunkDeferred_ = false;
+            try
+            {
+                more = queue_.front().stream(chunkBody_);
+            }
+            catch (const std::exception &e)
+            {
+                // The status line is already out; all we can do is drop the connection
+                LOG_ERROR("stream_error", {"error", e.what()});
+                return shutdown();
+            }
+            if (chunkDeferred_)
+                return;
+        } while (more && chunkBody_.empty());
+
+        if (!chunkBody_.empty())
+        {
+            char size[20];
+            int n = std::snprintf(size, sizeof(size), "%zx\r\n", chunkBody_.size());
+            chunk_.append(size, n).append(chunkBody_).append("\r\n");
+        }
+        if (!more)
+        {
+            chunk_.append("0\r\n\r\n");
+            streamDone_ = true;
+            releaseSlot(queue_.front()); // no more storage work for it
+        }
+
+        stream_.expires_after(cfg_.idleTimeout);
+        net::async_write(stream_, net::buffer(chunk_),
+                         beast::bind_front_handler(&Session::onChunk, shared_from_this()));
+    }
+
+    void onWrite(beast::error_code ec, std::size_t)
+    {
+        writing_ = false;
+        if (ec)
+        {
+            LOG_WARN("session_write_error", {"error", ec.message()});
+            return shutdown();
+        }
+
+        const Outgoing &done = queue_.front();
+        const auto now = metrics::Clock::now();
+        metrics::record(done.route, metrics::Phase::write, metrics::nanosBetween(writeStart_, now));
+        metrics::record(done.route, metrics::Phase::total, metrics::nanosBetween(done.started, now));
+        metrics::countStatus(done.res.result_int());
+        metrics::countAllocations(done.route, done.allocations);
+        trace::record(done.trace, "write", writeStart_, now);
+        trace::finish(done.trace, metrics::routeName(done.route), done.started, now);
+
+        bool close = streamHeader_ ? streamHeader_->need_eof() : done.res.need_eof();
+        releaseSlot(queue_.front());
+        releaseStream(queue_.front());
+        queue_.pop_front();
+        streamSerializer_.reset();
+        streamHeader_.reset();
+        if (close)
+            return shutdown();
+
+        if (!queue_.empty())
+            doWrite();
+        else if (closing_)
+            return shutdown();
+        doRead();
+    }
+
+    // Called when the peer stops sending: flush whatever is still queued first
+    void finish()
+    {
+        closing_ = true;
+        if (!writing_ && queue_.empty())
+            shutdown();
+    }
+
+    void shutdown()
+    {
+        beast::error_code ec;
+        stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
+        stream_.close();
+    }
+};
+
+// Accepts connections asynchronously and hands each one to its own strand
+class Listener : public std::enable_shared_from_this<Listener>
+{
+public:
+    Listener(net::io_context &ioc, const ServerConfig &cfg)
+        : ioc_(ioc), acceptor_(net::make_strand(ioc)), cfg_(cfg)
+    {
+        tcp::endpoint endpoint{tcp::v4(), cfg.port};
+        acceptor_.open(endpoint.protocol());
+        acceptor_.set_option(net::socket_base::reuse_address(true));
+        acceptor_.bind(endpoint);
+        acceptor_.listen(net::socket_base::max_listen_connections);
+    }
+
+    void run()
+    {
+        doAccept();
+    }
+
+private:
+    net::io_context &ioc_;
+    tcp::acceptor acceptor_;
+    const ServerConfig &cfg_;
+
+    void doAccept()
+    {
+        acceptor_.async_accept(net::make_strand(ioc_),
+                               beast::bind_front_handler(&Listener::onAccept, shared_from_this()));
+    }
+
+    void onAccept(beast::error_code ec, Stream::socket_type socket)
+    {
+        if (ec)
+        {
+            LOG_WARN("accept_error", {"error", ec.message()});
+        }
+        else if (activeSessions.load(std::memory_order_relaxed) >= cfg_.maxConnections)
+        {
+            // Over the connection cap: refuse instead of queueing unbounded work
+            beast::error_code ignored;
+            socket.close(ignored);
+        }
+        else
+        {
+            socket.set_option(tcp::no_delay(true), ec);
+            std::make_shared<Session>(std::move(socket), cfg_)->run();
+        }
+        doAccept();
+    }
+};
+
+// Open the database pool before accepting traffic so a bad connection
+// string fails at startup rather than on the first request. The nonblocking
+// connections for the hot path open on `ioc` once it runs.
+static void startPostgres(net::io_context &ioc)
+{
+    const DbConfig dbCfg = loadDbConfig();
+    ConnectionPool::instance().init(dbCfg);
+    ReplicaRouter::instance().start(dbCfg);
+    GroupCommitter::instance().start(loadGroupCommitConfig());
+    AsyncDB::instance().start(ioc, dbCfg);
+    StripeConsolidator::instance().start(loadHotAccountConfig());
+    PartitionMaintainer::instance().start(loadLedgerConfig());
+
+    // Balance cache, kept coherent with other server instances through
+    // the balance_changed NOTIFY channel
+    ChangeListener &listener = ChangeListener::instance();
+    BalanceCache::instance().configure(dbCfg.balanceCacheCapacity);
+    if (BalanceCache::instance().enabled())
+    {
+        listener.subscribe("balance_changed", [](const std::string &payload)
+                           { BalanceCache::instance().applyNotification(payload); });
+        listener.onReconnect([]
+                             { BalanceCache::instance().clear(); });
+    }
+
+    // Push subscribers hear about changes made through any instance. Hot
+    // accounts' notifications carry no balance, so it is read back.
+    push::Hub::instance().setBalanceReader([](int userId, std::function<void(std::optional<double>)> done)
+                                           { AsyncDB::instance().readBalance(userId, std::move(done)); });
+    listener.subscribe("balance_changed", [](const std::string &payload)
+                       { push::Hub::instance().applyBalanceNotification(payload); });
+    listener.subscribe("transaction_posted", [](const std::string &payload)
+                       { push::Hub::instance().applyTransactionNotification(payload); });
+    listener.onReconnect([]
+                         { push::Hub::instance().resyncAll(); });
+    listener.start(dbCfg.connectionString);
+}
+
+// Values owned by other components, sampled on each /metrics scrape
+static void registerGauges()
+{
+    if (auto *memory = dynamic_cast<MemoryStorage *>(&storage()))
+    {
+        metrics::registerGauge("bank_memory_accounts", "Accounts held by the in-memory engine.", "gauge", [memory]
+                               { return static_cast<double>(memory->stats().accounts); });
+        metrics::registerGauge("bank_memory_transactions_total", "Ledger entries written by the in-memory engine.", "counter", [memory]
+                               { return static_cast<double>(memory->stats().transactions); });
+        if (memory->durable())
+        {
+            metrics::registerGauge("bank_wal_records_total", "Records appended to the write-ahead log.", "counter", [memory]
+                                   { return static_cast<double>(memory->walStats().records); });
+            metrics::registerGauge("bank_wal_syncs_total", "WAL fsyncs; records per sync is the group-commit batch size.", "counter", [memory]
+                                   { return static_cast<double>(memory->walStats().syncs); });
+            metrics::registerGauge("bank_wal_bytes_total", "Bytes written to the write-ahead log.", "counter", [memory]
+                                   { return static_cast<double>(memory->walStats().bytes); });
+        }
+    }
+
+    metrics::registerGauge("bank_sessions_active", "Open client connections.", "gauge", []
+                           { return static_cast<double>(activeSessions.load(std::memory_order_relaxed)); });
+    metrics::registerGauge("bank_push_subscribers", "Open /events subscriptions.", "gauge", []
+                           { return static_cast<double>(push::Hub::instance().stats().subscribers); });
+    metrics::registerGauge("bank_push_events_total", "Events queued to /events subscribers.", "counter", []
+                           { return static_cast<double>(push::Hub::instance().stats().events); });
+    metrics::registerGauge("bank_push_coalesced_total", "Balance events replaced by a newer one before a slow subscriber read them.", "counter", []
+                           { return static_cast<double>(push::Hub::instance().stats().coalesced); });
+    metrics::registerGauge("bank_push_resyncs_total", "Resync markers sent because a subscriber's queue overflowed or notifications were lost.", "counter", []
+                           { return static_cast<double>(push::Hub::instance().stats().resyncs); });
+    metrics::registerGauge("bank_db_pool_connections", "Open database connections.", "gauge", []
+                           { return static_cast<double>(ConnectionPool::instance().stats().total); });
+    metrics::registerGauge("bank_db_pool_idle", "Idle pooled connections.", "gauge", []
+                           { return static_cast<double>(ConnectionPool::instance().stats().idle); });
+    metrics::registerGauge("bank_db_pool_waiting", "Requests waiting for a connection.", "gauge", []
+                           { return static_cast<double>(ConnectionPool::instance().stats().waiting); });
+    metrics::registerGauge("bank_db_async_connections", "Nonblocking database connections open and prepared.", "gauge", []
+                           { return static_cast<double>(AsyncDB::instance().stats().connections); });
+    metrics::registerGauge("bank_db_async_queued", "Queries waiting for a nonblocking connection.", "gauge", []
+                           { return static_cast<double>(AsyncDB::instance().stats().queued); });
+    metrics::registerGauge("bank_db_replicas_usable", "Read replicas within the lag bound.", "gauge", []
+                           { return static_cast<double>(ReplicaRouter::instance().stats().usable); });
+    metrics::registerGauge("bank_db_replica_lag_max_seconds", "Replay lag of the furthest-behind reachable replica.", "gauge", []
+                           { return ReplicaRouter::instance().stats().maxLagSeconds; });
+    metrics::registerGauge("bank_db_replica_reads_total", "Reads served by a replica.", "counter", []
+                           { return static_cast<double>(ReplicaRouter::instance().stats().replicaReads); });
+    metrics::registerGauge("bank_db_replica_sticky_reads_total", "Reads sent to the primary because the account was just written.", "counter", []
+                           { return static_cast<double>(ReplicaRouter::instance().stats().stickyReads); });
+    metrics::registerGauge("bank_db_replica_fallback_reads_total", "Reads sent to the primary because no replica was usable or it failed.", "counter", []
+                           { return static_cast<double>(ReplicaRouter::instance().stats().fallbackReads); });
+    metrics::registerGauge("bank_balance_cache_hits_total", "Balance cache hits.", "counter", []
+                           { return static_cast<double>(BalanceCache::instance().stats().hits); });
+    metrics::registerGauge("bank_balance_cache_misses_total", "Balance cache misses.", "counter", []
+                           { return static_cast<double>(BalanceCache::instance().stats().misses); });
+    metrics::registerGauge("bank_balance_cache_evictions_total", "Balance cache evictions.", "counter", []
+                           { return static_cast<double>(BalanceCache::instance().stats().evictions); });
+    metrics::registerGauge("bank_balance_cache_entries", "Balances currently cached.", "gauge", []
+                           { return static_cast<double>(BalanceCache::instance().stats().size); });
+    metrics::registerGauge("bank_group_commit_batches_total", "Group-commit batches committed.", "counter", []
+                           { return static_cast<double>(GroupCommitter::instance().stats().batches); });
+    metrics::registerGauge("bank_group_commit_operations_total", "Operations committed through group commit.", "counter", []
+                           { return static_cast<double>(GroupCommitter::instance().stats().operations); });
+    metrics::registerHistogram("bank_group_commit_batch_size", "Operations per group-commit batch.", []
+                               {
+                                   // Bucket i holds batches of 2^i to 2^(i+1)-1 operations, the last one the rest
+                                   const GroupCommitter::Stats stats = GroupCommitter::instance().stats();
+                                   metrics::HistogramSample sample;
+                                   std::uint64_t below = 0;
+                                   for (std::size_t i = 0; i + 1 < GroupCommitter::histogramBuckets; ++i)
+                                   {
+                                       below += stats.batchSizes[i];
+                                       sample.buckets.emplace_back(static_cast<double>((std::size_t{2} << i) - 1), below);
+                                   }
+                                   // The counters are read one by one, so count the buckets rather than
+                                   // trust stats.batches to agree with them
+                                   sample.count = below + stats.batchSizes[GroupCommitter::histogramBuckets - 1];
+                                   sample.sum = static_cast<double>(stats.operations);
+                                   return sample;
+                               });
+    metrics::registerGauge("bank_stripe_folds_total", "Hot accounts whose stripes were folded back into the main balance.", "counter", []
+                           { return static_cast<double>(StripeConsolidator::instance().stats().folds); });
+    metrics::registerGauge("bank_stripe_fold_errors_total", "Stripe consolidation passes cut short by a database error.", "counter", []
+                           { return static_cast<double>(StripeConsolidator::instance().stats().errors); });
+    metrics::registerGauge("bank_ledger_partitions_created_total", "Monthly transactions partitions created.", "counter", []
+                           { return static_cast<double>(PartitionMaintainer::instance().stats().created); });
+    metrics::registerGauge("bank_ledger_partitions_archived_total", "Transactions partitions detached into the archive schema.", "counter", []
+                           { return static_cast<double>(PartitionMaintainer::instance().stats().archived); });
+    metrics::registerGauge("bank_ledger_maintenance_errors_total", "Partition maintenance passes cut short by a database error.", "counter", []
+                           { return static_cast<double>(PartitionMaintainer::instance().stats().errors); });
+    metrics::registerGauge("bank_auth_sessions", "Live login sessions, including expired ones not yet swept.", "gauge", []
+                           { return static_cast<double>(auth::SessionStore::instance().size()); });
+    metrics::registerGauge("bank_auth_queue", "Password hashes waiting for a worker.", "gauge", []
+                           { return static_cast<double>(auth::PasswordWorkers::instance().stats().queued); });
+    metrics::registerGauge("bank_auth_rejected_total", "Logins and registrations refused with 503 because the hash queue was full.", "counter", []
+                           { return static_cast<double>(auth::PasswordWorkers::instance().stats().rejected); });
+    metrics::registerGauge("bank_admission_in_flight", "Requests holding an admission slot.", "gauge", []
+                           { return static_cast<double>(admission::Controller::instance().stats().inFlight); });
+    metrics::registerGauge("bank_admission_queued", "Requests waiting for an admission slot.", "gauge", []
+                           { return static_cast<double>(admission::Controller::instance().stats().queued); });
+    metrics::registerGauge("bank_admission_streams", "Streamed responses being sent.", "gauge", []
+                           { return static_cast<double>(admission::Controller::instance().stats().streams); });
+    metrics::registerGauge("bank_admission_shed_overload_total", "Requests refused with 503 because the admission queue was full.", "counter", []
+                           { return static_cast<double>(admission::Controller::instance().stats().shedOverload); });
+    metrics::registerGauge("bank_admission_shed_deadline_total", "Requests refused with 503 after waiting past the admission deadline.", "counter", []
+                           { return static_cast<double>(admission::Controller::instance().stats().shedDeadline); });
+    metrics::registerGauge("bank_admission_shed_streams_total", "Streamed responses refused with 503 at the stream limit.", "counter", []
+                           { return static_cast<double>(admission::Controller::instance().stats().shedStreams); });
+    metrics::registerGauge("bank_rate_limited_client_total", "Requests refused with 429 by the per-client rate limit.", "counter", []
+                           { return static_cast<double>(admission::Controller::instance().stats().limitedClient); });
+    metrics::registerGauge("bank_rate_limited_account_total", "Requests refused with 429 by the per-account rate limit.", "counter", []
+                           { return static_cast<double>(admission::Controller::instance().stats().limitedAccount); });
+    metrics::registerGauge("bank_log_dropped_total", "Log lines dropped because a buffer was full.", "counter", []
+                           { return static_cast<double>(logging::dropped()); });
+    if (trace::enabled())
+    {
+        metrics::registerGauge("bank_trace_sampled_total", "Requests traced.", "counter", []
+                               { return static_cast<double>(trace::stats().sampled); });
+        metrics::registerGauge("bank_trace_spans_total", "Trace spans written to the trace file.", "counter", []
+                               { return static_cast<double>(trace::stats().spans); });
+        metrics::registerGauge("bank_trace_spans_dropped_total", "Trace spans dropped because a thread's buffer was full.", "counter", []
+                               { return static_cast<double>(trace::stats().dropped); });
     }
 }
 
 int main()
 {
+    logging::configure(loadLogConfig());
     try
     {
-        std::cerr << "MAIN() REACHED \n";
-        boost::asio::io_context ioc{1};
-        tcp::acceptor acceptor{ioc, {tcp::v4(), 8080}};
+        const ServerConfig cfg = loadServerConfig();
 
-        std::cout << "Server running on http://localhost:8080\n";
+        net::io_context ioc{static_cast<int>(cfg.threads)};
 
-        for (;;)
-        {
-            tcp::socket socket{ioc};
-            acceptor.accept(socket);
-            std::thread([sock = std::move(socket)]() mutable
-                        { do_session(std::move(sock)); })
-                .detach();
-        }
+        push::Hub::instance().configure(pushConfig());
+        trace::start(loadTraceConfig());
+
+        const StorageConfig storageCfg = loadStorageConfig();
+        initStorage(storageCfg);
+        if (storageCfg.backend == "postgres")
+            startPostgres(ioc);
+        registerGauges();
+
+        // Admission: by default one request in the handlers per pooled connection
+        AdmissionConfig admissionCfg = loadAdmissionConfig();
+        if (admissionCfg.maxInFlight == 0 && storageCfg.backend == "postgres")
+            admissionCfg.maxInFlight = loadDbConfig().poolMax;
+        admission::Controller::instance().start(admissionCfg);
+
+        // Sessions and the password-hashing pool, ready before the first login
+        const AuthConfig authCfg = loadAuthConfig();
+        auth::SessionStore::instance().configure(authCfg);
+        auth::PasswordWorkers::instance().start(authCfg.hashThreads, authCfg.hashQueue);
+
+        std::make_shared<Listener>(ioc, cfg)->run();
+
+        // Stop cleanly on SIGINT/SIGTERM
+        net::signal_set signals(ioc, SIGINT, SIGTERM);
+        signals.async_wait([&ioc](const beast::error_code &, int)
+                           { ioc.stop(); });
+
+        LOG_INFO("server_started", {"port", cfg.port}, {"threads", cfg.threads});
+
+        std::vector<std::thread> workers;
+        workers.reserve(cfg.threads - 1);
+        for (unsigned i = 1; i < cfg.threads; ++i)
+            workers.emplace_back([&ioc]
+                                 { ioc.run(); });
+        ioc.run();
+
+        for (auto &t : workers)
+            t.join();
+        AsyncDB::instance().stop();
+
+        // Flush any batch still waiting to commit
+        GroupCommitter::instance().stop();
+        StripeConsolidator::instance().stop();
+        PartitionMaintainer::instance().stop();
+        auth::PasswordWorkers::instance().stop();
+        admission::Controller::instance().stop();
+        bulk::ImportJobs::instance().stop();
+        ChangeListener::instance().stop();
+        ReplicaRouter::instance().stop();
+        storage().close();
+        trace::stop();
     }
     catch (const std::exception &e)
     {
-        std::cerr << "Server error: " << e.what() << std::endl;
+        LOG_ERROR("server_error", {"error", e.what()});
+        logging::shutdown();
         return EXIT_FAILURE;
     }
+    logging::shutdown();
 }
@@ -0,0 +1,142 @@
+#include "../include/statements.hpp"
+#include <iterator>
+#include <string>
+
+namespace stmt {
+
+static const Definition catalogue[] = {
+    {createUser, "INSERT INTO users (name, balance) VALUES ($1, $2)"},
+    {registerUser, "INSERT INTO users (name, password, balance) VALUES ($1, $2, $3)"},
+    // Passwords are checked in the server (they are salted hashes), so login
+    // only fetches the candidates; users_name_idx keeps this an index lookup
+    {credentials, "SELECT id, password FROM users WHERE name = $1 AND password IS NOT NULL ORDER BY id"},
+    {setPassword, "UPDATE users SET password = $2 WHERE id = $1"},
+    // Hot accounts keep part of their balance in balance_stripes (see
+    // schema.sql); one snapshot sees both parts, so the sum is exact
+    {getBalance,
+     "SELECT u.balance + COALESCE((SELECT sum(s.balance) FROM balance_stripes s WHERE s.user_id = u.id), 0) AS balance"
+     "  FROM users u WHERE u.id = $1"},
+
+    // Money movements: each is a single statement that updates balances and
+    // writes the ledger rows together, returning (id, balance) for every
+    // account it changed so the balance cache can be updated. An empty result
+    // means nothing changed (missing account or insufficient funds). The
+    // balance is NULL for a hot account, whose total this statement can't
+    // know while other credits land on its other stripes.
+    //
+    // Credits to a hot account update one of its stripe rows, never the users
+    // row, which only takes the key-share lock of the ledger row's foreign
+    // key. Debits update users.balance, and only when that is short call
+    // debit_from_stripes() (schema.sql), which folds the stripes in and tries
+    // again. Its statements see the rows as they are by then; a second
+    // UPDATE of a row in this statement would work from the statement's
+    // older snapshot and re-lock the row behind waiters queued on it.
+    {deposit,
+     "WITH account AS ("
+     "  SELECT id, CASE WHEN stripes > 0 THEN credit_stripe(stripes) END AS stripe"
+     "    FROM users WHERE id = $1::int"
+     "), credited AS ("
+     "  UPDATE users u SET balance = u.balance + $2::numeric FROM account a"
+     "   WHERE u.id = a.id AND a.stripe IS NULL"
+     "  RETURNING u.id, u.balance"
+     "), striped AS ("
+     "  UPDATE balance_stripes s SET balance = s.balance + $2::numeric FROM account a"
+     "   WHERE s.user_id = a.id AND s.stripe = a.stripe"
+     "  RETURNING s.user_id AS id, NULL::numeric AS balance"
+     "), changed AS ("
+     "  SELECT id, balance FROM credited UNION ALL SELECT id, balance FROM striped"
+     "), ledger AS ("
+     "  INSERT INTO transactions (user_id, amount, type) SELECT id, $2, 'deposit' FROM changed"
+     ") "
+     "SELECT id, balance FROM changed"},
+    {withdraw,
+     "WITH direct AS ("
+     "  UPDATE users SET balance = balance - $2::numeric"
+     "   WHERE id = $1::int AND balance >= $2"
+     "  RETURNING id, balance, stripes"
+     "), borrowed AS ("
+     "  SELECT d.id, d.balance, d.stripes FROM debit_from_stripes($1, $2) d"
+     "   WHERE NOT EXISTS (SELECT 1 FROM direct)"
+     "), debited AS ("
+     "  SELECT id, balance, stripes FROM direct UNION ALL SELECT id, balance, stripes FROM borrowed"
+     "), ledger AS ("
+     "  INSERT INTO transactions (user_id, amount, type) SELECT id, $2, 'withdrawal' FROM debited"
+     ") "
+     "SELECT id, CASE WHEN stripes = 0 THEN balance END FROM debited"},
+    // Ordinary accounts are locked in ascending id order (ORDER BY ... FOR
+    // NO KEY UPDATE) before anything is written, which rules out
+    // sender/receiver lock-order deadlocks. A hot receiver isn't locked at
+    // all, and a hot sender only by its own debit, after the receiver.
+    // Whether the receiver is hot is decided once (`receiver`), and that one
+    // answer decides where its credit goes.
+    {transfer,
+     "WITH locked AS ("
+     "  SELECT id FROM users WHERE id IN ($1::int, $2::int) AND stripes = 0"
+     "   ORDER BY id FOR NO KEY UPDATE"
+     "), receiver AS ("
+     "  SELECT id, NULL::int AS stripe FROM locked WHERE id = $2"
+     "  UNION ALL"
+     "  SELECT id, credit_stripe(stripes) FROM users"
+     "   WHERE id = $2 AND stripes > 0 AND NOT EXISTS (SELECT 1 FROM locked WHERE id = $2)"
+     "), direct AS ("
+     "  UPDATE users SET balance = balance - $3::numeric"
+     "   WHERE id = $1 AND balance >= $3 AND EXISTS (SELECT 1 FROM receiver)"
+     "  RETURNING id, balance, stripes"
+     "), borrowed AS ("
+     "  SELECT d.id, d.balance, d.stripes FROM debit_from_stripes($1, $3) d"
+     "   WHERE NOT EXISTS (SELECT 1 FROM direct) AND EXISTS (SELECT 1 FROM receiver)"
+     "), debited AS ("
+     "  SELECT id, balance, stripes FROM direct UNION ALL SELECT id, balance, stripes FROM borrowed"
+     "), credited AS ("
+     "  UPDATE users u SET balance = u.balance + $3 FROM receiver r"
+     "   WHERE u.id = r.id AND r.stripe IS NULL AND EXISTS (SELECT 1 FROM debited)"
+     "  RETURNING u.id, u.balance"
+     "), striped AS ("
+     "  UPDATE balance_stripes s SET balance = s.balance + $3 FROM receiver r"
+     "   WHERE s.user_id = r.id AND s.stripe = r.stripe AND EXISTS (SELECT 1 FROM debited)"
+     "  RETURNING s.user_id AS id, NULL::numeric AS balance"
+     "), changed AS ("
+     "  SELECT id, CASE WHEN stripes = 0 THEN balance END AS balance FROM debited"
+     "  UNION ALL SELECT id, balance FROM credited"
+     "  UNION ALL SELECT id, balance FROM striped"
+     "), ledger AS ("
+     "  INSERT INTO transactions (user_id, amount, type)"
+     "  SELECT id, $3, CASE WHEN id = $1 THEN 'transfer_sent' ELSE 'transfer_received' END FROM changed"
+     ") "
+     "SELECT id, balance FROM changed ORDER BY id"},
+    // Pages run in (timestamp, id) order and start after the row ($4, $2).
+    // With $4 empty (a bare id) the row's timestamp is looked up; id 0 starts
+    // at the beginning. The plain timestamp bound is what prunes the months
+    // before the cursor.
+    {transactionsForUser,
+     "SELECT id, user_id, amount, type, timestamp FROM transactions"
+     " WHERE user_id = $1"
+     "  AND timestamp >= COALESCE(NULLIF($4, '')::timestamp,"
+     "   (SELECT timestamp FROM transactions WHERE id = $2 AND user_id = $1), '-infinity')"
+     "  AND (timestamp, id) > (COALESCE(NULLIF($4, '')::timestamp,"
+     "   (SELECT timestamp FROM transactions WHERE id = $2 AND user_id = $1), '-infinity'), $2)"
+     " ORDER BY timestamp, id LIMIT $3"},
+
+    // Hot-account upkeep (StripeConsolidator)
+    {stripedAccounts, "SELECT DISTINCT user_id FROM balance_stripes WHERE balance <> 0"},
+    {foldStripes, "SELECT fold_stripes($1)"},
+    {setStripes, "SELECT set_account_stripes($1, $2)"},
+};
+
+void prepareAll(pqxx::connection &conn) {
+    for (const Definition &def : catalogue) {
+        try {
+            conn.prepare(def.name, def.sql);
+        } catch (const pqxx::sql_error &e) {
+            throw pqxx::failure(std::string("failed to prepare statement '") + def.name +
+                                "': " + e.what());
+        }
+    }
+}
+
+const std::vector<Definition> &all() {
+    static const std::vector<Definition> definitions(std::begin(catalogue), std::end(catalogue));
+    return definitions;
+}
+
+} // namespace stmt
@@ -0,0 +1,140 @@
+#include "../include/storage.hpp"
+#include "../include/async_db.hpp"
+#include "../include/db.hpp"
+#include "../include/log.hpp"
+#include "../include/memory_storage.hpp"
+#include "../include/replicas.hpp"
+#include <stdexcept>
+
+namespace {
+
+std::unique_ptr<Storage> selected;
+
+} // namespace
+
+bool validBatchOperation(const BatchOperation &op) {
+    if (op.amount <= 0) return false;
+    return op.kind != BatchOperation::Kind::transfer || op.userId != op.receiverId;
+}
+
+// ---- PostgresStorage ----
+//
+// Writes mark the accounts they touch with ReplicaRouter::wrote() first, so
+// reads of those accounts stay on the primary until the replicas have the
+// change (read-your-writes).
+
+bool PostgresStorage::createUser(const std::string &name, double initialBalance) {
+    DB db;
+    return db.createUser(name, initialBalance);
+}
+
+double PostgresStorage::getBalance(int userId) {
+    DB db;
+    return db.getBalance(userId);
+}
+
+WriteResult PostgresStorage::deposit(int userId, double amount) {
+    ReplicaRouter::instance().wrote(userId);
+    DB db;
+    return db.deposit(userId, amount);
+}
+
+WriteResult PostgresStorage::withdraw(int userId, double amount) {
+    ReplicaRouter::instance().wrote(userId);
+    DB db;
+    return db.withdraw(userId, amount);
+}
+
+WriteResult PostgresStorage::transfer(int senderId, int receiverId, double amount) {
+    ReplicaRouter::instance().wrote(senderId);
+    ReplicaRouter::instance().wrote(receiverId);
+    DB db;
+    return db.transfer(senderId, receiverId, amount);
+}
+
+bool PostgresStorage::registerUser(const std::string &name, const std::string &password, double initialBalance) {
+    DB db;
+    return db.registerUser(name, password, initialBalance);
+}
+
+std::vector<Credential> PostgresStorage::credentials(const std::string &name) {
+    DB db;
+    return db.getCredentials(name);
+}
+
+void PostgresStorage::upgradePassword(int userId, const std::string &password) {
+    DB db;
+    db.setPassword(userId, password);
+}
+
+std::optional<std::vector<Transaction>> PostgresStorage::getTransactions(int userId, const HistoryCursor &after,
+                                                                         int limit) {
+    DB db;
+    return db.getTransactions(userId, after, limit);
+}
+
+std::vector<BatchResult> PostgresStorage::executeBatch(const std::vector<BatchOperation> &ops, bool atomic) {
+    ReplicaRouter &router = ReplicaRouter::instance();
+    if (router.enabled()) {
+        for (const BatchOperation &op : ops) {
+            router.wrote(op.userId);
+            if (op.kind == BatchOperation::Kind::transfer) router.wrote(op.receiverId);
+        }
+    }
+    DB db;
+    return db.executeBatch(ops, atomic);
+}
+
+// Without AsyncDB (BANK_DB_ASYNC_CONNECTIONS=0) these complete in place
+bool PostgresStorage::suspends() const {
+    return AsyncDB::instance().running();
+}
+
+void PostgresStorage::getBalanceAsync(int userId, std::function<void(double)> done) {
+    if (!suspends()) return Storage::getBalanceAsync(userId, std::move(done));
+    AsyncDB::instance().getBalance(userId, std::move(done));
+}
+
+void PostgresStorage::depositAsync(int userId, double amount, std::function<void(WriteResult)> done) {
+    if (!suspends()) return Storage::depositAsync(userId, amount, std::move(done));
+    ReplicaRouter::instance().wrote(userId);
+    AsyncDB::instance().deposit(userId, amount, std::move(done));
+}
+
+void PostgresStorage::withdrawAsync(int userId, double amount, std::function<void(WriteResult)> done) {
+    if (!suspends()) return Storage::withdrawAsync(userId, amount, std::move(done));
+    ReplicaRouter::instance().wrote(userId);
+    AsyncDB::instance().withdraw(userId, amount, std::move(done));
+}
+
+void PostgresStorage::transferAsync(int senderId, int receiverId, double amount, std::function<void(WriteResult)> done) {
+    if (!suspends()) return Storage::transferAsync(senderId, receiverId, amount, std::move(done));
+    ReplicaRouter::instance().wrote(senderId);
+    ReplicaRouter::instance().wrote(receiverId);
+    AsyncDB::instance().transfer(senderId, receiverId, amount, std::move(done));
+}
+
+void PostgresStorage::getTransactionsAsync(int userId, const HistoryCursor &after, int limit,
+                                           std::function<void(std::optional<std::vector<Transaction>>)> done) {
+    if (!suspends()) return Storage::getTransactionsAsync(userId, after, limit, std::move(done));
+    AsyncDB::instance().getTransactions(userId, after, limit, std::move(done));
+}
+
+// ---- Selection ----
+
+void initStorage(const StorageConfig &cfg) {
+    if (cfg.backend == "postgres") {
+        selected = std::make_unique<PostgresStorage>();
+    } else if (cfg.backend == "memory") {
+        auto memory = std::make_unique<MemoryStorage>();
+        if (!cfg.walDir.empty()) memory->enableDurability(cfg);
+        selected = std::move(memory);
+    } else {
+        throw std::invalid_argument("unknown storage backend '" + cfg.backend + "' (expected postgres or memory)");
+    }
+    LOG_INFO("storage_selected", {"backend", cfg.backend});
+}
+
+Storage &storage() {
+    return *selected;
+}
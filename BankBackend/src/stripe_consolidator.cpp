@@ -0,0 +1,99 @@
+#include "../include/stripe_consolidator.hpp"
+#include "../include/db_pool.hpp"
+#include "../include/log.hpp"
+#include "../include/statements.hpp"
+#include <pqxx/pqxx>
+#include <vector>
+
+StripeConsolidator &StripeConsolidator::instance() {
+    static StripeConsolidator consolidator;
+    return consolidator;
+}
+
+StripeConsolidator::~StripeConsolidator() {
+    stop();
+}
+
+void StripeConsolidator::start(const HotAccountConfig &config) {
+    if (worker.joinable()) return;
+    cfg = config;
+    flagAccounts();
+    if (cfg.consolidateInterval.count() == 0) return;
+    stopping = false;
+    worker = std::thread(&StripeConsolidator::run, this);
+    LOG_INFO("stripe_consolidator_started", {"intervalMs", cfg.consolidateInterval.count()});
+}
+
+void StripeConsolidator::stop() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    worker.join();
+}
+
+StripeConsolidator::Stats StripeConsolidator::stats() const {
+    return {folds.load(), errors.load()};
+}
+
+// Re-flagging an account that is already hot is harmless (its stripes are
+// folded in and the count set again), so this runs on every start
+void StripeConsolidator::flagAccounts() {
+    if (cfg.accounts.empty()) return;
+    ConnectionPool::Lease lease = ConnectionPool::instance().acquire();
+    if (!lease) {
+        LOG_ERROR("hot_accounts_unflagged", {"error", "no database connection"});
+        return;
+    }
+    for (int userId : cfg.accounts) {
+        try {
+            pqxx::work txn(*lease);
+            const bool found = txn.exec_prepared(stmt::setStripes, userId, cfg.stripes)[0][0].as<bool>();
+            txn.commit();
+            if (found) {
+                LOG_INFO("hot_account_flagged", {"userId", userId}, {"stripes", cfg.stripes});
+            } else {
+                LOG_WARN("user_not_found", {"userId", userId});
+            }
+        } catch (const std::exception &e) {
+            LOG_ERROR("db_error", {"op", "flagHotAccount"}, {"userId", userId}, {"error", e.what()});
+        }
+    }
+}
+
+void StripeConsolidator::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        wakeup.wait_for(lock, cfg.consolidateInterval, [this] { return stopping; });
+        if (stopping) break;
+        lock.unlock();
+        consolidate();
+        lock.lock();
+    }
+}
+
+// Each fold is its own transaction, holding the account's locks only as long
+// as it takes to move that one account's stripes
+void StripeConsolidator::consolidate() {
+    ConnectionPool::Lease lease = ConnectionPool::instance().acquire();
+    if (!lease) return;
+    try {
+        std::vector<int> accounts;
+        {
+            pqxx::read_transaction txn(*lease);
+            for (const auto &row : txn.exec_prepared(stmt::stripedAccounts)) accounts.push_back(row[0].as<int>());
+        }
+        for (int userId : accounts) {
+            pqxx::work txn(*lease);
+            txn.exec_prepared(stmt::foldStripes, userId);
+            txn.commit();
+            folds.fetch_add(1, std::memory_order_relaxed);
+        }
+    } catch (const std::exception &e) {
+        // A deadlock with a batch holding the same stripes, say; the next pass retries
+        LOG_WARN("stripe_fold_failed", {"error", e.what()});
+        errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
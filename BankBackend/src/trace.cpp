@@ -0,0 +1,415 @@
+#include "../include/trace.hpp"
+#include "../include/config.hpp"
+#include "../include/json_codec.hpp"
+#include "../include/log.hpp"
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+constexpr std::size_t kBufferSpans = 16 * 1024; // per thread, between writer passes
+constexpr auto kFlushInterval = std::chrono::milliseconds(200);
+
+struct Event {
+    const char *name;
+    const char *what;
+    std::uint64_t traceHigh;
+    std::uint64_t traceLow;
+    std::uint64_t id;
+    std::uint64_t parent;
+    Clock::time_point start;
+    Clock::time_point end;
+};
+
+// Filled by its thread, emptied by the writer. The lock is only ever
+// contended for the moment the writer swaps the events out.
+struct Buffer {
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::uint32_t thread = 0; // tid in the trace file
+    std::atomic<bool> retired{false};
+};
+
+class Tracer {
+public:
+    static Tracer &instance() {
+        static Tracer tracer;
+        return tracer;
+    }
+
+    ~Tracer() { stop(); }
+
+    void start(const TraceConfig &cfg);
+    void stop();
+    Buffer *localBuffer();
+    void push(const Event &event);
+
+    std::atomic<bool> on{false};
+    unsigned sampleOneIn = 0;
+    std::atomic<std::uint64_t> sampled{0};
+    std::atomic<std::uint64_t> written{0};
+    std::atomic<std::uint64_t> dropped{0};
+
+private:
+    void run();
+    void drain(std::vector<Event> &batch, std::vector<std::uint32_t> &threads);
+    void write(const std::vector<Event> &batch, const std::vector<std::uint32_t> &threads);
+    void open();
+    void rotate();
+    void writeAll(const std::string &text);
+
+    std::string file;
+    std::size_t fileBytes = 0;
+    unsigned files = 0;
+    int fd = -1;
+    std::size_t size = 0;     // bytes in the current file
+    bool first = true;        // no event in the current file yet
+    Clock::time_point epoch = Clock::now();
+    int pid = static_cast<int>(::getpid());
+
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::vector<std::shared_ptr<Buffer>> buffers;
+    std::uint32_t nextThread = 1;
+    std::thread writer;
+    bool stopping = false;
+};
+
+// Marks the thread's buffer retired on thread exit; the writer frees it once
+// it has been drained
+struct LocalBuffer {
+    std::shared_ptr<Buffer> buffer;
+    ~LocalBuffer() {
+        if (buffer) buffer->retired.store(true, std::memory_order_release);
+    }
+};
+
+std::uint64_t randomId() {
+    thread_local std::mt19937_64 rng(std::random_device{}() ^
+                                     std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    std::uint64_t id;
+    do {
+        id = rng();
+    } while (id == 0); // all-zero ids are invalid in traceparent
+    return id;
+}
+
+bool parseHex(std::string_view text, std::uint64_t &out) {
+    out = 0;
+    for (char c : text) {
+        unsigned digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<unsigned>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<unsigned>(c - 'a' + 10);
+        } else {
+            return false; // the spec allows lowercase only
+        }
+        out = (out << 4) | digit;
+    }
+    return true;
+}
+
+void appendHex(std::string &out, std::uint64_t v) {
+    static const char digits[] = "0123456789abcdef";
+    char buf[16];
+    for (int i = 15; i >= 0; --i, v >>= 4) buf[i] = digits[v & 0xF];
+    out.append(buf, sizeof(buf));
+}
+
+// traceparent: version "-" trace-id "-" parent-id "-" flags, all lowercase
+// hex. Later versions may append fields, which are ignored.
+bool parseTraceparent(std::string_view text, Context &ctx, std::uint8_t &flags) {
+    if (text.size() < 55 || text[2] != '-' || text[35] != '-' || text[52] != '-') return false;
+    if (text.size() > 55 && text[55] != '-') return false;
+    std::uint64_t version, flagBits;
+    if (!parseHex(text.substr(0, 2), version) || version == 0xff) return false;
+    if (version == 0 && text.size() != 55) return false;
+    if (!parseHex(text.substr(3, 16), ctx.traceHigh) || !parseHex(text.substr(19, 16), ctx.traceLow) ||
+        !parseHex(text.substr(36, 16), ctx.remoteParent) || !parseHex(text.substr(53, 2), flagBits)) {
+        return false;
+    }
+    if ((ctx.traceHigh | ctx.traceLow) == 0 || ctx.remoteParent == 0) return false;
+    flags = static_cast<std::uint8_t>(flagBits);
+    return true;
+}
+
+} // namespace
+
+void Tracer::start(const TraceConfig &cfg) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (cfg.file.empty() || writer.joinable()) return;
+    file = cfg.file;
+    fileBytes = cfg.fileBytes;
+    files = cfg.files;
+    sampleOneIn = cfg.sampleOneIn;
+    // A file left by an earlier run is rotated out of the way, not appended to
+    if (::access(file.c_str(), F_OK) == 0) {
+        rotate();
+    } else {
+        open();
+    }
+    if (fd < 0) return;
+    stopping = false;
+    writer = std::thread([this] { run(); });
+    on.store(true, std::memory_order_release);
+    LOG_INFO("tracing_started", {"file", file}, {"sampleOneIn", sampleOneIn});
+}
+
+void Tracer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!writer.joinable() || stopping) return;
+        stopping = true;
+    }
+    on.store(false, std::memory_order_release);
+    wakeup.notify_all();
+    writer.join();
+}
+
+Buffer *Tracer::localBuffer() {
+    thread_local LocalBuffer local;
+    if (!local.buffer) {
+        auto buffer = std::make_shared<Buffer>();
+        buffer->events.reserve(256);
+        std::lock_guard<std::mutex> lock(mutex);
+        buffer->thread = nextThread++;
+        buffers.push_back(buffer);
+        local.buffer = std::move(buffer);
+    }
+    return local.buffer.get();
+}
+
+void Tracer::push(const Event &event) {
+    if (!on.load(std::memory_order_acquire)) return;
+    Buffer &buffer = *localBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.events.size() >= kBufferSpans) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.events.push_back(event);
+}
+
+void Tracer::run() {
+    std::vector<Event> batch;
+    std::vector<std::uint32_t> threads; // per event in batch
+    for (;;) {
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeup.wait_for(lock, kFlushInterval, [this] { return stopping; });
+            stop = stopping;
+            drain(batch, threads);
+        }
+        write(batch, threads);
+        batch.clear();
+        threads.clear();
+        if (stop) break;
+    }
+    writeAll(first ? "]\n" : "\n]\n");
+    ::close(fd);
+    fd = -1;
+}
+
+// Caller holds `mutex`
+void Tracer::drain(std::vector<Event> &batch, std::vector<std::uint32_t> &threads) {
+    std::vector<Event> taken;
+    for (auto it = buffers.begin(); it != buffers.end();) {
+        Buffer &buffer = **it;
+        const bool retired = buffer.retired.load(std::memory_order_acquire);
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            taken.swap(buffer.events);
+        }
+        batch.insert(batch.end(), taken.begin(), taken.end());
+        threads.insert(threads.end(), taken.size(), buffer.thread);
+        taken.clear();
+        if (retired) {
+            it = buffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// Complete ("X") events of the JSON array format; timestamps in microseconds
+void Tracer::write(const std::vector<Event> &batch, const std::vector<std::uint32_t> &threads) {
+    std::string out;
+    std::string event;
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        const Event &e = batch[i];
+        event.clear();
+        event.append("{\"name\":");
+        codec::appendString(event, e.name);
+        event.append(",\"cat\":\"bank\",\"ph\":\"X\",\"ts\":");
+        codec::appendNumber(event, std::chrono::duration<double, std::micro>(e.start - epoch).count());
+        event.append(",\"dur\":");
+        codec::appendNumber(event, std::chrono::duration<double, std::micro>(e.end - e.start).count());
+        event.append(",\"pid\":").append(std::to_string(pid));
+        event.append(",\"tid\":").append(std::to_string(threads[i]));
+        event.append(",\"args\":{\"trace\":\"");
+        appendHex(event, e.traceHigh);
+        appendHex(event, e.traceLow);
+        event.append("\",\"span\":\"");
+        appendHex(event, e.id);
+        event.append("\",\"parent\":\"");
+        appendHex(event, e.parent);
+        event.push_back('"');
+        if (e.what) {
+            event.append(",\"what\":");
+            codec::appendString(event, e.what);
+        }
+        event.append("}}");
+
+        if (!first && size + out.size() + event.size() + 2 > fileBytes) {
+            writeAll(out);
+            out.clear();
+            rotate();
+        }
+        out.append(first ? "\n" : ",\n").append(event);
+        first = false;
+    }
+    writeAll(out);
+    written.fetch_add(batch.size(), std::memory_order_relaxed);
+}
+
+// Every file starts a new array, so each one opens on its own
+void Tracer::open() {
+    fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("trace_open_failed", {"file", file}, {"error", std::strerror(errno)});
+        return;
+    }
+    size = 0;
+    first = true;
+    writeAll("[");
+}
+
+// file -> file.1 -> ... -> file.<files>; the oldest is overwritten
+void Tracer::rotate() {
+    if (fd >= 0) {
+        writeAll("\n]\n");
+        ::close(fd);
+        fd = -1;
+    }
+    for (unsigned i = files; i > 1; --i) {
+        const std::string from = file + "." + std::to_string(i - 1);
+        std::rename(from.c_str(), (file + "." + std::to_string(i)).c_str());
+    }
+    if (files > 0) {
+        std::rename(file.c_str(), (file + ".1").c_str());
+    } else {
+        std::remove(file.c_str());
+    }
+    open();
+}
+
+void Tracer::writeAll(const std::string &text) {
+    if (fd < 0) return;
+    const char *p = text.data();
+    std::size_t left = text.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        p += n;
+        left -= static_cast<std::size_t>(n);
+    }
+    size += text.size();
+}
+
+void Span::open(const char *spanName, const char *spanWhat) {
+    name = spanName;
+    what = spanWhat;
+    id = randomId();
+    parent = ctx->span;
+    ctx->span = id;
+    start = Clock::now();
+}
+
+void Span::close() {
+    const auto end = Clock::now();
+    ctx->span = parent;
+    Tracer::instance().push({name, what, ctx->traceHigh, ctx->traceLow, id, parent, start, end});
+}
+
+void start(const TraceConfig &cfg) {
+    Tracer::instance().start(cfg);
+}
+
+void stop() {
+    Tracer::instance().stop();
+}
+
+bool enabled() {
+    return Tracer::instance().on.load(std::memory_order_relaxed);
+}
+
+Context begin(std::string_view traceparent) {
+    Tracer &tracer = Tracer::instance();
+    Context ctx;
+    if (!tracer.on.load(std::memory_order_relaxed)) return ctx;
+
+    std::uint8_t flags = 0;
+    ctx.propagated = !traceparent.empty() && parseTraceparent(traceparent, ctx, flags);
+    if (ctx.propagated) {
+        ctx.sampled = (flags & 0x01) != 0;
+    } else {
+        ctx = Context{};
+        ctx.traceHigh = randomId();
+        ctx.traceLow = randomId();
+    }
+    if (!ctx.sampled && tracer.sampleOneIn != 0) ctx.sampled = randomId() % tracer.sampleOneIn == 0;
+    if (!ctx.sampled && !ctx.propagated) return Context{};
+
+    ctx.root = randomId();
+    ctx.span = ctx.root;
+    if (ctx.sampled) tracer.sampled.fetch_add(1, std::memory_order_relaxed);
+    return ctx;
+}
+
+std::string header(const Context &ctx) {
+    std::string out;
+    out.reserve(55);
+    out.append("00-");
+    appendHex(out, ctx.traceHigh);
+    appendHex(out, ctx.traceLow);
+    out.push_back('-');
+    appendHex(out, ctx.root);
+    out.append(ctx.sampled ? "-01" : "-00");
+    return out;
+}
+
+void record(const Context &ctx, const char *name, Clock::time_point start, Clock::time_point end,
+            const char *what) {
+    if (!ctx.sampled) return;
+    Tracer::instance().push({name, what, ctx.traceHigh, ctx.traceLow, randomId(), ctx.span, start, end});
+}
+
+void finish(const Context &ctx, const char *route, Clock::time_point start, Clock::time_point end) {
+    if (!ctx.sampled) return;
+    Tracer::instance().push({"session", route, ctx.traceHigh, ctx.traceLow, ctx.root, ctx.remoteParent, start, end});
+}
+
+Stats stats() {
+    const Tracer &tracer = Tracer::instance();
+    return {tracer.sampled.load(std::memory_order_relaxed), tracer.written.load(std::memory_order_relaxed),
+            tracer.dropped.load(std::memory_order_relaxed)};
+}
+
+} // namespace trace
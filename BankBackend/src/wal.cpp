@@ -0,0 +1,472 @@
+#include "../include/wal.hpp"
+#include "../include/log.hpp"
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr std::size_t headerSize = 4 + 4 + 8 + 1; // length, crc, lsn, type
+constexpr std::uint32_t maxPayload = 16 << 20;    // anything larger is a damaged header
+
+const std::array<std::uint32_t, 256> crcTable = [] {
+    std::array<std::uint32_t, 256> table{};
+    for (std::uint32_t i = 0; i < 256; ++i) {
+        std::uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        table[i] = c;
+    }
+    return table;
+}();
+
+template <typename T>
+void put(std::string &out, const T &value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void putString(std::string &out, const std::string &value) {
+    put(out, static_cast<std::uint32_t>(value.size()));
+    out.append(value);
+}
+
+// Bounds-checked cursor over one record's payload
+struct Cursor {
+    const char *data;
+    std::size_t size;
+    std::size_t pos = 0;
+    bool ok = true;
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (pos + sizeof(T) > size) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string getString() {
+        const auto n = get<std::uint32_t>();
+        if (!ok || pos + n > size) {
+            ok = false;
+            return {};
+        }
+        std::string value(data + pos, n);
+        pos += n;
+        return value;
+    }
+};
+
+void encodePayload(std::string &out, const WalRecord &r) {
+    switch (r.type) {
+    case WalRecord::Type::createUser:
+        put(out, r.userId);
+        put(out, r.balance);
+        put(out, static_cast<std::uint8_t>(r.hasPassword));
+        putString(out, r.name);
+        putString(out, r.password);
+        break;
+    case WalRecord::Type::deposit:
+    case WalRecord::Type::withdraw:
+        put(out, r.userId);
+        put(out, r.txId);
+        put(out, r.amount);
+        put(out, r.balance);
+        put(out, r.micros);
+        break;
+    case WalRecord::Type::transfer:
+        put(out, r.userId);
+        put(out, r.receiverId);
+        put(out, r.txId);
+        put(out, r.receiverTxId);
+        put(out, r.amount);
+        put(out, r.balance);
+        put(out, r.receiverBalance);
+        put(out, r.micros);
+        break;
+    case WalRecord::Type::batch:
+        // u32 count, then each item as u8 type | payload
+        put(out, static_cast<std::uint32_t>(r.items.size()));
+        for (const WalRecord &item : r.items) {
+            put(out, static_cast<std::uint8_t>(item.type));
+            encodePayload(out, item);
+        }
+        break;
+    }
+}
+
+void encode(std::string &out, const WalRecord &r) {
+    const std::size_t start = out.size();
+    out.resize(start + 8); // length and crc, filled in below
+    put(out, r.lsn);
+    put(out, static_cast<std::uint8_t>(r.type));
+    encodePayload(out, r);
+
+    const auto length = static_cast<std::uint32_t>(out.size() - start - headerSize);
+    const std::uint32_t crc = crc32(out.data() + start + 8, out.size() - start - 8);
+    std::memcpy(&out[start], &length, 4);
+    std::memcpy(&out[start + 4], &crc, 4);
+}
+
+bool decodePayload(Cursor &c, WalRecord &r) {
+    switch (r.type) {
+    case WalRecord::Type::createUser:
+        r.userId = c.get<int>();
+        r.balance = c.get<double>();
+        r.hasPassword = c.get<std::uint8_t>() != 0;
+        r.name = c.getString();
+        r.password = c.getString();
+        break;
+    case WalRecord::Type::deposit:
+    case WalRecord::Type::withdraw:
+        r.userId = c.get<int>();
+        r.txId = c.get<int>();
+        r.amount = c.get<double>();
+        r.balance = c.get<double>();
+        r.micros = c.get<std::int64_t>();
+        break;
+    case WalRecord::Type::transfer:
+        r.userId = c.get<int>();
+        r.receiverId = c.get<int>();
+        r.txId = c.get<int>();
+        r.receiverTxId = c.get<int>();
+        r.amount = c.get<double>();
+        r.balance = c.get<double>();
+        r.receiverBalance = c.get<double>();
+        r.micros = c.get<std::int64_t>();
+        break;
+    case WalRecord::Type::batch: {
+        const auto count = c.get<std::uint32_t>();
+        // Each item takes at least its type byte, which bounds a damaged count
+        if (!c.ok || count > c.size - c.pos) return false;
+        r.items.clear();
+        r.items.resize(count);
+        for (WalRecord &item : r.items) {
+            item.type = static_cast<WalRecord::Type>(c.get<std::uint8_t>());
+            // Batches hold money movements only, never nested batches
+            if (item.type == WalRecord::Type::batch || item.type == WalRecord::Type::createUser) return false;
+            if (!c.ok || !decodePayload(c, item)) return false;
+            item.lsn = r.lsn;
+        }
+        break;
+    }
+    default:
+        return false;
+    }
+    return c.ok;
+}
+
+bool decode(const char *payload, std::size_t size, WalRecord &r) {
+    Cursor c{payload, size};
+    return decodePayload(c, r) && c.pos == size;
+}
+
+std::string segmentName(std::uint64_t firstLsn) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "wal-%016llx.log", static_cast<unsigned long long>(firstLsn));
+    return buf;
+}
+
+std::uint64_t segmentLsn(const std::string &path) {
+    const auto slash = path.rfind('/');
+    return std::strtoull(path.c_str() + (slash == std::string::npos ? 0 : slash + 1) + 4, nullptr, 16);
+}
+
+// Losing a write or an fsync means we can no longer tell what is on disk, and
+// the in-memory state is already ahead of it. Stop rather than acknowledge
+// operations that might not survive.
+[[noreturn]] void fail(const char *op) {
+    LOG_ERROR("wal_io_failed", {"op", op}, {"error", std::strerror(errno)});
+    logging::shutdown();
+    std::abort();
+}
+
+} // namespace
+
+std::uint32_t crc32(const char *data, std::size_t size, std::uint32_t crc) {
+    std::uint32_t c = ~crc;
+    for (std::size_t i = 0; i < size; ++i) {
+        c = crcTable[(c ^ static_cast<unsigned char>(data[i])) & 0xFF] ^ (c >> 8);
+    }
+    return ~c;
+}
+
+void syncDirectory(const std::string &dir) {
+    const int dfd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        ::fsync(dfd);
+        ::close(dfd);
+    }
+}
+
+// ---- Wal ----
+
+Wal::~Wal() {
+    close();
+}
+
+void Wal::open(const Options &options, std::uint64_t nextLsn) {
+    opts = options;
+    next = nextLsn;
+    synced = nextLsn - 1;
+    if (::mkdir(opts.dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error("cannot create WAL directory " + opts.dir + ": " + std::strerror(errno));
+    }
+    stopping = false;
+    writer = std::thread([this] { run(); });
+}
+
+void Wal::close() {
+    if (!writer.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work.notify_one();
+    writer.join();
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::uint64_t Wal::append(WalRecord &record) {
+    std::lock_guard<std::mutex> lock(mutex);
+    record.lsn = next++;
+    const bool wake = pending.empty();
+    if (wake) pendingFirst = record.lsn;
+    encode(pending, record);
+    ++recordCount;
+    if (wake) work.notify_one();
+    return record.lsn;
+}
+
+void Wal::waitDurable(std::uint64_t lsn) {
+    std::unique_lock<std::mutex> lock(mutex);
+    durable.wait(lock, [&] { return synced >= lsn; });
+}
+
+std::uint64_t Wal::nextLsn() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return next;
+}
+
+std::uint64_t Wal::durableLsn() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return synced;
+}
+
+void Wal::rotate() {
+    std::lock_guard<std::mutex> lock(mutex);
+    rotateRequested = true;
+}
+
+Wal::Stats Wal::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return {recordCount, syncCount, byteCount, synced};
+}
+
+void Wal::openSegment(std::uint64_t firstLsn) {
+    const std::string path = opts.dir + "/" + segmentName(firstLsn);
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) fail("open");
+    struct stat st {};
+    segmentSize = ::fstat(fd, &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+    syncDirectory(opts.dir);
+}
+
+// Writer thread: take everything appended so far, write it with one call and
+// sync once, then release every appender it covered
+void Wal::run() {
+    std::string batch;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        work.wait(lock, [&] { return !pending.empty() || stopping; });
+        if (pending.empty()) break;
+
+        if (opts.syncWindow.count() > 0 && !stopping) {
+            lock.unlock();
+            std::this_thread::sleep_for(opts.syncWindow);
+            lock.lock();
+        }
+        batch.swap(pending);
+        const std::uint64_t first = pendingFirst;
+        const std::uint64_t last = next - 1;
+        const bool roll = rotateRequested;
+        rotateRequested = false;
+        lock.unlock();
+
+        if (fd >= 0 && (roll || segmentSize >= opts.segmentBytes)) {
+            ::close(fd);
+            fd = -1;
+        }
+        if (fd < 0) openSegment(first);
+
+        for (std::size_t done = 0; done < batch.size();) {
+            const ssize_t n = ::write(fd, batch.data() + done, batch.size() - done);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail("write");
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        if (::fdatasync(fd) != 0) fail("fdatasync");
+        segmentSize += batch.size();
+
+        lock.lock();
+        synced = last;
+        ++syncCount;
+        byteCount += batch.size();
+        batch.clear();
+        durable.notify_all();
+    }
+}
+
+std::vector<std::string> Wal::segments(const std::string &dir) {
+    std::vector<std::string> paths;
+    DIR *d = ::opendir(dir.c_str());
+    if (!d) return paths;
+    while (dirent *e = ::readdir(d)) {
+        const std::string name = e->d_name;
+        if (name.size() == 24 && name.compare(0, 4, "wal-") == 0 && name.compare(20, 4, ".log") == 0) {
+            paths.push_back(dir + "/" + name);
+        }
+    }
+    ::closedir(d);
+    // Fixed-width hex names sort in LSN order
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+void Wal::removeSegmentsBefore(std::uint64_t lsn) {
+    const auto paths = segments(opts.dir);
+    for (std::size_t i = 0; i + 1 < paths.size(); ++i) {
+        // Segment i ends where segment i+1 begins
+        if (segmentLsn(paths[i + 1]) > lsn) break;
+        if (::unlink(paths[i].c_str()) == 0) {
+            LOG_DEBUG("wal_segment_removed", {"path", paths[i]});
+        }
+    }
+}
+
+// ---- WalReader ----
+
+WalReader::WalReader(std::string dir) : dir(std::move(dir)) {}
+
+WalReader::~WalReader() {
+    if (fd >= 0) ::close(fd);
+}
+
+// Move to the first segment after the current one
+bool WalReader::openNext() {
+    for (const std::string &candidate : Wal::segments(dir)) {
+        if (candidate <= path) continue;
+        const int next = ::open(candidate.c_str(), O_RDONLY | O_CLOEXEC);
+        if (next < 0) continue; // removed under us; try the one after
+        if (fd >= 0) ::close(fd);
+        fd = next;
+        path = candidate;
+        offset = 0;
+        buffer.clear();
+        pos = 0;
+        return true;
+    }
+    return false;
+}
+
+// Make at least `need` unread bytes available, reading more of the segment
+bool WalReader::fill(std::size_t need) {
+    if (buffer.size() - pos >= need) return true;
+    if (pos > 0) {
+        buffer.erase(0, pos);
+        offset += pos;
+        pos = 0;
+    }
+    char chunk[64 * 1024];
+    while (buffer.size() < need) {
+        const ssize_t n = ::read(fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buffer.append(chunk, static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+bool WalReader::next(WalRecord &record, std::uint64_t upTo) {
+    damaged = false;
+    for (;;) {
+        if (fd < 0 && !openNext()) return false;
+
+        if (!fill(headerSize)) {
+            // End of this segment. A later segment only appears after this
+            // one is complete, so look again before moving on.
+            const auto all = Wal::segments(dir);
+            const bool later = !all.empty() && all.back() > path;
+            if (later && fill(headerSize)) continue;
+            if (buffer.size() > pos) {
+                damaged = true; // partial header
+                return false;
+            }
+            if (!later || !openNext()) return false;
+            continue;
+        }
+
+        std::uint32_t length, crc;
+        std::uint64_t lsn;
+        std::memcpy(&length, buffer.data() + pos, 4);
+        std::memcpy(&crc, buffer.data() + pos + 4, 4);
+        std::memcpy(&lsn, buffer.data() + pos + 8, 8);
+        if (length > maxPayload) {
+            damaged = true;
+            return false;
+        }
+        if (lsn > upTo) return false;
+        if (!fill(headerSize + length)) {
+            damaged = true; // partial payload
+            return false;
+        }
+
+        const char *frame = buffer.data() + pos;
+        if (crc32(frame + 8, headerSize - 8 + length) != crc) {
+            damaged = true;
+            return false;
+        }
+        record = WalRecord{};
+        record.lsn = lsn;
+        record.type = static_cast<WalRecord::Type>(static_cast<std::uint8_t>(frame[16]));
+        if (!decode(frame + headerSize, length, record)) {
+            damaged = true;
+            return false;
+        }
+        pos += headerSize + length;
+        return true;
+    }
+}
+
+void WalReader::truncateTail() {
+    if (fd < 0) return;
+    for (const std::string &later : Wal::segments(dir)) {
+        // Damage before the last segment isn't a torn write; don't guess
+        if (later > path) throw std::runtime_error("corrupt WAL record in " + path + " followed by " + later);
+    }
+    const std::uint64_t end = offset + pos;
+    if (::truncate(path.c_str(), static_cast<off_t>(end)) != 0) {
+        throw std::runtime_error("cannot truncate " + path + ": " + std::strerror(errno));
+    }
+    LOG_WARN("wal_tail_truncated", {"path", path}, {"offset", end});
+    buffer.clear();
+    pos = 0;
+    offset = end;
+    ::lseek(fd, static_cast<off_t>(end), SEEK_SET);
+}
@@ -0,0 +1,186 @@
+// Offline bulk loader and dumper for the bank tables, built on COPY.
+//
+//   ./build/bankcopy import users|transactions <file.csv|-> [--db=URL]
+//                    [--workers=0] [--max-rejects=0] [--defer-indexes=1]
+//   ./build/bankcopy export users|transactions <file.csv|-> [--db=URL] [--user=0]
+//
+// Imports validate rows on --workers threads (0 = one per core) and load
+// everything in one transaction: nothing is committed if more than
+// --max-rejects rows are invalid or the database refuses a row. With
+// --defer-indexes the transactions table's secondary index is dropped for
+// the load and rebuilt once at the end. Exports write CSV with a header, in
+// id order, optionally only one user's rows. `-` is stdin/stdout. The
+// connection string defaults to BANK_DB_URL, as for the server. See bulk.hpp
+// for the columns.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "bulk.hpp"
+#include "config.hpp"
+#include "log.hpp"
+
+namespace
+{
+
+struct Options
+{
+    std::string command;
+    bulk::Table table = bulk::Table::users;
+    std::string path;
+    std::string db;
+    unsigned workers = 0;
+    std::size_t maxRejects = 0;
+    bool deferIndexes = true;
+    int user = 0;
+};
+
+[[noreturn]] void usage()
+{
+    std::fprintf(stderr,
+                 "usage: bankcopy import users|transactions <file|-> [--db=URL] [--workers=N]\n"
+                 "                       [--max-rejects=N] [--defer-indexes=0|1]\n"
+                 "       bankcopy export users|transactions <file|-> [--db=URL] [--user=ID]\n");
+    std::exit(EXIT_FAILURE);
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    if (argc < 4)
+        usage();
+    Options opt;
+    opt.command = argv[1];
+    if ((opt.command != "import" && opt.command != "export") || !bulk::parseTable(argv[2], opt.table))
+        usage();
+    opt.path = argv[3];
+    opt.db = loadDbConfig().connectionString;
+
+    for (int i = 4; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::invalid_argument("expected --name=value, got " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+
+        if (name == "db")
+            opt.db = value;
+        else if (name == "workers")
+            opt.workers = static_cast<unsigned>(std::stoul(value));
+        else if (name == "max-rejects")
+            opt.maxRejects = std::stoul(value);
+        else if (name == "defer-indexes")
+            opt.deferIndexes = value != "0";
+        else if (name == "user")
+            opt.user = std::stoi(value);
+        else
+            throw std::invalid_argument("unknown option --" + name);
+    }
+    return opt;
+}
+
+int runImport(pqxx::connection &conn, const Options &opt)
+{
+    std::ifstream file;
+    if (opt.path != "-")
+    {
+        file.open(opt.path, std::ios::binary);
+        if (!file)
+            throw std::runtime_error("cannot open " + opt.path);
+    }
+    std::istream &in = opt.path == "-" ? std::cin : file;
+
+    std::atomic<std::uint64_t> progress{0};
+    bulk::ImportOptions options;
+    options.workers = opt.workers;
+    options.maxRejects = opt.maxRejects;
+    options.deferIndexes = opt.deferIndexes;
+    options.progress = &progress;
+
+    // Report progress every few seconds while the load runs
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool finished = false;
+    std::thread reporter([&]
+                         {
+                             std::unique_lock<std::mutex> lock(mutex);
+                             while (!wake.wait_for(lock, std::chrono::seconds(2), [&] { return finished; }))
+                                 std::fprintf(stderr, "bankcopy: %llu rows sent\n",
+                                              static_cast<unsigned long long>(progress.load()));
+                         });
+
+    const bulk::ImportResult result = bulk::importCsv(conn, opt.table, in, options);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    wake.notify_one();
+    reporter.join();
+
+    for (const bulk::Reject &reject : result.rejects)
+        std::fprintf(stderr, "line %llu: %s\n", static_cast<unsigned long long>(reject.line), reject.reason.c_str());
+    if (result.rejected > result.rejects.size())
+        std::fprintf(stderr, "... %llu rejected rows in total\n", static_cast<unsigned long long>(result.rejected));
+
+    if (!result.committed)
+    {
+        std::fprintf(stderr, "bankcopy: nothing imported: %s\n", result.error.c_str());
+        return EXIT_FAILURE;
+    }
+    const double seconds = static_cast<double>(result.elapsed.count()) / 1000.0;
+    std::fprintf(stderr, "bankcopy: imported %llu %s rows in %.1f s (%.0f rows/s), %llu rejected\n",
+                 static_cast<unsigned long long>(result.rows), bulk::tableName(opt.table), seconds,
+                 seconds > 0 ? static_cast<double>(result.rows) / seconds : 0.0,
+                 static_cast<unsigned long long>(result.rejected));
+    return EXIT_SUCCESS;
+}
+
+int runExport(pqxx::connection &conn, const Options &opt)
+{
+    std::FILE *out = opt.path == "-" ? stdout : std::fopen(opt.path.c_str(), "wb");
+    if (!out)
+        throw std::runtime_error("cannot create " + opt.path);
+
+    bulk::Exporter exporter(conn, opt.table, opt.user);
+    std::string chunk;
+    bool more = true;
+    while (more)
+    {
+        chunk.clear();
+        more = exporter.next(chunk);
+        if (std::fwrite(chunk.data(), 1, chunk.size(), out) != chunk.size())
+            throw std::runtime_error("write failed: " + opt.path);
+    }
+    if ((out != stdout && std::fclose(out) != 0) || (out == stdout && std::fflush(out) != 0))
+        throw std::runtime_error("write failed: " + opt.path);
+    return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    logging::configure(loadLogConfig());
+    int status = EXIT_FAILURE;
+    try
+    {
+        const Options opt = parseOptions(argc, argv);
+        pqxx::connection conn(opt.db);
+        status = opt.command == "import" ? runImport(conn, opt) : runExport(conn, opt);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "bankcopy: %s\n", e.what());
+    }
+    logging::shutdown();
+    return status;
+}
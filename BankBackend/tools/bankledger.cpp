@@ -0,0 +1,144 @@
+// Migration and upkeep of the monthly partitions of the transactions table.
+//
+//   ./build/bankledger migrate [--db=URL] [--ahead=2]
+//   ./build/bankledger maintain [--db=URL] [--ahead=2] [--retain=0]
+//   ./build/bankledger status [--db=URL]
+//
+// `migrate` converts the single transactions table of schemas from before
+// partitioning, copying every row in one transaction that keeps the table
+// locked; stop the servers first, or expect their writes to wait. It does
+// nothing to a table that is already partitioned. `maintain` runs the pass
+// the server runs every BANK_LEDGER_MAINTAIN_S: create partitions up to
+// --ahead months past the current one, move rows out of the default
+// partition, and, with --retain > 0, archive the months before the last
+// --retain into the ledger_archive schema. `status` lists the partitions.
+// Defaults come from the same BANK_LEDGER_* and BANK_DB_URL variables as
+// the server's. See ledger_partitions.hpp.
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include "config.hpp"
+#include "ledger_partitions.hpp"
+#include "log.hpp"
+
+namespace
+{
+
+struct Options
+{
+    std::string command;
+    std::string db;
+    unsigned monthsAhead = 0;
+    unsigned retainMonths = 0;
+};
+
+[[noreturn]] void usage()
+{
+    std::fprintf(stderr,
+                 "usage: bankledger migrate [--db=URL] [--ahead=N]\n"
+                 "       bankledger maintain [--db=URL] [--ahead=N] [--retain=N]\n"
+                 "       bankledger status [--db=URL]\n");
+    std::exit(EXIT_FAILURE);
+}
+
+Options parseOptions(int argc, char **argv)
+{
+    if (argc < 2)
+        usage();
+    Options opt;
+    opt.command = argv[1];
+    if (opt.command != "migrate" && opt.command != "maintain" && opt.command != "status")
+        usage();
+    opt.db = loadDbConfig().connectionString;
+    const LedgerConfig ledger = loadLedgerConfig();
+    opt.monthsAhead = ledger.monthsAhead;
+    opt.retainMonths = ledger.retainMonths;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        const auto eq = arg.find('=');
+        if (arg.rfind("--", 0) != 0 || eq == std::string::npos)
+            throw std::invalid_argument("expected --name=value, got " + arg);
+        const std::string name = arg.substr(2, eq - 2);
+        const std::string value = arg.substr(eq + 1);
+
+        if (name == "db")
+            opt.db = value;
+        else if (name == "ahead")
+            opt.monthsAhead = static_cast<unsigned>(std::stoul(value));
+        else if (name == "retain")
+            opt.retainMonths = static_cast<unsigned>(std::stoul(value));
+        else
+            throw std::invalid_argument("unknown option --" + name);
+    }
+    return opt;
+}
+
+int runMigrate(pqxx::connection &conn, const Options &opt)
+{
+    const partitions::MigrateResult result = partitions::migrate(conn, opt.monthsAhead);
+    if (!result.migrated)
+    {
+        std::fprintf(stderr, "bankledger: transactions is already partitioned\n");
+        return EXIT_SUCCESS;
+    }
+    std::fprintf(stderr, "bankledger: copied %llu rows into %zu monthly partitions\n",
+                 static_cast<unsigned long long>(result.rows), result.created.size());
+    return EXIT_SUCCESS;
+}
+
+int runMaintain(pqxx::connection &conn, const Options &opt)
+{
+    const partitions::MaintainResult result = partitions::maintain(conn, opt.monthsAhead, opt.retainMonths);
+    for (const std::string &name : result.created)
+        std::fprintf(stderr, "bankledger: created %s\n", name.c_str());
+    if (result.moved > 0)
+        std::fprintf(stderr, "bankledger: moved %llu rows out of transactions_default\n",
+                     static_cast<unsigned long long>(result.moved));
+    for (const std::string &name : result.archived)
+        std::fprintf(stderr, "bankledger: archived %s into %s\n", name.c_str(), partitions::archiveSchema);
+    return EXIT_SUCCESS;
+}
+
+int runStatus(pqxx::connection &conn)
+{
+    if (!partitions::partitioned(conn))
+    {
+        std::printf("transactions is not partitioned; run bankledger migrate\n");
+        return EXIT_SUCCESS;
+    }
+    for (const partitions::Partition &p : partitions::list(conn))
+    {
+        const std::string rows = p.rows < 0 ? "?" : std::to_string(p.rows);
+        std::printf("%-40s %12s  %s\n", p.name.c_str(), rows.c_str(), p.bounds.empty() ? "archived" : p.bounds.c_str());
+    }
+    return EXIT_SUCCESS;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    logging::configure(loadLogConfig());
+    int status = EXIT_FAILURE;
+    try
+    {
+        const Options opt = parseOptions(argc, argv);
+        pqxx::connection conn(opt.db);
+        if (opt.command == "migrate")
+            status = runMigrate(conn, opt);
+        else if (opt.command == "maintain")
+            status = runMaintain(conn, opt);
+        else
+            status = runStatus(conn);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "bankledger: %s\n", e.what());
+    }
+    logging::shutdown();
+    return status;
+}